@@ -0,0 +1,80 @@
+// Runs the server as several node:cluster workers sharing one port, each owning
+// the device sockets that connect to it. The primary relays message bus traffic
+// between workers (see src/lib/server/messageBus.ts) and elects the leader that
+// handles Gmail.
+//
+//   yarn build && CLUSTER_WORKERS=4 yarn start:cluster
+import cluster from 'node:cluster';
+import http from 'node:http';
+import net from 'node:net';
+import os from 'node:os';
+import next from 'next';
+
+const PORT = Number(process.env.PORT ?? 3005);
+const WORKERS = Number(process.env.CLUSTER_WORKERS ?? os.cpus().length);
+const LEADER_TOPIC = 'leader';
+
+function runPrimary() {
+  let leaderId;
+
+  function leaderMessage() {
+    return { bus: true, topic: LEADER_TOPIC, message: { workerId: leaderId } };
+  }
+
+  function elect() {
+    leaderId = Object.values(cluster.workers).filter(w => w.isConnected())[0]?.id;
+    console.log(`Worker ${leaderId} is the leader`);
+    Object.values(cluster.workers).forEach(w => w.send(leaderMessage()));
+  }
+
+  cluster.on('message', (worker, value) => {
+    if (value?.bus !== true) return;
+    if (value.topic === LEADER_TOPIC) {
+      // A worker asking who the leader is.
+      if (leaderId == null) elect();
+      else worker.send(leaderMessage());
+      return;
+    }
+    Object.values(cluster.workers).forEach(w => w.isConnected() && w.send(value));
+  });
+
+  cluster.on('exit', (worker, code) => {
+    console.log(`Worker ${worker.id} exited with ${code}, replacing it`);
+    if (worker.id === leaderId) elect();
+    cluster.fork({ NOTIFY_CLUSTER: '1' });
+  });
+
+  for (let i = 0; i < WORKERS; i++) {
+    cluster.fork({ NOTIFY_CLUSTER: '1' });
+  }
+}
+
+async function runWorker() {
+  const app = next({ dev: false });
+  const handle = app.getRequestHandler();
+  await app.prepare();
+
+  const server = http.createServer((req, res) => handle(req, res));
+  global._notifyHttpServer = server;
+  server.listen(PORT, () => console.log(`Worker ${cluster.worker.id} listening on ${PORT}`));
+
+  // The socket server starts with the first API call this worker handles.
+  // Requests to the shared port can land on any worker, so make one through a
+  // private listener that feeds this worker's server.
+  const local = net.createServer(socket => server.emit('connection', socket));
+  local.listen(0, '127.0.0.1', () => {
+    http.get(`http://127.0.0.1:${local.address().port}/api/keepalive`, res => {
+      res.resume();
+      res.on('end', () => local.close());
+    });
+  });
+}
+
+if (cluster.isPrimary) {
+  runPrimary();
+} else {
+  runWorker().catch(err => {
+    console.error(err);
+    process.exit(1);
+  });
+}
@@ -0,0 +1,401 @@
+// Microbenchmarks for the firmware's parsing and scheduling code. Reports the
+// time, heap allocations and peak heap of each case, and fails if a case is
+// over the limits in the thresholds file given on the command line.
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arbiter.h"
+#include "cli.h"
+#include "frame.h"
+#include "gesture.h"
+#include "journal.h"
+#include "player.h"
+#include "reassembly.h"
+#include "show.h"
+#include "song.h"
+#include "timeline.h"
+#include "trace.h"
+
+#define ITERATIONS 20000
+#define WARMUP_ITERATIONS 100
+#define MAX_NAME_LEN 48
+
+struct HeapStats_t {
+  long allocs;
+  size_t current;
+  size_t peak;
+};
+
+struct BenchCase_t {
+  const char *name;
+  void (*run)(const void *arg);
+  const void *arg;
+};
+
+struct BenchResult_t {
+  double nsPerOp;
+  double allocsPerOp;
+  size_t peakBytes;
+};
+
+static struct HeapStats_t heap;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void *trackAlloc(void *ptr) {
+  if (ptr != NULL) {
+    heap.allocs++;
+    heap.current += malloc_usable_size(ptr);
+    if (heap.current > heap.peak) heap.peak = heap.current;
+  }
+  return ptr;
+}
+
+void *__wrap_malloc(size_t size) {
+  return trackAlloc(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  return trackAlloc(__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (ptr != NULL) heap.current -= malloc_usable_size(ptr);
+  return trackAlloc(__real_realloc(ptr, size));
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr != NULL) heap.current -= malloc_usable_size(ptr);
+  __real_free(ptr);
+}
+
+// Results are written here so the work can't be optimized away.
+static volatile int sink;
+
+static struct Show_t show;
+static struct Song_t song;
+static struct Reassembler_t reassembler;
+static struct Player_t player;
+static struct Journal_t journal;
+static struct TraceRing_t traceRing;
+
+static void benchShowText(const void *arg) {
+  sink = show_compile((const char *)arg, &show) + show.count;
+}
+
+static void benchSongText(const void *arg) {
+  sink = song_compile((const char *)arg, &song) + song.count;
+}
+
+struct FrameBytes_t {
+  uint8_t data[256];
+  uint32_t len;
+};
+
+static void putU16(struct FrameBytes_t *frame, uint16_t value) {
+  frame->data[frame->len++] = value & 0xff;
+  frame->data[frame->len++] = value >> 8;
+}
+
+static void putRecord(struct FrameBytes_t *frame, uint8_t type, uint8_t target, int16_t replays, const uint16_t *values,
+                      int count) {
+  int stride = type == FRAME_LED ? FRAME_LED_STEP_LEN : FRAME_BEEP_NOTE_LEN;
+  frame->data[frame->len++] = type;
+  putU16(frame, FRAME_COMMAND_HEADER_LEN + count / 2 * stride);
+  frame->data[frame->len++] = target;
+  putU16(frame, replays);
+  for (int i = 0; i < count; i += 2) {
+    if (type == FRAME_LED) {
+      frame->data[frame->len++] = values[i] >> 8;
+      frame->data[frame->len++] = values[i] & 0xff;
+      frame->data[frame->len++] = 0;
+    } else {
+      putU16(frame, values[i]);
+    }
+    putU16(frame, values[i + 1]);
+  }
+}
+
+static void benchFrame(const void *arg) {
+  const struct FrameBytes_t *frame = (const struct FrameBytes_t *)arg;
+  struct FrameReader_t reader;
+  struct FrameRecord_t record;
+  if (frame_open(&reader, frame->data, frame->len) != FRAME_OK) return;
+
+  while (frame_next(&reader, &record) == FRAME_OK) {
+    if (record.type == FRAME_LED) {
+      show_begin(&show, record.replays);
+      for (int i = 0; i < record.count; i++) {
+        uint8_t rgb[SHOW_NUM_CHANNELS];
+        uint16_t ms;
+        frame_led_step(&record, i, rgb, &ms);
+        show_add_segment(&show, rgb, ms);
+      }
+      sink = show.count;
+    } else {
+      song_begin(&song, record.target, record.replays);
+      for (int i = 0; i < record.count; i++) {
+        uint16_t freq, ms;
+        frame_beep_note(&record, i, &freq, &ms);
+        song_add_note(&song, freq, ms);
+      }
+      sink = song.count;
+    }
+  }
+}
+
+static void benchReassembly(const void *arg) {
+  static uint8_t message[REASSEMBLY_MAX_LEN];
+  uint32_t chunk = *(const uint32_t *)arg;
+  for (uint32_t offset = 0; offset < sizeof(message); offset += chunk) {
+    sink = reassembly_feed(&reassembler, 1, sizeof(message), offset, message + offset, chunk);
+  }
+}
+
+static void releaseNothing(const struct Song_t *released) {
+  sink = released->count;
+}
+
+static void benchPlayer(const void *arg) {
+  static struct Song_t playerSong;
+  static bool compiled = false;
+  if (!compiled) {
+    song_compile((const char *)arg, &playerSong);
+    player_init(&player, releaseNothing);
+    compiled = true;
+  }
+
+  uint32_t now = 0;
+  player_command(&player, PLAYER_PLAY, &playerSong, now);
+  while (player.running) {
+    now = player.segmentEnd;
+    player_update(&player, now);
+    sink = player_output(&player);
+  }
+}
+
+// Records a burst of presses while "disconnected", then sends and acknowledges
+// them in batches.
+static void benchJournal(const void *arg) {
+  uint32_t presses = *(const uint32_t *)arg;
+  struct JournalEvent_t batch[16];
+  for (uint32_t i = 0; i < presses; i++) {
+    journal_record(&journal, JOURNAL_BUTTON, 1, i);
+  }
+
+  uint32_t count;
+  while ((count = journal_next_batch(&journal, batch, 16)) > 0) {
+    journal_ack(&journal, batch[count - 1].seq);
+    sink = count;
+  }
+}
+
+struct TraceEdge_t {
+  uint32_t ms;
+  uint8_t button;
+  bool down;
+};
+
+struct GestureTrace_t {
+  const struct TraceEdge_t *edges;
+  int count;
+};
+
+// Classifies an edge trace recorded from a device, including contact bounce.
+static void benchGesture(const void *arg) {
+  const struct GestureTrace_t *trace = (const struct GestureTrace_t *)arg;
+  struct Gesture_t gesture;
+  struct GestureEvent_t event;
+  int found = 0;
+  gesture_init(&gesture, 2);
+  for (int i = 0; i < trace->count; i++) {
+    const struct TraceEdge_t *edge = &trace->edges[i];
+    while (gesture_poll(&gesture, edge->ms, &event)) {
+      found++;
+    }
+    if (gesture_edge(&gesture, edge->button, edge->down, edge->ms, &event)) found++;
+  }
+  while (gesture_poll(&gesture, trace->edges[trace->count - 1].ms + GESTURE_LONG_MS, &event)) {
+    found++;
+  }
+  sink = found;
+}
+
+// Renders the welcome show with a 10 ms tick.
+static void benchTimeline(const void *arg) {
+  static struct Timeline_t timeline;
+  struct TimelineSample_t sample;
+  timeline_init(&timeline, 10);
+  timeline_command(&timeline, (const char *)arg);
+  timeline_advance(&timeline, 1000, &sample);
+  sink = timeline.changes;
+}
+
+// Fills the trace ring, with a masked off event mixed in, then copies it out as
+// after a crash.
+static void benchTrace(const void *arg) {
+  static struct TraceRecord_t copied[TRACE_CAPACITY];
+  uint32_t records = *(const uint32_t *)arg;
+  trace_init(&traceRing, TRACE_ALL_MODULES & ~(1 << TRACE_MODULE_BUTTON));
+  for (uint32_t i = 0; i < records; i++) {
+    trace_write(&traceRing, TRACE_SPEAKER_TONE, i * 1000, i, 0, 0);
+    trace_write(&traceRing, TRACE_BUTTON_EDGE, i * 1000, 1, 1, 0);
+  }
+  sink = trace_copy(&traceRing, traceRing.boot, copied, TRACE_CAPACITY);
+}
+
+// Types a command a byte at a time, with an arrow key and a corrected typo,
+// then parses it.
+static void benchCli(const void *arg) {
+  const char *typed = (const char *)arg;
+  static struct CliEditor_t editor;
+  struct CliCommand_t command;
+  enum CliEvent_t event = CLI_NONE;
+  cli_init(&editor);
+  for (const char *ch = typed; *ch != '\0' && event != CLI_LINE; ch++) {
+    event = cli_feed(&editor, *ch);
+  }
+  sink = cli_parse(editor.line, &command) + command.argc;
+}
+
+// A reconnect animation, then an alert over it and a button blip during the
+// alert. The blip waits for the alert, and the animation resumes last.
+static void benchArbiter(const void *arg) {
+  (void)arg;
+  struct Arbiter_t arbiter;
+  arbiter_init(&arbiter);
+  sink = arbiter_start(&arbiter, ARBITER_STATUS).play;
+  sink = arbiter_start(&arbiter, ARBITER_ALERT).play;
+  sink = arbiter_start(&arbiter, ARBITER_STATUS).play;
+  sink = arbiter_start(&arbiter, ARBITER_FEEDBACK).play;
+  sink = arbiter_finish(&arbiter, ARBITER_ALERT).play;
+  sink = arbiter_finish(&arbiter, ARBITER_FEEDBACK).play;
+  sink = arbiter_finish(&arbiter, ARBITER_STATUS).play;
+}
+
+static double elapsedNs(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static struct BenchResult_t runCase(const struct BenchCase_t *bench) {
+  for (int i = 0; i < WARMUP_ITERATIONS; i++) {
+    bench->run(bench->arg);
+  }
+
+  memset(&heap, 0, sizeof(heap));
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < ITERATIONS; i++) {
+    bench->run(bench->arg);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  struct BenchResult_t result = {
+    .nsPerOp = elapsedNs(&start, &end) / ITERATIONS,
+    .allocsPerOp = (double)heap.allocs / ITERATIONS,
+    .peakBytes = heap.peak,
+  };
+  return result;
+}
+
+// Each line of the thresholds file is "<case> <max ns/op> <max allocs/op>
+// <max peak bytes>". Lines starting with # are comments.
+static bool checkThresholds(FILE *file, const char *name, const struct BenchResult_t *result) {
+  char line[160];
+  rewind(file);
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char caseName[MAX_NAME_LEN];
+    double maxNs, maxAllocs;
+    unsigned long maxPeak;
+    if (line[0] == '#' || sscanf(line, "%47s %lf %lf %lu", caseName, &maxNs, &maxAllocs, &maxPeak) != 4) continue;
+    if (strcmp(caseName, name) != 0) continue;
+
+    bool ok = true;
+    if (result->nsPerOp > maxNs) {
+      printf("  REGRESSION %s: %.0f ns/op exceeds %.0f\n", name, result->nsPerOp, maxNs);
+      ok = false;
+    }
+    if (result->allocsPerOp > maxAllocs) {
+      printf("  REGRESSION %s: %.2f allocs/op exceeds %.2f\n", name, result->allocsPerOp, maxAllocs);
+      ok = false;
+    }
+    if (result->peakBytes > maxPeak) {
+      printf("  REGRESSION %s: peak heap %zu bytes exceeds %lu\n", name, result->peakBytes, maxPeak);
+      ok = false;
+    }
+    return ok;
+  }
+  printf("  %s has no threshold\n", name);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  static const uint32_t wsChunk = 1024;
+  static const uint32_t journalPresses = JOURNAL_CAPACITY;
+  static const uint32_t traceRecords = TRACE_CAPACITY;
+  // A bouncy press, then a double press, a long press and a chord of both buttons.
+  static const struct TraceEdge_t gestureEdges[] = {
+    { 1000, 0, true }, { 1002, 0, false }, { 1004, 0, true }, { 1110, 0, false }, { 1113, 0, true }, { 1115, 0, false },
+    { 2000, 0, true }, { 2090, 0, false }, { 2250, 0, true }, { 2340, 0, false },
+    { 3000, 0, true }, { 3003, 0, false }, { 3005, 0, true }, { 4100, 0, false },
+    { 5000, 0, true }, { 5040, 1, true }, { 5400, 0, false }, { 5420, 1, false },
+  };
+  static const struct GestureTrace_t gestureTrace = { gestureEdges, sizeof(gestureEdges) / sizeof(gestureEdges[0]) };
+  static const uint16_t ledSteps[] = { 0xFF00, 1000, 0x00FF, 1000, 0x0000, 1000 };
+  static const uint16_t beepNotes[] = { 1000, 500, 0, 100, 1000, 500, 0, 100, 1000, 750, 0, 500 };
+  static struct FrameBytes_t ledFrame = { .data = { FRAME_VERSION }, .len = FRAME_HEADER_LEN };
+  static struct FrameBytes_t beepFrame = { .data = { FRAME_VERSION }, .len = FRAME_HEADER_LEN };
+  putRecord(&ledFrame, FRAME_LED, 1, 10, ledSteps, sizeof(ledSteps) / sizeof(ledSteps[0]));
+  putRecord(&beepFrame, FRAME_BEEP, 0, 3, beepNotes, sizeof(beepNotes) / sizeof(beepNotes[0]));
+
+  const struct BenchCase_t cases[] = {
+    { "show_text_connecting", benchShowText, "-1 000000 0 ff4400 1000 000000 1000" },
+    { "show_text_welcome", benchShowText, "2 000000 0 000000 200 000088 0 000088 200" },
+    { "show_text_breathing", benchShowText, "-1 000000 0 000044 3000 000000 3000" },
+    { "show_text_test", benchShowText, "10 FF0000 1000 00FF00 1000 0000FF 1000" },
+    { "song_text_test", benchSongText, "0 3 1000 500 0 100 1000 500 0 100 1000 750 0 500" },
+    { "song_text_scale", benchSongText, "1 3 262 200 294 200 330 200 349 200 392 200 440 200 494 200 523 400 0 400" },
+    { "frame_led_test", benchFrame, &ledFrame },
+    { "frame_beep_test", benchFrame, &beepFrame },
+    { "reassembly_4k", benchReassembly, &wsChunk },
+    { "player_test_song", benchPlayer, "0 3 1000 500 0 100 1000 500 0 100 1000 750 0 500" },
+    { "journal_full_drain", benchJournal, &journalPresses },
+    { "gesture_trace", benchGesture, &gestureTrace },
+    { "trace_full_ring", benchTrace, &traceRecords },
+    { "timeline_welcome", benchTimeline, "LED 1 2 000000 0 000000 200 000088 0 000088 200" },
+    { "arbiter_preempt", benchArbiter, NULL },
+    { "cli_show_line", benchCli, "shw\b\bhow\x1b[A 10 FF0000 1000 00FF00 1000 0000FF 1000\r" },
+  };
+
+  journal_init(&journal, 1);
+
+  FILE *thresholds = NULL;
+  if (argc > 1) {
+    thresholds = fopen(argv[1], "r");
+    if (thresholds == NULL) {
+      fprintf(stderr, "Can't open thresholds file %s\n", argv[1]);
+      return 2;
+    }
+  }
+
+  bool ok = true;
+  printf("%-24s %12s %12s %12s\n", "case", "ns/op", "allocs/op", "peak bytes");
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    struct BenchResult_t result = runCase(&cases[i]);
+    printf("%-24s %12.0f %12.2f %12zu\n", cases[i].name, result.nsPerOp, result.allocsPerOp, result.peakBytes);
+    if (thresholds != NULL && !checkThresholds(thresholds, cases[i].name, &result)) {
+      ok = false;
+    }
+  }
+
+  if (thresholds != NULL) fclose(thresholds);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// Replays button edges recorded from a device through the gesture classifier,
+// so timing changes can be tried against real presses without a board.
+//
+// The button task logs every edge at debug level as "EDGE <ms> <button> <DOWN|UP>".
+// Give this a captured log (or any file of those lines, other lines are skipped):
+//
+//   notify_gesture_replay monitor.log
+//
+// It prints each gesture as "<ms> <TYPE> <buttons>", buttons counted from 1.
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gesture.h"
+
+#define MAX_LINE 256
+
+static void printEvent(const struct GestureEvent_t *event) {
+  printf("%lu %s", (unsigned long)event->timeMs, gesture_type_name(event->type));
+  const char *separator = " ";
+  for (int i = 0; i < GESTURE_MAX_BUTTONS; i++) {
+    if (event->buttons & (1 << i)) {
+      printf("%s%d", separator, i + 1);
+      separator = "+";
+    }
+  }
+  printf("\n");
+}
+
+static void pollUntil(struct Gesture_t *gesture, uint32_t nowMs) {
+  struct GestureEvent_t event;
+  while (gesture_poll(gesture, nowMs, &event)) {
+    printEvent(&event);
+  }
+}
+
+int main(int argc, char **argv) {
+  FILE *file = argc > 1 ? fopen(argv[1], "r") : stdin;
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", argv[1]);
+    return 2;
+  }
+
+  struct Gesture_t gesture;
+  gesture_init(&gesture, GESTURE_MAX_BUTTONS);
+
+  char line[MAX_LINE];
+  uint32_t lastMs = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    const char *edge = strstr(line, "EDGE ");
+    unsigned long ms;
+    unsigned button;
+    char direction[8];
+    if (edge == NULL || sscanf(edge, "EDGE %lu %u %7s", &ms, &button, direction) != 3 || button < 1) continue;
+
+    // Whatever the device would have polled for between edges.
+    pollUntil(&gesture, ms);
+    struct GestureEvent_t event;
+    if (gesture_edge(&gesture, button - 1, strcmp(direction, "DOWN") == 0, ms, &event)) {
+      printEvent(&event);
+    }
+    lastMs = ms;
+  }
+  pollUntil(&gesture, lastMs + GESTURE_LONG_MS + GESTURE_DOUBLE_GAP_MS);
+
+  if (file != stdin) fclose(file);
+  return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// A minimal harness for the host unit tests. Each suite is a function that
+// runs its cases with RUN_TEST. A failed check prints where it was and the
+// values involved, then ends that case; the other cases still run.
+
+extern int testFailures;
+extern const char *testDataDir;  // firmware/host/corpus
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+      return; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    long long actualValue = (long long)(actual); \
+    long long expectedValue = (long long)(expected); \
+    if (actualValue != expectedValue) { \
+      printf("  %s:%d: %s is %lld, expected %s (%lld)\n", __FILE__, __LINE__, #actual, actualValue, #expected, \
+             expectedValue); \
+      testFailures++; \
+      return; \
+    } \
+  } while (0)
+
+#define RUN_TEST(test) \
+  do { \
+    int failuresBefore = testFailures; \
+    test(); \
+    printf("%s %s\n", testFailures == failuresBefore ? "PASS" : "FAIL", #test); \
+  } while (0)
+
+void suite_arbiter();
+void suite_backoff();
+void suite_cli();
+void suite_delta();
+void suite_frame();
+void suite_gesture();
+void suite_journal();
+void suite_player();
+void suite_powerlock();
+void suite_reassembly();
+void suite_stats();
+void suite_timeline();
+void suite_trace();
+
+#endif
@@ -0,0 +1,85 @@
+// Starts and finishes layers in the orders the LED and speaker tasks see them,
+// checking which layer pauses and which plays after each change.
+#include <string.h>
+
+#include "arbiter.h"
+#include "test.h"
+
+#define CHECK_CHANGE(change, expectPause, expectPlay) \
+  do { \
+    struct ArbiterChange_t changed = (change); \
+    CHECK_EQ(changed.pause, expectPause); \
+    CHECK_EQ(changed.play, expectPlay); \
+  } while (0)
+
+// A reconnect animation, then an alert over it and a button blip during the
+// alert. The blip waits for the alert, and the animation resumes last.
+static void test_preempt() {
+  struct Arbiter_t arbiter;
+  arbiter_init(&arbiter);
+  CHECK_EQ(arbiter_top(&arbiter), ARBITER_NONE);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_STATUS), ARBITER_NONE, ARBITER_STATUS);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_ALERT), ARBITER_STATUS, ARBITER_ALERT);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_STATUS), ARBITER_NONE, ARBITER_NONE);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_FEEDBACK), ARBITER_NONE, ARBITER_NONE);
+  CHECK_EQ(arbiter_top(&arbiter), ARBITER_ALERT);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_ALERT), ARBITER_NONE, ARBITER_FEEDBACK);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_FEEDBACK), ARBITER_NONE, ARBITER_STATUS);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_STATUS), ARBITER_NONE, ARBITER_NONE);
+  CHECK_EQ(arbiter_top(&arbiter), ARBITER_NONE);
+  CHECK_EQ(arbiter.active, 0);
+}
+
+// A new show on the playing layer replaces it in place. Finishing a layer
+// that doesn't own the output changes nothing that is playing.
+static void test_replace_and_finish_below() {
+  struct Arbiter_t arbiter;
+  arbiter_init(&arbiter);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_FEEDBACK), ARBITER_NONE, ARBITER_FEEDBACK);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_FEEDBACK), ARBITER_NONE, ARBITER_FEEDBACK);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_STATUS), ARBITER_NONE, ARBITER_NONE);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_STATUS), ARBITER_NONE, ARBITER_NONE);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_ALERT), ARBITER_NONE, ARBITER_NONE);
+  CHECK_EQ(arbiter_top(&arbiter), ARBITER_FEEDBACK);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_FEEDBACK), ARBITER_NONE, ARBITER_NONE);
+  CHECK_EQ(arbiter_top(&arbiter), ARBITER_NONE);
+}
+
+static void test_bad_layer() {
+  struct Arbiter_t arbiter;
+  arbiter_init(&arbiter);
+  CHECK_CHANGE(arbiter_start(&arbiter, ARBITER_LAYER_COUNT), ARBITER_NONE, ARBITER_NONE);
+  CHECK_CHANGE(arbiter_finish(&arbiter, ARBITER_LAYER_COUNT), ARBITER_NONE, ARBITER_NONE);
+  CHECK_EQ(arbiter.active, 0);
+  CHECK(strcmp(arbiter_layer_name(ARBITER_LAYER_COUNT), "unknown") == 0);
+  CHECK(strcmp(arbiter_layer_name(ARBITER_ALERT), "unknown") != 0);
+}
+
+static void test_split_tag() {
+  char command[16];
+  enum ArbiterLayer_t layer = ARBITER_ALERT;
+
+  strcpy(command, "LED@0");
+  CHECK(arbiter_split_tag(command, &layer));
+  CHECK(strcmp(command, "LED") == 0);
+  CHECK_EQ(layer, ARBITER_STATUS);
+
+  strcpy(command, "BEEP");
+  CHECK(arbiter_split_tag(command, &layer));
+  CHECK(strcmp(command, "BEEP") == 0);
+  CHECK_EQ(layer, ARBITER_STATUS);
+
+  const char *bad[] = { "LED@", "LED@3", "LED@1x", "LED@-1", "LED@@1" };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    strcpy(command, bad[i]);
+    CHECK(!arbiter_split_tag(command, &layer));
+    CHECK_EQ(layer, ARBITER_STATUS);
+  }
+}
+
+void suite_arbiter() {
+  RUN_TEST(test_preempt);
+  RUN_TEST(test_replace_and_finish_below);
+  RUN_TEST(test_bad_layer);
+  RUN_TEST(test_split_tag);
+}
@@ -0,0 +1,93 @@
+// Runs reconnect delays through a series of failed attempts, checking each one
+// lands in its jitter window and that the windows double up to the cap.
+#include <stdbool.h>
+
+#include "backoff.h"
+#include "test.h"
+
+#define BASE_MS 1000
+#define CAP_MS 60000
+
+static struct Backoff_t backoff;
+
+// Each delay is between half and all of its ceiling.
+#define CHECK_WINDOW(delayMs, ceilingMs) \
+  do { \
+    uint32_t windowDelay = (delayMs); \
+    CHECK(windowDelay >= (ceilingMs) - (ceilingMs) / 2); \
+    CHECK(windowDelay <= (ceilingMs)); \
+  } while (0)
+
+static void test_growth() {
+  const uint32_t ceilings[] = { 1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000, 60000 };
+  backoff_init(&backoff, BASE_MS, CAP_MS, 12345);
+  for (size_t i = 0; i < sizeof(ceilings) / sizeof(ceilings[0]); i++) {
+    CHECK_WINDOW(backoff_next_ms(&backoff), ceilings[i]);
+  }
+
+  // Failures long after reaching the cap stay there.
+  for (int i = 0; i < 1000; i++) {
+    CHECK_WINDOW(backoff_next_ms(&backoff), CAP_MS);
+  }
+}
+
+// Over many seeds the delays stay in the window and use both ends of it, so
+// devices that lost the server together don't return together.
+static void test_jitter() {
+  uint32_t lowest = UINT32_MAX;
+  uint32_t highest = 0;
+  for (uint32_t seed = 1; seed <= 1000; seed++) {
+    backoff_init(&backoff, BASE_MS, CAP_MS, seed * 2654435761u);
+    uint32_t delay = backoff_next_ms(&backoff);
+    CHECK_WINDOW(delay, BASE_MS);
+    if (delay < lowest) lowest = delay;
+    if (delay > highest) highest = delay;
+  }
+  CHECK(lowest < BASE_MS / 2 + BASE_MS / 20);
+  CHECK(highest > BASE_MS - BASE_MS / 20);
+}
+
+static void test_reset() {
+  backoff_init(&backoff, BASE_MS, CAP_MS, 7);
+  for (int i = 0; i < 10; i++) {
+    backoff_next_ms(&backoff);
+  }
+  backoff_reset(&backoff);
+  CHECK_WINDOW(backoff_next_ms(&backoff), 1000);
+  CHECK_WINDOW(backoff_next_ms(&backoff), 2000);
+}
+
+// A zero seed would leave xorshift stuck at 0 and every delay at the bottom of
+// its window.
+static void test_zero_seed() {
+  backoff_init(&backoff, BASE_MS, CAP_MS, 0);
+  CHECK(backoff.random != 0);
+  uint32_t first = backoff_next_ms(&backoff);
+  CHECK_WINDOW(first, BASE_MS);
+  bool varied = false;
+  for (int i = 0; i < 10; i++) {
+    backoff_reset(&backoff);
+    varied |= backoff_next_ms(&backoff) != first;
+  }
+  CHECK(varied);
+  CHECK(backoff.random != 0);
+}
+
+// A zero base or a cap below it still gives sane delays.
+static void test_bad_limits() {
+  backoff_init(&backoff, 0, 0, 1);
+  CHECK_WINDOW(backoff_next_ms(&backoff), 1);
+  CHECK_WINDOW(backoff_next_ms(&backoff), 1);
+
+  backoff_init(&backoff, BASE_MS, BASE_MS / 2, 1);
+  CHECK_WINDOW(backoff_next_ms(&backoff), BASE_MS);
+  CHECK_WINDOW(backoff_next_ms(&backoff), BASE_MS);
+}
+
+void suite_backoff() {
+  RUN_TEST(test_growth);
+  RUN_TEST(test_jitter);
+  RUN_TEST(test_reset);
+  RUN_TEST(test_zero_seed);
+  RUN_TEST(test_bad_limits);
+}
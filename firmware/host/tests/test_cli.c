@@ -0,0 +1,138 @@
+// Types into the console's line editor a byte at a time, and parses the lines
+// it gives back.
+#include <string.h>
+
+#include "cli.h"
+#include "test.h"
+
+static struct CliEditor_t editor;
+static char echoed[256];
+
+// Feeds typed until something other than CLI_NONE happens, collecting the echo.
+// Returns that event and leaves *typed past the byte that caused it.
+static enum CliEvent_t type(const char **typed) {
+  size_t echoedLen = 0;
+  enum CliEvent_t event = CLI_NONE;
+  while (**typed != '\0' && event == CLI_NONE) {
+    event = cli_feed(&editor, *(*typed)++);
+    if (echoedLen + editor.echoLen < sizeof(echoed)) {
+      memcpy(echoed + echoedLen, editor.echo, editor.echoLen);
+      echoedLen += editor.echoLen;
+    }
+  }
+  echoed[echoedLen] = '\0';
+  return event;
+}
+
+static void test_editing() {
+  cli_init(&editor);
+  const char *typed = "shw\b\bhow\x1b[A 10 FF0000 1000 00FF00 1000 0000FF 1000\r\n";
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "show 10 FF0000 1000 00FF00 1000 0000FF 1000") == 0);
+  CHECK(strncmp(echoed, "shw\b \b\b \bhow 10", 15) == 0);
+  // The LF of CR LF doesn't end a second line.
+  CHECK_EQ(type(&typed), CLI_NONE);
+
+  typed = "\b\x7f";
+  CHECK_EQ(type(&typed), CLI_NONE);
+  CHECK_EQ(strlen(echoed), 0);
+
+  typed = "ota\n\n";
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "ota") == 0);
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "") == 0);
+}
+
+static void test_secret() {
+  cli_init(&editor);
+  cli_set_secret(&editor, true);
+  const char *typed = "hunter2\r";
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "hunter2") == 0);
+  CHECK(strcmp(echoed, "*******\n") == 0);
+}
+
+static void test_long_line() {
+  cli_init(&editor);
+  for (int i = 0; i < CLI_LINE_LEN + 10; i++) {
+    CHECK_EQ(cli_feed(&editor, 'a'), CLI_NONE);
+    CHECK(i < CLI_LINE_LEN - 1 || (editor.echoLen == 1 && editor.echo[0] == '\a'));
+  }
+  CHECK_EQ(cli_feed(&editor, '\r'), CLI_LINE);
+  CHECK_EQ(strlen(editor.line), CLI_LINE_LEN - 1);
+}
+
+// Arrow keys are skipped. An ESC on its own, or before something that isn't a
+// sequence, cancels the line.
+static void test_escape() {
+  cli_init(&editor);
+  const char *typed = "co\x1b[1;5Cn\x1bOBfig\r";
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "config") == 0);
+
+  typed = "setup\x1b";
+  CHECK_EQ(type(&typed), CLI_NONE);
+  CHECK_EQ(cli_idle(&editor), CLI_CANCEL);
+  CHECK_EQ(editor.len, 0);
+  CHECK_EQ(cli_idle(&editor), CLI_NONE);
+
+  typed = "setup\x1bx";
+  CHECK_EQ(type(&typed), CLI_CANCEL);
+  typed = "boot\r";
+  CHECK_EQ(type(&typed), CLI_LINE);
+  CHECK(strcmp(editor.line, "boot") == 0);
+}
+
+static enum CliResult_t parse(const char *text, struct CliCommand_t *command) {
+  static char line[CLI_LINE_LEN];
+  snprintf(line, sizeof(line), "%s", text);
+  return cli_parse(line, command);
+}
+
+static void test_parse() {
+  struct CliCommand_t command;
+  CHECK_EQ(parse("show 10 FF0000 1000 00FF00 1000 0000FF 1000", &command), CLI_OK);
+  CHECK_EQ(command.id, CLI_CMD_SHOW);
+  CHECK_EQ(command.argc, 7);
+  CHECK(strcmp(command.rest, "10 FF0000 1000 00FF00 1000 0000FF 1000") == 0);
+  CHECK(strncmp(command.argv[1], "FF0000 ", 7) == 0);
+
+  CHECK_EQ(parse("  trace   1f  ", &command), CLI_OK);
+  CHECK_EQ(command.id, CLI_CMD_TRACE);
+  CHECK_EQ(command.argc, 1);
+  CHECK(strncmp(command.argv[0], "1f", 2) == 0);
+
+  // Arguments past CLI_MAX_ARGS are counted but only reachable through rest.
+  CHECK_EQ(parse("beep 0 1 1000 100 2000 100 3000 100 4000 100", &command), CLI_OK);
+  CHECK_EQ(command.argc, 10);
+  CHECK(strcmp(command.argv[CLI_MAX_ARGS - 1], "100 4000 100") == 0);
+
+  CHECK_EQ(parse("", &command), CLI_EMPTY);
+  CHECK_EQ(parse("   ", &command), CLI_EMPTY);
+  CHECK_EQ(parse("bogus", &command), CLI_UNKNOWN);
+  CHECK_EQ(parse("SHOW", &command), CLI_UNKNOWN);
+  CHECK_EQ(parse("trace", &command), CLI_BAD_ARGS);
+  CHECK_EQ(parse("trace 1 2", &command), CLI_BAD_ARGS);
+  CHECK_EQ(parse("help me", &command), CLI_BAD_ARGS);
+  CHECK_EQ(parse("restart", &command), CLI_OK);
+  CHECK_EQ(command.argc, 0);
+}
+
+static void test_command_info() {
+  for (int id = 0; id < CLI_CMD_COUNT; id++) {
+    const struct CliCommandInfo_t *info = cli_command_info(id);
+    CHECK(info != NULL && info->name != NULL && info->usage != NULL);
+    CHECK(strncmp(info->usage, info->name, strlen(info->name)) == 0);
+  }
+  CHECK(cli_command_info(CLI_CMD_COUNT) == NULL);
+}
+
+void suite_cli() {
+  RUN_TEST(test_editing);
+  RUN_TEST(test_secret);
+  RUN_TEST(test_long_line);
+  RUN_TEST(test_escape);
+  RUN_TEST(test_parse);
+  RUN_TEST(test_command_info);
+}
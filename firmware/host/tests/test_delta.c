@@ -0,0 +1,205 @@
+// Applies NDL1 deltas built here against a made up running image, fed whole
+// and split at every byte, and checks malformed deltas are refused.
+#include <stdbool.h>
+#include <string.h>
+
+#include "delta.h"
+#include "test.h"
+
+#define SOURCE_LEN 1500
+#define MAX_DELTA_LEN 2048
+#define MAX_TARGET_LEN 2048
+
+static uint8_t source[SOURCE_LEN];
+static uint8_t target[MAX_TARGET_LEN];
+static uint32_t targetLen;
+
+static uint8_t delta[MAX_DELTA_LEN];
+static uint32_t deltaLen;
+static uint8_t expected[MAX_TARGET_LEN];
+static uint32_t expectedLen;
+
+static struct DeltaPatch_t patch;
+
+static bool readSource(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len) {
+  (void)ctx;
+  if (offset > SOURCE_LEN || len > SOURCE_LEN - offset) return false;
+  memcpy(buf, source + offset, len);
+  return true;
+}
+
+static bool writeTarget(void *ctx, const uint8_t *data, uint32_t len) {
+  (void)ctx;
+  if (len > MAX_TARGET_LEN - targetLen) return false;
+  memcpy(target + targetLen, data, len);
+  targetLen += len;
+  return true;
+}
+
+static void begin() {
+  for (int i = 0; i < SOURCE_LEN; i++) {
+    source[i] = (uint8_t)(i * 7 + i / 256);
+  }
+  targetLen = 0;
+  delta_begin(&patch, SOURCE_LEN, readSource, writeTarget, NULL);
+}
+
+static void putByte(uint8_t byte) {
+  delta[deltaLen++] = byte;
+}
+
+static void putU32(uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    putByte((uint8_t)(value >> (8 * i)));
+  }
+}
+
+// Starts a delta producing imageLen bytes. The ops after it build expected.
+static void writeHeader(uint32_t imageLen) {
+  expectedLen = 0;
+  memcpy(delta, DELTA_MAGIC, DELTA_MAGIC_LEN);
+  deltaLen = DELTA_MAGIC_LEN;
+  putU32(imageLen);
+}
+
+static void writeCopy(uint32_t offset, uint32_t len) {
+  putByte(DELTA_OP_COPY);
+  putU32(offset);
+  putU32(len);
+  if (offset <= SOURCE_LEN && len <= SOURCE_LEN - offset) {
+    memcpy(expected + expectedLen, source + offset, len);
+    expectedLen += len;
+  }
+}
+
+static void writeData(const char *text) {
+  uint32_t len = strlen(text);
+  putByte(DELTA_OP_DATA);
+  putU32(len);
+  memcpy(delta + deltaLen, text, len);
+  deltaLen += len;
+  memcpy(expected + expectedLen, text, len);
+  expectedLen += len;
+}
+
+// Copies longer than a chunk, new bytes between them and an empty DATA.
+static void writeSample() {
+  begin();
+  writeHeader(1200 + 23 + 10);
+  writeCopy(100, 1200);
+  writeData("new bytes in the middle");
+  writeData("");
+  writeCopy(SOURCE_LEN - 10, 10);
+}
+
+static void test_copy_and_data() {
+  writeSample();
+  CHECK_EQ(expectedLen, 1233);
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_DONE);
+  CHECK_EQ(targetLen, expectedLen);
+  CHECK(memcmp(target, expected, expectedLen) == 0);
+
+  // An image with nothing in it is done at the end of the header.
+  begin();
+  writeHeader(0);
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_DONE);
+  CHECK_EQ(targetLen, 0);
+}
+
+// However the delta is cut up, the image comes out the same and only the last
+// piece finishes it.
+static void test_split_feeds() {
+  writeSample();
+  for (uint32_t cut = 0; cut <= deltaLen; cut++) {
+    begin();
+    enum DeltaResult_t first = delta_feed(&patch, delta, cut);
+    enum DeltaResult_t second = delta_feed(&patch, delta + cut, deltaLen - cut);
+    if (cut == deltaLen) {
+      CHECK_EQ(first, DELTA_DONE);
+      CHECK_EQ(second, DELTA_DONE);
+    } else {
+      CHECK_EQ(first, DELTA_OK);
+      CHECK_EQ(second, DELTA_DONE);
+    }
+    CHECK_EQ(targetLen, expectedLen);
+    CHECK(memcmp(target, expected, expectedLen) == 0);
+  }
+
+  begin();
+  for (uint32_t i = 0; i < deltaLen - 1; i++) {
+    CHECK_EQ(delta_feed(&patch, delta + i, 1), DELTA_OK);
+  }
+  CHECK_EQ(delta_feed(&patch, delta + deltaLen - 1, 1), DELTA_DONE);
+  CHECK(memcmp(target, expected, expectedLen) == 0);
+}
+
+static void test_copy_out_of_range() {
+  const uint32_t copies[][2] = {
+    { SOURCE_LEN - 10, 11 },
+    { SOURCE_LEN + 1, 0 },
+    { 10, UINT32_MAX },
+    { UINT32_MAX, 2 },
+  };
+  for (size_t i = 0; i < sizeof(copies) / sizeof(copies[0]); i++) {
+    begin();
+    writeHeader(100);
+    writeCopy(copies[i][0], copies[i][1]);
+    CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_RANGE);
+    CHECK_EQ(targetLen, 0);
+  }
+
+  // Operations may not make more image than the header said.
+  begin();
+  writeHeader(10);
+  writeCopy(0, 11);
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_RANGE);
+  begin();
+  writeHeader(10);
+  writeData("eleven long");
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_RANGE);
+  CHECK_EQ(targetLen, 0);
+}
+
+// Nothing may follow the operation that completes the image, whether it
+// arrives with that operation or after it.
+static void test_trailing_bytes() {
+  writeSample();
+  putByte(DELTA_OP_DATA);
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_OP);
+
+  writeSample();
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_DONE);
+  const uint8_t extra = 0;
+  CHECK_EQ(delta_feed(&patch, &extra, 1), DELTA_ERR_OP);
+  // Feeding nothing more is harmless.
+  CHECK_EQ(delta_feed(&patch, NULL, 0), DELTA_DONE);
+}
+
+static void test_bad_delta() {
+  writeSample();
+  delta[3] = '2';
+  CHECK(!delta_is_patch(delta, deltaLen));
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_MAGIC);
+  CHECK_EQ(targetLen, 0);
+  CHECK(!delta_is_patch(delta, DELTA_MAGIC_LEN - 1));
+
+  writeSample();
+  CHECK(delta_is_patch(delta, deltaLen));
+  delta[DELTA_HEADER_LEN] = 3;
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_OP);
+
+  // A failed read of the running image stops the update.
+  begin();
+  patch.sourceLen = SOURCE_LEN + 200;
+  writeHeader(100);
+  writeCopy(SOURCE_LEN, 100);
+  CHECK_EQ(delta_feed(&patch, delta, deltaLen), DELTA_ERR_IO);
+}
+
+void suite_delta() {
+  RUN_TEST(test_copy_and_data);
+  RUN_TEST(test_split_feeds);
+  RUN_TEST(test_copy_out_of_range);
+  RUN_TEST(test_trailing_bytes);
+  RUN_TEST(test_bad_delta);
+}
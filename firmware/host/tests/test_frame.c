@@ -0,0 +1,278 @@
+// Decodes frames produced by src/lib/server/commandFrame.ts (corpus/frames.txt)
+// and checks that every field and step matches the command they were encoded
+// from. Damaged copies of the same frames must be rejected.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "show.h"
+#include "test.h"
+
+#define MAX_FRAME_LEN 1024
+#define MAX_LINE_LEN 4096
+#define MAX_CORPUS_FRAMES 32
+
+struct CorpusFrame_t {
+  int line;
+  int priority;
+  uint8_t data[MAX_FRAME_LEN];
+  uint32_t len;
+  char command[MAX_LINE_LEN];
+};
+
+static struct CorpusFrame_t corpus[MAX_CORPUS_FRAMES];
+static int corpusCount = 0;
+
+static int priorityNamed(const char *name) {
+  if (strcmp(name, "status") == 0) return 0;
+  if (strcmp(name, "feedback") == 0) return 1;
+  if (strcmp(name, "alert") == 0) return 2;
+  return FRAME_NO_PRIORITY;
+}
+
+static bool parseHex(const char *hex, uint8_t *out, uint32_t *len) {
+  size_t chars = strlen(hex);
+  if (chars % 2 != 0 || chars / 2 > MAX_FRAME_LEN) return false;
+  for (size_t i = 0; i < chars; i += 2) {
+    char byte[3] = { hex[i], hex[i + 1], '\0' };
+    char *end;
+    out[i / 2] = (uint8_t)strtoul(byte, &end, 16);
+    if (*end != '\0') return false;
+  }
+  *len = (uint32_t)(chars / 2);
+  return true;
+}
+
+// Lines are "<priority or -> <hex frame> <command>".
+static bool loadCorpus() {
+  if (corpusCount > 0) return true;
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/frames.txt", testDataDir);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    printf("  Can't open %s\n", path);
+    return false;
+  }
+
+  static char line[MAX_LINE_LEN];
+  int lineNumber = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    lineNumber++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#') continue;
+
+    char *priority = strtok(line, " ");
+    char *hex = strtok(NULL, " ");
+    char *command = strtok(NULL, "");
+    if (hex == NULL || command == NULL || corpusCount == MAX_CORPUS_FRAMES) {
+      ok = false;
+      break;
+    }
+    struct CorpusFrame_t *frame = &corpus[corpusCount];
+    frame->line = lineNumber;
+    frame->priority = priorityNamed(priority);
+    snprintf(frame->command, sizeof(frame->command), "%s", command);
+    ok = parseHex(hex, frame->data, &frame->len);
+    if (ok) corpusCount++;
+  }
+  fclose(file);
+  if (!ok) printf("  %s:%d is malformed\n", path, lineNumber);
+  return ok;
+}
+
+// Checks a frame carries exactly the one command its corpus line describes.
+static void checkFrame(const struct CorpusFrame_t *frame) {
+  char command[MAX_LINE_LEN];
+  snprintf(command, sizeof(command), "%s", frame->command);
+  char *word = strtok(command, " ");
+  CHECK(word != NULL);
+  bool isLed = strcmp(word, "LED") == 0;
+  CHECK(isLed || strcmp(word, "BEEP") == 0);
+  long target = strtol(strtok(NULL, " "), NULL, 10);
+  long replays = strtol(strtok(NULL, " "), NULL, 10);
+
+  struct FrameReader_t reader;
+  struct FrameRecord_t record;
+  CHECK_EQ(frame_open(&reader, frame->data, frame->len), FRAME_OK);
+  CHECK_EQ(frame_next(&reader, &record), FRAME_OK);
+  CHECK_EQ(record.type, isLed ? FRAME_LED : FRAME_BEEP);
+  CHECK_EQ(record.target, target);
+  CHECK_EQ(record.replays, replays);
+  CHECK_EQ(record.priority, frame->priority);
+
+  int idx = 0;
+  for (char *first = strtok(NULL, " "); first != NULL; first = strtok(NULL, " "), idx++) {
+    char *second = strtok(NULL, " ");
+    CHECK(second != NULL);
+    CHECK(idx < record.count);
+    uint16_t ms;
+    if (isLed) {
+      uint8_t rgb[3];
+      frame_led_step(&record, idx, rgb, &ms);
+      long color = strtol(first, NULL, 16);
+      CHECK_EQ(rgb[0], (color >> 16) & 0xff);
+      CHECK_EQ(rgb[1], (color >> 8) & 0xff);
+      CHECK_EQ(rgb[2], color & 0xff);
+    } else {
+      uint16_t freq;
+      frame_beep_note(&record, idx, &freq, &ms);
+      CHECK_EQ(freq, strtol(first, NULL, 10));
+    }
+    CHECK_EQ(ms, strtol(second, NULL, 10));
+  }
+  CHECK_EQ(record.count, idx);
+  CHECK_EQ(frame_next(&reader, &record), FRAME_END);
+}
+
+static void test_corpus_decodes() {
+  CHECK(loadCorpus());
+  CHECK(corpusCount > 0);
+  for (int i = 0; i < corpusCount; i++) {
+    int failuresBefore = testFailures;
+    checkFrame(&corpus[i]);
+    if (testFailures != failuresBefore) printf("  frames.txt:%d: %s\n", corpus[i].line, corpus[i].command);
+  }
+}
+
+// Returns the offset of the first LED or BEEP record in a corpus frame.
+static uint32_t commandOffset(const struct CorpusFrame_t *frame) {
+  uint32_t offset = FRAME_HEADER_LEN;
+  if (frame->data[offset] == FRAME_PRIORITY) offset += FRAME_RECORD_HEADER_LEN + FRAME_PRIORITY_LEN;
+  return offset;
+}
+
+// The result of opening a frame and reading up to its first command.
+static enum FrameResult_t firstCommand(const uint8_t *data, uint32_t len) {
+  struct FrameReader_t reader;
+  struct FrameRecord_t record;
+  enum FrameResult_t result = frame_open(&reader, data, len);
+  return result == FRAME_OK ? frame_next(&reader, &record) : result;
+}
+
+// A cut anywhere inside a record must be rejected. Cuts between records leave
+// a valid frame with nothing to do.
+static void test_truncated_frames_rejected() {
+  CHECK(loadCorpus());
+  for (int i = 0; i < corpusCount; i++) {
+    uint32_t offset = commandOffset(&corpus[i]);
+    for (uint32_t cut = 0; cut < corpus[i].len; cut++) {
+      enum FrameResult_t result = firstCommand(corpus[i].data, cut);
+      if (cut == FRAME_HEADER_LEN || cut == offset) {
+        CHECK_EQ(result, FRAME_END);
+      } else {
+        CHECK_EQ(result, FRAME_ERR_TRUNCATED);
+      }
+    }
+  }
+}
+
+static void test_bad_tlv_rejected() {
+  CHECK(loadCorpus());
+  static uint8_t data[MAX_FRAME_LEN + 1];
+  for (int i = 0; i < corpusCount; i++) {
+    const struct CorpusFrame_t *frame = &corpus[i];
+    uint32_t offset = commandOffset(frame);
+    uint16_t length = frame->data[offset + 1] | (frame->data[offset + 2] << 8);
+    int stride = frame->data[offset] == FRAME_LED ? FRAME_LED_STEP_LEN : FRAME_BEEP_NOTE_LEN;
+
+    memcpy(data, frame->data, frame->len);
+    data[0] = FRAME_VERSION + 1;
+    struct FrameReader_t reader;
+    CHECK_EQ(frame_open(&reader, data, frame->len), FRAME_ERR_VERSION);
+
+    // Declaring one byte more than the frame holds.
+    memcpy(data, frame->data, frame->len);
+    data[offset + 1] = (uint8_t)(length + 1);
+    data[offset + 2] = (uint8_t)((length + 1) >> 8);
+    CHECK_EQ(firstCommand(data, frame->len), FRAME_ERR_TRUNCATED);
+
+    // A value that ends partway through a step.
+    data[frame->len] = 0;
+    CHECK_EQ(firstCommand(data, frame->len + 1), FRAME_ERR_LENGTH);
+
+    // A value too short for the command header.
+    memcpy(data, frame->data, frame->len);
+    data[offset + 1] = FRAME_COMMAND_HEADER_LEN - 1;
+    data[offset + 2] = 0;
+    CHECK_EQ(firstCommand(data, offset + FRAME_RECORD_HEADER_LEN + FRAME_COMMAND_HEADER_LEN - 1), FRAME_ERR_LENGTH);
+
+    // Dropping the last step leaves a well formed, shorter command.
+    memcpy(data, frame->data, frame->len);
+    data[offset + 1] = (uint8_t)(length - stride);
+    data[offset + 2] = (uint8_t)((length - stride) >> 8);
+    CHECK_EQ(firstCommand(data, frame->len - stride), FRAME_OK);
+  }
+
+  // A priority layer must be exactly one byte.
+  const uint8_t widePriority[] = { FRAME_VERSION, FRAME_PRIORITY, 2, 0, 1, 0 };
+  CHECK_EQ(firstCommand(widePriority, sizeof(widePriority)), FRAME_ERR_LENGTH);
+}
+
+static void test_oversized_rejected() {
+  CHECK(loadCorpus());
+
+  // A record declaring far more than any websocket message carries.
+  const uint8_t huge[] = { FRAME_VERSION, FRAME_LED, 0xff, 0xff, 1, 1, 0 };
+  CHECK_EQ(firstCommand(huge, sizeof(huge)), FRAME_ERR_TRUNCATED);
+
+  // Shows the LED task would build from the corpus: those with more steps than
+  // a show holds must be refused, the rest must fit.
+  bool sawOverflow = false;
+  for (int i = 0; i < corpusCount; i++) {
+    struct FrameReader_t reader;
+    struct FrameRecord_t record;
+    CHECK_EQ(frame_open(&reader, corpus[i].data, corpus[i].len), FRAME_OK);
+    CHECK_EQ(frame_next(&reader, &record), FRAME_OK);
+    if (record.type != FRAME_LED) continue;
+
+    static struct Show_t show;
+    show_begin(&show, record.replays);
+    enum ShowResult_t result = SHOW_OK;
+    for (int s = 0; s < record.count && result == SHOW_OK; s++) {
+      uint8_t rgb[3];
+      uint16_t ms;
+      frame_led_step(&record, s, rgb, &ms);
+      result = show_add_segment(&show, rgb, ms);
+    }
+    if (result == SHOW_OK) result = show_end(&show);
+    if (record.count > SHOW_MAX_STEPS) {
+      CHECK_EQ(result, SHOW_ERR_OVERFLOW);
+      sawOverflow = true;
+    } else {
+      CHECK_EQ(result, SHOW_OK);
+    }
+  }
+  CHECK(sawOverflow);
+}
+
+// Steps of 0 ms are fine once through, but a show repeating them would keep
+// the LED task busy without ever waiting.
+static void test_idle_show_rejected() {
+  static struct Show_t show;
+  const uint8_t red[SHOW_NUM_CHANNELS] = { 0xff, 0, 0 };
+  const int replays[] = { -1, 0, 2 };
+  for (size_t i = 0; i < sizeof(replays) / sizeof(replays[0]); i++) {
+    show_begin(&show, replays[i]);
+    CHECK_EQ(show_end(&show), SHOW_ERR_SYNTAX);
+    CHECK_EQ(show_add_segment(&show, red, 0), SHOW_OK);
+    CHECK_EQ(show_add_segment(&show, red, 0), SHOW_OK);
+    CHECK_EQ(show_end(&show), SHOW_ERR_SYNTAX);
+    CHECK_EQ(show_add_segment(&show, red, 1), SHOW_OK);
+    CHECK_EQ(show_end(&show), SHOW_OK);
+  }
+
+  show_begin(&show, 1);
+  CHECK_EQ(show_add_segment(&show, red, 0), SHOW_OK);
+  CHECK_EQ(show_end(&show), SHOW_OK);
+}
+
+void suite_frame() {
+  RUN_TEST(test_corpus_decodes);
+  RUN_TEST(test_truncated_frames_rejected);
+  RUN_TEST(test_bad_tlv_rejected);
+  RUN_TEST(test_oversized_rejected);
+  RUN_TEST(test_idle_show_rejected);
+}
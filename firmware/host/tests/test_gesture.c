@@ -0,0 +1,127 @@
+// Plays button edge traces through the gesture classifier, polling at the
+// deadlines it asks for as the button task does, and checks every gesture.
+#include "gesture.h"
+#include "test.h"
+
+#define MAX_EDGES 12
+#define MAX_EVENTS 4
+
+struct Edge_t {
+  uint32_t ms;
+  uint8_t button;
+  bool down;
+};
+
+struct GestureTrace_t {
+  const char *name;
+  bool polled;  // false to only feed edges, as if the task never woke in between
+  struct Edge_t edges[MAX_EDGES];
+  int edgeCount;
+  struct GestureEvent_t expected[MAX_EVENTS];
+  int expectedCount;
+};
+
+static const struct GestureTrace_t traces[] = {
+  { "bouncy press", true,
+    { { 1000, 0, true }, { 1002, 0, false }, { 1004, 0, true }, { 1110, 0, false }, { 1113, 0, true },
+      { 1115, 0, false } }, 6,
+    { { GESTURE_PRESS, 1, 1110 } }, 1 },
+  { "double press", true,
+    { { 2000, 0, true }, { 2090, 0, false }, { 2250, 0, true }, { 2340, 0, false } }, 4,
+    { { GESTURE_DOUBLE, 1, 2340 } }, 1 },
+  { "long press", true,
+    { { 3000, 0, true }, { 3003, 0, false }, { 3005, 0, true }, { 4100, 0, false } }, 4,
+    { { GESTURE_LONG, 1, 3800 } }, 1 },
+  { "long second press", true,
+    { { 3000, 0, true }, { 3100, 0, false }, { 3200, 0, true }, { 4500, 0, false } }, 4,
+    { { GESTURE_LONG, 1, 4000 } }, 1 },
+  { "chord", true,
+    { { 5000, 0, true }, { 5040, 1, true }, { 5400, 0, false }, { 5420, 1, false } }, 4,
+    { { GESTURE_CHORD, 3, 5420 } }, 1 },
+  { "second button", true,
+    { { 7000, 1, true }, { 7100, 1, false } }, 2,
+    { { GESTURE_PRESS, 2, 7100 } }, 1 },
+  { "presses on each button", true,
+    { { 8000, 0, true }, { 8050, 0, false }, { 8100, 1, true }, { 8150, 1, false } }, 4,
+    { { GESTURE_PRESS, 1, 8050 }, { GESTURE_PRESS, 2, 8150 } }, 2 },
+  { "slow presses", true,
+    { { 9000, 0, true }, { 9100, 0, false }, { 9500, 0, true }, { 9600, 0, false } }, 4,
+    { { GESTURE_PRESS, 1, 9100 }, { GESTURE_PRESS, 1, 9600 } }, 2 },
+  { "slow presses, not polled", false,
+    { { 9000, 0, true }, { 9100, 0, false }, { 9500, 0, true }, { 9600, 0, false } }, 4,
+    { { GESTURE_PRESS, 1, 9100 }, { GESTURE_PRESS, 1, 9600 } }, 2 },
+  { "long press, not polled", false,
+    { { 3000, 0, true }, { 4000, 0, false } }, 2,
+    { { GESTURE_LONG, 1, 3000 } }, 1 },
+  { "button out of range", true,
+    { { 1000, 5, true }, { 1100, 5, false } }, 2,
+    { { 0, 0, 0 } }, 0 },
+};
+
+static bool pollUntil(struct Gesture_t *gesture, uint32_t *now, uint32_t until, struct GestureEvent_t *event) {
+  uint32_t wait = gesture_next_deadline_ms(gesture, *now);
+  if (wait == GESTURE_NO_DEADLINE || *now + wait > until) return false;
+  *now += wait;
+  return gesture_poll(gesture, *now, event);
+}
+
+static void runTrace(const struct GestureTrace_t *trace) {
+  struct Gesture_t gesture;
+  struct GestureEvent_t events[MAX_EVENTS + 1];
+  int found = 0;
+  uint32_t now = 0;
+  gesture_init(&gesture, 2);
+
+  for (int i = 0; i <= trace->edgeCount; i++) {
+    uint32_t until = i < trace->edgeCount ? trace->edges[i].ms : UINT32_MAX - 1;
+    while (trace->polled && found <= MAX_EVENTS && pollUntil(&gesture, &now, until, &events[found])) {
+      found++;
+    }
+    if (i == trace->edgeCount) break;
+
+    const struct Edge_t *edge = &trace->edges[i];
+    now = edge->ms;
+    if (found <= MAX_EVENTS && gesture_edge(&gesture, edge->button, edge->down, edge->ms, &events[found])) found++;
+  }
+  if (!trace->polled && found <= MAX_EVENTS && gesture_poll(&gesture, now + GESTURE_LONG_MS, &events[found])) {
+    found++;
+  }
+
+  CHECK_EQ(found, trace->expectedCount);
+  for (int i = 0; i < found; i++) {
+    CHECK_EQ(events[i].type, trace->expected[i].type);
+    CHECK_EQ(events[i].buttons, trace->expected[i].buttons);
+    CHECK_EQ(events[i].timeMs, trace->expected[i].timeMs);
+  }
+  CHECK_EQ(gesture_next_deadline_ms(&gesture, now), GESTURE_NO_DEADLINE);
+}
+
+static void test_traces() {
+  for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+    int failuresBefore = testFailures;
+    runTrace(&traces[i]);
+    if (testFailures != failuresBefore) printf("  in trace \"%s\"\n", traces[i].name);
+  }
+}
+
+// A single press can't be reported until the double press gap has passed.
+static void test_deadlines() {
+  struct Gesture_t gesture;
+  struct GestureEvent_t event;
+  gesture_init(&gesture, 1);
+  CHECK_EQ(gesture_next_deadline_ms(&gesture, 0), GESTURE_NO_DEADLINE);
+  CHECK(!gesture_edge(&gesture, 0, true, 1000, &event));
+  CHECK_EQ(gesture_next_deadline_ms(&gesture, 1000), GESTURE_LONG_MS);
+  CHECK(!gesture_edge(&gesture, 0, false, 1100, &event));
+  CHECK_EQ(gesture_next_deadline_ms(&gesture, 1200), GESTURE_DOUBLE_GAP_MS - 100);
+  CHECK(!gesture_poll(&gesture, 1100 + GESTURE_DOUBLE_GAP_MS - 1, &event));
+  CHECK_EQ(gesture_next_deadline_ms(&gesture, 2000), 0);
+  CHECK(gesture_poll(&gesture, 2000, &event));
+  CHECK_EQ(event.type, GESTURE_PRESS);
+  CHECK(!gesture_poll(&gesture, 2000, &event));
+}
+
+void suite_gesture() {
+  RUN_TEST(test_traces);
+  RUN_TEST(test_deadlines);
+}
@@ -0,0 +1,132 @@
+// Records, sends and acknowledges journal events the way uplink.c does.
+#include "journal.h"
+#include "test.h"
+
+#define BATCH 16
+
+static struct Journal_t journal;
+
+static void test_full_drain() {
+  journal_init(&journal, 1);
+  for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++) {
+    CHECK(journal_record(&journal, JOURNAL_BUTTON, 1, i));
+  }
+  CHECK(!journal_record(&journal, JOURNAL_BUTTON, 1, JOURNAL_CAPACITY));
+  CHECK_EQ(journal.dropped, 1);
+
+  struct JournalEvent_t batch[BATCH];
+  uint32_t expected = 0;
+  uint32_t count;
+  while ((count = journal_next_batch(&journal, batch, BATCH)) > 0) {
+    for (uint32_t i = 0; i < count; i++) {
+      CHECK_EQ(batch[i].seq, expected);
+      CHECK_EQ(batch[i].timeMs, expected);
+      expected++;
+    }
+    journal_ack(&journal, batch[count - 1].seq);
+  }
+  CHECK_EQ(expected, JOURNAL_CAPACITY);
+  CHECK_EQ(journal_unacked(&journal), 0);
+  CHECK(journal_record(&journal, JOURNAL_BUTTON, 1, 0));
+}
+
+// Sequence numbers keep counting as the ring wraps many times.
+static void test_wraps() {
+  journal_init(&journal, 1);
+  struct JournalEvent_t batch[BATCH];
+  uint32_t expected = 0;
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 13; i++) {
+      CHECK(journal_record(&journal, JOURNAL_BUTTON_LONG, 2, 0));
+    }
+    uint32_t count;
+    while ((count = journal_next_batch(&journal, batch, BATCH)) > 0) {
+      for (uint32_t i = 0; i < count; i++) {
+        CHECK_EQ(batch[i].seq, expected++);
+        CHECK_EQ(batch[i].type, JOURNAL_BUTTON_LONG);
+      }
+      journal_ack(&journal, batch[count - 1].seq);
+    }
+  }
+  CHECK_EQ(expected, 20 * 13);
+  CHECK_EQ(journal_unacked(&journal), 0);
+}
+
+// Unacknowledged events go again after a rewind, and acknowledgements for
+// events that were never recorded are ignored.
+static void test_rewind_and_ack() {
+  journal_init(&journal, 1);
+  struct JournalEvent_t batch[BATCH];
+  for (uint32_t i = 0; i < 10; i++) {
+    CHECK(journal_record(&journal, JOURNAL_BUTTON, 1, i));
+  }
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 10);
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 0);
+
+  journal_ack(&journal, 3);
+  CHECK_EQ(journal_unacked(&journal), 6);
+  journal_ack(&journal, 50);
+  CHECK_EQ(journal_unacked(&journal), 6);
+
+  journal_rewind(&journal);
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 6);
+  CHECK_EQ(batch[0].seq, 4);
+  CHECK_EQ(batch[5].seq, 9);
+}
+
+// Events that didn't fit in a message go back for the next one.
+static void test_unsend() {
+  journal_init(&journal, 1);
+  struct JournalEvent_t batch[BATCH];
+  for (uint32_t i = 0; i < 20; i++) {
+    CHECK(journal_record(&journal, JOURNAL_BUTTON, 1, i));
+  }
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), BATCH);
+  journal_unsend(&journal, batch[10].seq);
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 10);
+  CHECK_EQ(batch[0].seq, 10);
+  CHECK_EQ(batch[9].seq, 19);
+
+  // Nothing outside what has been taken moves the send position.
+  journal_ack(&journal, 4);
+  journal_unsend(&journal, 2);
+  journal_unsend(&journal, 20);
+  journal_unsend(&journal, 25);
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 0);
+}
+
+// A journal that survives a restart starts a new boot and resends what wasn't
+// acknowledged. One that doesn't look intact isn't resumed.
+static void test_resume() {
+  journal_init(&journal, 7);
+  struct JournalEvent_t batch[BATCH];
+  for (uint32_t i = 0; i < 5; i++) {
+    CHECK(journal_record(&journal, JOURNAL_OTA, 0, i));
+  }
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 5);
+  journal_ack(&journal, 1);
+
+  CHECK(journal_resume(&journal));
+  CHECK_EQ(journal.id, 7);
+  CHECK_EQ(journal.boot, 1);
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 3);
+  CHECK_EQ(batch[0].seq, 2);
+  CHECK_EQ(batch[0].boot, 0);
+  CHECK(journal_record(&journal, JOURNAL_RECONNECT, 0, 0));
+  CHECK_EQ(journal_next_batch(&journal, batch, BATCH), 1);
+  CHECK_EQ(batch[0].boot, 1);
+
+  journal.magic = 0;
+  CHECK(!journal_resume(&journal));
+  journal_init(&journal, 7);
+  journal.head = journal.acked + JOURNAL_CAPACITY + 1;
+  CHECK(!journal_resume(&journal));
+}
+
+void suite_journal() {
+  RUN_TEST(test_full_drain);
+  RUN_TEST(test_wraps);
+  RUN_TEST(test_rewind_and_ack);
+  RUN_TEST(test_unsend);
+  RUN_TEST(test_resume);
+}
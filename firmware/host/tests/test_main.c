@@ -0,0 +1,49 @@
+// Host unit tests for the firmware's plain C modules. Each suite is a separate
+// ctest test:
+//
+//   notify_tests <suite> [corpus dir]
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+int testFailures = 0;
+const char *testDataDir = ".";
+
+struct Suite_t {
+  const char *name;
+  void (*run)();
+};
+
+static const struct Suite_t suites[] = {
+  { "arbiter", suite_arbiter },
+  { "backoff", suite_backoff },
+  { "cli", suite_cli },
+  { "delta", suite_delta },
+  { "frame", suite_frame },
+  { "gesture", suite_gesture },
+  { "journal", suite_journal },
+  { "player", suite_player },
+  { "powerlock", suite_powerlock },
+  { "reassembly", suite_reassembly },
+  { "stats", suite_stats },
+  { "timeline", suite_timeline },
+  { "trace", suite_trace },
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <suite> [corpus dir]\n", argv[0]);
+    return 2;
+  }
+  if (argc > 2) testDataDir = argv[2];
+
+  for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+    if (strcmp(suites[i].name, argv[1]) != 0) continue;
+    suites[i].run();
+    printf("%s: %d failed\n", argv[1], testFailures);
+    return testFailures == 0 ? 0 : 1;
+  }
+  fprintf(stderr, "No suite %s\n", argv[1]);
+  return 2;
+}
@@ -0,0 +1,191 @@
+// Drives the audio task's player through PLAY, STOP and MIX, checking the tone
+// at each moment and that every song is handed back exactly once.
+#include "player.h"
+#include "song.h"
+#include "test.h"
+
+#define MAX_RELEASED 8
+
+static struct Player_t player;
+static const struct Song_t *released[MAX_RELEASED];
+static int releasedCount;
+
+static void recordRelease(const struct Song_t *song) {
+  if (releasedCount < MAX_RELEASED) released[releasedCount] = song;
+  releasedCount++;
+}
+
+static void reset() {
+  releasedCount = 0;
+  player_init(&player, recordRelease);
+}
+
+// The tone at now, after letting the player catch up.
+static uint16_t toneAt(uint32_t now) {
+  player_update(&player, now);
+  return player_output(&player);
+}
+
+static void test_play() {
+  static struct Song_t song;
+  CHECK_EQ(song_compile("0 2 1000 100 0 50", &song), SONG_OK);
+  reset();
+  CHECK_EQ(toneAt(0), 0);
+
+  player_command(&player, PLAYER_PLAY, &song, 1000);
+  CHECK(player.running);
+  CHECK_EQ(toneAt(1000), 1000);
+  CHECK_EQ(toneAt(1099), 1000);
+  CHECK_EQ(toneAt(1100), 0);
+  CHECK_EQ(toneAt(1150), 1000);
+  CHECK_EQ(toneAt(1299), 0);
+  CHECK(player.running);
+  CHECK_EQ(releasedCount, 0);
+  CHECK_EQ(toneAt(1300), 0);
+  CHECK(!player.running);
+  CHECK_EQ(releasedCount, 1);
+  CHECK(released[0] == &song);
+}
+
+// A late update chains from where each segment was due to end, so the song
+// keeps its length.
+static void test_late_update() {
+  static struct Song_t song;
+  CHECK_EQ(song_compile("0 -1 1000 100 2000 100", &song), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &song, 0);
+  CHECK_EQ(toneAt(1050), 1000);
+  CHECK_EQ(player.segmentEnd, 1100);
+  CHECK_EQ(toneAt(1150), 2000);
+  // A song played forever is still going.
+  CHECK_EQ(toneAt(100000), 1000);
+  CHECK_EQ(releasedCount, 0);
+}
+
+static void test_play_replaces() {
+  static struct Song_t first;
+  static struct Song_t second;
+  CHECK_EQ(song_compile("0 1 1000 500", &first), SONG_OK);
+  CHECK_EQ(song_compile("0 1 2000 100", &second), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &first, 0);
+  player_command(&player, PLAYER_PLAY, &second, 200);
+  CHECK_EQ(releasedCount, 1);
+  CHECK(released[0] == &first);
+  CHECK_EQ(toneAt(250), 2000);
+  CHECK_EQ(toneAt(300), 0);
+  CHECK_EQ(releasedCount, 2);
+}
+
+static void test_stop() {
+  static struct Song_t main;
+  static struct Song_t mix;
+  CHECK_EQ(song_compile("0 -1 1000 500", &main), SONG_OK);
+  CHECK_EQ(song_compile("0 1 3000 100", &mix), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &main, 0);
+  player_command(&player, PLAYER_MIX, &mix, 100);
+  player_command(&player, PLAYER_STOP, NULL, 150);
+  CHECK(!player.running);
+  CHECK_EQ(toneAt(150), 0);
+  CHECK_EQ(releasedCount, 2);
+
+  // Stopping with nothing playing is harmless.
+  player_command(&player, PLAYER_STOP, NULL, 200);
+  CHECK_EQ(releasedCount, 2);
+}
+
+// A mix plays over the main song, which then finishes the segment it was in.
+static void test_mix() {
+  static struct Song_t main;
+  static struct Song_t mix;
+  CHECK_EQ(song_compile("0 1 1000 500 2000 500", &main), SONG_OK);
+  CHECK_EQ(song_compile("0 1 3000 100 0 50", &mix), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &main, 0);
+  CHECK_EQ(toneAt(200), 1000);
+
+  player_command(&player, PLAYER_MIX, &mix, 200);
+  CHECK_EQ(player.main.leftMs, 300);
+  CHECK_EQ(toneAt(200), 3000);
+  CHECK_EQ(toneAt(300), 0);
+  CHECK_EQ(releasedCount, 0);
+  CHECK_EQ(toneAt(350), 1000);
+  CHECK_EQ(releasedCount, 1);
+  CHECK(released[0] == &mix);
+  CHECK_EQ(toneAt(649), 1000);
+  CHECK_EQ(toneAt(650), 2000);
+  CHECK_EQ(toneAt(1150), 0);
+  CHECK(!player.running);
+  CHECK_EQ(releasedCount, 2);
+}
+
+// A second mix replaces the first, and the main song still resumes where it
+// was paused.
+static void test_mix_over_mix() {
+  static struct Song_t main;
+  static struct Song_t first;
+  static struct Song_t second;
+  CHECK_EQ(song_compile("0 1 1000 500", &main), SONG_OK);
+  CHECK_EQ(song_compile("0 1 3000 100", &first), SONG_OK);
+  CHECK_EQ(song_compile("0 1 4000 100", &second), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &main, 0);
+  player_command(&player, PLAYER_MIX, &first, 100);
+  player_command(&player, PLAYER_MIX, &second, 150);
+  CHECK_EQ(releasedCount, 1);
+  CHECK(released[0] == &first);
+  CHECK_EQ(player.main.leftMs, 400);
+  CHECK_EQ(toneAt(200), 4000);
+  CHECK_EQ(toneAt(250), 1000);
+  CHECK_EQ(toneAt(649), 1000);
+  CHECK_EQ(toneAt(650), 0);
+  CHECK_EQ(releasedCount, 3);
+}
+
+// A mix with nothing under it plays on its own.
+static void test_mix_alone() {
+  static struct Song_t mix;
+  CHECK_EQ(song_compile("0 1 3000 100", &mix), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_MIX, &mix, 0);
+  CHECK_EQ(toneAt(50), 3000);
+  CHECK_EQ(toneAt(100), 0);
+  CHECK(!player.running);
+  CHECK_EQ(releasedCount, 1);
+}
+
+// Songs for another speaker, and empty songs, are handed straight back.
+static void test_unplayable() {
+  static struct Song_t other;
+  static struct Song_t empty;
+  static struct Song_t main;
+  CHECK_EQ(song_compile("1 1 1000 100", &other), SONG_OK);
+  song_begin(&empty, 0, 1);
+  CHECK_EQ(song_compile("0 1 1000 100", &main), SONG_OK);
+  reset();
+  player_command(&player, PLAYER_PLAY, &main, 0);
+  player_command(&player, PLAYER_PLAY, &other, 10);
+  CHECK_EQ(releasedCount, 1);
+  CHECK(released[0] == &other);
+  CHECK_EQ(toneAt(20), 1000);
+
+  player_command(&player, PLAYER_MIX, &empty, 20);
+  CHECK_EQ(releasedCount, 2);
+  CHECK_EQ(toneAt(30), 1000);
+
+  player_command(&player, PLAYER_PLAY, &empty, 40);
+  CHECK(!player.running);
+  CHECK_EQ(releasedCount, 4);
+}
+
+void suite_player() {
+  RUN_TEST(test_play);
+  RUN_TEST(test_late_update);
+  RUN_TEST(test_play_replaces);
+  RUN_TEST(test_stop);
+  RUN_TEST(test_mix);
+  RUN_TEST(test_mix_over_mix);
+  RUN_TEST(test_mix_alone);
+  RUN_TEST(test_unplayable);
+}
@@ -0,0 +1,146 @@
+// Simulates the LED and speaker tasks starting and stopping output, taking and
+// releasing the power lock the way led.c and speaker.c do, and checks the lock
+// is held exactly while some output is active.
+#include "player.h"
+#include "powerlock.h"
+#include "show.h"
+#include "song.h"
+#include "test.h"
+
+#define SIM_END_MS 6000
+
+static void test_hold_release() {
+  struct PowerLock_t lock;
+  powerlock_init(&lock);
+
+  CHECK(powerlock_hold(&lock, POWER_LED, 100));
+  CHECK(!powerlock_hold(&lock, POWER_LED, 150));
+  CHECK(!powerlock_hold(&lock, POWER_SPEAKER, 200));
+  CHECK_EQ(lock.wakes, 1);
+  CHECK(!powerlock_release(&lock, POWER_LED, 300));
+  CHECK_EQ(powerlock_awake_ms(&lock, 350), 250);
+  CHECK(powerlock_release(&lock, POWER_SPEAKER, 400));
+  CHECK(!powerlock_release(&lock, POWER_SPEAKER, 450));
+  CHECK_EQ(lock.holders, 0);
+  CHECK_EQ(powerlock_awake_ms(&lock, 1000), 300);
+
+  CHECK(powerlock_hold(&lock, POWER_OTA, 2000));
+  CHECK_EQ(lock.wakes, 2);
+  CHECK_EQ(powerlock_awake_ms(&lock, 2500), 800);
+}
+
+static void releaseNothing(const struct Song_t *song) {
+  (void)song;
+}
+
+// The two output tasks, stepped one millisecond at a time.
+struct Simulation_t {
+  struct PowerLock_t lock;
+  struct ShowCursor_t cursor;
+  bool ledActive;
+  uint32_t stepEnd;
+  struct Player_t player;
+};
+
+static void startShow(struct Simulation_t *sim, const struct Show_t *show, uint32_t now) {
+  show_cursor_start(&sim->cursor, show);
+  sim->ledActive = true;
+  sim->stepEnd = now;
+}
+
+static void runLed(struct Simulation_t *sim, uint32_t now) {
+  while (sim->ledActive && now >= sim->stepEnd) {
+    const struct ShowStep_t *step = show_cursor_next(&sim->cursor);
+    if (step == NULL) {
+      sim->ledActive = false;
+      powerlock_release(&sim->lock, POWER_LED, now);
+      break;
+    }
+    powerlock_hold(&sim->lock, POWER_LED, now);
+    sim->stepEnd += step->ms;
+  }
+}
+
+static void runSpeaker(struct Simulation_t *sim, uint32_t now) {
+  player_update(&sim->player, now);
+  if (sim->player.running) {
+    powerlock_hold(&sim->lock, POWER_SPEAKER, now);
+  } else {
+    powerlock_release(&sim->lock, POWER_SPEAKER, now);
+  }
+}
+
+static void test_lock_follows_output() {
+  static struct Show_t show;
+  const uint8_t red[SHOW_NUM_CHANNELS] = { 255, 0, 0 };
+  const uint8_t off[SHOW_NUM_CHANNELS] = { 0, 0, 0 };
+  show_begin(&show, 2);
+  CHECK_EQ(show_add_segment(&show, red, 200), SHOW_OK);
+  CHECK_EQ(show_add_segment(&show, off, 200), SHOW_OK);
+
+  static struct Song_t beeps;
+  static struct Song_t chirp;
+  static struct Song_t forever;
+  CHECK_EQ(song_compile("0 2 1000 200 0 100", &beeps), SONG_OK);
+  CHECK_EQ(song_compile("0 1 2000 50", &chirp), SONG_OK);
+  CHECK_EQ(song_compile("0 -1 1500 100 0 100", &forever), SONG_OK);
+
+  static struct Simulation_t sim;
+  powerlock_init(&sim.lock);
+  sim.ledActive = false;
+  player_init(&sim.player, releaseNothing);
+
+  uint32_t outputStarts = 0;
+  uint32_t busyPeriods = 0;
+  uint64_t busyMs = 0;
+  bool wasBusy = false;
+  for (uint32_t now = 0; now < SIM_END_MS; now++) {
+    switch (now) {
+    case 100:  // a show, with a song overlapping its end
+    case 3000:  // the same show on its own
+      startShow(&sim, &show, now);
+      outputStarts++;
+      break;
+    case 700:
+      player_command(&sim.player, PLAYER_PLAY, &beeps, now);
+      outputStarts++;
+      break;
+    case 2000:  // a song that only ends when stopped, with a chirp over it
+      player_command(&sim.player, PLAYER_PLAY, &forever, now);
+      outputStarts++;
+      break;
+    case 2150:
+      player_command(&sim.player, PLAYER_MIX, &chirp, now);
+      break;
+    case 2600:
+      player_command(&sim.player, PLAYER_STOP, NULL, now);
+      break;
+    case 4500:  // a song too short to overlap anything
+      player_command(&sim.player, PLAYER_PLAY, &chirp, now);
+      outputStarts++;
+      break;
+    }
+    runLed(&sim, now);
+    runSpeaker(&sim, now);
+
+    bool busy = sim.ledActive || sim.player.running;
+    CHECK_EQ((sim.lock.holders & (1 << POWER_LED)) != 0, sim.ledActive);
+    CHECK_EQ((sim.lock.holders & (1 << POWER_SPEAKER)) != 0, sim.player.running);
+    CHECK_EQ(sim.lock.holders != 0, busy);
+    if (busy && !wasBusy) busyPeriods++;
+    if (busy) busyMs++;
+    wasBusy = busy;
+  }
+
+  CHECK(!wasBusy);
+  CHECK_EQ(busyPeriods, 4);
+  // Overlapping output shares a wake, so there are never more than one per start.
+  CHECK_EQ(sim.lock.wakes, busyPeriods);
+  CHECK(sim.lock.wakes <= outputStarts);
+  CHECK_EQ(powerlock_awake_ms(&sim.lock, SIM_END_MS), busyMs);
+}
+
+void suite_powerlock() {
+  RUN_TEST(test_hold_release);
+  RUN_TEST(test_lock_follows_output);
+}
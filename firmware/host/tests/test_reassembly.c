@@ -0,0 +1,138 @@
+// Feeds synthetic fragment sequences through the reassembler, the way
+// WEBSOCKET_EVENT_DATA delivers them, and checks the result of every piece.
+#include <string.h>
+
+#include "reassembly.h"
+#include "test.h"
+
+#define OP_TEXT 1
+#define OP_BINARY 2
+#define MAX_STEPS 8
+
+// One WEBSOCKET_EVENT_DATA event. The piece's bytes are made from message and
+// offset, so a completed message can be checked byte for byte.
+struct Piece_t {
+  uint8_t message;
+  uint8_t opcode;
+  uint32_t payloadLen;
+  uint32_t offset;
+  uint32_t len;
+  enum ReassemblyResult_t expected;
+};
+
+struct Sequence_t {
+  const char *name;
+  struct Piece_t pieces[MAX_STEPS];
+  int count;
+};
+
+static uint8_t pieceByte(uint8_t message, uint32_t offset) {
+  return (uint8_t)(message * 31 + offset * 7);
+}
+
+static const struct Sequence_t sequences[] = {
+  { "one piece", {
+    { 1, OP_TEXT, 100, 0, 100, REASSEMBLY_COMPLETE },
+  }, 1 },
+  { "in order", {
+    { 1, OP_TEXT, 2500, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 2500, 1000, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 2500, 2000, 500, REASSEMBLY_COMPLETE },
+  }, 3 },
+  { "largest message", {
+    { 2, OP_BINARY, REASSEMBLY_MAX_LEN, 0, 1024, REASSEMBLY_PARTIAL },
+    { 2, OP_BINARY, REASSEMBLY_MAX_LEN, 1024, REASSEMBLY_MAX_LEN - 1024, REASSEMBLY_COMPLETE },
+  }, 2 },
+  { "gap", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 3000, 1500, 1000, REASSEMBLY_ERR_SEQUENCE },
+    { 1, OP_TEXT, 3000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 3 },
+  { "repeated piece", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 3000, 1000, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 3000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 3 },
+  { "no start", {
+    { 1, OP_TEXT, 3000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 1 },
+  { "length changes", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 2000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 2 },
+  { "opcode changes", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_BINARY, 3000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 2 },
+  { "piece runs past the end", {
+    { 1, OP_TEXT, 1500, 0, 1000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, 1500, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 2 },
+  { "oversize", {
+    { 1, OP_TEXT, REASSEMBLY_MAX_LEN + 1000, 0, 2000, REASSEMBLY_ERR_OVERSIZE },
+    { 1, OP_TEXT, REASSEMBLY_MAX_LEN + 1000, 2000, 2000, REASSEMBLY_PARTIAL },
+    { 1, OP_TEXT, REASSEMBLY_MAX_LEN + 1000, 4000, REASSEMBLY_MAX_LEN - 3000, REASSEMBLY_PARTIAL },
+    { 2, OP_TEXT, 50, 0, 50, REASSEMBLY_COMPLETE },
+  }, 4 },
+  { "oversize interrupted", {
+    { 1, OP_BINARY, 10000, 0, 2000, REASSEMBLY_ERR_OVERSIZE },
+    { 2, OP_TEXT, 1200, 0, 1000, REASSEMBLY_PARTIAL },
+    { 2, OP_TEXT, 1200, 1000, 200, REASSEMBLY_COMPLETE },
+    { 1, OP_BINARY, 10000, 2000, 2000, REASSEMBLY_ERR_SEQUENCE },
+  }, 4 },
+  { "new message interrupts", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 2, OP_BINARY, 10, 0, 10, REASSEMBLY_COMPLETE },
+    { 1, OP_TEXT, 3000, 1000, 1000, REASSEMBLY_ERR_SEQUENCE },
+  }, 3 },
+  { "new partial message interrupts", {
+    { 1, OP_TEXT, 3000, 0, 1000, REASSEMBLY_PARTIAL },
+    { 2, OP_TEXT, 1500, 0, 1000, REASSEMBLY_PARTIAL },
+    { 2, OP_TEXT, 1500, 1000, 500, REASSEMBLY_COMPLETE },
+  }, 3 },
+};
+
+static void runSequence(const struct Sequence_t *sequence) {
+  static struct Reassembler_t reassembler;
+  static uint8_t data[REASSEMBLY_MAX_LEN];
+  reassembly_reset(&reassembler);
+
+  for (int i = 0; i < sequence->count; i++) {
+    const struct Piece_t *piece = &sequence->pieces[i];
+    for (uint32_t b = 0; b < piece->len && b < sizeof(data); b++) {
+      data[b] = pieceByte(piece->message, piece->offset + b);
+    }
+    enum ReassemblyResult_t result =
+        reassembly_feed(&reassembler, piece->opcode, piece->payloadLen, piece->offset, data, piece->len);
+    CHECK_EQ(result, piece->expected);
+    if (result != REASSEMBLY_COMPLETE) continue;
+
+    CHECK_EQ(reassembler.opcode, piece->opcode);
+    CHECK_EQ(reassembler.received, piece->payloadLen);
+    for (uint32_t b = 0; b < piece->payloadLen; b++) {
+      CHECK_EQ(reassembler.buffer[b], pieceByte(piece->message, b));
+    }
+    CHECK_EQ(reassembler.buffer[piece->payloadLen], 0);
+  }
+}
+
+static void test_sequences() {
+  for (size_t i = 0; i < sizeof(sequences) / sizeof(sequences[0]); i++) {
+    int failuresBefore = testFailures;
+    runSequence(&sequences[i]);
+    if (testFailures != failuresBefore) printf("  in sequence \"%s\"\n", sequences[i].name);
+  }
+}
+
+// An empty message has no pieces to wait for.
+static void test_empty_message() {
+  static struct Reassembler_t reassembler;
+  reassembly_reset(&reassembler);
+  CHECK_EQ(reassembly_feed(&reassembler, OP_TEXT, 0, 0, (const uint8_t *)"", 0), REASSEMBLY_COMPLETE);
+  CHECK_EQ(reassembler.buffer[0], 0);
+}
+
+void suite_reassembly() {
+  RUN_TEST(test_sequences);
+  RUN_TEST(test_empty_message);
+}
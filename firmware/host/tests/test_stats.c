@@ -0,0 +1,79 @@
+// Encodes STATS lines and checks them against the key=value fields
+// SocketConnection.parseStats reads on the server.
+#include <string.h>
+
+#include "stats.h"
+#include "test.h"
+
+static char buf[256];
+
+static void fillStats(struct DeviceStats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->uptimeS = 86400;
+  stats->freeHeap = 123456;
+  stats->minFreeHeap = 98765;
+  stats->largestBlock = 65536;
+  stats->reconnects = 3;
+  stats->wakes = 4000000000u;
+  stats->awakeMs = 5000000000ull;
+}
+
+static void test_fields() {
+  struct DeviceStats_t stats;
+  fillStats(&stats);
+  const char *expected = "STATS up=86400 heap=123456 minheap=98765 block=65536 rc=3 pm=4000000000 pmms=5000000000";
+  CHECK_EQ(stats_encode(&stats, buf, sizeof(buf)), strlen(expected));
+  CHECK(strcmp(buf, expected) == 0);
+}
+
+// Stack entries follow in task order, one s.<task>=<bytes> field each.
+static void test_tasks() {
+  struct DeviceStats_t stats;
+  fillStats(&stats);
+  stats.tasks[0] = (struct TaskStats_t){ "led", 1200 };
+  stats.tasks[1] = (struct TaskStats_t){ "speaker", 0 };
+  stats.tasks[2] = (struct TaskStats_t){ "uplink", 480 };
+  stats.taskCount = 3;
+  const char *expected = "STATS up=86400 heap=123456 minheap=98765 block=65536 rc=3 pm=4000000000 pmms=5000000000"
+                         " s.led=1200 s.speaker=0 s.uplink=480";
+  CHECK_EQ(stats_encode(&stats, buf, sizeof(buf)), strlen(expected));
+  CHECK(strcmp(buf, expected) == 0);
+
+  // A count past the array is held to it.
+  for (int i = 0; i < STATS_MAX_TASKS; i++) {
+    stats.tasks[i] = (struct TaskStats_t){ "t", i };
+  }
+  stats.taskCount = STATS_MAX_TASKS + 5;
+  CHECK(stats_encode(&stats, buf, sizeof(buf)) > 0);
+  int entries = 0;
+  for (const char *entry = buf; (entry = strstr(entry, " s.")) != NULL; entry++) {
+    entries++;
+  }
+  CHECK_EQ(entries, STATS_MAX_TASKS);
+  CHECK(strstr(buf, " s.t=7") != NULL);
+}
+
+// A buffer a byte too short for the line, at any point in it, is refused
+// rather than sending a cut off field.
+static void test_truncation() {
+  struct DeviceStats_t stats;
+  fillStats(&stats);
+  stats.tasks[0] = (struct TaskStats_t){ "websocket", 2048 };
+  stats.tasks[1] = (struct TaskStats_t){ "button", 900 };
+  stats.taskCount = 2;
+  int full = stats_encode(&stats, buf, sizeof(buf));
+  CHECK(full > 0);
+
+  char small[sizeof(buf)];
+  for (int len = 0; len <= full; len++) {
+    CHECK_EQ(stats_encode(&stats, small, len), -1);
+  }
+  CHECK_EQ(stats_encode(&stats, small, full + 1), full);
+  CHECK(strcmp(small, buf) == 0);
+}
+
+void suite_stats() {
+  RUN_TEST(test_fields);
+  RUN_TEST(test_tasks);
+  RUN_TEST(test_truncation);
+}
@@ -0,0 +1,111 @@
+// Renders LED and BEEP commands through the timeline and checks the outputs at
+// chosen moments.
+#include "show.h"
+#include "test.h"
+#include "timeline.h"
+
+static struct Timeline_t timeline;
+
+// The welcome show with a 10 ms tick ends dark, on time to within a tick.
+static void test_welcome_show() {
+  struct TimelineSample_t sample;
+  timeline_init(&timeline, 10);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 2 000000 0 000000 200 000088 0 000088 200"), TIMELINE_OK);
+
+  timeline_advance(&timeline, 100, &sample);
+  CHECK_EQ(sample.duty[2], 0);
+  timeline_advance(&timeline, 300, &sample);
+  CHECK_EQ(sample.duty[2], show_duty(0x88));
+  CHECK_EQ(sample.duty[0], 0);
+  timeline_advance(&timeline, 500, &sample);
+  CHECK_EQ(sample.duty[2], 0);
+  CHECK(timeline_busy(&timeline));
+
+  timeline_advance(&timeline, 1000, &sample);
+  CHECK(!timeline_busy(&timeline));
+  CHECK_EQ(sample.duty[2], 0);
+  CHECK(timeline.changes > 0);
+  CHECK(timeline.maxLateMs < 10);
+}
+
+// A fade is a straight line in duty. A new show stops it where it is.
+static void test_fades() {
+  struct TimelineSample_t sample;
+  uint16_t full = show_duty(0xff);
+  timeline_init(&timeline, 0);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 FF0000 100"), TIMELINE_OK);
+  timeline_advance(&timeline, 50, &sample);
+  CHECK_EQ(sample.duty[0], full / 2);
+  timeline_advance(&timeline, 99, &sample);
+  CHECK_EQ(sample.duty[0], full * 99 / 100);
+  timeline_advance(&timeline, 100, &sample);
+  CHECK(!timeline_busy(&timeline));
+  CHECK_EQ(sample.duty[0], 0);
+
+  timeline_init(&timeline, 0);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 FF0000 100"), TIMELINE_OK);
+  timeline_advance(&timeline, 50, &sample);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 000000 100"), TIMELINE_OK);
+  timeline_advance(&timeline, 100, &sample);
+  CHECK_EQ(sample.duty[0], full / 2 - full / 2 / 2);
+  CHECK_EQ(timeline.maxLateMs, 0);
+}
+
+static void test_song() {
+  struct TimelineSample_t sample;
+  timeline_init(&timeline, 0);
+  CHECK_EQ(timeline_command(&timeline, "BEEP 0 1 1000 100 0 50 2000 100"), TIMELINE_OK);
+  timeline_advance(&timeline, 50, &sample);
+  CHECK_EQ(sample.freq, 1000);
+  timeline_advance(&timeline, 120, &sample);
+  CHECK_EQ(sample.freq, 0);
+  CHECK(timeline_busy(&timeline));
+  timeline_advance(&timeline, 200, &sample);
+  CHECK_EQ(sample.freq, 2000);
+  timeline_advance(&timeline, 250, &sample);
+  CHECK_EQ(sample.freq, 0);
+  CHECK(!timeline_busy(&timeline));
+
+  // With a tick, each change waits for the next one.
+  timeline_init(&timeline, 10);
+  CHECK_EQ(timeline_command(&timeline, "BEEP 0 1 1000 15 2000 15"), TIMELINE_OK);
+  timeline_advance(&timeline, 19, &sample);
+  CHECK_EQ(sample.freq, 1000);
+  timeline_advance(&timeline, 20, &sample);
+  CHECK_EQ(sample.freq, 2000);
+  timeline_advance(&timeline, 100, &sample);
+  CHECK(!timeline_busy(&timeline));
+  CHECK_EQ(timeline.maxLateMs, 5);
+}
+
+static void test_bad_commands() {
+  struct TimelineSample_t sample;
+  timeline_init(&timeline, 0);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 nonsense"), TIMELINE_ERR_SHOW);
+  // A show that repeats with no time in it would never let the clock move.
+  CHECK_EQ(timeline_command(&timeline, "LED 1 -1 FF0000 0"), TIMELINE_ERR_SHOW);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 2 FF0000 0 00FF00 0"), TIMELINE_ERR_SHOW);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 FF0000 0"), TIMELINE_OK);
+  CHECK(!timeline_busy(&timeline));
+  CHECK_EQ(timeline_command(&timeline, "BEEP 0 1 1000"), TIMELINE_ERR_SONG);
+  CHECK_EQ(timeline_command(&timeline, "HELLO"), TIMELINE_ERR_COMMAND);
+  CHECK_EQ(timeline_command(&timeline, "LED@2 1 1 FF0000 100"), TIMELINE_ERR_LAYER);
+  CHECK_EQ(timeline_command(&timeline, "BEEP@0 0 1 1000 100"), TIMELINE_ERR_LAYER);
+  CHECK_EQ(timeline_command(&timeline, "LED@ 1 1 FF0000 100"), TIMELINE_ERR_LAYER);
+  // Only LED 1 is wired up.
+  CHECK_EQ(timeline_command(&timeline, "LED 2 1 FF0000 100"), TIMELINE_OK);
+  CHECK(!timeline_busy(&timeline));
+
+  // A bad show leaves the playing one alone.
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 00FF00 100"), TIMELINE_OK);
+  CHECK_EQ(timeline_command(&timeline, "LED 1 1 00FF00"), TIMELINE_ERR_SHOW);
+  timeline_advance(&timeline, 50, &sample);
+  CHECK_EQ(sample.duty[1], show_duty(0xff) / 2);
+}
+
+void suite_timeline() {
+  RUN_TEST(test_welcome_show);
+  RUN_TEST(test_fades);
+  RUN_TEST(test_song);
+  RUN_TEST(test_bad_commands);
+}
@@ -0,0 +1,111 @@
+// Writes trace records and copies them out as after a crash, and round trips
+// records through the hex form they are sent to the server in.
+#include <string.h>
+
+#include "test.h"
+#include "trace.h"
+
+static struct TraceRing_t ring;
+static struct TraceRecord_t copied[TRACE_CAPACITY];
+
+// Every record survives in order. The masked off module writes nothing.
+static void test_full_ring() {
+  trace_init(&ring, TRACE_ALL_MODULES & ~(1 << TRACE_MODULE_BUTTON));
+  for (uint32_t i = 0; i < TRACE_CAPACITY; i++) {
+    trace_write(&ring, TRACE_SPEAKER_TONE, i * 1000, i, 0, 0);
+    trace_write(&ring, TRACE_BUTTON_EDGE, i * 1000, 1, 1, 0);
+  }
+  CHECK_EQ(trace_copy(&ring, ring.boot, copied, TRACE_CAPACITY), TRACE_CAPACITY);
+  for (uint32_t i = 0; i < TRACE_CAPACITY; i++) {
+    CHECK_EQ(copied[i].seq, i);
+    CHECK_EQ(copied[i].event, TRACE_SPEAKER_TONE);
+    CHECK_EQ(copied[i].timeUs, i * 1000);
+    CHECK_EQ(copied[i].args[0], i);
+  }
+}
+
+// Once the ring wraps only the newest records are left, oldest first.
+static void test_wraps() {
+  trace_init(&ring, TRACE_ALL_MODULES);
+  for (uint32_t i = 0; i < TRACE_CAPACITY + 50; i++) {
+    trace_write(&ring, TRACE_LED_STEP, i, i, 0, 0);
+  }
+  CHECK_EQ(trace_copy(&ring, ring.boot, copied, TRACE_CAPACITY), TRACE_CAPACITY);
+  CHECK_EQ(copied[0].seq, 50);
+  CHECK_EQ(copied[TRACE_CAPACITY - 1].seq, TRACE_CAPACITY + 49);
+
+  CHECK_EQ(trace_copy(&ring, ring.boot, copied, 10), 10);
+  CHECK_EQ(copied[9].seq, 59);
+}
+
+// A record a crash cut short doesn't match its slot and is skipped.
+static void test_torn_record() {
+  trace_init(&ring, TRACE_ALL_MODULES);
+  for (uint32_t i = 0; i < 10; i++) {
+    trace_write(&ring, TRACE_WS_EVENT, i, i, 0, 0);
+  }
+  ring.records[4].seq = ~4u;
+  CHECK_EQ(trace_copy(&ring, ring.boot, copied, TRACE_CAPACITY), 9);
+  CHECK_EQ(copied[3].seq, 3);
+  CHECK_EQ(copied[4].seq, 5);
+}
+
+// After a restart the last boot's records are still there until overwritten.
+static void test_resume() {
+  trace_init(&ring, TRACE_ALL_MODULES);
+  for (uint32_t i = 0; i < 10; i++) {
+    trace_write(&ring, TRACE_BOOT, i, 0, 0, 0);
+  }
+  CHECK(trace_resume(&ring));
+  CHECK_EQ(ring.boot, 1);
+  for (uint32_t i = 0; i < 4; i++) {
+    trace_write(&ring, TRACE_WS_MESSAGE, i, trace_tag("LED"), 10, 0);
+  }
+  CHECK_EQ(trace_copy(&ring, 0, copied, TRACE_CAPACITY), 10);
+  CHECK_EQ(trace_copy(&ring, 1, copied, TRACE_CAPACITY), 4);
+  CHECK_EQ(copied[0].seq, 10);
+  CHECK_EQ(copied[0].args[0], trace_tag("LED"));
+
+  ring.magic = 0;
+  CHECK(!trace_resume(&ring));
+}
+
+static void test_hex() {
+  struct TraceRecord_t record = { 0x12345678, 0xfffffffe, TRACE_SPEAKER_TONE, 3, { -1, 440, INT32_MIN } };
+  char hex[TRACE_HEX_LEN + 1];
+  CHECK_EQ(trace_encode_hex(&record, hex, sizeof(hex)), TRACE_HEX_LEN);
+  CHECK_EQ(strlen(hex), TRACE_HEX_LEN);
+  CHECK(strncmp(hex, "12345678fffffffe03020003ffffffff", 32) == 0);
+  CHECK_EQ(trace_encode_hex(&record, hex, TRACE_HEX_LEN), -1);
+
+  struct TraceRecord_t decoded;
+  CHECK(trace_decode_hex(hex, &decoded));
+  CHECK_EQ(decoded.seq, record.seq);
+  CHECK_EQ(decoded.timeUs, record.timeUs);
+  CHECK_EQ(decoded.event, record.event);
+  CHECK_EQ(decoded.boot, record.boot);
+  for (int i = 0; i < TRACE_ARGS; i++) {
+    CHECK_EQ(decoded.args[i], record.args[i]);
+  }
+
+  hex[20] = 'g';
+  CHECK(!trace_decode_hex(hex, &decoded));
+  CHECK(!trace_decode_hex("1234", &decoded));
+}
+
+static void test_event_formats() {
+  CHECK(trace_event_format(TRACE_BOOT) != NULL);
+  CHECK(trace_event_format(TRACE_BUTTON_GESTURE) != NULL);
+  CHECK(trace_event_format(0x7f7f) == NULL);
+  CHECK_EQ(trace_tag("ABCDE"), 0x44434241);
+  CHECK_EQ(trace_tag(""), 0);
+}
+
+void suite_trace() {
+  RUN_TEST(test_full_ring);
+  RUN_TEST(test_wraps);
+  RUN_TEST(test_torn_record);
+  RUN_TEST(test_resume);
+  RUN_TEST(test_hex);
+  RUN_TEST(test_event_formats);
+}
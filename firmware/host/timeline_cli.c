@@ -0,0 +1,97 @@
+// Renders LED and BEEP commands into what the device's outputs would do, using
+// the firmware's own show, song and player code. For previewing a new alert
+// pattern, or diffing one against a saved rendering, before it goes to the
+// fleet:
+//
+//   notify_timeline [--tick <ms>] [--every <ms>] [--changes] [--until <ms>] [@<ms>] <command> ...
+//
+// Each command starts at the time of the @<ms> before it, or 0. Prints
+// "ms,r,g,b,freq" every --every ms (default 1), or only when something changes
+// with --changes, until everything has finished or --until (default 60000).
+// --tick sets the scheduler tick (default 10, as on the device; 0 for exact
+// timing) and the summary on stderr says how late changes landed because of it.
+//
+//   notify_timeline --changes "LED 1 2 000000 0 000088 200" @100 "BEEP 0 1 1000 500"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+
+#define MAX_COMMANDS 32
+
+struct TimedCommand_t {
+  uint32_t at;
+  const char *text;
+};
+
+static bool sameSample(const struct TimelineSample_t *a, const struct TimelineSample_t *b) {
+  return memcmp(a->duty, b->duty, sizeof(a->duty)) == 0 && a->freq == b->freq;
+}
+
+int main(int argc, char **argv) {
+  uint32_t tickMs = 10;
+  uint32_t every = 1;
+  uint32_t until = 60000;
+  bool changesOnly = false;
+  struct TimedCommand_t commands[MAX_COMMANDS];
+  int count = 0;
+  uint32_t at = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+      tickMs = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+      every = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+      until = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--changes") == 0) {
+      changesOnly = true;
+    } else if (argv[i][0] == '@') {
+      at = strtoul(argv[i] + 1, NULL, 10);
+    } else if (count < MAX_COMMANDS) {
+      commands[count].at = at;
+      commands[count].text = argv[i];
+      count++;
+    }
+  }
+  if (count == 0 || every == 0) {
+    fprintf(stderr, "usage: %s [--tick <ms>] [--every <ms>] [--changes] [--until <ms>] [@<ms>] <command> ...\n", argv[0]);
+    return 2;
+  }
+
+  static struct Timeline_t timeline;
+  timeline_init(&timeline, tickMs);
+  struct TimelineSample_t sample, last;
+  bool printed = false;
+  int next = 0;
+  printf("ms,r,g,b,freq\n");
+  for (uint32_t ms = 0; ms <= until; ms++) {
+    timeline_advance(&timeline, ms, &sample);
+    bool started = false;
+    while (next < count && commands[next].at <= ms) {
+      enum TimelineResult_t result = timeline_command(&timeline, commands[next].text);
+      if (result != TIMELINE_OK) {
+        fprintf(stderr, "Can't play \"%s\": %s\n", commands[next].text, timeline_result_name(result));
+        return 1;
+      }
+      next++;
+      started = true;
+    }
+    if (started) timeline_advance(&timeline, ms, &sample);
+
+    bool changed = !printed || !sameSample(&sample, &last);
+    if (changesOnly ? changed : ms % every == 0) {
+      printf("%lu,%u,%u,%u,%u\n", (unsigned long)ms, sample.duty[0], sample.duty[1], sample.duty[2], sample.freq);
+      last = sample;
+      printed = true;
+    }
+    if (next == count && !timeline_busy(&timeline)) break;
+  }
+
+  fprintf(stderr, "%lu changes, latest %lu ms late, %.1f ms late on average (tick %lu ms)\n",
+          (unsigned long)timeline.changes, (unsigned long)timeline.maxLateMs,
+          timeline.changes ? (double)timeline.totalLateMs / timeline.changes : 0.0, (unsigned long)tickMs);
+  return 0;
+}
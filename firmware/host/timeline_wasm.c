@@ -0,0 +1,48 @@
+// The timeline for the web simulator, built with Emscripten (see
+// CMakeLists.txt). One timeline, driven through a shared command buffer so the
+// page needs no C string handling.
+#include <stdint.h>
+
+#include "timeline.h"
+
+#define COMMAND_LEN 1024
+
+static struct Timeline_t timeline;
+static struct TimelineSample_t sample;
+static char command[COMMAND_LEN];
+
+char *timeline_command_buffer() {
+  return command;
+}
+
+uint32_t timeline_command_buffer_len() {
+  return COMMAND_LEN;
+}
+
+void timeline_reset(uint32_t tickMs) {
+  timeline_init(&timeline, tickMs);
+  timeline_advance(&timeline, 0, &sample);
+}
+
+// Plays the NUL terminated command in the buffer at ms. Returns a TimelineResult_t.
+int timeline_play(uint32_t ms) {
+  timeline_advance(&timeline, ms, &sample);
+  int result = timeline_command(&timeline, command);
+  timeline_advance(&timeline, ms, &sample);
+  return result;
+}
+
+// Moves to ms. Returns whether anything is still playing.
+int timeline_seek(uint32_t ms) {
+  timeline_advance(&timeline, ms, &sample);
+  return timeline_busy(&timeline);
+}
+
+// 0-2 are the red, green and blue duty, 3 is the buzzer frequency.
+uint32_t timeline_output(int which) {
+  return which < SHOW_NUM_CHANNELS ? sample.duty[which] : sample.freq;
+}
+
+uint32_t timeline_duty_max() {
+  return SHOW_DUTY_MAX;
+}
@@ -0,0 +1,92 @@
+// Formats trace records (see trace.h) pulled from a device. Takes the TRACE
+// messages a device sends after a crash, or any text with records in it as
+// 48 digit hex words; everything else is skipped:
+//
+//   node scripts/trace-dump.mjs --callsign ABC | notify_trace_decode
+//
+// Prints "<boot> <seconds since boot> <module> <text>" for each record. The
+// formats come from this build's trace.h, so decode with a build close to the
+// device's firmware.
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAX_LINE 4096
+
+static const char *const moduleNames[TRACE_MODULE_COUNT] = {
+  [TRACE_MODULE_SYSTEM] = "system",
+  [TRACE_MODULE_WEBSOCKET] = "websocket",
+  [TRACE_MODULE_LED] = "led",
+  [TRACE_MODULE_SPEAKER] = "speaker",
+  [TRACE_MODULE_BUTTON] = "button",
+};
+
+static void printTag(int32_t tag) {
+  for (int i = 0; i < 4; i++) {
+    char ch = (uint32_t)tag >> (8 * i);
+    if (ch == '\0') break;
+    putchar(isprint((unsigned char)ch) ? ch : '?');
+  }
+}
+
+static void printRecord(const struct TraceRecord_t *record) {
+  int module = record->event >> 8;
+  printf("%u %lu.%06lu %s ", record->boot, (unsigned long)(record->timeUs / 1000000),
+         (unsigned long)(record->timeUs % 1000000), module < TRACE_MODULE_COUNT ? moduleNames[module] : "?");
+
+  const char *format = trace_event_format(record->event);
+  if (format == NULL) {
+    printf("unknown event %04x %ld %ld %ld\n", record->event, (long)record->args[0], (long)record->args[1],
+           (long)record->args[2]);
+    return;
+  }
+
+  int arg = 0;
+  for (const char *ch = format; *ch != '\0'; ch++) {
+    if (*ch != '%' || ch[1] == '\0' || arg == TRACE_ARGS) {
+      putchar(*ch);
+      continue;
+    }
+    int32_t value = record->args[arg++];
+    switch (*++ch) {
+    case 'd':
+      printf("%ld", (long)value);
+      break;
+    case 'u':
+      printf("%lu", (unsigned long)(uint32_t)value);
+      break;
+    case 'x':
+      printf("%lx", (unsigned long)(uint32_t)value);
+      break;
+    case 'k':
+      printTag(value);
+      break;
+    default:
+      putchar('%');
+      putchar(*ch);
+      arg--;
+    }
+  }
+  putchar('\n');
+}
+
+int main(int argc, char **argv) {
+  FILE *file = argc > 1 ? fopen(argv[1], "r") : stdin;
+  if (file == NULL) {
+    fprintf(stderr, "Can't open %s\n", argv[1]);
+    return 2;
+  }
+
+  char line[MAX_LINE];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    for (char *word = strtok(line, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+      struct TraceRecord_t record;
+      if (strlen(word) == TRACE_HEX_LEN && trace_decode_hex(word, &record)) printRecord(&record);
+    }
+  }
+
+  if (file != stdin) fclose(file);
+  return 0;
+}
@@ -21,12 +21,16 @@
 
 #include "button.h"
 #include "logging.h"
+#include "power.h"
 #include "speaker.h"
 #include "websocket.h"
 #include "wifi.h"
 #include "configuration.h"
+#include "console.h"
 #include "ota.h"
 #include "led.h"
+#include "telemetry.h"
+#include "uplink.h"
 
 static const char *TAG = "app";
 /* The examples use WiFi configuration that you can set via project configuration menu
@@ -41,6 +45,10 @@ static const char *TAG = "app";
 TaskHandle_t beep_handle = NULL;
 
 void app_main(void) {
+  logging_setup();
+  telemetry_boot_phase(BOOT_PHASE_MAIN);
+  power_setup();
+  uplink_setup();
   speaker_setup();
   
   // Initialize NVS
@@ -50,23 +58,35 @@ void app_main(void) {
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+  telemetry_boot_phase(BOOT_PHASE_NVS);
 
   char otaHash[OTA_HASH_STR_LEN];
   ESP_LOGI(TAG, "Starting firmware version %s", ota_get_partition_hash(otaHash));
   enable_logging();
   struct AppConfig *config = config_read();
 
-  xTaskCreatePinnedToCore(led_task, "led", 2560, NULL, 15, NULL, 1);
+  TaskHandle_t task = NULL;
+  xTaskCreatePinnedToCore(led_task, "led", 2560, NULL, 15, &task, 1);
+  telemetry_watch_task(task);
 
   if (config != NULL) {
-    wifi_init_sta(config->wifi_ssid, config->wifi_password);
+    wifi_init_sta(config->wifi_ssid, config->wifi_password, config->static_ip);
     websocket_start(config->server, config->callsign);
     xTaskCreatePinnedToCore(speaker_task, "beep", 2560, NULL, 10, &beep_handle, 1);
+    telemetry_watch_task(beep_handle);
+    xTaskCreatePinnedToCore(uplink_task, "uplink", 3072, NULL, 8, &task, 1);
+    telemetry_watch_task(task);
   } else {
     ESP_LOGW(TAG, "Network not started: Wi-Fi not configured.");
-    led_show("-1 FF0000 0 FF0000 200 000000 0 000000 1000");
+    led_show(ARBITER_STATUS, "-1 FF0000 0 FF0000 200 000000 0 000000 1000");
   }
 
-  xTaskCreatePinnedToCore(button_task, "button", 2560, NULL, 15, NULL, 1);
-  xTaskCreatePinnedToCore(configure_task, "configure", 2560, NULL, 15, NULL, 1);
+  xTaskCreatePinnedToCore(button_task, "button", 2560, NULL, 15, &task, 1);
+  telemetry_watch_task(task);
+  xTaskCreatePinnedToCore(console_task, "console", 3072, NULL, 15, &task, 1);
+  telemetry_watch_task(task);
+
+  if (config != NULL) {
+    xTaskCreatePinnedToCore(telemetry_task, "stats", 2560, NULL, 5, NULL, 1);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arbiter.h"
+
+static const char *const layerNames[ARBITER_LAYER_COUNT] = {
+  [ARBITER_STATUS] = "status",
+  [ARBITER_FEEDBACK] = "feedback",
+  [ARBITER_ALERT] = "alert",
+};
+
+static int8_t topOf(uint8_t active) {
+  return active == 0 ? ARBITER_NONE : 31 - __builtin_clz(active);
+}
+
+void arbiter_init(struct Arbiter_t *arbiter) {
+  arbiter->active = 0;
+}
+
+int8_t arbiter_top(const struct Arbiter_t *arbiter) {
+  return topOf(arbiter->active);
+}
+
+// The layer has something new to play, replacing whatever it had. It only
+// plays now if nothing above it is playing.
+struct ArbiterChange_t arbiter_start(struct Arbiter_t *arbiter, enum ArbiterLayer_t layer) {
+  struct ArbiterChange_t change = { ARBITER_NONE, ARBITER_NONE };
+  if (layer >= ARBITER_LAYER_COUNT) return change;
+
+  int8_t before = topOf(arbiter->active);
+  arbiter->active |= 1 << layer;
+  if (topOf(arbiter->active) != (int8_t)layer) return change;
+
+  if (before != ARBITER_NONE && before != (int8_t)layer) change.pause = before;
+  change.play = layer;
+  return change;
+}
+
+// The layer finished or was stopped. If it owned the output, the next layer
+// down with something to play resumes.
+struct ArbiterChange_t arbiter_finish(struct Arbiter_t *arbiter, enum ArbiterLayer_t layer) {
+  struct ArbiterChange_t change = { ARBITER_NONE, ARBITER_NONE };
+  if (layer >= ARBITER_LAYER_COUNT) return change;
+
+  bool wasTop = topOf(arbiter->active) == (int8_t)layer;
+  arbiter->active &= ~(1 << layer);
+  if (wasTop) change.play = topOf(arbiter->active);
+  return change;
+}
+
+// Strips an "@<layer>" tag from a command name. Returns false if the tag isn't
+// a layer, leaving layer alone. Without a tag, layer is left alone too.
+bool arbiter_split_tag(char *command, enum ArbiterLayer_t *layer) {
+  char *tag = strchr(command, '@');
+  if (tag == NULL) return true;
+
+  *tag = '\0';
+  char *end;
+  unsigned long value = strtoul(tag + 1, &end, 10);
+  if (end == tag + 1 || *end != '\0' || value >= ARBITER_LAYER_COUNT) return false;
+  *layer = (enum ArbiterLayer_t)value;
+  return true;
+}
+
+const char *arbiter_layer_name(enum ArbiterLayer_t layer) {
+  return layer < ARBITER_LAYER_COUNT ? layerNames[layer] : "unknown";
+}
@@ -0,0 +1,45 @@
+#ifndef ARBITER_H
+#define ARBITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decides which priority layer owns an output, the LED or the speaker. Plain C
+// with no ESP-IDF dependencies so it can be built and exercised on a host
+// machine.
+//
+// Each layer holds at most one show or song. The highest layer with something
+// to play owns the output. A layer that is preempted keeps its place and
+// resumes once everything above it has finished. Every call is constant time.
+//
+// The server can tag LED and BEEP commands with a layer, as "LED@2 1 ..." in
+// text or a FRAME_PRIORITY record in binary frames. Untagged commands from the
+// server are alerts.
+
+enum ArbiterLayer_t {
+  ARBITER_STATUS = 0,  // connection state, replaced as it changes
+  ARBITER_FEEDBACK,    // responses to the buttons and console
+  ARBITER_ALERT,       // notifications from the server
+  ARBITER_LAYER_COUNT,
+};
+
+#define ARBITER_NONE -1
+
+struct Arbiter_t {
+  uint8_t active;  // bit per layer with something to play
+};
+
+// What the output has to do after a change. Either can be ARBITER_NONE.
+struct ArbiterChange_t {
+  int8_t pause;  // lost the output and should remember where it was
+  int8_t play;   // owns the output now, from the start or from where it paused
+};
+
+void arbiter_init(struct Arbiter_t *arbiter);
+struct ArbiterChange_t arbiter_start(struct Arbiter_t *arbiter, enum ArbiterLayer_t layer);
+struct ArbiterChange_t arbiter_finish(struct Arbiter_t *arbiter, enum ArbiterLayer_t layer);
+int8_t arbiter_top(const struct Arbiter_t *arbiter);
+bool arbiter_split_tag(char *command, enum ArbiterLayer_t *layer);
+const char *arbiter_layer_name(enum ArbiterLayer_t layer);
+
+#endif
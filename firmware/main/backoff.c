@@ -0,0 +1,35 @@
+#include "backoff.h"
+
+static uint32_t nextRandom(struct Backoff_t *backoff) {
+  uint32_t x = backoff->random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  backoff->random = x;
+  return x;
+}
+
+void backoff_init(struct Backoff_t *backoff, uint32_t baseMs, uint32_t capMs, uint32_t seed) {
+  backoff->baseMs = baseMs > 0 ? baseMs : 1;
+  backoff->capMs = capMs > backoff->baseMs ? capMs : backoff->baseMs;
+  backoff->attempt = 0;
+  backoff->random = seed != 0 ? seed : 0x9e3779b9;
+}
+
+uint32_t backoff_next_ms(struct Backoff_t *backoff) {
+  uint32_t ceiling = backoff->baseMs;
+  for (uint8_t i = 0; i < backoff->attempt && ceiling < backoff->capMs; i++) {
+    ceiling = ceiling > backoff->capMs / 2 ? backoff->capMs : ceiling * 2;
+  }
+  if (ceiling > backoff->capMs) ceiling = backoff->capMs;
+  // Once at the cap there's no point counting further.
+  if (ceiling < backoff->capMs) backoff->attempt++;
+
+  uint32_t half = ceiling / 2;
+  return ceiling - half + nextRandom(backoff) % (half + 1);
+}
+
+// Called once a connection has been accepted by the server.
+void backoff_reset(struct Backoff_t *backoff) {
+  backoff->attempt = 0;
+}
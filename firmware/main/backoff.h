@@ -0,0 +1,24 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+// Reconnect delays with exponential backoff and jitter. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+//
+// Attempt n waits a random time between half and all of min(cap, base * 2^n),
+// so devices that lost the server at the same moment don't all come back at
+// the same moment.
+
+struct Backoff_t {
+  uint32_t baseMs;
+  uint32_t capMs;
+  uint8_t attempt;
+  uint32_t random;  // xorshift32 state, never 0
+};
+
+void backoff_init(struct Backoff_t *backoff, uint32_t baseMs, uint32_t capMs, uint32_t seed);
+uint32_t backoff_next_ms(struct Backoff_t *backoff);
+void backoff_reset(struct Backoff_t *backoff);
+
+#endif
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bootlog.h"
+
+static const char *const phaseKeys[BOOT_PHASE_COUNT] = {
+  [BOOT_PHASE_MAIN] = "main",
+  [BOOT_PHASE_NVS] = "nvs",
+  [BOOT_PHASE_ASSOCIATED] = "assoc",
+  [BOOT_PHASE_GOT_IP] = "ip",
+  [BOOT_PHASE_CONNECTED] = "tls",
+  [BOOT_PHASE_WELCOME] = "welcome",
+};
+
+void bootlog_init(struct BootLog_t *log, uint8_t resetReason) {
+  memset(log, 0, sizeof(*log));
+  log->resetReason = resetReason;
+}
+
+// Only the first time counts. Reconnects later on aren't part of booting.
+void bootlog_mark(struct BootLog_t *log, enum BootPhase_t phase, uint32_t ms) {
+  if (phase >= BOOT_PHASE_COUNT || bootlog_has(log, phase)) return;
+  log->ms[phase] = ms;
+  log->seen |= 1 << phase;
+}
+
+bool bootlog_has(const struct BootLog_t *log, enum BootPhase_t phase) {
+  return phase < BOOT_PHASE_COUNT && (log->seen & (1 << phase)) != 0;
+}
+
+// Returns the length of the message, or -1 if it doesn't fit in buf.
+int bootlog_encode(const struct BootLog_t *log, char *buf, size_t len) {
+  int used = snprintf(buf, len, "BOOT rst=%u fast=%d", log->resetReason, log->fastConnect ? 1 : 0);
+  if (used < 0 || (size_t)used >= len) return -1;
+
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    if (!bootlog_has(log, i)) continue;
+    int written = snprintf(buf + used, len - used, " %s=%lu", phaseKeys[i], (unsigned long)log->ms[i]);
+    if (written < 0 || (size_t)written >= len - used) return -1;
+    used += written;
+  }
+  return used;
+}
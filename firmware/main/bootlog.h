@@ -0,0 +1,40 @@
+#ifndef BOOTLOG_H
+#define BOOTLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// When each step between power on and the server's WELCOME happened, sent to
+// the server as a BOOT message. Plain C with no ESP-IDF dependencies so it can
+// be built and exercised on a host machine.
+//
+//   BOOT rst=<reset reason> fast=<0|1> main=<ms> nvs=<ms> assoc=<ms> ip=<ms> tls=<ms> welcome=<ms>
+//
+// Times are ms since the device started. fast=1 means Wi-Fi went straight to
+// the access point remembered from last time instead of scanning. Phases that
+// didn't happen are left out.
+
+enum BootPhase_t {
+  BOOT_PHASE_MAIN = 0,   // app_main started
+  BOOT_PHASE_NVS,        // flash storage ready
+  BOOT_PHASE_ASSOCIATED, // joined the access point
+  BOOT_PHASE_GOT_IP,
+  BOOT_PHASE_CONNECTED,  // TLS and websocket handshake done
+  BOOT_PHASE_WELCOME,
+  BOOT_PHASE_COUNT,
+};
+
+struct BootLog_t {
+  uint32_t ms[BOOT_PHASE_COUNT];
+  uint8_t seen;  // bit per phase
+  uint8_t resetReason;
+  bool fastConnect;
+};
+
+void bootlog_init(struct BootLog_t *log, uint8_t resetReason);
+void bootlog_mark(struct BootLog_t *log, enum BootPhase_t phase, uint32_t ms);
+bool bootlog_has(const struct BootLog_t *log, enum BootPhase_t phase);
+int bootlog_encode(const struct BootLog_t *log, char *buf, size_t len);
+
+#endif
@@ -1,53 +1,148 @@
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
 #include <stdio.h>
 
 #include "button.h"
+#include "gesture.h"
+#include "logging.h"
 #include "setup.h"
 #include "speaker.h"
-#include "websocket.h"
+#include "uplink.h"
 #include "led.h"
 
 #define ESP_INTR_FLAG_DEFAULT 0
-#define DEBOUNCE_MS 300
+#define EDGE_QUEUE_LEN 32
+// While a button is down, check its pin this often in case its release was
+// lost to a full queue or debouncing.
+#define RESYNC_MS 100
 
 static const char *TAG = "BUTTON";
 
-static SemaphoreHandle_t clickSemaphore = NULL;
+struct ButtonEdge_t {
+  uint8_t button;
+  bool down;
+  int64_t timeUs;
+};
 
-void IRAM_ATTR handleButtonInterrupt() {
-  xSemaphoreGive(clickSemaphore);
+static const gpio_num_t pins[] = BUTTON_PINS;
+#define BUTTON_COUNT (sizeof(pins) / sizeof(pins[0]))
+
+static QueueHandle_t edges = NULL;
+// What each button's interrupt is waiting for. Only the ISR changes it.
+static bool waitingForPress[BUTTON_COUNT];
+
+static struct Gesture_t gesture;
+
+// Edge interrupts can't wake the chip from light sleep, so each button uses a
+// level interrupt that is also a wakeup source, and flips the level it waits
+// for every time it fires. Every interrupt is then an edge, timestamped here.
+static void IRAM_ATTR handleButtonInterrupt(void *arg) {
+  uint32_t button = (uint32_t)arg;
+  bool down = waitingForPress[button];
+  waitingForPress[button] = !down;
+  gpio_int_type_t next = down ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+  gpio_ll_set_intr_type(&GPIO, pins[button], next);
+  gpio_ll_wakeup_enable(&GPIO, pins[button], next);
+
+  struct ButtonEdge_t edge = { .button = button, .down = down, .timeUs = esp_timer_get_time() };
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(edges, &edge, &woken);
+  if (woken) portYIELD_FROM_ISR();
 }
 
-void button_task(void *arg) {
-  gpio_pad_select_gpio(BUTTON_A_PIN);
-  gpio_set_direction(BUTTON_A_PIN, GPIO_MODE_INPUT);
-  gpio_pullup_en(BUTTON_A_PIN);
+static uint32_t nowMs() {
+  return esp_timer_get_time() / 1000;
+}
+
+static void setupPin(uint32_t button) {
+  gpio_num_t pin = pins[button];
+  gpio_pad_select_gpio(pin);
+  gpio_set_direction(pin, GPIO_MODE_INPUT);
+  gpio_pullup_en(pin);
+
+  waitingForPress[button] = true;
+  gpio_set_intr_type(pin, GPIO_INTR_LOW_LEVEL);
+  gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+  gpio_isr_handler_add(pin, handleButtonInterrupt, (void *)button);
+}
+
+static void sendGesture(const struct GestureEvent_t *event) {
+  static const enum JournalEventType_t journalTypes[] = {
+    [GESTURE_PRESS] = JOURNAL_BUTTON,
+    [GESTURE_LONG] = JOURNAL_BUTTON_LONG,
+    [GESTURE_DOUBLE] = JOURNAL_BUTTON_DOUBLE,
+    [GESTURE_CHORD] = JOURNAL_BUTTON_CHORD,
+  };
+  // Single buttons go by number, chords by their mask.
+  uint8_t arg = event->type == GESTURE_CHORD ? event->buttons : __builtin_ctz(event->buttons) + 1;
+  TRACE(TRACE_BUTTON_GESTURE, event->type, arg, 0);
+  ESP_LOGW(TAG, "Button %s %u at %lu", gesture_type_name(event->type), arg, (unsigned long)event->timeMs);
+  // Goes out when the link is up, so a press while we're disconnected isn't lost.
+  uplink_record(journalTypes[event->type], arg);
+}
+
+// Feedback as soon as a button goes down, before we know which gesture it is.
+static void acknowledgePress() {
+  speaker_silence();
+  // Whatever status show is fading underneath picks up again after the blip.
+  led_show(ARBITER_FEEDBACK, "1 000088 0 000000 200");
+}
 
-  clickSemaphore = xSemaphoreCreateBinary();
+static void handleEdge(const struct ButtonEdge_t *edge) {
+  uint32_t timeMs = edge->timeUs / 1000;
+  TRACE(TRACE_BUTTON_EDGE, edge->button + 1, edge->down, 0);
+  ESP_LOGD(TAG, "EDGE %lu %u %s", (unsigned long)timeMs, edge->button + 1, edge->down ? "DOWN" : "UP");
+
+  uint8_t held = gesture.held;
+  struct GestureEvent_t event;
+  if (gesture_edge(&gesture, edge->button, edge->down, timeMs, &event)) sendGesture(&event);
+  if (gesture.held & ~held) acknowledgePress();
+}
+
+// Catches a release we never heard about.
+static void resync() {
+  for (uint32_t i = 0; i < BUTTON_COUNT; i++) {
+    if ((gesture.held & (1 << i)) && gpio_get_level(pins[i]) == 1) {
+      struct ButtonEdge_t edge = { .button = i, .down = false, .timeUs = esp_timer_get_time() };
+      handleEdge(&edge);
+    }
+  }
+}
+
+void button_task(void *arg) {
+  edges = xQueueCreate(EDGE_QUEUE_LEN, sizeof(struct ButtonEdge_t));
+  gesture_init(&gesture, BUTTON_COUNT);
 
-  gpio_set_intr_type(BUTTON_A_PIN, GPIO_INTR_NEGEDGE);
   gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-  gpio_isr_handler_add(BUTTON_A_PIN, handleButtonInterrupt, NULL);
+  for (uint32_t i = 0; i < BUTTON_COUNT; i++) {
+    setupPin(i);
+  }
+  esp_sleep_enable_gpio_wakeup();
 
-  uint64_t lastClick = 0;
+  // One task for every button. It sleeps until an edge arrives or a gesture is
+  // due, e.g. a long press while the button is still down.
   while (1) {
-    xSemaphoreTake(clickSemaphore, portMAX_DELAY);
-    uint64_t now = esp_timer_get_time();
-    if (now - (DEBOUNCE_MS * 1000) > lastClick) {
-      uint64_t diff = now - lastClick;
-      lastClick = now;
-      ESP_LOGW(TAG, "Button was pressed %llu %llu", now, diff);
-      speaker_silence();
-      if (websocket_is_connected()) {
-        // only show the light blip while we're connected, because if we're not connected
-        // we're showing fading sequences.
-        led_show("1 000088 0 000000 200");
-        websocket_send_button(1);
-      }
+    uint32_t wait = gesture_next_deadline_ms(&gesture, nowMs());
+    if (gesture.held != 0 && wait > RESYNC_MS) wait = RESYNC_MS;
+    TickType_t ticks = wait == GESTURE_NO_DEADLINE ? portMAX_DELAY : pdMS_TO_TICKS(wait) + 1;
+
+    struct ButtonEdge_t edge;
+    if (xQueueReceive(edges, &edge, ticks) == pdTRUE) {
+      handleEdge(&edge);
+    } else {
+      resync();
+    }
+
+    struct GestureEvent_t event;
+    while (gesture_poll(&gesture, nowMs(), &event)) {
+      sendGesture(&event);
     }
   }
 }
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "cli.h"
+
+#define ESC 27
+#define BACKSPACE '\b'
+#define DELETE 127
+#define BELL '\a'
+
+static const struct CliCommandInfo_t commands[CLI_CMD_COUNT] = {
+  [CLI_CMD_HELP] = { "help", 0, 0, "help - list commands" },
+  [CLI_CMD_CONFIG] = { "config", 0, 0, "config - show the saved settings" },
+  [CLI_CMD_SETUP] = { "setup", 0, 0, "setup - change Wi-Fi, server and call sign" },
+  [CLI_CMD_SHOW] = { "show", 0, CLI_LINE_LEN, "show [<replays> <RRGGBB> <ms> ...] - play a light show, or the test show" },
+  [CLI_CMD_BEEP] = { "beep", 0, CLI_LINE_LEN, "beep [<speaker> <replays> <freq> <ms> ...] - play a song, or the test song" },
+  [CLI_CMD_STATS] = { "stats", 0, 0, "stats - heap, stacks, reconnects and wakes" },
+  [CLI_CMD_BOOT] = { "boot", 0, 0, "boot - how long this boot took to get online" },
+  [CLI_CMD_TRACE] = { "trace", 1, 1, "trace <hex mask> - choose which modules trace" },
+  [CLI_CMD_OTA] = { "ota", 0, 0, "ota - check for and install a firmware update now" },
+  [CLI_CMD_RESTART] = { "restart", 0, 0, "restart - restart the device" },
+};
+
+void cli_init(struct CliEditor_t *editor) {
+  memset(editor, 0, sizeof(*editor));
+}
+
+void cli_set_secret(struct CliEditor_t *editor, bool secret) {
+  editor->secret = secret;
+}
+
+void cli_clear(struct CliEditor_t *editor) {
+  editor->len = 0;
+  editor->line[0] = '\0';
+  editor->escape = CLI_ESC_NONE;
+}
+
+static void echo(struct CliEditor_t *editor, const char *text) {
+  size_t len = strlen(text);
+  memcpy(editor->echo + editor->echoLen, text, len);
+  editor->echoLen += len;
+}
+
+// Returns what the byte finished, if anything, and leaves what should be
+// echoed back in editor->echo.
+enum CliEvent_t cli_feed(struct CliEditor_t *editor, char ch) {
+  editor->echoLen = 0;
+  bool afterCr = editor->afterCr;
+  editor->afterCr = ch == '\r';
+
+  if (editor->escape == CLI_ESC_SEQUENCE) {
+    // Parameters and intermediates until a final byte.
+    if (ch >= 0x40 && ch <= 0x7e) editor->escape = CLI_ESC_NONE;
+    return CLI_NONE;
+  }
+  if (editor->escape == CLI_ESC_START) {
+    if (ch == '[' || ch == 'O') {
+      editor->escape = CLI_ESC_SEQUENCE;
+      return CLI_NONE;
+    }
+    // Something other than a sequence followed, so the ESC was meant.
+    cli_clear(editor);
+    return CLI_CANCEL;
+  }
+
+  if (ch == ESC) {
+    editor->escape = CLI_ESC_START;
+  } else if (ch == '\n' && afterCr) {
+    // The rest of a CR LF.
+  } else if (ch == '\r' || ch == '\n') {
+    editor->line[editor->len] = '\0';
+    editor->len = 0;
+    echo(editor, "\n");
+    return CLI_LINE;
+  } else if (ch == BACKSPACE || ch == DELETE) {
+    if (editor->len > 0) {
+      editor->line[--editor->len] = '\0';
+      echo(editor, "\b \b");
+    }
+  } else if (ch >= ' ' && ch < DELETE) {
+    if (editor->len >= CLI_LINE_LEN - 1) {
+      echo(editor, "\a");
+    } else {
+      editor->line[editor->len++] = ch;
+      editor->line[editor->len] = '\0';
+      char shown[2] = { editor->secret ? '*' : ch, '\0' };
+      echo(editor, shown);
+    }
+  }
+  return CLI_NONE;
+}
+
+// Call when no more input is waiting. An ESC on its own is then a cancel
+// rather than the start of a sequence.
+enum CliEvent_t cli_idle(struct CliEditor_t *editor) {
+  editor->echoLen = 0;
+  if (editor->escape != CLI_ESC_START) return CLI_NONE;
+  cli_clear(editor);
+  return CLI_CANCEL;
+}
+
+static char *skipSpaces(char *ch) {
+  while (*ch == ' ') ch++;
+  return ch;
+}
+
+// Splits line in place into a command and its arguments. Command names are
+// case sensitive.
+enum CliResult_t cli_parse(char *line, struct CliCommand_t *command) {
+  char *ch = skipSpaces(line);
+  if (*ch == '\0') return CLI_EMPTY;
+
+  char *name = ch;
+  while (*ch != ' ' && *ch != '\0') ch++;
+  if (*ch != '\0') *ch++ = '\0';
+  ch = skipSpaces(ch);
+
+  int id;
+  for (id = 0; id < CLI_CMD_COUNT; id++) {
+    if (strcmp(name, commands[id].name) == 0) break;
+  }
+  if (id == CLI_CMD_COUNT) return CLI_UNKNOWN;
+
+  command->id = id;
+  command->rest = ch;
+  command->argc = 0;
+  // Count the arguments without splitting rest, which some commands want whole.
+  for (char *arg = ch; *arg != '\0'; arg = skipSpaces(arg)) {
+    if (command->argc < CLI_MAX_ARGS) command->argv[command->argc] = arg;
+    command->argc++;
+    while (*arg != ' ' && *arg != '\0') arg++;
+  }
+  if (command->argc < commands[id].minArgs || command->argc > commands[id].maxArgs) return CLI_BAD_ARGS;
+  return CLI_OK;
+}
+
+const struct CliCommandInfo_t *cli_command_info(enum CliCommandId_t id) {
+  return id < CLI_CMD_COUNT ? &commands[id] : NULL;
+}
+
+const char *cli_result_name(enum CliResult_t result) {
+  switch (result) {
+  case CLI_OK:
+    return "ok";
+  case CLI_EMPTY:
+    return "empty line";
+  case CLI_UNKNOWN:
+    return "unknown command";
+  case CLI_BAD_ARGS:
+    return "wrong arguments";
+  }
+  return "unknown";
+}
@@ -0,0 +1,89 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The serial console's line editor and command parser. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+//
+// cli_feed takes one byte at a time and says when a line is finished. Lines
+// longer than CLI_LINE_LEN - 1 are cut short rather than overrunning. Escape
+// sequences from arrow keys are skipped; a lone ESC cancels the line, which is
+// only known once no more bytes follow it (cli_idle).
+
+#define CLI_LINE_LEN 64
+#define CLI_MAX_ARGS 8
+#define CLI_ECHO_LEN 4
+
+enum CliEvent_t {
+  CLI_NONE = 0,
+  CLI_LINE,    // line holds a finished line
+  CLI_CANCEL,  // ESC
+};
+
+enum CliEscape_t {
+  CLI_ESC_NONE = 0,
+  CLI_ESC_START,     // ESC seen
+  CLI_ESC_SEQUENCE,  // inside ESC [ ...
+};
+
+struct CliEditor_t {
+  char line[CLI_LINE_LEN];
+  uint8_t len;
+  bool secret;  // echo * instead of what is typed
+  enum CliEscape_t escape;
+  bool afterCr;  // so CR LF ends one line, not two
+  char echo[CLI_ECHO_LEN];  // what to write back after each byte
+  uint8_t echoLen;
+};
+
+enum CliCommandId_t {
+  CLI_CMD_HELP = 0,
+  CLI_CMD_CONFIG,
+  CLI_CMD_SETUP,
+  CLI_CMD_SHOW,
+  CLI_CMD_BEEP,
+  CLI_CMD_STATS,
+  CLI_CMD_BOOT,
+  CLI_CMD_TRACE,
+  CLI_CMD_OTA,
+  CLI_CMD_RESTART,
+  CLI_CMD_COUNT,
+};
+
+enum CliResult_t {
+  CLI_OK = 0,
+  CLI_EMPTY,
+  CLI_UNKNOWN,
+  CLI_BAD_ARGS,
+};
+
+struct CliCommandInfo_t {
+  const char *name;
+  uint8_t minArgs;
+  uint8_t maxArgs;
+  const char *usage;
+};
+
+// argv points at the first CLI_MAX_ARGS arguments within rest, which is left
+// whole for commands that take a show or song. Each runs to the end of the
+// line, so read them with functions that stop at a space.
+struct CliCommand_t {
+  enum CliCommandId_t id;
+  int argc;
+  const char *argv[CLI_MAX_ARGS];
+  const char *rest;
+};
+
+void cli_init(struct CliEditor_t *editor);
+void cli_set_secret(struct CliEditor_t *editor, bool secret);
+enum CliEvent_t cli_feed(struct CliEditor_t *editor, char ch);
+enum CliEvent_t cli_idle(struct CliEditor_t *editor);
+void cli_clear(struct CliEditor_t *editor);
+
+enum CliResult_t cli_parse(char *line, struct CliCommand_t *command);
+const struct CliCommandInfo_t *cli_command_info(enum CliCommandId_t id);
+const char *cli_result_name(enum CliResult_t result);
+
+#endif
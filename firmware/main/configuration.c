@@ -1,6 +1,4 @@
-#include "driver/uart.h"
 #include "esp_log.h"
-#include "esp_vfs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs.h"
@@ -11,12 +9,12 @@
 #include "logging.h"
 #include "configuration.h"
 
-#define MAX_INPUT_LEN 64
 #define NVS_NAMESPACE "config"
 #define NVS_KEY_SSID "wifi_ssid"
 #define NVS_KEY_PASSWORD "wifi_password"
 #define NVS_KEY_SERVER "server"
 #define NVS_KEY_CALLSIGN "callsign"
+#define NVS_KEY_STATIC_IP "static_ip"
 
 enum ConfigState_t {
   IDLE,
@@ -33,8 +31,6 @@ static const char *TAG = "CONFIG";
 static struct AppConfig *loadedConfig = NULL;
 struct AppConfig *editConfig = NULL;
 static enum ConfigState_t config_state = IDLE;
-static char user_input[MAX_INPUT_LEN];
-static int user_idx = 0;
 static bool restartOnCancel = false;
 
 char* stringOrEmpty(char* str) {
@@ -64,7 +60,7 @@ void printPrompt() {
   fsync(fileno(stdout));
 }
 
-void copyToField(char** field, char* value) {  
+void copyToField(char** field, const char* value) {
   if (*field != NULL) {
     free(*field);
   }
@@ -72,21 +68,36 @@ void copyToField(char** field, char* value) {
   *field = malloc(strlen(value) + 1);
   strcpy(*field, value);
 }
+
+// Frees the config and the strings it owns.
+static void freeConfig(struct AppConfig *config) {
+  if (config == NULL) return;
+  free(config->wifi_ssid);
+  free(config->wifi_password);
+  free(config->server);
+  free(config->callsign);
+  free(config->static_ip);
+  free(config);
+}
+
 void setupEditConfig() {
-  if (editConfig != NULL) free(editConfig);
+  freeConfig(editConfig);
 
   editConfig = (struct AppConfig *)malloc(sizeof(struct AppConfig));
   memset(editConfig, 0, sizeof(struct AppConfig));
   copyToField(&editConfig->server, DEFAULT_SERVER);
+  // Copies, since editing frees the old value and setup can be cancelled.
   if (loadedConfig != NULL) {
-    editConfig->wifi_ssid = loadedConfig->wifi_ssid;
-    editConfig->wifi_password = loadedConfig->wifi_password;
-    editConfig->server = loadedConfig->server;
-    editConfig->callsign = loadedConfig->callsign;
+    copyToField(&editConfig->wifi_ssid, loadedConfig->wifi_ssid);
+    copyToField(&editConfig->wifi_password, loadedConfig->wifi_password);
+    copyToField(&editConfig->server, loadedConfig->server);
+    copyToField(&editConfig->callsign, loadedConfig->callsign);
   }
 }
 
-void start_set_config() {
+// Starts asking for settings. If they are required, cancelling restarts.
+void config_setup_start(bool required) {
+  restartOnCancel = required;
   disable_logging();
   setupEditConfig();
 
@@ -121,89 +132,63 @@ void endSetConfig(bool commit) {
       esp_restart();
     }
   }
-  free(editConfig);
+  freeConfig(editConfig);
+  editConfig = NULL;
 }
 
-void handleBasicInput(char** field, enum ConfigState_t nextState) {
-  if (user_idx == 0 && field == NULL) {
-    // do nothing. User needs to repeat the last step.
+static void handleBasicInput(const char *line, char **field, enum ConfigState_t nextState) {
+  if (line[0] == '\0' && *field == NULL) {
+    // Nothing to keep. The user needs to answer again.
   } else {
-    if (user_idx > 0) {
-      copyToField(field, user_input);
+    if (line[0] != '\0') {
+      copyToField(field, line);
     }
     config_state = nextState;
   }
   printPrompt();
 }
 
-void handleUserInput() {
+// Takes a line typed at one of the setup prompts.
+void config_setup_line(const char *line) {
   if (config_state == IDLE) return;
-  
+
+  putchar('\n');
   if (config_state == WIFI_PROMPT) {
-    handleBasicInput(&editConfig->wifi_ssid, PASSWORD_PROMPT);
+    handleBasicInput(line, &editConfig->wifi_ssid, PASSWORD_PROMPT);
   } else if (config_state == PASSWORD_PROMPT) {
-    handleBasicInput(&editConfig->wifi_password, SERVER_PROMPT);
+    handleBasicInput(line, &editConfig->wifi_password, SERVER_PROMPT);
   } else if (config_state == SERVER_PROMPT) {
-    handleBasicInput(&editConfig->server, CALLSIGN_PROMPT);
+    handleBasicInput(line, &editConfig->server, CALLSIGN_PROMPT);
   } else if (config_state == CALLSIGN_PROMPT) {
-    handleBasicInput(&editConfig->callsign, REVIEW);
+    handleBasicInput(line, &editConfig->callsign, REVIEW);
   } else if (config_state == REVIEW) {
     endSetConfig(true);
   }
 }
 
-void configure_task(void *args) {
-  if (config_read() == NULL) {
-    restartOnCancel = true;
-    start_set_config();
-  }
-  
-  while (1) {
-    if (config_state == IDLE) {
-      char c = getchar();
-      if (c == 10) {
-        start_set_config();
-      }
-      vTaskDelay(500 / portTICK_PERIOD_MS);
-    } else {
-      char c = getchar();
-      if (c == 0 || c == 255) {
-        // wait for more input
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-      } else if (c == '\r') {
-        // do nothing
-      } else {
-        if (c == 27) {          
-          putchar('\n');
-          endSetConfig(false);
-        } else if (c == '\n') {
-          user_input[user_idx] = 0;
-          putchar('\n');
-          putchar('\n');
-          handleUserInput(c);
-          user_idx = 0;
-        } else if (c == '\b') {
-          if (user_idx > 0) {
-            putchar('\b');
-            putchar(' ');
-            putchar('\b');
-            user_input[user_idx] = 0;
-            user_idx--;
-          }
-        } else if (c > 20 && c < 128) {
-          user_input[user_idx] = c;
-          if (user_idx < MAX_INPUT_LEN) {
-            user_idx++;
-            user_input[user_idx] = 0;
-          } else {
-            putchar('\b');
-          }
-          putchar(c);
-        }
-        fsync(fileno(stdout));
-      }
-    }
+void config_setup_cancel() {
+  if (config_state == IDLE) return;
+  putchar('\n');
+  endSetConfig(false);
+}
+
+bool config_setup_active() {
+  return config_state != IDLE;
+}
+
+// Whether what is being typed should be hidden.
+bool config_setup_secret() {
+  return config_state == PASSWORD_PROMPT;
+}
+
+void config_print() {
+  struct AppConfig *config = config_read();
+  if (config == NULL) {
+    printf("Not configured. Use setup.\n");
+    return;
   }
+  printf("SSID: %s\nPassword: [hidden]\nServer: %s\nCall sign: %s\nStatic IP: %s\n", config->wifi_ssid,
+         config->server, config->callsign, config->static_ip != NULL ? config->static_ip : "(DHCP)");
 }
 
 esp_err_t read_string(nvs_handle_t handle, const char* key, char** field) {
@@ -213,7 +198,10 @@ esp_err_t read_string(nvs_handle_t handle, const char* key, char** field) {
 
   char* value = malloc(size);
   err = nvs_get_str(handle, key, value, &size);
-  if (err != ESP_OK) return err;
+  if (err != ESP_OK) {
+    free(value);
+    return err;
+  }
 
   *field = value;
   return ESP_OK;
@@ -221,41 +209,29 @@ esp_err_t read_string(nvs_handle_t handle, const char* key, char** field) {
 
 struct AppConfig* config_read() {
   if (loadedConfig == NULL) {
-    struct AppConfig *newConfig = (struct AppConfig *)malloc(sizeof(struct AppConfig));
     nvs_handle_t my_handle;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle);
     if (err != ESP_OK) {
       ESP_LOGE(TAG, "Error (%s) opening NVS handle!\n", esp_err_to_name(err));
-      nvs_close(my_handle);
       return NULL;
-    } else {
-      err = read_string(my_handle, NVS_KEY_SSID, &newConfig->wifi_ssid);
-      if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Configuration missing");
-        return NULL;
-      }
-
-      err = read_string(my_handle, NVS_KEY_PASSWORD, &newConfig->wifi_password);
-      if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Configuration missing");
-        return NULL;
-      }
-
-      err = read_string(my_handle, NVS_KEY_SERVER, &newConfig->server);
-      if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Configuration missing");
-        return NULL;
-      }
+    }
 
-      err = read_string(my_handle, NVS_KEY_CALLSIGN, &newConfig->callsign);
-      if (err != ESP_OK) {
-        ESP_LOGW(TAG, "Configuration missing");
-        return NULL;
-      }
+    struct AppConfig *newConfig = (struct AppConfig *)malloc(sizeof(struct AppConfig));
+    memset(newConfig, 0, sizeof(struct AppConfig));
+    err = read_string(my_handle, NVS_KEY_SSID, &newConfig->wifi_ssid);
+    if (err == ESP_OK) err = read_string(my_handle, NVS_KEY_PASSWORD, &newConfig->wifi_password);
+    if (err == ESP_OK) err = read_string(my_handle, NVS_KEY_SERVER, &newConfig->server);
+    if (err == ESP_OK) err = read_string(my_handle, NVS_KEY_CALLSIGN, &newConfig->callsign);
+    // Optional.
+    if (err == ESP_OK) read_string(my_handle, NVS_KEY_STATIC_IP, &newConfig->static_ip);
+    nvs_close(my_handle);
 
-      nvs_close(my_handle);
-      loadedConfig = newConfig;
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Configuration missing");
+      freeConfig(newConfig);
+      return NULL;
     }
+    loadedConfig = newConfig;
   }
   return loadedConfig;
 }
\ No newline at end of file
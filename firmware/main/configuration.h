@@ -1,13 +1,26 @@
 #ifndef CONFIGURATION_H
 #define CONFIGURATION_H
 
+#include <stdbool.h>
+
 struct AppConfig {
   char *wifi_ssid;
   char *wifi_password;
   char *server;
   char *callsign;
+  // "<ip> <netmask> <gateway> [<dns>]" to skip DHCP, or NULL. Not prompted for;
+  // set the static_ip key directly.
+  char *static_ip;
 };
 
 struct AppConfig *config_read();
-void configure_task(void *args);
+void config_print();
+
+// Setup asks for each setting in turn. The console feeds it whole lines while
+// it is active. Committing saves to NVS and restarts.
+void config_setup_start(bool required);
+bool config_setup_active();
+bool config_setup_secret();
+void config_setup_line(const char *line);
+void config_setup_cancel();
 #endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_vfs_dev.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "configuration.h"
+#include "console.h"
+#include "led.h"
+#include "logging.h"
+#include "ota.h"
+#include "power.h"
+#include "speaker.h"
+#include "telemetry.h"
+
+#define CONSOLE_UART CONFIG_ESP_CONSOLE_UART_NUM
+#define CONSOLE_RX_BUFFER 256
+#define CONSOLE_QUEUE_LEN 8
+#define CONSOLE_MESSAGE_LEN 256
+// Edges on RX needed to wake from light sleep. The byte that wakes the chip is
+// lost, so the first key after a quiet period may need pressing twice.
+#define CONSOLE_WAKE_EDGES 3
+
+#define TEST_SHOW "10 FF0000 1000 00FF00 1000 0000FF 1000"
+#define TEST_SONG "0 3 1000 500 0 100 1000 500 0 100 1000 750 0 500"
+
+static const char *TAG = "CONSOLE";
+
+static struct CliEditor_t editor;
+
+static void flushOut() {
+  fflush(stdout);
+  fsync(fileno(stdout));
+}
+
+static void printPrompt() {
+  if (config_setup_active()) return;
+  printf("> ");
+  flushOut();
+}
+
+static void printHelp() {
+  for (int i = 0; i < CLI_CMD_COUNT; i++) {
+    printf("  %s\n", cli_command_info(i)->usage);
+  }
+}
+
+static void printMessage(int len, const char *message) {
+  if (len < 0) {
+    printf("Doesn't fit\n");
+  } else {
+    printf("%s\n", message);
+  }
+}
+
+static void runCommand(const struct CliCommand_t *command) {
+  char message[CONSOLE_MESSAGE_LEN];
+
+  switch (command->id) {
+    case CLI_CMD_HELP:
+      printHelp();
+      break;
+    case CLI_CMD_CONFIG:
+      config_print();
+      break;
+    case CLI_CMD_SETUP:
+      config_setup_start(false);
+      break;
+    case CLI_CMD_SHOW:
+      led_show(ARBITER_FEEDBACK, command->argc > 0 ? command->rest : TEST_SHOW);
+      break;
+    case CLI_CMD_BEEP:
+      speaker_play(ARBITER_FEEDBACK, command->argc > 0 ? command->rest : TEST_SONG);
+      break;
+    case CLI_CMD_STATS:
+      printMessage(telemetry_format_stats(message, sizeof(message)), message);
+      break;
+    case CLI_CMD_BOOT:
+      printMessage(telemetry_format_boot(message, sizeof(message)), message);
+      break;
+    case CLI_CMD_TRACE:
+      logging_set_trace_mask(strtoul(command->argv[0], NULL, 16));
+      break;
+    case CLI_CMD_OTA:
+      ota_start_update();
+      break;
+    case CLI_CMD_RESTART:
+      esp_restart();
+      break;
+    default:
+      break;
+  }
+}
+
+static void handleLine(char *line) {
+  if (config_setup_active()) {
+    config_setup_line(line);
+    return;
+  }
+
+  struct CliCommand_t command;
+  enum CliResult_t result = cli_parse(line, &command);
+  if (result == CLI_UNKNOWN) {
+    printf("Unknown command. Try help.\n");
+  } else if (result == CLI_BAD_ARGS) {
+    printf("Usage: %s\n", cli_command_info(command.id)->usage);
+  } else if (result == CLI_OK) {
+    runCommand(&command);
+  }
+}
+
+static void handleEvent(enum CliEvent_t event) {
+  if (event == CLI_LINE) {
+    handleLine(editor.line);
+    cli_clear(&editor);
+    printPrompt();
+  } else if (event == CLI_CANCEL) {
+    if (config_setup_active()) {
+      config_setup_cancel();
+    } else {
+      printf("\n");
+    }
+    printPrompt();
+  }
+}
+
+static void readInput() {
+  uint8_t bytes[32];
+  int count;
+  while ((count = uart_read_bytes(CONSOLE_UART, bytes, sizeof(bytes), 0)) > 0) {
+    for (int i = 0; i < count; i++) {
+      enum CliEvent_t event = cli_feed(&editor, bytes[i]);
+      fwrite(editor.echo, 1, editor.echoLen, stdout);
+      handleEvent(event);
+      cli_set_secret(&editor, config_setup_secret());
+    }
+  }
+  // Whatever arrived is read. A lone ESC with nothing after it is a cancel.
+  handleEvent(cli_idle(&editor));
+  flushOut();
+}
+
+// Keeps the chip awake while something is half typed, so the UART doesn't
+// drop the rest of it entering light sleep.
+static void updatePowerLock() {
+  if (editor.len > 0 || editor.escape != CLI_ESC_NONE || config_setup_active()) {
+    power_hold(POWER_CONSOLE);
+  } else {
+    power_release(POWER_CONSOLE);
+  }
+}
+
+// Blocks on the UART driver's event queue, so the task only runs when bytes
+// arrive instead of polling getchar.
+void console_task(void *args) {
+  ESP_LOGI(TAG, "Task is starting ...");
+
+  QueueHandle_t events;
+  ESP_ERROR_CHECK(uart_driver_install(CONSOLE_UART, CONSOLE_RX_BUFFER, 0, CONSOLE_QUEUE_LEN, &events, 0));
+  esp_vfs_dev_uart_use_driver(CONSOLE_UART);
+  uart_set_wakeup_threshold(CONSOLE_UART, CONSOLE_WAKE_EDGES);
+  esp_sleep_enable_uart_wakeup(CONSOLE_UART);
+
+  cli_init(&editor);
+  if (config_read() == NULL) {
+    config_setup_start(true);
+  } else {
+    printPrompt();
+  }
+  cli_set_secret(&editor, config_setup_secret());
+  updatePowerLock();
+
+  uart_event_t event;
+  while (1) {
+    if (!xQueueReceive(events, &event, portMAX_DELAY)) continue;
+
+    if (event.type == UART_DATA) {
+      readInput();
+    } else if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+      ESP_LOGW(TAG, "Input overflowed");
+      uart_flush_input(CONSOLE_UART);
+      xQueueReset(events);
+      cli_clear(&editor);
+      printPrompt();
+    }
+    updatePowerLock();
+  }
+}
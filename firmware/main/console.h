@@ -0,0 +1,6 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+void console_task(void *args);
+
+#endif
@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include "delta.h"
+
+enum DeltaState_t {
+  STATE_HEADER,
+  STATE_OP,
+  STATE_ARGS,
+  STATE_DATA,
+  STATE_DONE,
+};
+
+static uint32_t readU32(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static uint8_t argsLength(uint8_t op) {
+  return op == DELTA_OP_COPY ? 8 : 4;
+}
+
+// Collects up to want bytes of a fixed size field. Returns true once it is full.
+static bool collect(struct DeltaPatch_t *patch, uint8_t want, const uint8_t **data, uint32_t *len) {
+  uint32_t take = want - patch->fieldLen;
+  if (take > *len) take = *len;
+  memcpy(patch->field + patch->fieldLen, *data, take);
+  patch->fieldLen += take;
+  *data += take;
+  *len -= take;
+  return patch->fieldLen == want;
+}
+
+static enum DeltaResult_t copySource(struct DeltaPatch_t *patch, uint32_t offset, uint32_t count) {
+  if (offset > patch->sourceLen || count > patch->sourceLen - offset) return DELTA_ERR_RANGE;
+  if (count > patch->targetLen - patch->written) return DELTA_ERR_RANGE;
+
+  uint8_t chunk[DELTA_COPY_CHUNK];
+  while (count > 0) {
+    uint32_t n = count < sizeof(chunk) ? count : sizeof(chunk);
+    if (!patch->read(patch->ctx, offset, chunk, n) || !patch->write(patch->ctx, chunk, n)) return DELTA_ERR_IO;
+    offset += n;
+    count -= n;
+    patch->written += n;
+  }
+  return DELTA_OK;
+}
+
+// Runs the operation whose arguments are in field.
+static enum DeltaResult_t startOp(struct DeltaPatch_t *patch) {
+  if (patch->op == DELTA_OP_COPY) {
+    enum DeltaResult_t result = copySource(patch, readU32(patch->field), readU32(patch->field + 4));
+    patch->state = STATE_OP;
+    return result;
+  }
+
+  patch->remaining = readU32(patch->field);
+  if (patch->remaining > patch->targetLen - patch->written) return DELTA_ERR_RANGE;
+  patch->state = patch->remaining > 0 ? STATE_DATA : STATE_OP;
+  return DELTA_OK;
+}
+
+void delta_begin(struct DeltaPatch_t *patch, uint32_t sourceLen, DeltaRead_t read, DeltaWrite_t write, void *ctx) {
+  memset(patch, 0, sizeof(*patch));
+  patch->read = read;
+  patch->write = write;
+  patch->ctx = ctx;
+  patch->sourceLen = sourceLen;
+  patch->state = STATE_HEADER;
+}
+
+// Feeds the next len bytes of the delta, in chunks of any size. Returns
+// DELTA_DONE once the whole image has been written.
+enum DeltaResult_t delta_feed(struct DeltaPatch_t *patch, const uint8_t *data, uint32_t len) {
+  while (len > 0) {
+    enum DeltaResult_t result = DELTA_OK;
+    switch (patch->state) {
+    case STATE_HEADER:
+      if (!collect(patch, DELTA_HEADER_LEN, &data, &len)) break;
+      if (memcmp(patch->field, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0) return DELTA_ERR_MAGIC;
+      patch->targetLen = readU32(patch->field + DELTA_MAGIC_LEN);
+      patch->fieldLen = 0;
+      patch->state = patch->targetLen > 0 ? STATE_OP : STATE_DONE;
+      break;
+
+    case STATE_OP:
+      patch->op = *data++;
+      len--;
+      if (patch->op != DELTA_OP_COPY && patch->op != DELTA_OP_DATA) return DELTA_ERR_OP;
+      patch->state = STATE_ARGS;
+      break;
+
+    case STATE_ARGS:
+      if (!collect(patch, argsLength(patch->op), &data, &len)) break;
+      patch->fieldLen = 0;
+      result = startOp(patch);
+      break;
+
+    case STATE_DATA: {
+      uint32_t take = len < patch->remaining ? len : patch->remaining;
+      if (!patch->write(patch->ctx, data, take)) return DELTA_ERR_IO;
+      data += take;
+      len -= take;
+      patch->written += take;
+      patch->remaining -= take;
+      if (patch->remaining == 0) patch->state = STATE_OP;
+      break;
+    }
+
+    case STATE_DONE:
+      // Nothing may follow the last operation.
+      return DELTA_ERR_OP;
+    }
+
+    if (result != DELTA_OK) return result;
+    if (patch->state == STATE_OP && patch->written == patch->targetLen) patch->state = STATE_DONE;
+  }
+  return patch->state == STATE_DONE ? DELTA_DONE : DELTA_OK;
+}
+
+bool delta_is_patch(const uint8_t *data, uint32_t len) {
+  return len >= DELTA_MAGIC_LEN && memcmp(data, DELTA_MAGIC, DELTA_MAGIC_LEN) == 0;
+}
+
+const char *delta_result_name(enum DeltaResult_t result) {
+  switch (result) {
+  case DELTA_OK:
+    return "ok";
+  case DELTA_DONE:
+    return "done";
+  case DELTA_ERR_MAGIC:
+    return "not a delta";
+  case DELTA_ERR_OP:
+    return "bad operation";
+  case DELTA_ERR_RANGE:
+    return "out of range";
+  case DELTA_ERR_IO:
+    return "read or write failed";
+  }
+  return "unknown";
+}
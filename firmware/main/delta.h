@@ -0,0 +1,61 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Applies a firmware delta against the running image as it streams in. Plain C
+// with no ESP-IDF dependencies so it can be built and exercised on a host
+// machine. The server side encoder is src/lib/server/firmwareDelta.ts.
+//
+// A delta is the magic "NDL1", the uint32 length of the image it produces and
+// then operations until that many bytes have been produced. Integers are
+// little-endian.
+//
+//   DELTA_OP_COPY  uint32 source offset, uint32 length
+//   DELTA_OP_DATA  uint32 length, then that many bytes of new image
+
+#define DELTA_MAGIC "NDL1"
+#define DELTA_MAGIC_LEN 4
+#define DELTA_HEADER_LEN 8
+#define DELTA_COPY_CHUNK 512
+
+enum DeltaOp_t {
+  DELTA_OP_COPY = 1,
+  DELTA_OP_DATA = 2,
+};
+
+enum DeltaResult_t {
+  DELTA_OK = 0,
+  DELTA_DONE,
+  DELTA_ERR_MAGIC,
+  DELTA_ERR_OP,
+  DELTA_ERR_RANGE,
+  DELTA_ERR_IO,
+};
+
+// Reads len bytes of the running image at offset.
+typedef bool (*DeltaRead_t)(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+// Appends len bytes to the new image.
+typedef bool (*DeltaWrite_t)(void *ctx, const uint8_t *data, uint32_t len);
+
+struct DeltaPatch_t {
+  DeltaRead_t read;
+  DeltaWrite_t write;
+  void *ctx;
+  uint32_t sourceLen;
+  uint32_t targetLen;
+  uint32_t written;
+  uint8_t state;
+  uint8_t op;
+  uint8_t field[DELTA_HEADER_LEN];
+  uint8_t fieldLen;
+  uint32_t remaining;  // bytes left in the current DATA operation
+};
+
+void delta_begin(struct DeltaPatch_t *patch, uint32_t sourceLen, DeltaRead_t read, DeltaWrite_t write, void *ctx);
+enum DeltaResult_t delta_feed(struct DeltaPatch_t *patch, const uint8_t *data, uint32_t len);
+bool delta_is_patch(const uint8_t *data, uint32_t len);
+const char *delta_result_name(enum DeltaResult_t result);
+
+#endif
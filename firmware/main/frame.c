@@ -0,0 +1,115 @@
+#include <stddef.h>
+
+#include "frame.h"
+
+static uint16_t readU16(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8);
+}
+
+static uint32_t itemLength(uint8_t type) {
+  if (type == FRAME_LED) return FRAME_LED_STEP_LEN;
+  if (type == FRAME_BEEP) return FRAME_BEEP_NOTE_LEN;
+  return 0;
+}
+
+// Checks one record starting at offset, returning its total length or 0 if it
+// is malformed.
+static uint32_t checkRecord(const uint8_t *data, uint32_t len, uint32_t offset, enum FrameResult_t *result) {
+  if (len - offset < FRAME_RECORD_HEADER_LEN) {
+    *result = FRAME_ERR_TRUNCATED;
+    return 0;
+  }
+  uint8_t type = data[offset];
+  uint32_t valueLen = readU16(data + offset + 1);
+  if (len - offset - FRAME_RECORD_HEADER_LEN < valueLen) {
+    *result = FRAME_ERR_TRUNCATED;
+    return 0;
+  }
+
+  if (type == FRAME_PRIORITY && valueLen != FRAME_PRIORITY_LEN) {
+    *result = FRAME_ERR_LENGTH;
+    return 0;
+  }
+  uint32_t stride = itemLength(type);
+  if (stride > 0 && (valueLen < FRAME_COMMAND_HEADER_LEN || (valueLen - FRAME_COMMAND_HEADER_LEN) % stride != 0)) {
+    *result = FRAME_ERR_LENGTH;
+    return 0;
+  }
+  return FRAME_RECORD_HEADER_LEN + valueLen;
+}
+
+enum FrameResult_t frame_open(struct FrameReader_t *reader, const uint8_t *data, uint32_t len) {
+  reader->data = data;
+  reader->len = len;
+  reader->offset = FRAME_HEADER_LEN;
+  reader->priority = FRAME_NO_PRIORITY;
+
+  if (len < FRAME_HEADER_LEN) return FRAME_ERR_TRUNCATED;
+  if (data[0] != FRAME_VERSION) return FRAME_ERR_VERSION;
+
+  // Validate every record up front so a bad frame is rejected before any of
+  // it has been acted on.
+  enum FrameResult_t result = FRAME_OK;
+  for (uint32_t offset = FRAME_HEADER_LEN; offset < len;) {
+    uint32_t recordLen = checkRecord(data, len, offset, &result);
+    if (recordLen == 0) return result;
+    offset += recordLen;
+  }
+  return FRAME_OK;
+}
+
+enum FrameResult_t frame_next(struct FrameReader_t *reader, struct FrameRecord_t *record) {
+  while (reader->offset < reader->len) {
+    const uint8_t *ptr = reader->data + reader->offset;
+    uint8_t type = ptr[0];
+    uint32_t valueLen = readU16(ptr + 1);
+    reader->offset += FRAME_RECORD_HEADER_LEN + valueLen;
+
+    const uint8_t *value = ptr + FRAME_RECORD_HEADER_LEN;
+    if (type == FRAME_PRIORITY) {
+      reader->priority = value[0];
+      continue;
+    }
+    uint32_t stride = itemLength(type);
+    if (stride == 0) continue;
+
+    record->type = type;
+    record->target = value[0];
+    record->replays = (int16_t)readU16(value + 1);
+    record->count = (valueLen - FRAME_COMMAND_HEADER_LEN) / stride;
+    record->priority = reader->priority;
+    record->items = value + FRAME_COMMAND_HEADER_LEN;
+    return FRAME_OK;
+  }
+  return FRAME_END;
+}
+
+void frame_led_step(const struct FrameRecord_t *record, int idx, uint8_t rgb[3], uint16_t *ms) {
+  const uint8_t *item = record->items + idx * FRAME_LED_STEP_LEN;
+  rgb[0] = item[0];
+  rgb[1] = item[1];
+  rgb[2] = item[2];
+  *ms = readU16(item + 3);
+}
+
+void frame_beep_note(const struct FrameRecord_t *record, int idx, uint16_t *freq, uint16_t *ms) {
+  const uint8_t *item = record->items + idx * FRAME_BEEP_NOTE_LEN;
+  *freq = readU16(item);
+  *ms = readU16(item + 2);
+}
+
+const char *frame_result_name(enum FrameResult_t result) {
+  switch (result) {
+  case FRAME_OK:
+    return "ok";
+  case FRAME_END:
+    return "end of frame";
+  case FRAME_ERR_VERSION:
+    return "unsupported version";
+  case FRAME_ERR_TRUNCATED:
+    return "truncated";
+  case FRAME_ERR_LENGTH:
+    return "bad record length";
+  }
+  return "unknown";
+}
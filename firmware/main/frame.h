@@ -0,0 +1,68 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decoder for binary command frames (websocket opcode 2). Plain C with no
+// ESP-IDF dependencies so it can be built and exercised on a host machine.
+//
+// A frame is a version byte followed by records. Every record is a type byte,
+// a little-endian uint16 value length and the value. Multi-byte fields are
+// little-endian.
+//
+//   FRAME_LED   uint8 target, int16 replays, then steps of
+//               { uint8 r, uint8 g, uint8 b, uint16 ms }
+//   FRAME_BEEP  uint8 speaker, int16 replays, then notes of
+//               { uint16 freq, uint16 ms }
+//   FRAME_PRIORITY  uint8 layer (see arbiter.h) for the records after it in
+//               the same frame
+//
+// Records of unknown type are skipped so newer servers can add them.
+
+#define FRAME_VERSION 1
+#define FRAME_HEADER_LEN 1
+#define FRAME_RECORD_HEADER_LEN 3
+#define FRAME_COMMAND_HEADER_LEN 3
+#define FRAME_LED_STEP_LEN 5
+#define FRAME_BEEP_NOTE_LEN 4
+#define FRAME_PRIORITY_LEN 1
+#define FRAME_NO_PRIORITY -1
+
+enum FrameType_t {
+  FRAME_LED = 1,
+  FRAME_BEEP = 2,
+  FRAME_PRIORITY = 3,
+};
+
+enum FrameResult_t {
+  FRAME_OK = 0,
+  FRAME_END,
+  FRAME_ERR_VERSION,
+  FRAME_ERR_TRUNCATED,
+  FRAME_ERR_LENGTH,
+};
+
+struct FrameReader_t {
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t offset;
+  int16_t priority;
+};
+
+struct FrameRecord_t {
+  uint8_t type;
+  uint8_t target;
+  int16_t replays;
+  uint16_t count;
+  int16_t priority;  // FRAME_NO_PRIORITY unless a FRAME_PRIORITY record came first
+  const uint8_t *items;
+};
+
+enum FrameResult_t frame_open(struct FrameReader_t *reader, const uint8_t *data, uint32_t len);
+enum FrameResult_t frame_next(struct FrameReader_t *reader, struct FrameRecord_t *record);
+void frame_led_step(const struct FrameRecord_t *record, int idx, uint8_t rgb[3], uint16_t *ms);
+void frame_beep_note(const struct FrameRecord_t *record, int idx, uint16_t *freq, uint16_t *ms);
+const char *frame_result_name(enum FrameResult_t result);
+
+#endif
@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "gesture.h"
+
+void gesture_init(struct Gesture_t *gesture, uint8_t count) {
+  memset(gesture, 0, sizeof(*gesture));
+  gesture->count = count > GESTURE_MAX_BUTTONS ? GESTURE_MAX_BUTTONS : count;
+  for (int i = 0; i < GESTURE_MAX_BUTTONS; i++) {
+    // So the first edge is never inside the debounce window.
+    gesture->buttons[i].lastEdgeMs = -GESTURE_DEBOUNCE_MS;
+  }
+}
+
+static bool emit(struct GestureEvent_t *event, enum GestureType_t type, uint8_t buttons, uint32_t timeMs) {
+  event->type = type;
+  event->buttons = buttons;
+  event->timeMs = timeMs;
+  return true;
+}
+
+static void setState(struct GestureButton_t *button, enum GestureState_t state, uint32_t timeMs) {
+  button->state = state;
+  button->stateSince = timeMs;
+}
+
+static void joinChord(struct Gesture_t *gesture, uint32_t timeMs) {
+  gesture->chord |= gesture->held;
+  for (int i = 0; i < gesture->count; i++) {
+    if (gesture->held & (1 << i)) setState(&gesture->buttons[i], GESTURE_IN_CHORD, timeMs);
+  }
+}
+
+static bool pressed(struct Gesture_t *gesture, uint8_t index, uint32_t timeMs, struct GestureEvent_t *event) {
+  struct GestureButton_t *button = &gesture->buttons[index];
+  uint8_t bit = 1 << index;
+  gesture->held |= bit;
+
+  if (gesture->held != bit || gesture->chord != 0) {
+    joinChord(gesture, timeMs);
+    return false;
+  }
+
+  if (button->state == GESTURE_RELEASED) {
+    if (timeMs - button->stateSince < GESTURE_DOUBLE_GAP_MS) {
+      setState(button, GESTURE_DOWN_AGAIN, timeMs);
+      return false;
+    }
+    // Nobody polled after the first press, so report it now.
+    uint32_t releasedAt = button->stateSince;
+    setState(button, GESTURE_DOWN, timeMs);
+    return emit(event, GESTURE_PRESS, bit, releasedAt);
+  }
+  setState(button, GESTURE_DOWN, timeMs);
+  return false;
+}
+
+static bool released(struct Gesture_t *gesture, uint8_t index, uint32_t timeMs, struct GestureEvent_t *event) {
+  struct GestureButton_t *button = &gesture->buttons[index];
+  uint8_t bit = 1 << index;
+  gesture->held &= ~bit;
+
+  if (gesture->chord != 0) {
+    if (gesture->held != 0) return false;
+    uint8_t chord = gesture->chord;
+    gesture->chord = 0;
+    for (int i = 0; i < gesture->count; i++) {
+      if (chord & (1 << i)) setState(&gesture->buttons[i], GESTURE_IDLE, timeMs);
+    }
+    return emit(event, GESTURE_CHORD, chord, timeMs);
+  }
+
+  enum GestureState_t state = button->state;
+  bool wasLong = timeMs - button->stateSince >= GESTURE_LONG_MS;
+  if ((state == GESTURE_DOWN || state == GESTURE_DOWN_AGAIN) && wasLong) {
+    // Nobody polled while it was held.
+    uint32_t pressedAt = button->stateSince;
+    setState(button, GESTURE_IDLE, timeMs);
+    return emit(event, GESTURE_LONG, bit, pressedAt);
+  }
+  if (state == GESTURE_DOWN) {
+    setState(button, GESTURE_RELEASED, timeMs);
+    return false;
+  }
+  setState(button, GESTURE_IDLE, timeMs);
+  return state == GESTURE_DOWN_AGAIN && emit(event, GESTURE_DOUBLE, bit, timeMs);
+}
+
+// Returns true and fills in event if the edge completes a gesture. Repeated
+// edges, and edges within GESTURE_DEBOUNCE_MS of the last one, are ignored.
+bool gesture_edge(struct Gesture_t *gesture, uint8_t button, bool down, uint32_t timeMs, struct GestureEvent_t *event) {
+  if (button >= gesture->count) return false;
+  struct GestureButton_t *state = &gesture->buttons[button];
+  if (down == state->down || timeMs - state->lastEdgeMs < GESTURE_DEBOUNCE_MS) return false;
+
+  state->down = down;
+  state->lastEdgeMs = timeMs;
+  return down ? pressed(gesture, button, timeMs, event) : released(gesture, button, timeMs, event);
+}
+
+static bool deadline(const struct GestureButton_t *button, uint32_t *due) {
+  switch (button->state) {
+    case GESTURE_DOWN:
+    case GESTURE_DOWN_AGAIN:
+      *due = button->stateSince + GESTURE_LONG_MS;
+      return true;
+    case GESTURE_RELEASED:
+      *due = button->stateSince + GESTURE_DOUBLE_GAP_MS;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true and fills in event for a gesture that is complete by nowMs. Call
+// until it returns false.
+bool gesture_poll(struct Gesture_t *gesture, uint32_t nowMs, struct GestureEvent_t *event) {
+  for (int i = 0; i < gesture->count; i++) {
+    struct GestureButton_t *button = &gesture->buttons[i];
+    uint32_t due;
+    if (!deadline(button, &due) || (int32_t)(nowMs - due) < 0) continue;
+
+    if (button->state == GESTURE_RELEASED) {
+      uint32_t releasedAt = button->stateSince;
+      setState(button, GESTURE_IDLE, due);
+      return emit(event, GESTURE_PRESS, 1 << i, releasedAt);
+    }
+    // A long hold on the second press of a double counts as a long press.
+    setState(button, GESTURE_HELD_LONG, due);
+    return emit(event, GESTURE_LONG, 1 << i, due);
+  }
+  return false;
+}
+
+// Milliseconds from nowMs until gesture_poll has something to report, 0 if it
+// already does, or GESTURE_NO_DEADLINE if nothing is pending.
+uint32_t gesture_next_deadline_ms(const struct Gesture_t *gesture, uint32_t nowMs) {
+  uint32_t next = GESTURE_NO_DEADLINE;
+  for (int i = 0; i < gesture->count; i++) {
+    uint32_t due;
+    if (!deadline(&gesture->buttons[i], &due)) continue;
+    uint32_t wait = (int32_t)(due - nowMs) > 0 ? due - nowMs : 0;
+    if (wait < next) next = wait;
+  }
+  return next;
+}
+
+const char *gesture_type_name(enum GestureType_t type) {
+  switch (type) {
+    case GESTURE_PRESS: return "PRESS";
+    case GESTURE_LONG: return "LONG";
+    case GESTURE_DOUBLE: return "DOUBLE";
+    case GESTURE_CHORD: return "CHORD";
+    default: return "UNKNOWN";
+  }
+}
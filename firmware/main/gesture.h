@@ -0,0 +1,63 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Turns debounced button edges into presses, long presses, double presses and
+// chords. Plain C with no ESP-IDF dependencies so it can be built and
+// exercised on a host machine.
+//
+// Feed it every edge with gesture_edge, and call gesture_poll by the deadline
+// gesture_next_deadline_ms gives, since a long press or a single press is only
+// known once enough time has passed without another edge.
+
+#define GESTURE_MAX_BUTTONS 8
+#define GESTURE_DEBOUNCE_MS 20
+#define GESTURE_LONG_MS 800
+#define GESTURE_DOUBLE_GAP_MS 300
+#define GESTURE_NO_DEADLINE UINT32_MAX
+
+enum GestureType_t {
+  GESTURE_PRESS = 1,
+  GESTURE_LONG,
+  GESTURE_DOUBLE,
+  GESTURE_CHORD,  // two or more buttons down together, reported once all are released
+};
+
+enum GestureState_t {
+  GESTURE_IDLE = 0,
+  GESTURE_DOWN,
+  GESTURE_RELEASED,    // might still become a double press
+  GESTURE_DOWN_AGAIN,
+  GESTURE_HELD_LONG,   // long press already reported, waiting for release
+  GESTURE_IN_CHORD,
+};
+
+struct GestureEvent_t {
+  enum GestureType_t type;
+  uint8_t buttons;  // bit per button. Only chords have more than one.
+  uint32_t timeMs;
+};
+
+struct GestureButton_t {
+  uint8_t state;
+  bool down;
+  uint32_t lastEdgeMs;
+  uint32_t stateSince;
+};
+
+struct Gesture_t {
+  uint8_t count;
+  uint8_t held;   // buttons down now
+  uint8_t chord;  // buttons in the chord being made, 0 if there isn't one
+  struct GestureButton_t buttons[GESTURE_MAX_BUTTONS];
+};
+
+void gesture_init(struct Gesture_t *gesture, uint8_t count);
+bool gesture_edge(struct Gesture_t *gesture, uint8_t button, bool down, uint32_t timeMs, struct GestureEvent_t *event);
+bool gesture_poll(struct Gesture_t *gesture, uint32_t nowMs, struct GestureEvent_t *event);
+uint32_t gesture_next_deadline_ms(const struct Gesture_t *gesture, uint32_t nowMs);
+const char *gesture_type_name(enum GestureType_t type);
+
+#endif
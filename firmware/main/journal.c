@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "journal.h"
+
+// head and acked are the only fields both sides touch. Each side publishes its
+// own with release and reads the other's with acquire, so an event's contents
+// are visible before its sequence number is, and a slot is reused only after
+// the consumer is done with it.
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+void journal_init(struct Journal_t *journal, uint32_t id) {
+  memset(journal, 0, sizeof(*journal));
+  journal->magic = JOURNAL_MAGIC;
+  journal->id = id;
+}
+
+// For a journal kept in memory that survives a restart. Returns false if it
+// doesn't look intact, and it should be initialized instead. Otherwise starts a
+// new boot and sends everything unacknowledged again.
+bool journal_resume(struct Journal_t *journal) {
+  if (journal->magic != JOURNAL_MAGIC || journal->head - journal->acked > JOURNAL_CAPACITY) return false;
+  journal->boot++;
+  journal->sent = journal->acked;
+  return true;
+}
+
+// Returns false if the journal is full and the event was dropped.
+bool journal_record(struct Journal_t *journal, uint8_t type, uint8_t arg, uint32_t timeMs) {
+  uint32_t head = journal->head;
+  if (head - LOAD(journal->acked) >= JOURNAL_CAPACITY) {
+    journal->dropped++;
+    return false;
+  }
+
+  struct JournalEvent_t *event = &journal->events[head & (JOURNAL_CAPACITY - 1)];
+  event->seq = head;
+  event->timeMs = timeMs;
+  event->boot = journal->boot;
+  event->type = type;
+  event->arg = arg;
+  STORE(journal->head, head + 1);
+  return true;
+}
+
+// Copies up to max events that haven't been sent yet, and counts them as sent.
+// They stay in the journal until they are acknowledged.
+uint32_t journal_next_batch(struct Journal_t *journal, struct JournalEvent_t *out, uint32_t max) {
+  uint32_t head = LOAD(journal->head);
+  uint32_t count = 0;
+  while (count < max && journal->sent != head) {
+    out[count++] = journal->events[journal->sent & (JOURNAL_CAPACITY - 1)];
+    journal->sent++;
+  }
+  return count;
+}
+
+// The server has every event up to and including seq. Acknowledgements for
+// events we don't have are ignored.
+void journal_ack(struct Journal_t *journal, uint32_t seq) {
+  uint32_t acked = journal->acked;
+  uint32_t next = seq + 1;
+  if (next - acked > LOAD(journal->head) - acked) return;
+
+  STORE(journal->acked, next);
+  if (journal->sent - next > JOURNAL_CAPACITY) journal->sent = next;
+}
+
+// Sends everything unacknowledged again, e.g. after a reconnect.
+void journal_rewind(struct Journal_t *journal) {
+  journal->sent = journal->acked;
+}
+
+// Hands back events taken by journal_next_batch that weren't sent, so seq is
+// the next to go. Sequence numbers outside what has been taken are ignored.
+void journal_unsend(struct Journal_t *journal, uint32_t seq) {
+  if (seq - journal->acked < journal->sent - journal->acked) journal->sent = seq;
+}
+
+uint32_t journal_unacked(const struct Journal_t *journal) {
+  return LOAD(journal->head) - journal->acked;
+}
+
+const char *journal_type_name(uint8_t type) {
+  switch (type) {
+    case JOURNAL_BUTTON: return "BUTTON";
+    case JOURNAL_RECONNECT: return "RECONNECT";
+    case JOURNAL_OTA: return "OTA";
+    case JOURNAL_BUTTON_LONG: return "BUTTON_LONG";
+    case JOURNAL_BUTTON_DOUBLE: return "BUTTON_DOUBLE";
+    case JOURNAL_BUTTON_CHORD: return "BUTTON_CHORD";
+    default: return "UNKNOWN";
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A ring of device events waiting for the server. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+//
+// One task records events and one task sends them, without locks. Events stay
+// in the ring until the server acknowledges their sequence number, so anything
+// recorded while the link is down goes out once it is back. When the ring is
+// full new events are dropped and counted, rather than overwriting ones that
+// may be in flight.
+
+#define JOURNAL_CAPACITY 64  // a power of two
+#define JOURNAL_MAGIC 0x314c4e4a  // "JNL1"
+
+enum JournalEventType_t {
+  JOURNAL_BUTTON = 1,  // arg is the button
+  JOURNAL_RECONNECT,
+  JOURNAL_OTA,         // arg is the result, 0 for success
+  JOURNAL_BUTTON_LONG,
+  JOURNAL_BUTTON_DOUBLE,
+  JOURNAL_BUTTON_CHORD,  // arg has a bit for each button, button 1 in bit 0
+};
+
+struct JournalEvent_t {
+  uint32_t seq;
+  uint32_t timeMs;  // since boot
+  uint16_t boot;    // which boot timeMs is counted from
+  uint8_t type;
+  uint8_t arg;
+};
+
+struct Journal_t {
+  uint32_t magic;
+  uint32_t id;     // picked when the journal is created, so the server can tell a new one from an old one
+  uint16_t boot;
+  uint32_t head;   // sequence number of the next event. Only the producer writes it.
+  uint32_t acked;  // every event before this has been acknowledged. Only the consumer writes it.
+  uint32_t sent;   // next event to send. Consumer only.
+  uint32_t dropped;
+  struct JournalEvent_t events[JOURNAL_CAPACITY];
+};
+
+void journal_init(struct Journal_t *journal, uint32_t id);
+bool journal_resume(struct Journal_t *journal);
+
+// Producer
+bool journal_record(struct Journal_t *journal, uint8_t type, uint8_t arg, uint32_t timeMs);
+
+// Consumer
+uint32_t journal_next_batch(struct Journal_t *journal, struct JournalEvent_t *out, uint32_t max);
+void journal_ack(struct Journal_t *journal, uint32_t seq);
+void journal_rewind(struct Journal_t *journal);
+void journal_unsend(struct Journal_t *journal, uint32_t seq);
+uint32_t journal_unacked(const struct Journal_t *journal);
+const char *journal_type_name(uint8_t type);
+
+#endif
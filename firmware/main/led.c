@@ -7,233 +7,252 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "arbiter.h"
 #include "led.h"
+#include "logging.h"
+#include "power.h"
 #include "setup.h"
+#include "show.h"
 
-#define NUM_CHANNELS 3
-#define NUM_CHANNELS_W_TIMING (NUM_CHANNELS + 1)
-
-#define MAX_INTERVAL_MS 300
+#define NUM_CHANNELS SHOW_NUM_CHANNELS
 
 static const char *TAG = "LED";
 
-static const ledc_channel_t ledChannels[NUM_CHANNELS_W_TIMING] = { LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3, LEDC_CHANNEL_4 };
-static const int ledPins[NUM_CHANNELS_W_TIMING] = { LED_R_PIN, LED_G_PIN, LED_B_PIN, LED_TIMING_PIN };
-static SemaphoreHandle_t allChannelsSync = NULL;
-static SemaphoreHandle_t runShow = NULL;
-static uint16_t timingDuty = 0x0;
-static uint8_t lastColors[NUM_CHANNELS];
-
-struct DisplayNode_t {
-  uint8_t rgbDuty[NUM_CHANNELS];
-  int ms;
-  uint8_t replays;
-  struct DisplayNode_t *next;
+static const ledc_channel_t ledChannels[NUM_CHANNELS] = { LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3 };
+static const int ledPins[NUM_CHANNELS] = { LED_R_PIN, LED_G_PIN, LED_B_PIN };
+static TaskHandle_t ledTask = NULL;
+static SemaphoreHandle_t compileLock = NULL;
+
+// Each priority layer double-buffers its shows. A new show is compiled into
+// whichever of the layer's buffers is not playing, then handed to the LED task
+// through the layer's pending pointer. Only the LED task touches the rest of
+// the layer, so it only needs the lock when pendingLayers is set.
+struct LedLayer_t {
+  struct Show_t buffers[2];
+  struct Show_t *show;
+  struct Show_t *pending;
+  struct ShowCursor_t cursor;
+  const struct ShowStep_t *pausedStep;  // cut short by a higher layer
+  uint32_t pausedMs;                    // what was left of it
 };
-struct DisplayNode_t *displayStart = NULL;
-struct DisplayNode_t *nextDisplayStep = NULL;
-static portMUX_TYPE updateDisplayLock = portMUX_INITIALIZER_UNLOCKED;
-
 
+static struct LedLayer_t layers[ARBITER_LAYER_COUNT];
+static uint8_t pendingLayers = 0;  // bit per layer
+static struct Show_t stopShow;
+static struct Arbiter_t arbiter;
+static const struct ShowStep_t *playingStep = NULL;
+static portMUX_TYPE updateDisplayLock = portMUX_INITIALIZER_UNLOCKED;
 
-static uint8_t fromHex(char ch) {
-  //ESP_LOGI(TAG, "fromHex %c %d", ch, ch);
-  if (ch >= '0' && ch <= '9') return ch - '0';
-  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
-  return 0;
+static void stopChannels() {
+  for (int i=0; i<NUM_CHANNELS; i++) {
+    ledc_stop(LEDC_LOW_SPEED_MODE, ledChannels[i], 0);
+  }
 }
 
-static struct DisplayNode_t* parseShow(const char* display) {
-  int len = strlen(display);
-  char *ch = (char*)display;
-  int replays = 0;
-  
-  struct DisplayNode_t *first = NULL;
-  struct DisplayNode_t *last = NULL;
-
-  int sign = 1;
-  if (*ch == '-') {
-    sign = -1;
-    ch++;
-  }
-  while (ch < display + len && *ch != '\0' && *ch != ' ') {
-    replays = replays * 10 + (*ch - '0');
-    ch++;
+// Ends any fade still running by rewriting the channel's current duty, so a
+// new show can start right away instead of waiting for the old fade to end.
+static void cancelFades() {
+  for (int i=0; i<NUM_CHANNELS; i++) {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, ledChannels[i], ledc_get_duty(LEDC_LOW_SPEED_MODE, ledChannels[i]));
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, ledChannels[i]);
   }
-  ch++; // eat the space
-
-  replays = replays * sign;
-
-  memset(lastColors, 0, sizeof(lastColors));
-  uint8_t toColors[NUM_CHANNELS];
-  int ms = 0;
-
-  while (ch < display + len) {
-    for (int i=0; i<NUM_CHANNELS; i++) {
-      //ESP_LOGI(TAG, "Is space? %c", *ch);
-      toColors[i] = fromHex(*ch) * 16 + fromHex(*ch);
-      ch += 2;
-      //ESP_LOGI(TAG, "RGB %d %d", i, toColors[i]);
-    }
-    ch++; // eat the space
-
-    ms = 0;
-    while (ch < display + len && *ch != '\0' && *ch != ' ') {
-      ms = 10 * ms + (*ch - '0');
-      ch++;
-      //ESP_LOGI(TAG, "MS %d", ms);
-    }
-    ch++; // eat the space
-
-    int remainingMs = ms;
-    uint64_t duty;
-    do {
-      struct DisplayNode_t *node = malloc(sizeof(struct DisplayNode_t));
-      node->replays = replays;
-
-      if (ms == 0) {
-        memcpy(node->rgbDuty, toColors, sizeof(toColors));
-        node->ms = 0;
-        remainingMs = 0;
-      } else {
-        for (int i=0; i<NUM_CHANNELS; i++) {
-          duty = ((lastColors[i] * (remainingMs)) + (toColors[i] * (ms - remainingMs))) / ms;
-          node->rgbDuty[i] = duty;
-        }
-        node->ms = remainingMs > MAX_INTERVAL_MS ? MAX_INTERVAL_MS : remainingMs;
-        remainingMs -= MAX_INTERVAL_MS;
-      }
+}
 
-      if (first == NULL) {
-        first = node;
-      } else {
-        last->next = node;
-      }
-      last = node;
-    } while (remainingMs > 0);
-    memcpy(lastColors, toColors, sizeof(toColors));
+// A preempted layer remembers the step it was on and how long it had left. It
+// fades from whatever the higher layer left behind to that step's colour over
+// the time left once it resumes.
+static void applyChange(struct ArbiterChange_t change, int64_t *stepEnd) {
+  if (change.pause == ARBITER_NONE && change.play == ARBITER_NONE) return;
+  TRACE(TRACE_LED_LAYER, change.pause, change.play, 0);
+
+  int64_t now = esp_timer_get_time();
+  if (change.pause != ARBITER_NONE && playingStep != NULL) {
+    int64_t left = *stepEnd - now;
+    layers[change.pause].pausedStep = playingStep;
+    layers[change.pause].pausedMs = left > 0 ? left / 1000 : 0;
   }
-  last->next = first;
-  return first;
+  playingStep = NULL;
+  cancelFades();
+  *stepEnd = now;
 }
 
+static void takePendingShows(int64_t *stepEnd) {
+  if (__atomic_load_n(&pendingLayers, __ATOMIC_ACQUIRE) == 0) return;
 
-
-static IRAM_ATTR bool cb_ledc_fade_end_event(const ledc_cb_param_t *param, void *user_arg)
-{
-    portBASE_TYPE taskAwoken = pdFALSE;
-
-    if (param->event == LEDC_FADE_END_EVT) {
-        SemaphoreHandle_t sync = (SemaphoreHandle_t) user_arg;
-        xSemaphoreGiveFromISR(sync, &taskAwoken);
-    }
-
-    return (taskAwoken == pdTRUE);
-}
-
-static void abortDisplay(bool shutdown) {
-  struct DisplayNode_t *ptr = displayStart;
+  struct Show_t *taken[ARBITER_LAYER_COUNT];
   taskENTER_CRITICAL(&updateDisplayLock);
-  displayStart = NULL;
+  for (int i = 0; i < ARBITER_LAYER_COUNT; i++) {
+    taken[i] = layers[i].pending;
+    layers[i].pending = NULL;
+    if (taken[i] != NULL) layers[i].show = taken[i];
+  }
+  pendingLayers = 0;
   taskEXIT_CRITICAL(&updateDisplayLock);
 
-  struct DisplayNode_t *begin = NULL;
-  while (ptr != begin) {
-    if (begin == NULL) begin = ptr;
-    struct DisplayNode_t *next = ptr->next;
-    free(ptr);
-    ptr = next;
+  for (int i = 0; i < ARBITER_LAYER_COUNT; i++) {
+    if (taken[i] == NULL) continue;
+    show_cursor_start(&layers[i].cursor, taken[i]);
+    layers[i].pausedStep = NULL;
+    applyChange(taken[i]->count > 0 ? arbiter_start(&arbiter, i) : arbiter_finish(&arbiter, i), stepEnd);
   }
+}
 
-  if (shutdown) {
-    for (int i=0; i<NUM_CHANNELS_W_TIMING; i++) {
-      ledc_stop(LEDC_LOW_SPEED_MODE, ledChannels[i], 0);
+// Starts the hardware on the step. Fades run on their own, so nothing else
+// happens until the step's deadline.
+static void startStep(const struct ShowStep_t *step, uint32_t ms) {
+  if (ms < SHOW_MIN_FADE_MS) {
+    for (int i=0; i<NUM_CHANNELS; i++) {
+      ledc_set_duty(LEDC_LOW_SPEED_MODE, ledChannels[i], step->duty[i]);
+      ledc_update_duty(LEDC_LOW_SPEED_MODE, ledChannels[i]);
     }
+  } else {
     for (int i=0; i<NUM_CHANNELS; i++) {
-      lastColors[i] = 0;
+      ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, ledChannels[i], step->duty[i], ms);
+      ledc_fade_start(LEDC_LOW_SPEED_MODE, ledChannels[i], LEDC_FADE_NO_WAIT);
     }
   }
 }
 
-static void playNextStep() {
-  //ESP_LOGI(TAG, "ENTER playNextStep");
-  int64_t stepFinishTime = esp_timer_get_time();
-  if (nextDisplayStep != NULL) {
-    bool play = false;
-    uint8_t duties[NUM_CHANNELS];
-    int ms = 0;
+// Sleeps until deadline, or until a new show is handed over. Returns whether
+// it blocked at all.
+static bool waitUntil(int64_t deadline) {
+  bool blocked = false;
+  int64_t left;
+  while ((left = deadline - esp_timer_get_time()) > 0 && __atomic_load_n(&pendingLayers, __ATOMIC_ACQUIRE) == 0) {
+    TickType_t ticks = (left + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+    ulTaskNotifyTake(pdTRUE, ticks);
+    blocked = true;
+  }
+  return blocked;
+}
 
-    taskENTER_CRITICAL(&updateDisplayLock);
-    if (nextDisplayStep->replays != 0) {
-      if (nextDisplayStep->replays > 0) nextDisplayStep->replays--;
-      play = true;
-      memcpy(duties, nextDisplayStep->rgbDuty, sizeof(duties));
-      ms = nextDisplayStep->ms;
-      stepFinishTime += ms * 1000;
-
-      nextDisplayStep = nextDisplayStep->next;
+static void playShows() {
+  int64_t stepEnd = esp_timer_get_time();
+  bool blocked = false;  // since the last pass through a show ended
+  while (1) {
+    takePendingShows(&stepEnd);
+
+    int8_t top = arbiter_top(&arbiter);
+    if (top == ARBITER_NONE) {
+      stopChannels();
+      playingStep = NULL;
+      power_release(POWER_LED);
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      stepEnd = esp_timer_get_time();
+      continue;
     }
-    taskEXIT_CRITICAL(&updateDisplayLock);
 
-    if (play) {
-      //ESP_LOGI(TAG, "MS %d", ms);
-      if (ms < 30) {
-        for (int i=0; i<NUM_CHANNELS; i++) {
-          ledc_set_duty(LEDC_LOW_SPEED_MODE, ledChannels[i], duties[i]);
-          ledc_update_duty(LEDC_LOW_SPEED_MODE, ledChannels[i]);
-        }
-      } else {
-        int64_t start = esp_timer_get_time();
-        timingDuty = (~timingDuty) & 0x3ff;
-        ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, ledChannels[NUM_CHANNELS], timingDuty, ms);
-        ledc_fade_start(LEDC_LOW_SPEED_MODE, ledChannels[NUM_CHANNELS], LEDC_FADE_NO_WAIT);
-        for (int i=0; i<NUM_CHANNELS; i++) {
-          ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, ledChannels[i], duties[i] << 2, ms);
-          ledc_fade_start(LEDC_LOW_SPEED_MODE, ledChannels[i], LEDC_FADE_NO_WAIT);  
-        }
-  
-        for (int i=0; i<NUM_CHANNELS_W_TIMING; i++) {
-          xSemaphoreTake(allChannelsSync, portMAX_DELAY); 
-        }
-      }
+    struct LedLayer_t *layer = &layers[top];
+    const struct ShowStep_t *step = layer->pausedStep;
+    uint32_t ms;
+    if (step != NULL) {
+      ms = layer->pausedMs;
+      layer->pausedStep = NULL;
     } else {
-      //ESP_LOGI(TAG, "Finished display. should clean up");
-      abortDisplay(true);
-      xSemaphoreTake(runShow, portMAX_DELAY);
+      step = show_cursor_next(&layer->cursor);
+      if (step == NULL) {
+        applyChange(arbiter_finish(&arbiter, top), &stepEnd);
+        continue;
+      }
+      ms = step->ms;
     }
+
+    // LEDC fades stop while the chip is in light sleep.
+    power_hold(POWER_LED);
+    TRACE(TRACE_LED_STEP, step - layer->show->steps, ms, step->duty[0]);
+    playingStep = step;
+    startStep(step, ms);
+    stepEnd += ms * 1000;
+    blocked |= waitUntil(stepEnd);
+
+    // A show too short to ever wait on would keep the lower priority tasks on
+    // this core from running, so each pass through it gives up a tick.
+    if (layer->cursor.step == 0) {
+      if (!blocked) {
+        vTaskDelay(1);
+        stepEnd = esp_timer_get_time();
+      }
+      blocked = false;
+    }
+  }
+}
+
+// Claims the layer's show buffer that isn't playing. Clearing the layer's
+// pending show first keeps the LED task from picking it up while it is half
+// written.
+static struct Show_t *claimShowBuffer(enum ArbiterLayer_t layer) {
+  while (ledTask == NULL) {
+    ESP_LOGI(TAG, "Waiting for LED to finish setup");
+    vTaskDelay(100 / portTICK_PERIOD_MS);
   }
 
-  //ESP_LOGI(TAG, "EXIT playNextStep");
+  xSemaphoreTake(compileLock, portMAX_DELAY);
+  struct LedLayer_t *owner = &layers[layer];
+  taskENTER_CRITICAL(&updateDisplayLock);
+  struct Show_t *next = owner->show == &owner->buffers[0] ? &owner->buffers[1] : &owner->buffers[0];
+  owner->pending = NULL;
+  taskEXIT_CRITICAL(&updateDisplayLock);
+  return next;
 }
 
+static void publishShow(enum ArbiterLayer_t layer, struct Show_t *next, enum ShowResult_t result) {
+  if (result == SHOW_OK) {
+    taskENTER_CRITICAL(&updateDisplayLock);
+    layers[layer].pending = next;
+    pendingLayers |= 1 << layer;
+    taskEXIT_CRITICAL(&updateDisplayLock);
+  }
 
-void led_show(const char *display) {
-  abortDisplay(false);
-  ESP_LOGI(TAG, "Parsing show %s", display);
-  displayStart = nextDisplayStep = parseShow(display);
+  xSemaphoreGive(compileLock);
+  if (result == SHOW_OK) {
+    xTaskNotifyGive(ledTask);
+  }
+}
 
-  // struct DisplayNode_t *walk = displayStart;
-  // do {
-  //   ESP_LOGI(TAG, "PART %d,%d,%d %dms x%d", (uint8_t)walk->rgbDuty[0], (uint8_t)walk->rgbDuty[1], (uint8_t)walk->rgbDuty[2], walk->ms, walk->replays);
-  //   walk = walk->next;
-  // } while (walk != NULL && walk != displayStart);
+void led_show(enum ArbiterLayer_t layer, const char *display) {
+  if (layer >= ARBITER_LAYER_COUNT) return;
+  struct Show_t *next = claimShowBuffer(layer);
+  enum ShowResult_t result = show_compile(display, next);
+  TRACE(TRACE_LED_SHOW, result, next->count, next->replays);
+  if (result != SHOW_OK) {
+    ESP_LOGE(TAG, "Can't play show (%s): %s", show_result_name(result), display);
+  }
+  publishShow(layer, next, result);
+}
 
-  while (runShow == NULL) {
-    ESP_LOGI(TAG, "Waiting for LED to finish setup");
-    vTaskDelay(100 / portTICK_PERIOD_MS);
+void led_show_frame(enum ArbiterLayer_t layer, const struct FrameRecord_t *record) {
+  if (layer >= ARBITER_LAYER_COUNT) return;
+  struct Show_t *next = claimShowBuffer(layer);
+  show_begin(next, record->replays);
+
+  enum ShowResult_t result = SHOW_OK;
+  for (int i = 0; i < record->count && result == SHOW_OK; i++) {
+    uint8_t rgb[SHOW_NUM_CHANNELS];
+    uint16_t ms;
+    frame_led_step(record, i, rgb, &ms);
+    result = show_add_segment(next, rgb, ms);
+  }
+  if (result == SHOW_OK) result = show_end(next);
+  TRACE(TRACE_LED_SHOW, result, next->count, next->replays);
+  if (result != SHOW_OK) {
+    ESP_LOGE(TAG, "Can't play binary show (%s)", show_result_name(result));
   }
-  xSemaphoreGive(runShow);
+  publishShow(layer, next, result);
 }
 
-void led_stop() {
-  abortDisplay(true);
+// Hands the layer an empty show, which the LED task treats as finished. Any
+// layer below it resumes.
+void led_stop(enum ArbiterLayer_t layer) {
+  if (layer >= ARBITER_LAYER_COUNT) return;
+  claimShowBuffer(layer);
+  publishShow(layer, &stopShow, SHOW_OK);
 }
 
 void led_task(void *args) {
   ESP_LOGI(TAG, "Task is starting ...");
 
   ledc_timer_config_t timer_config = {
-      .duty_resolution = LEDC_TIMER_10_BIT, // resolution of PWM duty
+      .duty_resolution = (ledc_timer_bit_t)SHOW_DUTY_BITS, // resolution of PWM duty
       .freq_hz = 5000,                     // frequency of PWM signal
       .speed_mode = LEDC_LOW_SPEED_MODE,   // timer mode
       .timer_num = LEDC_TIMER_2,           // timer index
@@ -241,11 +260,11 @@ void led_task(void *args) {
   };
   ledc_timer_config(&timer_config);
 
-  for (int i=0; i<NUM_CHANNELS_W_TIMING; i++) {
+  for (int i=0; i<NUM_CHANNELS; i++) {
     ESP_LOGI(TAG, "Config channel %d %d", ledChannels[i], ledPins[i]);
     ledc_channel_config_t channel_config = {
       .channel = ledChannels[i],
-      .duty = i == NUM_CHANNELS ? timingDuty : 0,
+      .duty = 0,
       .gpio_num = ledPins[i],
       .speed_mode = LEDC_LOW_SPEED_MODE,
       .hpoint = 0,
@@ -256,19 +275,12 @@ void led_task(void *args) {
   }
 
   ledc_fade_func_install(0);
-  ledc_cbs_t callbacks = {
-      .fade_cb = cb_ledc_fade_end_event
-  };
 
-  runShow = xSemaphoreCreateBinary();
-  allChannelsSync = xSemaphoreCreateCounting(NUM_CHANNELS_W_TIMING, 0);
-  for (int i = 0; i < NUM_CHANNELS_W_TIMING; i++) {
-    ledc_cb_register(LEDC_LOW_SPEED_MODE, ledChannels[i], &callbacks, (void *) allChannelsSync);
-  }
+  show_begin(&stopShow, 0);
+  arbiter_init(&arbiter);
+  compileLock = xSemaphoreCreateMutex();
+  ledTask = xTaskGetCurrentTaskHandle();
 
   ESP_LOGI(TAG, "Waiting for first light show");
-  xSemaphoreTake(runShow, portMAX_DELAY);
-  while (1) {
-    playNextStep();
-  }
-}
\ No newline at end of file
+  playShows();
+}
@@ -1,8 +1,12 @@
 #ifndef LED_H
 #define LED_H
 
+#include "arbiter.h"
+#include "frame.h"
+
 void led_task(void *args);
-void led_show(const char* display);
-void led_stop();
+void led_show(enum ArbiterLayer_t layer, const char* display);
+void led_show_frame(enum ArbiterLayer_t layer, const struct FrameRecord_t *record);
+void led_stop(enum ArbiterLayer_t layer);
 
 #endif
\ No newline at end of file
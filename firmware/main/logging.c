@@ -1,6 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 
 #include "logging.h"
+#include "websocket.h"
+
+// Records per TRACE message: "TRACE <reset reason> <hex record> ..."
+#define TRACE_BATCH 12
+#define TRACE_MESSAGE_LEN (16 + TRACE_BATCH * (TRACE_HEX_LEN + 1))
+
+static const char *TAG = "LOGGING";
+
+// Kept through a restart, including a panic or watchdog reset, so the events
+// leading up to one can be sent to the server once we're back online.
+static RTC_NOINIT_ATTR struct TraceRing_t traceRing;
+
+// The last boot's records, copied out after a crash before this boot's
+// overwrite them. Freed once the server has them.
+static struct TraceRecord_t *crashRecords = NULL;
+static uint32_t crashCount = 0;
+static uint8_t crashReason = 0;
 
 void enable_logging() {
   esp_log_level_set("*", ESP_LOG_INFO);
@@ -8,4 +31,55 @@ void enable_logging() {
 
 void disable_logging() {
   esp_log_level_set("*", ESP_LOG_NONE);
-}
\ No newline at end of file
+}
+
+static bool isCrash(esp_reset_reason_t reason) {
+  return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+         reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+// Call first thing in app_main, before anything traces.
+void logging_setup() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (reason == ESP_RST_POWERON || !trace_resume(&traceRing)) {
+    trace_init(&traceRing, TRACE_ALL_MODULES);
+  } else if (isCrash(reason)) {
+    crashRecords = malloc(TRACE_CAPACITY * sizeof(struct TraceRecord_t));
+    if (crashRecords != NULL) {
+      crashCount = trace_copy(&traceRing, traceRing.boot - 1, crashRecords, TRACE_CAPACITY);
+      crashReason = reason;
+      ESP_LOGW(TAG, "Restarted after a crash (reason %d), %lu trace records kept", reason,
+               (unsigned long)crashCount);
+    }
+  }
+  TRACE(TRACE_BOOT, reason, 0, 0);
+}
+
+void logging_trace(uint16_t event, int32_t a, int32_t b, int32_t c) {
+  trace_write(&traceRing, event, (uint32_t)esp_timer_get_time(), a, b, c);
+}
+
+void logging_set_trace_mask(uint32_t mask) {
+  ESP_LOGI(TAG, "Trace mask %lx", (unsigned long)mask);
+  traceRing.mask = mask;
+}
+
+// Sends the records from before a crash, if there are any. Call once the
+// server has welcomed us; they are kept for the next connection if it fails.
+void logging_send_crash_trace() {
+  if (crashRecords == NULL) return;
+
+  char message[TRACE_MESSAGE_LEN];
+  for (uint32_t start = 0; start < crashCount; start += TRACE_BATCH) {
+    int len = snprintf(message, sizeof(message), "TRACE %u", crashReason);
+    for (uint32_t i = start; i < crashCount && i < start + TRACE_BATCH; i++) {
+      message[len++] = ' ';
+      len += trace_encode_hex(&crashRecords[i], message + len, sizeof(message) - len);
+    }
+    if (!websocket_send_text(message, len)) return;
+  }
+
+  free(crashRecords);
+  crashRecords = NULL;
+  crashCount = 0;
+}
@@ -1,7 +1,20 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdint.h>
+
+#include "trace.h"
+
+// Records a trace event (see trace.h). Cheap enough for hot paths and safe from
+// any task or timer callback. Skipped if the event's module is masked off.
+#define TRACE(event, a, b, c) logging_trace((event), (a), (b), (c))
+
 void enable_logging();
 void disable_logging();
 
+void logging_setup();
+void logging_trace(uint16_t event, int32_t a, int32_t b, int32_t c);
+void logging_set_trace_mask(uint32_t mask);
+void logging_send_crash_trace();
+
 #endif
@@ -1,13 +1,19 @@
 #include <string.h>
+#include <strings.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
-#include "esp_https_ota.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
 
 #include "configuration.h"
+#include "delta.h"
 #include "ota.h"
+#include "power.h"
+#include "uplink.h"
+#include "websocket.h"
 
 static const char *TAG = "OTA";
 
@@ -21,6 +27,9 @@ const char* ota_get_partition_hash(char outBuf[OTA_HASH_STR_LEN]) {
   return outBuf;
 }
 
+// Room for a quoted SHA-256, the server's ETag for an image.
+#define OTA_ETAG_LEN 72
+
 static esp_err_t http_event_handler(esp_http_client_event_t *evt)
 {
     switch (evt->event_id) {
@@ -35,6 +44,9 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
         break;
     case HTTP_EVENT_ON_HEADER:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        if (evt->user_data != NULL && strcasecmp(evt->header_key, "ETag") == 0) {
+            strlcpy((char *)evt->user_data, evt->header_value, OTA_ETAG_LEN);
+        }
         break;
     case HTTP_EVENT_ON_DATA:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -49,28 +61,240 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-void ota_start_update() {
-  ESP_LOGI(TAG, "Starting OTA update ...");
+// Bytes are written to flash as they arrive, so a dropped connection resumes
+// from where it stopped with an HTTP Range request instead of starting over.
+#define OTA_TASK_STACK 8192
+#define OTA_BUFFER_LEN 1024
+#define OTA_URL_LEN 256
+#define OTA_TIMEOUT_MS 15000
+#define OTA_MAX_ATTEMPTS 8
+#define OTA_RETRY_DELAY_MS 5000
+#define OTA_PROGRESS_INTERVAL_US (5 * 1000 * 1000)
+
+enum OtaAttempt_t {
+  OTA_ATTEMPT_DONE,
+  OTA_ATTEMPT_RETRY,    // network trouble, resume from where we are
+  OTA_ATTEMPT_CORRUPT,  // what we have is bad, start again with the full image
+  OTA_ATTEMPT_FAILED,   // the server won't give us an image
+};
 
+struct OtaDownload_t {
+  const esp_partition_t *running;
+  const esp_partition_t *target;
+  esp_ota_handle_t handle;
+  bool started;
+  bool isDelta;
+  bool complete;
+  uint32_t received;  // body bytes consumed so far, where a retry resumes
+  uint32_t total;
+  // Sent back as If-Range on a resume, so a changed image is sent whole.
+  char etag[OTA_ETAG_LEN];
+  struct DeltaPatch_t patch;
+  int64_t lastReport;
+};
+
+static TaskHandle_t otaTask = NULL;
+static char url[OTA_URL_LEN];
+static uint8_t buffer[OTA_BUFFER_LEN];
+
+static void buildUrl(bool allowDelta) {
   struct AppConfig *config = config_read();
-  const char *uriTemplate = "https://%s/api/devices/%s/firmware";
-  char uri[strlen(uriTemplate) + strlen(config->server) + strlen(config->callsign)];
-  sprintf(uri, uriTemplate, config->server, config->callsign);
-  ESP_LOGI(TAG, "Downloading from %s", uri);
-  esp_http_client_config_t otaConfig = {
-    .url = uri,
+  char hash[OTA_HASH_STR_LEN];
+  int len = snprintf(url, sizeof(url), "https://%s/api/devices/%s/firmware", config->server, config->callsign);
+  if (allowDelta && len > 0 && (size_t)len < sizeof(url)) {
+    snprintf(url + len, sizeof(url) - len, "?from=%s", ota_get_partition_hash(hash));
+  }
+}
+
+static bool readRunning(void *ctx, uint32_t offset, uint8_t *data, uint32_t len) {
+  struct OtaDownload_t *download = (struct OtaDownload_t *)ctx;
+  return esp_partition_read(download->running, offset, data, len) == ESP_OK;
+}
+
+static bool writeTarget(void *ctx, const uint8_t *data, uint32_t len) {
+  struct OtaDownload_t *download = (struct OtaDownload_t *)ctx;
+  return esp_ota_write(download->handle, data, len) == ESP_OK;
+}
+
+static void reportProgress(struct OtaDownload_t *download, bool force) {
+  int64_t now = esp_timer_get_time();
+  if (!force && now - download->lastReport < OTA_PROGRESS_INTERVAL_US) return;
+  download->lastReport = now;
+
+  char message[48];
+  int len = snprintf(message, sizeof(message), "OTA_PROGRESS %lu %lu", (unsigned long)download->received,
+                     (unsigned long)download->total);
+  websocket_send_text(message, len);
+}
+
+static void reportFailure(enum OtaAttempt_t result) {
+  char message[32];
+  int len = snprintf(message, sizeof(message), "OTA_PROGRESS FAILED %d", result);
+  websocket_send_text(message, len);
+}
+
+static void discardDownload(struct OtaDownload_t *download) {
+  if (download->started) esp_ota_abort(download->handle);
+  download->started = false;
+  download->complete = false;
+  download->received = 0;
+  download->total = 0;
+}
+
+// The body is either a firmware image or a delta against the running one.
+static esp_err_t beginImage(struct OtaDownload_t *download, const uint8_t *data, uint32_t len) {
+  download->isDelta = delta_is_patch(data, len);
+  esp_err_t err = esp_ota_begin(download->target, OTA_WITH_SEQUENTIAL_WRITES, &download->handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Can't start writing %s: %s", download->target->label, esp_err_to_name(err));
+    return err;
+  }
+  if (download->isDelta) {
+    delta_begin(&download->patch, download->running->size, readRunning, writeTarget, download);
+  }
+  download->started = true;
+  ESP_LOGI(TAG, "Writing %s from a %s", download->target->label, download->isDelta ? "delta" : "full image");
+  return ESP_OK;
+}
+
+static esp_err_t consume(struct OtaDownload_t *download, const uint8_t *data, uint32_t len) {
+  if (!download->started && beginImage(download, data, len) != ESP_OK) return ESP_FAIL;
+
+  if (download->isDelta) {
+    enum DeltaResult_t result = delta_feed(&download->patch, data, len);
+    if (result != DELTA_OK && result != DELTA_DONE) {
+      ESP_LOGE(TAG, "Can't apply delta at byte %lu: %s", (unsigned long)download->received, delta_result_name(result));
+      return ESP_FAIL;
+    }
+    download->complete = result == DELTA_DONE;
+  } else if (esp_ota_write(download->handle, data, len) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  download->received += len;
+  if (!download->isDelta) download->complete = download->received == download->total;
+  return ESP_OK;
+}
+
+static enum OtaAttempt_t checkResponse(struct OtaDownload_t *download, esp_http_client_handle_t http) {
+  int contentLength = esp_http_client_fetch_headers(http);
+  int status = esp_http_client_get_status_code(http);
+  if (status == 200) {
+    if (download->received > 0) {
+      ESP_LOGW(TAG, "Server ignored our range or the image changed, starting again");
+      discardDownload(download);
+    }
+    download->total = contentLength;
+    return contentLength > 0 ? OTA_ATTEMPT_DONE : OTA_ATTEMPT_RETRY;
+  }
+  if (status == 206 && download->received > 0) {
+    ESP_LOGI(TAG, "Resuming at byte %lu", (unsigned long)download->received);
+    return OTA_ATTEMPT_DONE;
+  }
+  ESP_LOGE(TAG, "Firmware download returned HTTP %d", status);
+  if (status == 416) return OTA_ATTEMPT_CORRUPT;
+  return status >= 500 ? OTA_ATTEMPT_RETRY : OTA_ATTEMPT_FAILED;
+}
+
+static enum OtaAttempt_t downloadOnce(struct OtaDownload_t *download) {
+  esp_http_client_config_t httpConfig = {
+    .url = url,
     .event_handler = http_event_handler,
-    .keep_alive_enable = true,
+    .timeout_ms = OTA_TIMEOUT_MS,
+    .user_data = download->etag,
   };
+  esp_http_client_handle_t http = esp_http_client_init(&httpConfig);
+  if (http == NULL) return OTA_ATTEMPT_RETRY;
+
+  char range[32];
+  if (download->received > 0) {
+    snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)download->received);
+    esp_http_client_set_header(http, "Range", range);
+    if (download->etag[0] != '\0') esp_http_client_set_header(http, "If-Range", download->etag);
+  }
 
-  esp_err_t ret = esp_https_ota(&otaConfig);
-  if (ret == ESP_OK) {
-      ESP_LOGI(TAG, "OTA Succeed, Rebooting...");
-      esp_restart();
+  enum OtaAttempt_t result = OTA_ATTEMPT_RETRY;
+  esp_err_t err = esp_http_client_open(http, 0);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Can't connect to %s: %s", url, esp_err_to_name(err));
   } else {
-      ESP_LOGE(TAG, "Firmware upgrade failed");
+    result = checkResponse(download, http);
   }
-  while (1) {
-      vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+  while (result == OTA_ATTEMPT_DONE && !download->complete) {
+    int len = esp_http_client_read(http, (char *)buffer, sizeof(buffer));
+    if (len <= 0) {
+      ESP_LOGW(TAG, "Download stopped at byte %lu of %lu", (unsigned long)download->received,
+               (unsigned long)download->total);
+      result = OTA_ATTEMPT_RETRY;
+    } else if (consume(download, buffer, len) != ESP_OK) {
+      result = OTA_ATTEMPT_CORRUPT;
+    } else {
+      reportProgress(download, false);
+    }
   }
-}
\ No newline at end of file
+
+  esp_http_client_close(http);
+  esp_http_client_cleanup(http);
+  return result;
+}
+
+static esp_err_t finishImage(struct OtaDownload_t *download) {
+  download->started = false;
+  esp_err_t err = esp_ota_end(download->handle);
+  if (err == ESP_OK) err = esp_ota_set_boot_partition(download->target);
+  if (err != ESP_OK) ESP_LOGE(TAG, "New image is not valid: %s", esp_err_to_name(err));
+  return err;
+}
+
+static void runUpdate(void *args) {
+  power_hold(POWER_OTA);
+  struct OtaDownload_t download = {
+    .running = esp_ota_get_running_partition(),
+    .target = esp_ota_get_next_update_partition(NULL),
+  };
+  bool allowDelta = true;
+  buildUrl(allowDelta);
+  ESP_LOGI(TAG, "Downloading from %s", url);
+
+  enum OtaAttempt_t result = OTA_ATTEMPT_RETRY;
+  for (int attempt = 1; attempt <= OTA_MAX_ATTEMPTS; attempt++) {
+    result = downloadOnce(&download);
+    if (result == OTA_ATTEMPT_DONE) {
+      reportProgress(&download, true);
+      if (finishImage(&download) == ESP_OK) {
+        ESP_LOGI(TAG, "OTA Succeed, Rebooting...");
+        uplink_record(JOURNAL_OTA, 0);
+        esp_restart();
+      }
+      result = OTA_ATTEMPT_CORRUPT;
+    }
+    if (result == OTA_ATTEMPT_FAILED || attempt == OTA_MAX_ATTEMPTS) break;
+    if (result == OTA_ATTEMPT_CORRUPT) {
+      discardDownload(&download);
+      allowDelta = false;
+      buildUrl(allowDelta);
+    }
+    vTaskDelay(OTA_RETRY_DELAY_MS * attempt / portTICK_PERIOD_MS);
+  }
+
+  // Carry on with the running firmware rather than restarting, so a broken
+  // server can't keep the device in a reboot loop. The server offers the
+  // update again when we next say HELLO, and the next OTA request starts over.
+  ESP_LOGE(TAG, "Firmware upgrade failed");
+  uplink_record(JOURNAL_OTA, result);
+  reportFailure(result);
+  discardDownload(&download);
+  power_release(POWER_OTA);
+  otaTask = NULL;
+  vTaskDelete(NULL);
+}
+
+// Called from the websocket task, so the download runs in a task of its own.
+void ota_start_update() {
+  if (otaTask != NULL) {
+    ESP_LOGI(TAG, "OTA update is already running");
+    return;
+  }
+  ESP_LOGI(TAG, "Starting OTA update ...");
+  xTaskCreatePinnedToCore(runUpdate, "ota", OTA_TASK_STACK, NULL, 5, &otaTask, 0);
+}
@@ -0,0 +1,111 @@
+#include <stddef.h>
+
+#include "player.h"
+
+static bool isDue(uint32_t deadline, uint32_t now) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+static void releaseVoice(struct Player_t *player, struct PlayerVoice_t *voice) {
+  if (voice->song != NULL) {
+    player->release(voice->song);
+  }
+  voice->song = NULL;
+  voice->leftMs = 0;
+}
+
+static void startVoice(struct PlayerVoice_t *voice, const struct Song_t *song) {
+  voice->song = song;
+  voice->next = 0;
+  voice->remaining = song->replays;
+  voice->freq = 0;
+  voice->leftMs = 0;
+}
+
+// Starts the voice's next segment at start. Returns false if the song is over.
+static bool stepVoice(struct Player_t *player, struct PlayerVoice_t *voice, uint32_t start) {
+  if (voice->song == NULL || voice->song->count == 0 || voice->remaining == 0) return false;
+
+  const struct SongSegment_t *segment = &voice->song->segments[voice->next];
+  voice->freq = segment->freq;
+  player->segmentEnd = start + segment->ms;
+  if (++voice->next == voice->song->count) {
+    voice->next = 0;
+    if (voice->remaining > 0) voice->remaining--;
+  }
+  return true;
+}
+
+// Picks up the main voice after a mix, finishing the segment it was in.
+static bool resumeMain(struct Player_t *player, uint32_t start) {
+  if (player->main.leftMs > 0) {
+    player->segmentEnd = start + player->main.leftMs;
+    player->main.leftMs = 0;
+    return true;
+  }
+  return stepVoice(player, &player->main, start);
+}
+
+void player_init(struct Player_t *player, void (*release)(const struct Song_t *song)) {
+  player->main.song = NULL;
+  player->mix.song = NULL;
+  player->running = false;
+  player->segmentEnd = 0;
+  player->release = release;
+}
+
+void player_command(struct Player_t *player, enum PlayerCommandType_t type, const struct Song_t *song, uint32_t now) {
+  // Only the built in speaker (0) is played.
+  if (song != NULL && song->speaker != 0) {
+    player->release(song);
+    return;
+  }
+
+  if (type == PLAYER_STOP || type == PLAYER_PLAY) {
+    releaseVoice(player, &player->mix);
+    releaseVoice(player, &player->main);
+    player->running = false;
+    if (type == PLAYER_PLAY && song != NULL) {
+      startVoice(&player->main, song);
+      player->running = stepVoice(player, &player->main, now);
+      if (!player->running) releaseVoice(player, &player->main);
+    }
+  } else if (type == PLAYER_MIX && song != NULL) {
+    if (player->mix.song != NULL) {
+      releaseVoice(player, &player->mix);
+    } else if (player->running && player->main.song != NULL) {
+      player->main.leftMs = isDue(player->segmentEnd, now) ? 0 : player->segmentEnd - now;
+    }
+
+    startVoice(&player->mix, song);
+    if (stepVoice(player, &player->mix, now)) {
+      player->running = true;
+    } else {
+      releaseVoice(player, &player->mix);
+      player->running = player->main.song != NULL && resumeMain(player, now);
+    }
+  }
+}
+
+void player_update(struct Player_t *player, uint32_t now) {
+  while (player->running && isDue(player->segmentEnd, now)) {
+    // Chain from the scheduled end rather than now so a late wakeup doesn't
+    // stretch the song.
+    uint32_t start = player->segmentEnd;
+    if (player->mix.song != NULL) {
+      if (stepVoice(player, &player->mix, start)) continue;
+      releaseVoice(player, &player->mix);
+      if (player->main.song != NULL && resumeMain(player, start)) continue;
+    } else if (stepVoice(player, &player->main, start)) {
+      continue;
+    }
+
+    releaseVoice(player, &player->main);
+    player->running = false;
+  }
+}
+
+uint16_t player_output(const struct Player_t *player) {
+  if (!player->running) return 0;
+  return player->mix.song != NULL ? player->mix.freq : player->main.freq;
+}
@@ -0,0 +1,42 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "song.h"
+
+// State machine for the audio task. It decides what tone should be sounding
+// and when that next changes, but never touches hardware or allocates. Plain C
+// with no ESP-IDF dependencies so it can be built and exercised on a host
+// machine. Times are milliseconds from any free running clock.
+
+enum PlayerCommandType_t {
+  PLAYER_PLAY,  // replace everything with a new song
+  PLAYER_STOP,  // silence everything
+  PLAYER_MIX,   // play a song over the current one, which resumes afterwards
+};
+
+struct PlayerVoice_t {
+  const struct Song_t *song;
+  uint16_t next;     // segment to play after the current one
+  int remaining;     // passes left through the song, negative is forever
+  uint16_t freq;     // tone of the segment in progress
+  uint32_t leftMs;   // time left in that segment while the voice is paused
+};
+
+struct Player_t {
+  struct PlayerVoice_t main;
+  struct PlayerVoice_t mix;
+  bool running;
+  uint32_t segmentEnd;
+  // Called once the player is done with a song so its memory can be reused.
+  void (*release)(const struct Song_t *song);
+};
+
+void player_init(struct Player_t *player, void (*release)(const struct Song_t *song));
+void player_command(struct Player_t *player, enum PlayerCommandType_t type, const struct Song_t *song, uint32_t now);
+void player_update(struct Player_t *player, uint32_t now);
+uint16_t player_output(const struct Player_t *player);
+
+#endif
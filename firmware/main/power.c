@@ -0,0 +1,81 @@
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "power.h"
+#include "powerlock.h"
+
+// The CPU drops to the crystal frequency when idle and light sleeps between
+// Wi-Fi beacons. LEDC runs from the APB clock, so while a show, song or OTA is
+// active we keep both light sleep off and the APB clock at full speed.
+#define MAX_CPU_FREQ_MHZ CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#define MIN_CPU_FREQ_MHZ 40
+
+static const char *TAG = "POWER";
+
+static struct PowerLock_t state;
+static portMUX_TYPE stateLock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t noSleepLock = NULL;
+static esp_pm_lock_handle_t apbLock = NULL;
+#endif
+
+static uint64_t nowMs() {
+  return esp_timer_get_time() / 1000;
+}
+
+void power_setup() {
+  powerlock_init(&state);
+
+#ifdef CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t config = {
+    .max_freq_mhz = MAX_CPU_FREQ_MHZ,
+    .min_freq_mhz = MIN_CPU_FREQ_MHZ,
+    .light_sleep_enable = true,
+  };
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Can't configure power management: %s", esp_err_to_name(err));
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "output", &noSleepLock);
+  esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "output-apb", &apbLock);
+#else
+  ESP_LOGW(TAG, "Power management is disabled in this build");
+#endif
+}
+
+void power_hold(enum PowerClient_t client) {
+  taskENTER_CRITICAL(&stateLock);
+  bool first = powerlock_hold(&state, client, nowMs());
+  taskEXIT_CRITICAL(&stateLock);
+
+#ifdef CONFIG_PM_ENABLE
+  if (first) {
+    esp_pm_lock_acquire(apbLock);
+    esp_pm_lock_acquire(noSleepLock);
+  }
+#endif
+}
+
+void power_release(enum PowerClient_t client) {
+  taskENTER_CRITICAL(&stateLock);
+  bool last = powerlock_release(&state, client, nowMs());
+  taskEXIT_CRITICAL(&stateLock);
+
+#ifdef CONFIG_PM_ENABLE
+  if (last) {
+    esp_pm_lock_release(noSleepLock);
+    esp_pm_lock_release(apbLock);
+  }
+#endif
+}
+
+void power_get_wakes(uint32_t *wakes, uint64_t *awakeMs) {
+  taskENTER_CRITICAL(&stateLock);
+  *wakes = state.wakes;
+  *awakeMs = powerlock_awake_ms(&state, nowMs());
+  taskEXIT_CRITICAL(&stateLock);
+}
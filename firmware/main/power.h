@@ -0,0 +1,13 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+#include "powerlock.h"
+
+void power_setup();
+void power_hold(enum PowerClient_t client);
+void power_release(enum PowerClient_t client);
+void power_get_wakes(uint32_t *wakes, uint64_t *awakeMs);
+
+#endif
@@ -0,0 +1,42 @@
+#include "powerlock.h"
+
+void powerlock_init(struct PowerLock_t *lock) {
+  lock->holders = 0;
+  lock->wakes = 0;
+  lock->awakeMs = 0;
+  lock->awakeSince = 0;
+}
+
+// Marks client as needing the chip awake. Holding twice is the same as holding
+// once. Returns true if this is the first holder, so the caller should take the
+// underlying lock.
+bool powerlock_hold(struct PowerLock_t *lock, enum PowerClient_t client, uint64_t nowMs) {
+  uint8_t bit = 1 << client;
+  if (lock->holders & bit) return false;
+
+  bool first = lock->holders == 0;
+  lock->holders |= bit;
+  if (first) {
+    lock->wakes++;
+    lock->awakeSince = nowMs;
+  }
+  return first;
+}
+
+// Returns true if this was the last holder, so the caller should release the
+// underlying lock.
+bool powerlock_release(struct PowerLock_t *lock, enum PowerClient_t client, uint64_t nowMs) {
+  uint8_t bit = 1 << client;
+  if (!(lock->holders & bit)) return false;
+
+  lock->holders &= ~bit;
+  if (lock->holders == 0) {
+    lock->awakeMs += nowMs - lock->awakeSince;
+    return true;
+  }
+  return false;
+}
+
+uint64_t powerlock_awake_ms(const struct PowerLock_t *lock, uint64_t nowMs) {
+  return lock->awakeMs + (lock->holders != 0 ? nowMs - lock->awakeSince : 0);
+}
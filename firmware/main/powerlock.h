@@ -0,0 +1,37 @@
+#ifndef POWERLOCK_H
+#define POWERLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Tracks which parts of the firmware need the chip kept out of light sleep.
+// Plain C with no ESP-IDF dependencies so it can be built and exercised on a
+// host machine; power.c maps it onto esp_pm locks.
+//
+// Wake metric: "wakes" counts each time the device goes from no holders to at
+// least one, i.e. each period the application forces the chip to stay awake,
+// and "awakeMs" is the total length of those periods. Both only grow, and are
+// reported to the server in STATS as pm= and pmms=. Fewer, shorter periods mean
+// more time in light sleep.
+
+enum PowerClient_t {
+  POWER_LED,
+  POWER_SPEAKER,
+  POWER_OTA,
+  POWER_CONSOLE,
+  POWER_CLIENT_COUNT,
+};
+
+struct PowerLock_t {
+  uint8_t holders;  // bit per PowerClient_t
+  uint32_t wakes;
+  uint64_t awakeMs;
+  uint64_t awakeSince;
+};
+
+void powerlock_init(struct PowerLock_t *lock);
+bool powerlock_hold(struct PowerLock_t *lock, enum PowerClient_t client, uint64_t nowMs);
+bool powerlock_release(struct PowerLock_t *lock, enum PowerClient_t client, uint64_t nowMs);
+uint64_t powerlock_awake_ms(const struct PowerLock_t *lock, uint64_t nowMs);
+
+#endif
@@ -0,0 +1,68 @@
+#include <string.h>
+
+#include "reassembly.h"
+
+void reassembly_reset(struct Reassembler_t *reassembler) {
+  reassembler->opcode = 0;
+  reassembler->expected = 0;
+  reassembler->received = 0;
+  reassembler->discarding = false;
+}
+
+// Feeds one piece of a message. payloadLen is the length of the whole message
+// and payloadOffset is where this piece starts in it. Once
+// REASSEMBLY_COMPLETE is returned the message is in buffer, zero terminated,
+// until the next call.
+enum ReassemblyResult_t reassembly_feed(struct Reassembler_t *reassembler, uint8_t opcode, uint32_t payloadLen,
+                                        uint32_t payloadOffset, const uint8_t *data, uint32_t len) {
+  if (payloadOffset == 0) {
+    // Start of a new message. Anything unfinished before it is abandoned.
+    reassembly_reset(reassembler);
+    reassembler->opcode = opcode;
+    reassembler->expected = payloadLen;
+    if (payloadLen > REASSEMBLY_MAX_LEN) {
+      reassembler->discarding = true;
+    }
+  } else if (payloadOffset != reassembler->received || payloadLen != reassembler->expected || opcode != reassembler->opcode) {
+    reassembly_reset(reassembler);
+    return REASSEMBLY_ERR_SEQUENCE;
+  }
+
+  if (len > reassembler->expected - payloadOffset) {
+    reassembly_reset(reassembler);
+    return REASSEMBLY_ERR_SEQUENCE;
+  }
+
+  if (reassembler->discarding) {
+    // Report an oversized message once, on its first piece, then drop the rest.
+    reassembler->received += len;
+    bool first = payloadOffset == 0;
+    if (reassembler->received == reassembler->expected) {
+      reassembly_reset(reassembler);
+    }
+    return first ? REASSEMBLY_ERR_OVERSIZE : REASSEMBLY_PARTIAL;
+  }
+
+  memcpy(reassembler->buffer + reassembler->received, data, len);
+  reassembler->received += len;
+  if (reassembler->received < reassembler->expected) {
+    return REASSEMBLY_PARTIAL;
+  }
+
+  reassembler->buffer[reassembler->received] = 0;
+  return REASSEMBLY_COMPLETE;
+}
+
+const char *reassembly_result_name(enum ReassemblyResult_t result) {
+  switch (result) {
+  case REASSEMBLY_PARTIAL:
+    return "partial";
+  case REASSEMBLY_COMPLETE:
+    return "complete";
+  case REASSEMBLY_ERR_OVERSIZE:
+    return "message too large";
+  case REASSEMBLY_ERR_SEQUENCE:
+    return "out of sequence";
+  }
+  return "unknown";
+}
@@ -0,0 +1,35 @@
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Joins the pieces of a websocket message that arrive in more than one
+// WEBSOCKET_EVENT_DATA event (anything over CONFIG_WS_BUFFER_SIZE) into one
+// preallocated buffer. Plain C with no ESP-IDF dependencies so it can be built
+// and exercised on a host machine.
+
+#define REASSEMBLY_MAX_LEN 4096
+
+enum ReassemblyResult_t {
+  REASSEMBLY_PARTIAL = 0,
+  REASSEMBLY_COMPLETE,
+  REASSEMBLY_ERR_OVERSIZE,
+  REASSEMBLY_ERR_SEQUENCE,
+};
+
+struct Reassembler_t {
+  uint8_t opcode;
+  uint32_t expected;
+  uint32_t received;
+  bool discarding;
+  // One extra byte so text messages can be terminated and parsed in place.
+  uint8_t buffer[REASSEMBLY_MAX_LEN + 1];
+};
+
+void reassembly_reset(struct Reassembler_t *reassembler);
+enum ReassemblyResult_t reassembly_feed(struct Reassembler_t *reassembler, uint8_t opcode, uint32_t payloadLen,
+                                        uint32_t payloadOffset, const uint8_t *data, uint32_t len);
+const char *reassembly_result_name(enum ReassemblyResult_t result);
+
+#endif
@@ -5,12 +5,15 @@
 #define LED_R_PIN 25
 #define LED_G_PIN 26
 #define LED_B_PIN 27
-#define LED_TIMING_PIN 14
 
 #define BEEPER_PIN 33
 
 #define BUTTON_A_PIN 32
 
+// Every button, pulled up and pressed to ground. The server numbers them from 1
+// in this order. Up to GESTURE_MAX_BUTTONS.
+#define BUTTON_PINS { BUTTON_A_PIN }
+
 #define DEFAULT_SERVER "notifier.kcesar.org"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "show.h"
+
+// Longest segment a show may ask for. Keeps the interpolation math in range.
+#define MAX_SEGMENT_MS 3600000
+
+#if SHOW_DUTY_BITS != 13
+#error "gammaDuty is for 13 bit duty"
+#endif
+
+// round(SHOW_DUTY_MAX * (level / 255) ^ 2.2), so equal steps in a color look
+// like equal steps in brightness.
+static const uint16_t gammaDuty[256] = {
+  0, 0, 0, 0, 1, 1, 2, 3, 4, 5, 7, 8,
+  10, 12, 14, 16, 19, 21, 24, 27, 30, 34, 37, 41,
+  45, 49, 54, 59, 63, 69, 74, 79, 85, 91, 97, 104,
+  110, 117, 124, 132, 139, 147, 155, 163, 172, 180, 189, 198,
+  208, 217, 227, 237, 248, 258, 269, 280, 292, 303, 315, 327,
+  340, 352, 365, 378, 391, 405, 419, 433, 447, 462, 477, 492,
+  507, 523, 539, 555, 571, 588, 605, 622, 639, 657, 675, 693,
+  712, 731, 750, 769, 789, 808, 828, 849, 870, 890, 912, 933,
+  955, 977, 999, 1022, 1045, 1068, 1091, 1115, 1139, 1163, 1187, 1212,
+  1237, 1263, 1288, 1314, 1340, 1367, 1394, 1421, 1448, 1476, 1503, 1532,
+  1560, 1589, 1618, 1647, 1677, 1707, 1737, 1767, 1798, 1829, 1860, 1892,
+  1924, 1956, 1989, 2022, 2055, 2088, 2122, 2156, 2190, 2224, 2259, 2294,
+  2330, 2366, 2402, 2438, 2475, 2512, 2549, 2586, 2624, 2662, 2701, 2740,
+  2779, 2818, 2858, 2897, 2938, 2978, 3019, 3060, 3102, 3143, 3186, 3228,
+  3271, 3314, 3357, 3400, 3444, 3489, 3533, 3578, 3623, 3669, 3714, 3760,
+  3807, 3853, 3900, 3948, 3995, 4043, 4091, 4140, 4189, 4238, 4288, 4337,
+  4387, 4438, 4489, 4540, 4591, 4643, 4695, 4747, 4800, 4853, 4906, 4960,
+  5013, 5068, 5122, 5177, 5232, 5288, 5344, 5400, 5456, 5513, 5570, 5627,
+  5685, 5743, 5802, 5860, 5919, 5979, 6038, 6098, 6159, 6219, 6280, 6342,
+  6403, 6465, 6528, 6590, 6653, 6716, 6780, 6844, 6908, 6973, 7037, 7103,
+  7168, 7234, 7300, 7367, 7434, 7501, 7568, 7636, 7704, 7773, 7842, 7911,
+  7980, 8050, 8120, 8191,
+};
+
+static int fromHex(char ch) {
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+  if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+  return -1;
+}
+
+static const char *skipSpaces(const char *ch) {
+  while (*ch == ' ') ch++;
+  return ch;
+}
+
+// Reads a decimal number, returning NULL if there isn't one.
+static const char *readNumber(const char *ch, int *value) {
+  if (*ch < '0' || *ch > '9') return NULL;
+
+  int result = 0;
+  while (*ch >= '0' && *ch <= '9') {
+    if (result > MAX_SEGMENT_MS) return NULL;
+    result = result * 10 + (*ch - '0');
+    ch++;
+  }
+  *value = result;
+  return ch;
+}
+
+void show_begin(struct Show_t *show, int replays) {
+  show->replays = replays;
+  show->count = 0;
+  memset(show->lastDuty, 0, sizeof(show->lastDuty));
+}
+
+enum ShowResult_t show_add_segment(struct Show_t *show, const uint8_t rgb[SHOW_NUM_CHANNELS], int ms) {
+  if (ms < 0 || ms > MAX_SEGMENT_MS) return SHOW_ERR_SYNTAX;
+
+  // Each segment is played as a single hardware fade. Only fades too long for
+  // a step's ms field are broken into slices, each ending on the color it would
+  // have reached by that point.
+  int slices = ms == 0 ? 1 : (ms + SHOW_MAX_STEP_MS - 1) / SHOW_MAX_STEP_MS;
+  if (show->count + slices > SHOW_MAX_STEPS) return SHOW_ERR_OVERFLOW;
+
+  uint16_t duty[SHOW_NUM_CHANNELS];
+  for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+    duty[i] = show_duty(rgb[i]);
+  }
+
+  // Slices are points on the straight line in duty the fade would follow.
+  // Progress is in 16 bit fixed point, so each channel needs only 32 bit math.
+  int elapsed = 0;
+  for (int s = 0; s < slices; s++) {
+    struct ShowStep_t *step = &show->steps[show->count++];
+    if (ms == 0) {
+      memcpy(step->duty, duty, sizeof(duty));
+      step->ms = 0;
+    } else {
+      int sliceMs = ms - elapsed > SHOW_MAX_STEP_MS ? SHOW_MAX_STEP_MS : ms - elapsed;
+      elapsed += sliceMs;
+      int32_t progress = (int32_t)(((uint64_t)elapsed << 16) / ms);
+      for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+        int32_t from = show->lastDuty[i];
+        step->duty[i] = from + (((duty[i] - from) * progress) >> 16);
+      }
+      step->ms = sliceMs;
+    }
+  }
+  memcpy(show->lastDuty, duty, sizeof(duty));
+  return SHOW_OK;
+}
+
+// A show that replays but takes no time would have the player go round it
+// without ever waiting, so it is refused along with an empty one.
+enum ShowResult_t show_end(const struct Show_t *show) {
+  if (show->count == 0) return SHOW_ERR_SYNTAX;
+  if (show->replays == 1) return SHOW_OK;
+  for (int i = 0; i < show->count; i++) {
+    if (show->steps[i].ms > 0) return SHOW_OK;
+  }
+  return SHOW_ERR_SYNTAX;
+}
+
+// Format is "<replays> <RRGGBB> <ms> [<RRGGBB> <ms> ...]". Each pair fades from
+// the previous color (black at the start) to the new color over ms.
+enum ShowResult_t show_compile(const char *display, struct Show_t *show) {
+  const char *ch = skipSpaces(display);
+
+  int sign = 1;
+  if (*ch == '-') {
+    sign = -1;
+    ch++;
+  }
+  int replays;
+  ch = readNumber(ch, &replays);
+  if (ch == NULL) return SHOW_ERR_SYNTAX;
+  show_begin(show, replays * sign);
+
+  while (*(ch = skipSpaces(ch)) != '\0') {
+    uint8_t rgb[SHOW_NUM_CHANNELS];
+    for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+      int high = fromHex(ch[0]);
+      int low = high < 0 ? -1 : fromHex(ch[1]);
+      if (low < 0) return SHOW_ERR_SYNTAX;
+      rgb[i] = high * 16 + low;
+      ch += 2;
+    }
+
+    int ms;
+    if (*ch != ' ') return SHOW_ERR_SYNTAX;
+    ch = readNumber(skipSpaces(ch), &ms);
+    if (ch == NULL) return SHOW_ERR_SYNTAX;
+
+    enum ShowResult_t result = show_add_segment(show, rgb, ms);
+    if (result != SHOW_OK) return result;
+  }
+
+  return show_end(show);
+}
+
+// The PWM duty for a channel level.
+uint16_t show_duty(uint8_t level) {
+  return gammaDuty[level];
+}
+
+void show_cursor_start(struct ShowCursor_t *cursor, const struct Show_t *show) {
+  cursor->show = show;
+  cursor->step = 0;
+  cursor->remaining = show == NULL ? 0 : show->replays;
+}
+
+// Returns the step to play next, or NULL once the show is over.
+const struct ShowStep_t *show_cursor_next(struct ShowCursor_t *cursor) {
+  if (cursor->show == NULL || cursor->show->count == 0 || cursor->remaining == 0) return NULL;
+
+  const struct ShowStep_t *step = &cursor->show->steps[cursor->step];
+  if (++cursor->step == cursor->show->count) {
+    cursor->step = 0;
+    if (cursor->remaining > 0) cursor->remaining--;
+  }
+  return step;
+}
+
+const char *show_result_name(enum ShowResult_t result) {
+  switch (result) {
+  case SHOW_OK:
+    return "ok";
+  case SHOW_ERR_SYNTAX:
+    return "syntax error";
+  case SHOW_ERR_OVERFLOW:
+    return "too many steps";
+  }
+  return "unknown";
+}
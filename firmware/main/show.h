@@ -0,0 +1,57 @@
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <stdint.h>
+
+// Compiles LED shows into a fixed-size step array. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+
+#define SHOW_NUM_CHANNELS 3
+#define SHOW_MAX_STEPS 64
+#define SHOW_MAX_STEP_MS UINT16_MAX
+// Shorter steps are set at once rather than faded.
+#define SHOW_MIN_FADE_MS 30
+// The most LEDC can give at 5 kHz. Dim levels need the resolution once gamma
+// corrected.
+#define SHOW_DUTY_BITS 13
+#define SHOW_DUTY_MAX ((1 << SHOW_DUTY_BITS) - 1)
+
+enum ShowResult_t {
+  SHOW_OK = 0,
+  SHOW_ERR_SYNTAX,
+  SHOW_ERR_OVERFLOW,
+};
+
+// Duties are worked out when the show is compiled, so playing a step only
+// hands them to LEDC.
+struct ShowStep_t {
+  uint16_t duty[SHOW_NUM_CHANNELS];
+  uint16_t ms;
+};
+
+struct Show_t {
+  int replays;  // number of times to play the show. negative plays forever.
+  uint16_t count;
+  uint16_t lastDuty[SHOW_NUM_CHANNELS];
+  struct ShowStep_t steps[SHOW_MAX_STEPS];
+};
+
+// Where playback is in a show.
+struct ShowCursor_t {
+  const struct Show_t *show;
+  uint16_t step;
+  int remaining;  // passes left through the show, negative is forever
+};
+
+void show_begin(struct Show_t *show, int replays);
+enum ShowResult_t show_add_segment(struct Show_t *show, const uint8_t rgb[SHOW_NUM_CHANNELS], int ms);
+// Checks a show built with show_add_segment can be played.
+enum ShowResult_t show_end(const struct Show_t *show);
+enum ShowResult_t show_compile(const char *display, struct Show_t *show);
+const char *show_result_name(enum ShowResult_t result);
+uint16_t show_duty(uint8_t level);
+
+void show_cursor_start(struct ShowCursor_t *cursor, const struct Show_t *show);
+const struct ShowStep_t *show_cursor_next(struct ShowCursor_t *cursor);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stddef.h>
+
+#include "song.h"
+
+static const char *skipSpaces(const char *ch) {
+  while (*ch == ' ') ch++;
+  return ch;
+}
+
+// Reads a decimal number no larger than max, returning NULL if there isn't one.
+static const char *readNumber(const char *ch, int max, int *value) {
+  if (*ch < '0' || *ch > '9') return NULL;
+
+  int result = 0;
+  while (*ch >= '0' && *ch <= '9') {
+    result = result * 10 + (*ch - '0');
+    if (result > max) return NULL;
+    ch++;
+  }
+  *value = result;
+  return ch;
+}
+
+void song_begin(struct Song_t *song, uint8_t speaker, int replays) {
+  song->speaker = speaker;
+  song->replays = replays;
+  song->count = 0;
+}
+
+// Adds a note to the song. Notes continuing the previous tone (or rest) are
+// merged into its segment so playback only changes the output when it has to.
+enum SongResult_t song_add_note(struct Song_t *song, int freq, int ms) {
+  if (freq < 0 || ms < 0 || ms > UINT16_MAX) return SONG_ERR_SYNTAX;
+  if (ms == 0) return SONG_OK;
+
+  if (freq > 0 && freq < SONG_MIN_FREQ) freq = SONG_MIN_FREQ;
+  if (freq > SONG_MAX_FREQ) freq = SONG_MAX_FREQ;
+
+  if (song->count > 0) {
+    struct SongSegment_t *last = &song->segments[song->count - 1];
+    if (last->freq == freq && last->ms + ms <= UINT16_MAX) {
+      last->ms += ms;
+      return SONG_OK;
+    }
+  }
+
+  if (song->count == SONG_MAX_SEGMENTS) return SONG_ERR_OVERFLOW;
+  song->segments[song->count].freq = freq;
+  song->segments[song->count].ms = ms;
+  song->count++;
+  return SONG_OK;
+}
+
+// Format is "<speaker> <replays> <freq> <ms> [<freq> <ms> ...]". A freq of 0
+// is a rest.
+enum SongResult_t song_compile(const char *text, struct Song_t *song) {
+  const char *ch = skipSpaces(text);
+
+  int speaker;
+  ch = readNumber(ch, UINT8_MAX, &speaker);
+  if (ch == NULL) return SONG_ERR_SYNTAX;
+
+  int sign = 1;
+  ch = skipSpaces(ch);
+  if (*ch == '-') {
+    sign = -1;
+    ch++;
+  }
+  int replays;
+  ch = readNumber(ch, INT16_MAX, &replays);
+  if (ch == NULL) return SONG_ERR_SYNTAX;
+  song_begin(song, speaker, replays * sign);
+
+  while (*(ch = skipSpaces(ch)) != '\0') {
+    int freq, ms;
+    ch = readNumber(ch, UINT16_MAX, &freq);
+    if (ch == NULL) return SONG_ERR_SYNTAX;
+    ch = readNumber(skipSpaces(ch), UINT16_MAX, &ms);
+    if (ch == NULL) return SONG_ERR_SYNTAX;
+
+    enum SongResult_t result = song_add_note(song, freq, ms);
+    if (result != SONG_OK) return result;
+  }
+
+  return song->count == 0 ? SONG_ERR_SYNTAX : SONG_OK;
+}
+
+const char *song_result_name(enum SongResult_t result) {
+  switch (result) {
+  case SONG_OK:
+    return "ok";
+  case SONG_ERR_SYNTAX:
+    return "syntax error";
+  case SONG_ERR_OVERFLOW:
+    return "too many notes";
+  }
+  return "unknown";
+}
@@ -0,0 +1,36 @@
+#ifndef SONG_H
+#define SONG_H
+
+#include <stdint.h>
+
+// Compiles BEEP songs into timed tone segments. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+
+#define SONG_MAX_SEGMENTS 64
+#define SONG_MIN_FREQ 100
+#define SONG_MAX_FREQ 10000
+
+enum SongResult_t {
+  SONG_OK = 0,
+  SONG_ERR_SYNTAX,
+  SONG_ERR_OVERFLOW,
+};
+
+struct SongSegment_t {
+  uint16_t freq;  // 0 is a rest
+  uint16_t ms;
+};
+
+struct Song_t {
+  uint8_t speaker;
+  int replays;  // number of times to play the song. negative plays forever.
+  uint16_t count;
+  struct SongSegment_t segments[SONG_MAX_SEGMENTS];
+};
+
+void song_begin(struct Song_t *song, uint8_t speaker, int replays);
+enum SongResult_t song_add_note(struct Song_t *song, int freq, int ms);
+enum SongResult_t song_compile(const char *text, struct Song_t *song);
+const char *song_result_name(enum SongResult_t result);
+
+#endif
@@ -1,217 +1,256 @@
-#include "driver/gpio.h"
 #include "driver/ledc.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
 #include <string.h>
 
+#include "arbiter.h"
+#include "logging.h"
+#include "player.h"
+#include "power.h"
 #include "setup.h"
+#include "song.h"
 #include "speaker.h"
 
+#define BEEP_TIMER LEDC_TIMER_1
+#define BEEP_CHANNEL LEDC_CHANNEL_0
+#define BEEP_DUTY_ON 512 // half of the 10 bit range, a square wave
+
+#define COMMAND_QUEUE_LEN 8
+// Every layer's player can hold a main song and a mix, and every queued
+// command a song of its own. With that many slots a song is only ever dropped
+// because the queue is full.
+#define VOICES_PER_LAYER 2
+#define SONG_POOL_SIZE (ARBITER_LAYER_COUNT * VOICES_PER_LAYER + COMMAND_QUEUE_LEN)
+
 static const char *TAG = "SPEAKER";
 
-struct SongNode_t {
-  int freq;
-  int ms;
-  int replays;
-  struct SongNode_t *next;
+#define ALL_LAYERS ARBITER_LAYER_COUNT
+
+struct AudioCommand_t {
+  enum PlayerCommandType_t type;
+  uint8_t layer;  // or ALL_LAYERS
+  struct Song_t *song;
 };
 
-int playOnSpeaker = -1;
-struct SongNode_t *song = NULL;
-static esp_timer_handle_t beepTimer = NULL;
-
-// void speaker_play(char *songText) {
-//   ESP_LOGI(TAG, "Play Song %s", songText);
-//   char *marker;
-//   char *token = strtok_r(songText, " ", &marker);
-//   replays = atoi(token);
-
-//   struct SongNode_t *head = NULL;
-//   struct SongNode_t *lastNote = NULL;
-//   do {
-//     struct SongNode_t *note = (struct SongNode_t *)malloc(sizeof(struct SongNode_t));
-//     note->replays = replays;
-
-//     token = strtok_r(NULL, " ", &marker);
-//     note->freq = atoi(token);
-
-//     token = strtok_r(NULL, " ", &marker);
-//     note->ms = atoi(token);
-//     if (head == NULL) {
-//       head = note;
-//     } else {
-//       lastNote->next = note;
-//     }
-//     lastNote = note;
-//   } while (token != NULL && marker != NULL);
-
-//   // Make the list a loop so we can repeat the song.
-//   if (lastNote != NULL) {
-//     lastNote->next = head;
-//   }
-
-//   speaker_silence();
-//   song = head;
-// }
-
-// void speaker_silence() {
-//   ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_TIMER_1);
-
-//   struct SongNode_t *ptr = song;
-//   struct SongNode_t *begin = NULL;
-//   song = NULL;
-
-//   while (ptr != begin) {
-//     if (begin == NULL) begin = ptr;
-//     struct SongNode_t *next = ptr->next;
-//     free(ptr);
-//     ptr = next;
-//   }
-// }
+// Songs are compiled into a slot from this pool by whoever asks for them, then
+// owned by the speaker task until the player releases them. freeSongs holds the
+// indexes of unused slots.
+static struct Song_t songPool[SONG_POOL_SIZE];
+static QueueHandle_t freeSongs = NULL;
+static QueueHandle_t commands = NULL;
+static uint32_t droppedSongs = 0;
+
+// Each priority layer has its own player, and only the top one sounds. A
+// layer that is preempted has its clock stopped at pausedAt, and its schedule
+// moved on by however long it waited once it is back on top.
+static struct Player_t players[ARBITER_LAYER_COUNT];
+static bool paused[ARBITER_LAYER_COUNT];
+static uint32_t pausedAt[ARBITER_LAYER_COUNT];
+static struct Arbiter_t arbiter;
+static uint16_t currentFreq = 0;
+static int outputFreq = -1;
+
+static uint32_t nowMs() {
+  return esp_timer_get_time() / 1000;
+}
 
-void speaker_silence() {
-  playOnSpeaker = -1;
-  if (beepTimer != NULL) {
-    esp_timer_delete(beepTimer);
-    beepTimer = NULL;
+static void setTone(uint16_t freq) {
+  if (freq == outputFreq) return;
+  outputFreq = freq;
+
+  if (freq == 0) {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, BEEP_CHANNEL, 0);
+  } else {
+    if (freq != currentFreq) {
+      ledc_set_freq(LEDC_LOW_SPEED_MODE, BEEP_TIMER, freq);
+      currentFreq = freq;
+    }
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, BEEP_CHANNEL, BEEP_DUTY_ON);
   }
-  gpio_set_level(BEEPER_PIN, 0);
-  
-  struct SongNode_t *ptr = song;
-  struct SongNode_t *begin = NULL;
-  song = NULL;
-
-  while (ptr != begin) {
-    if (begin == NULL) begin = ptr;
-    struct SongNode_t *next = ptr->next;
-    free(ptr);
-    ptr = next;
+  ledc_update_duty(LEDC_LOW_SPEED_MODE, BEEP_CHANNEL);
+}
+
+static struct Song_t *claimSong() {
+  uint8_t idx;
+  if (freeSongs == NULL || xQueueReceive(freeSongs, &idx, 0) != pdTRUE) {
+    uint32_t dropped = __atomic_add_fetch(&droppedSongs, 1, __ATOMIC_RELAXED);
+    ESP_LOGW(TAG, "No free song slots. Dropping song (%lu dropped).", (unsigned long)dropped);
+    return NULL;
   }
+  return &songPool[idx];
 }
 
-static void playNextBeep() {
-  if (song == NULL || song->replays == 0) {
-    speaker_silence();
-    return;
-  };
+static void releaseSong(const struct Song_t *song) {
+  uint8_t idx = song - songPool;
+  xQueueSend(freeSongs, &idx, 0);
+}
 
-  if (beepTimer == NULL) {
-    const esp_timer_create_args_t beepArgs = {
-      .callback = &playNextBeep,
-      .name = "beep timer",
-    };
-    esp_timer_create(&beepArgs, &beepTimer);
+// Never blocks. If the queue is full the command is dropped.
+static void sendCommand(enum PlayerCommandType_t type, uint8_t layer, struct Song_t *song) {
+  struct AudioCommand_t command = { .type = type, .layer = layer, .song = song };
+  if (commands == NULL || xQueueSend(commands, &command, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Speaker is busy. Dropping command %d", type);
+    if (song != NULL) releaseSong(song);
   }
-  ESP_LOGI(TAG, "BEEP: %d %d (remaining %d)", song->freq > 0, song->ms, song->replays);
-  gpio_set_level(BEEPER_PIN, song->freq > 0);
-  esp_timer_start_once(beepTimer, song->ms * 1000);
-  song->replays--;
-  song = song->next;
 }
 
-void speaker_play(char *songText) {
-  ESP_LOGI(TAG, "Play Song %s", songText);
+static void queueSong(enum PlayerCommandType_t type, enum ArbiterLayer_t layer, const char *songText) {
+  if (layer >= ARBITER_LAYER_COUNT) return;
+  struct Song_t *song = claimSong();
+  if (song == NULL) return;
 
-  char *marker;
-  const char* token = strtok_r(songText, " ", &marker);
-  ESP_LOGI(TAG, "Parsing token %s :: %s", token, marker);
-  int speakerId = atoi(token);
-  if (speakerId > 1) return;
-
-  int replays = atoi(strtok_r(NULL, " ", &marker));
+  enum SongResult_t result = song_compile(songText, song);
+  if (result != SONG_OK) {
+    ESP_LOGE(TAG, "Can't play song (%s): %s", song_result_name(result), songText);
+    releaseSong(song);
+    return;
+  }
+  sendCommand(type, layer, song);
+}
 
-  struct SongNode_t *head = NULL;
-  struct SongNode_t *lastNote = NULL;
-  do {
-    struct SongNode_t *note = (struct SongNode_t *)malloc(sizeof(struct SongNode_t));
-    note->replays = replays;
+// Stops every layer.
+void speaker_silence() {
+  sendCommand(PLAYER_STOP, ALL_LAYERS, NULL);
+}
 
-    note->freq = atoi(strtok_r(NULL, " ", &marker));
-    note->ms = atoi(strtok_r(NULL, " ", &marker));
+void speaker_play(enum ArbiterLayer_t layer, const char *songText) {
+  queueSong(PLAYER_PLAY, layer, songText);
+}
 
-    if (head == NULL) {
-      head = note;
-    } else {
-      lastNote->next = note;
-    }
-    lastNote = note;
-  } while (marker != NULL);
+void speaker_mix(enum ArbiterLayer_t layer, const char *songText) {
+  queueSong(PLAYER_MIX, layer, songText);
+}
 
-  // Make the list a loop so we can repeat the song.
-  if (lastNote != NULL) {
-    lastNote->next = head;
+void speaker_play_frame(enum ArbiterLayer_t layer, const struct FrameRecord_t *record) {
+  if (layer >= ARBITER_LAYER_COUNT) return;
+  struct Song_t *song = claimSong();
+  if (song == NULL) return;
+
+  song_begin(song, record->target, record->replays);
+  enum SongResult_t result = SONG_OK;
+  for (int i = 0; i < record->count && result == SONG_OK; i++) {
+    uint16_t freq, ms;
+    frame_beep_note(record, i, &freq, &ms);
+    result = song_add_note(song, freq, ms);
+  }
+  if (result != SONG_OK || song->count == 0) {
+    ESP_LOGE(TAG, "Can't play binary song (%s)", song_result_name(result));
+    releaseSong(song);
+    return;
   }
+  sendCommand(PLAYER_PLAY, layer, song);
+}
+
+void speaker_setup() {
+  ledc_timer_config_t timer_config = {
+      .speed_mode = LEDC_LOW_SPEED_MODE,
+      .duty_resolution = LEDC_TIMER_10_BIT,
+      .timer_num = BEEP_TIMER,
+      .freq_hz = 1000,
+      .clk_cfg = LEDC_USE_APB_CLK,
+  };
+  ledc_timer_config(&timer_config);
+  currentFreq = timer_config.freq_hz;
+
+  ledc_channel_config_t channel_config = {
+      .gpio_num = BEEPER_PIN,
+      .speed_mode = LEDC_LOW_SPEED_MODE,
+      .channel = BEEP_CHANNEL,
+      .timer_sel = BEEP_TIMER,
+      .duty = 0,
+      .hpoint = 0,
+  };
+  ledc_channel_config(&channel_config);
 
-  speaker_silence();
-  song = head;
-  playOnSpeaker = speakerId;
-  if (playOnSpeaker == 0) {
-    playNextBeep();
+  freeSongs = xQueueCreate(SONG_POOL_SIZE, sizeof(uint8_t));
+  for (uint8_t i = 0; i < SONG_POOL_SIZE; i++) {
+    xQueueSend(freeSongs, &i, 0);
+  }
+  commands = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(struct AudioCommand_t));
+  for (int i = 0; i < ARBITER_LAYER_COUNT; i++) {
+    player_init(&players[i], releaseSong);
   }
+  arbiter_init(&arbiter);
 }
 
-void speaker_play_const(const char *song) {
-  char songbuf[strlen(song) + 1];
-  strcpy(songbuf, song);
-  speaker_play(songbuf);
+static void pauseClock(int8_t layer, uint32_t now) {
+  paused[layer] = true;
+  pausedAt[layer] = now;
 }
 
-void speaker_setup() {
-  gpio_reset_pin(BEEPER_PIN);
-  gpio_set_direction(BEEPER_PIN, GPIO_MODE_OUTPUT);
-  gpio_set_level(BEEPER_PIN, 0);
+static void resumeClock(int8_t layer, uint32_t now) {
+  if (!paused[layer]) return;
+  players[layer].segmentEnd += now - pausedAt[layer];
+  paused[layer] = false;
+}
+
+static void applyChange(struct ArbiterChange_t change, uint32_t now) {
+  if (change.pause == ARBITER_NONE && change.play == ARBITER_NONE) return;
+  TRACE(TRACE_SPEAKER_LAYER, change.pause, change.play, 0);
+  if (change.pause != ARBITER_NONE) pauseClock(change.pause, now);
+  if (change.play != ARBITER_NONE) resumeClock(change.play, now);
+}
+
+// A layer's clock runs while it takes the command, so a mix pauses the right
+// amount of its song. It stops again straight after if the layer isn't on top.
+static void commandLayer(const struct AudioCommand_t *command, enum ArbiterLayer_t layer, uint32_t now) {
+  struct Player_t *player = &players[layer];
+  resumeClock(layer, now);
+  player_command(player, command->type, command->song, now);
+  applyChange(player->running ? arbiter_start(&arbiter, layer) : arbiter_finish(&arbiter, layer), now);
+  if (player->running && arbiter_top(&arbiter) != layer) pauseClock(layer, now);
 }
 
+static void runCommand(const struct AudioCommand_t *command, uint32_t now) {
+  TRACE(TRACE_SPEAKER_COMMAND, command->type, command->song != NULL ? command->song->count : 0, command->layer);
+  if (command->layer == ALL_LAYERS) {
+    for (int i = 0; i < ARBITER_LAYER_COUNT; i++) {
+      commandLayer(command, i, now);
+    }
+  } else {
+    commandLayer(command, command->layer, now);
+  }
+}
+
+// Owns the buzzer and all song memory. Sleeps until a command arrives or the
+// current segment ends.
 void speaker_task(void *args) {
   ESP_LOGI(TAG, "Task is starting ...");
 
   while (1) {
-    vTaskDelay(500 / portTICK_PERIOD_MS);    
+    int8_t top = arbiter_top(&arbiter);
+    TickType_t wait = portMAX_DELAY;
+    if (top != ARBITER_NONE) {
+      int32_t ms = players[top].segmentEnd - nowMs();
+      wait = ms <= 0 ? 0 : (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+    }
+
+    struct AudioCommand_t command;
+    if (xQueueReceive(commands, &command, wait) == pdTRUE) {
+      runCommand(&command, nowMs());
+    }
+    uint32_t now = nowMs();
+    top = arbiter_top(&arbiter);
+    int32_t late = top != ARBITER_NONE ? (int32_t)(now - players[top].segmentEnd) : 0;
+    // A layer that finishes hands the buzzer to the next one down, which may
+    // itself be done. At most once per layer.
+    while (top != ARBITER_NONE) {
+      player_update(&players[top], now);
+      if (players[top].running) break;
+      applyChange(arbiter_finish(&arbiter, top), now);
+      top = arbiter_top(&arbiter);
+    }
+    if (top != ARBITER_NONE) {
+      power_hold(POWER_SPEAKER);
+    }
+    uint16_t freq = top != ARBITER_NONE ? player_output(&players[top]) : 0;
+    if (freq != outputFreq) TRACE(TRACE_SPEAKER_TONE, freq, late, 0);
+    setTone(freq);
+    if (top == ARBITER_NONE) {
+      power_release(POWER_SPEAKER);
+    }
   }
 }
-
-// void speaker_task_tones(void *args) {
-//   ESP_LOGI(TAG, "Task is starting ...");
-//   ledc_timer_config_t ledc_timer = {
-//       .speed_mode = LEDC_LOW_SPEED_MODE,
-//       .duty_resolution = LEDC_TIMER_8_BIT,
-//       .timer_num = LEDC_TIMER_1,
-//       .freq_hz = 10,
-//       .clk_cfg = LEDC_AUTO_CLK,
-//   };
-//   ledc_timer_config(&ledc_timer);
-//   ledc_channel_config_t ledc_channel = {
-//       .gpio_num = BEEPER_PIN,
-//       .speed_mode = LEDC_LOW_SPEED_MODE,
-//       .channel = LEDC_CHANNEL_0,
-//       .timer_sel = LEDC_TIMER_1,
-//       .duty = 0x1f,
-//       .hpoint = 0,
-//   };
-//   ledc_channel_config(&ledc_channel);
-//   ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_TIMER_1);
-
-//   while (1) {
-//     if (song == NULL || song->replays == 0) {
-//       speaker_silence();
-
-//       vTaskDelay(500 / portTICK_PERIOD_MS);
-//     } else {
-//       int ms = song->ms;
-
-//       ESP_LOGI(TAG, "NOTE: %d %d (remaining %d)", song->freq, song->ms, song->replays);
-//       if (song->freq == 0) {
-//         ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_TIMER_1);
-//       } else {
-//         ledc_set_freq(LEDC_LOW_SPEED_MODE, LEDC_TIMER_1, song->freq);
-//         ledc_timer_resume(LEDC_LOW_SPEED_MODE, LEDC_TIMER_1);
-//       }
-//       song->replays--;
-//       song = song->next;
-//       vTaskDelay(ms / portTICK_PERIOD_MS);
-//     }
-//   }
-// }
\ No newline at end of file
@@ -1,9 +1,13 @@
 #ifndef SPEAKER_H
 #define SPEAKER_H
 
+#include "arbiter.h"
+#include "frame.h"
+
 void speaker_setup();
-void speaker_play_const(const char *song);
-void speaker_play(char *song);
+void speaker_play(enum ArbiterLayer_t layer, const char *song);
+void speaker_mix(enum ArbiterLayer_t layer, const char *song);
+void speaker_play_frame(enum ArbiterLayer_t layer, const struct FrameRecord_t *record);
 void speaker_silence();
 void speaker_task(void *args);
 
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+#include "stats.h"
+
+// Returns the length of the message, or -1 if it doesn't fit in buf.
+int stats_encode(const struct DeviceStats_t *stats, char *buf, size_t len) {
+  int used = snprintf(buf, len, "STATS up=%lu heap=%lu minheap=%lu block=%lu rc=%lu pm=%lu pmms=%llu",
+                      (unsigned long)stats->uptimeS, (unsigned long)stats->freeHeap,
+                      (unsigned long)stats->minFreeHeap, (unsigned long)stats->largestBlock,
+                      (unsigned long)stats->reconnects, (unsigned long)stats->wakes,
+                      (unsigned long long)stats->awakeMs);
+  if (used < 0 || (size_t)used >= len) return -1;
+
+  for (int i = 0; i < stats->taskCount && i < STATS_MAX_TASKS; i++) {
+    int written = snprintf(buf + used, len - used, " s.%s=%lu", stats->tasks[i].name,
+                           (unsigned long)stats->tasks[i].stackFree);
+    if (written < 0 || (size_t)written >= len - used) return -1;
+    used += written;
+  }
+  return used;
+}
@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Encodes device health samples as a STATS message for the server. Plain C with
+// no ESP-IDF dependencies so it can be built and exercised on a host machine.
+//
+//   STATS up=<s> heap=<bytes> minheap=<bytes> block=<bytes> rc=<count> pm=<count> pmms=<ms>
+//         s.<task>=<bytes> ...
+//
+// pm and pmms are the wake count and time held awake from powerlock.h.
+// s.<task> is the least free stack the task has had, in bytes.
+
+#define STATS_MAX_TASKS 8
+
+struct TaskStats_t {
+  const char *name;
+  uint32_t stackFree;
+};
+
+struct DeviceStats_t {
+  uint32_t uptimeS;
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;
+  uint32_t largestBlock;
+  uint32_t reconnects;
+  uint32_t wakes;
+  uint64_t awakeMs;
+  uint8_t taskCount;
+  struct TaskStats_t tasks[STATS_MAX_TASKS];
+};
+
+int stats_encode(const struct DeviceStats_t *stats, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,116 @@
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "power.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "websocket.h"
+
+#define STATS_INTERVAL_MS (5 * 60 * 1000)
+#define STATS_MESSAGE_LEN 256
+#define BOOT_MESSAGE_LEN 128
+
+static const char *TAG = "TELEMETRY";
+
+static TaskHandle_t watchedTasks[STATS_MAX_TASKS];
+static int watchedCount = 0;
+
+// Phases are marked from app_main, the Wi-Fi event handler and the websocket
+// task.
+static struct BootLog_t bootLog;
+static bool bootLogStarted = false;
+static portMUX_TYPE bootLogLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Adds a task whose stack high-water mark should be reported. Call before
+// telemetry_task starts.
+void telemetry_watch_task(TaskHandle_t task) {
+  if (task == NULL || watchedCount == STATS_MAX_TASKS) return;
+  watchedTasks[watchedCount++] = task;
+}
+
+static void sampleStats(struct DeviceStats_t *stats) {
+  stats->uptimeS = esp_timer_get_time() / 1000000;
+  stats->freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  stats->minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  stats->largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  stats->reconnects = websocket_reconnect_count();
+  power_get_wakes(&stats->wakes, &stats->awakeMs);
+
+  stats->taskCount = watchedCount;
+  for (int i = 0; i < watchedCount; i++) {
+    stats->tasks[i].name = pcTaskGetName(watchedTasks[i]);
+    // ESP-IDF reports the high-water mark in bytes.
+    stats->tasks[i].stackFree = uxTaskGetStackHighWaterMark(watchedTasks[i]);
+  }
+}
+
+// Notes the time a boot phase was first reached. Reaching WELCOME sends the
+// whole log to the server.
+void telemetry_boot_phase(enum BootPhase_t phase) {
+  uint32_t ms = esp_timer_get_time() / 1000;
+  uint8_t resetReason = esp_reset_reason();
+  bool report = false;
+  struct BootLog_t copy;
+
+  taskENTER_CRITICAL(&bootLogLock);
+  if (!bootLogStarted) {
+    bootlog_init(&bootLog, resetReason);
+    bootLogStarted = true;
+  }
+  report = phase == BOOT_PHASE_WELCOME && !bootlog_has(&bootLog, phase);
+  bootlog_mark(&bootLog, phase, ms);
+  copy = bootLog;
+  taskEXIT_CRITICAL(&bootLogLock);
+
+  if (!report) return;
+  char message[BOOT_MESSAGE_LEN];
+  int len = bootlog_encode(&copy, message, sizeof(message));
+  ESP_LOGI(TAG, "%s", message);
+  if (len > 0) websocket_send_text(message, len);
+}
+
+// Writes the boot log as it would be sent. Returns the length, or -1 if it
+// doesn't fit.
+int telemetry_format_boot(char *buf, int len) {
+  struct BootLog_t copy;
+  taskENTER_CRITICAL(&bootLogLock);
+  copy = bootLog;
+  taskEXIT_CRITICAL(&bootLogLock);
+  return bootlog_encode(&copy, buf, len);
+}
+
+void telemetry_boot_fast_connect(bool fast) {
+  taskENTER_CRITICAL(&bootLogLock);
+  bootLog.fastConnect = fast;
+  taskEXIT_CRITICAL(&bootLogLock);
+}
+
+// Writes a STATS message for the current moment. Returns the length, or -1 if
+// it doesn't fit.
+int telemetry_format_stats(char *buf, int len) {
+  struct DeviceStats_t stats;
+  sampleStats(&stats);
+  return stats_encode(&stats, buf, len);
+}
+
+void telemetry_task(void *args) {
+  ESP_LOGI(TAG, "Task is starting ...");
+  telemetry_watch_task(xTaskGetCurrentTaskHandle());
+
+  char message[STATS_MESSAGE_LEN];
+  while (1) {
+    vTaskDelay(STATS_INTERVAL_MS / portTICK_PERIOD_MS);
+    if (!websocket_is_connected()) continue;
+
+    int len = telemetry_format_stats(message, sizeof(message));
+    if (len < 0) {
+      ESP_LOGW(TAG, "Stats don't fit in a message");
+      continue;
+    }
+    websocket_send_text(message, len);
+  }
+}
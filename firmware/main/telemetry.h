@@ -0,0 +1,16 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "bootlog.h"
+
+void telemetry_watch_task(TaskHandle_t task);
+void telemetry_task(void *args);
+void telemetry_boot_phase(enum BootPhase_t phase);
+void telemetry_boot_fast_connect(bool fast);
+int telemetry_format_stats(char *buf, int len);
+int telemetry_format_boot(char *buf, int len);
+
+#endif
@@ -0,0 +1,168 @@
+#include <string.h>
+
+#include "timeline.h"
+
+// Songs live in the timeline, so there is nothing to give back.
+static void releaseSong(const struct Song_t *song) {
+  (void)song;
+}
+
+static bool isDue(uint32_t deadline, uint32_t now) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+// When a task waiting for deadline wakes. Commands arrive through queues and
+// notifications and are acted on at once, but waits end on a tick.
+static uint32_t wakeTime(const struct Timeline_t *timeline, uint32_t deadline) {
+  if (timeline->tickMs == 0) return deadline;
+  return (deadline + timeline->tickMs - 1) / timeline->tickMs * timeline->tickMs;
+}
+
+static void noteChange(struct Timeline_t *timeline, uint32_t scheduled, uint32_t actual) {
+  uint32_t late = actual - scheduled;
+  timeline->changes++;
+  timeline->totalLateMs += late;
+  if (late > timeline->maxLateMs) timeline->maxLateMs = late;
+}
+
+static uint16_t ledDuty(const struct Timeline_t *timeline, int channel, uint32_t now) {
+  if (!timeline->ledRunning) return 0;
+
+  const struct ShowStep_t *step = timeline->step;
+  uint32_t elapsed = now - timeline->stepStarted;
+  if (step->ms < SHOW_MIN_FADE_MS || elapsed >= step->ms) return timeline->duty[channel];
+
+  int32_t from = timeline->fadeFrom[channel];
+  return from + ((int32_t)timeline->duty[channel] - from) * (int32_t)elapsed / step->ms;
+}
+
+// Starts the next step of the show at now, fading from wherever the LEDs are.
+// Between shows that is where the last one was stopped.
+static void startStep(struct Timeline_t *timeline, uint32_t now) {
+  uint16_t current[SHOW_NUM_CHANNELS];
+  for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+    current[i] = timeline->ledRunning ? ledDuty(timeline, i, now) : timeline->duty[i];
+  }
+
+  timeline->step = show_cursor_next(&timeline->cursor);
+  timeline->ledRunning = timeline->step != NULL;
+  if (!timeline->ledRunning) {
+    // A show that runs out goes dark.
+    memset(timeline->duty, 0, sizeof(timeline->duty));
+    return;
+  }
+
+  memcpy(timeline->fadeFrom, current, sizeof(current));
+  for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+    timeline->duty[i] = timeline->step->duty[i];
+  }
+  timeline->stepStarted = now;
+  timeline->stepDeadline += timeline->step->ms;
+}
+
+// Starts steps until one has time left to run. A step that is already due,
+// like a 0 ms one, starts without waiting for a tick.
+static void runSteps(struct Timeline_t *timeline, uint32_t now) {
+  do {
+    startStep(timeline, now);
+  } while (timeline->ledRunning && isDue(timeline->stepDeadline, now));
+}
+
+static void updateLed(struct Timeline_t *timeline, uint32_t now) {
+  if (!timeline->ledRunning || !isDue(wakeTime(timeline, timeline->stepDeadline), now)) return;
+  noteChange(timeline, timeline->stepDeadline, now);
+  runSteps(timeline, now);
+}
+
+static void updatePlayer(struct Timeline_t *timeline, uint32_t now) {
+  struct Player_t *player = &timeline->player;
+  if (!player->running || !isDue(wakeTime(timeline, player->segmentEnd), now)) return;
+  noteChange(timeline, player->segmentEnd, now);
+  player_update(player, now);
+}
+
+void timeline_init(struct Timeline_t *timeline, uint32_t tickMs) {
+  memset(timeline, 0, sizeof(*timeline));
+  timeline->tickMs = tickMs;
+  player_init(&timeline->player, releaseSong);
+}
+
+// Acts on an "LED 1 ..." or "BEEP ..." command, as the websocket task would,
+// at the timeline's current time.
+enum TimelineResult_t timeline_command(struct Timeline_t *timeline, const char *command) {
+  uint32_t now = timeline->now;
+  // There is one show and one player, not a layer of each. A tagged command
+  // played here would ignore its priority, so it is refused instead (the
+  // simulator doesn't advertise PRIO1, so the server never sends one).
+  const char *space = strchr(command, ' ');
+  const char *tag = strchr(command, '@');
+  if (tag != NULL && (space == NULL || tag < space)) return TIMELINE_ERR_LAYER;
+
+  if (strncmp(command, "LED ", 4) == 0) {
+    // Only LED 1 is wired up.
+    if (command[4] != '1' || command[5] != ' ') return TIMELINE_OK;
+
+    // Compiled aside first, so a bad show leaves the playing one alone.
+    struct Show_t show;
+    if (show_compile(command + 6, &show) != SHOW_OK) return TIMELINE_ERR_SHOW;
+    uint16_t current[SHOW_NUM_CHANNELS];
+    for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+      current[i] = ledDuty(timeline, i, now);
+    }
+    timeline->show = show;
+    show_cursor_start(&timeline->cursor, &timeline->show);
+
+    // Any fade in progress stops where it is.
+    memcpy(timeline->duty, current, sizeof(current));
+    timeline->step = NULL;
+    timeline->ledRunning = false;
+    timeline->stepDeadline = now;
+    runSteps(timeline, now);
+    return TIMELINE_OK;
+  }
+
+  if (strncmp(command, "BEEP ", 5) == 0) {
+    struct Song_t *song = &timeline->songs[timeline->nextSong];
+    if (song_compile(command + 5, song) != SONG_OK) return TIMELINE_ERR_SONG;
+    timeline->nextSong ^= 1;
+    player_command(&timeline->player, PLAYER_PLAY, song, now);
+    return TIMELINE_OK;
+  }
+
+  return TIMELINE_ERR_COMMAND;
+}
+
+// Moves the timeline forward to ms, a millisecond at a time, and fills in what
+// the outputs are then.
+void timeline_advance(struct Timeline_t *timeline, uint32_t ms, struct TimelineSample_t *sample) {
+  while (timeline->now != ms && isDue(timeline->now, ms)) {
+    timeline->now++;
+    updateLed(timeline, timeline->now);
+    updatePlayer(timeline, timeline->now);
+  }
+
+  for (int i = 0; i < SHOW_NUM_CHANNELS; i++) {
+    sample->duty[i] = ledDuty(timeline, i, timeline->now);
+  }
+  sample->freq = player_output(&timeline->player);
+}
+
+bool timeline_busy(const struct Timeline_t *timeline) {
+  return timeline->ledRunning || timeline->player.running;
+}
+
+const char *timeline_result_name(enum TimelineResult_t result) {
+  switch (result) {
+  case TIMELINE_OK:
+    return "ok";
+  case TIMELINE_ERR_COMMAND:
+    return "not an LED or BEEP command";
+  case TIMELINE_ERR_SHOW:
+    return "bad show";
+  case TIMELINE_ERR_SONG:
+    return "bad song";
+  case TIMELINE_ERR_LAYER:
+    return "priority layers aren't simulated";
+  }
+  return "unknown";
+}
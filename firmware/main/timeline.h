@@ -0,0 +1,61 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "player.h"
+#include "show.h"
+#include "song.h"
+
+// Plays LED and BEEP commands through the firmware's own show, song and player
+// code, and reports what the LED PWM and buzzer would be doing at each
+// millisecond. Plain C with no ESP-IDF dependencies so it can be built and
+// exercised on a host machine, and compiled to WASM for the web simulator.
+//
+// LEDC fades are modelled as straight lines in duty. With tickMs set, every
+// change waits for the next scheduler tick the way the LED and speaker tasks
+// do, and how late each one lands is measured.
+
+enum TimelineResult_t {
+  TIMELINE_OK = 0,
+  TIMELINE_ERR_COMMAND,  // not an LED or BEEP command
+  TIMELINE_ERR_SHOW,
+  TIMELINE_ERR_SONG,
+  TIMELINE_ERR_LAYER,    // has an @<layer> tag, which isn't modelled
+};
+
+struct TimelineSample_t {
+  uint16_t duty[SHOW_NUM_CHANNELS];
+  uint16_t freq;  // 0 is silent
+};
+
+struct Timeline_t {
+  uint32_t now;
+  uint32_t tickMs;  // 0 to change outputs exactly on time
+
+  struct Show_t show;
+  struct ShowCursor_t cursor;
+  const struct ShowStep_t *step;
+  bool ledRunning;
+  uint32_t stepDeadline;  // when the next step is scheduled to start
+  uint32_t stepStarted;   // when the current one actually did
+  uint16_t fadeFrom[SHOW_NUM_CHANNELS];
+  uint16_t duty[SHOW_NUM_CHANNELS];
+
+  struct Song_t songs[2];
+  uint8_t nextSong;
+  struct Player_t player;
+
+  uint32_t changes;      // step and segment starts so far
+  uint32_t maxLateMs;    // latest any of them landed
+  uint64_t totalLateMs;
+};
+
+void timeline_init(struct Timeline_t *timeline, uint32_t tickMs);
+enum TimelineResult_t timeline_command(struct Timeline_t *timeline, const char *command);
+void timeline_advance(struct Timeline_t *timeline, uint32_t ms, struct TimelineSample_t *sample);
+bool timeline_busy(const struct Timeline_t *timeline);
+const char *timeline_result_name(enum TimelineResult_t result);
+
+#endif
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "trace.h"
+
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+void trace_init(struct TraceRing_t *ring, uint32_t mask) {
+  memset(ring, 0, sizeof(*ring));
+  ring->magic = TRACE_MAGIC;
+  ring->mask = mask;
+}
+
+// For a ring kept in memory that survives a restart. Returns false if it
+// doesn't look intact, and it should be initialized instead. Otherwise starts
+// a new boot, keeping the last one's records until they are overwritten.
+bool trace_resume(struct TraceRing_t *ring) {
+  if (ring->magic != TRACE_MAGIC) return false;
+  ring->boot++;
+  return true;
+}
+
+void trace_write(struct TraceRing_t *ring, uint16_t event, uint32_t timeUs, int32_t a, int32_t b, int32_t c) {
+  if (!trace_enabled(ring, event)) return;
+
+  uint32_t seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  struct TraceRecord_t *record = &ring->records[seq & (TRACE_CAPACITY - 1)];
+  // Mark the slot as being written before touching the rest of it.
+  STORE(record->seq, ~seq);
+  record->timeUs = timeUs;
+  record->event = event;
+  record->boot = ring->boot;
+  record->args[0] = a;
+  record->args[1] = b;
+  record->args[2] = c;
+  STORE(record->seq, seq);
+}
+
+// Copies out the complete records from one boot, oldest first. Meant for when
+// nothing is writing, e.g. the last boot's records after a restart.
+uint32_t trace_copy(const struct TraceRing_t *ring, uint16_t boot, struct TraceRecord_t *out, uint32_t max) {
+  uint32_t head = LOAD(ring->head);
+  uint32_t seq = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+  uint32_t count = 0;
+  for (; seq != head && count < max; seq++) {
+    const struct TraceRecord_t *record = &ring->records[seq & (TRACE_CAPACITY - 1)];
+    if (LOAD(record->seq) != seq || record->boot != boot) continue;
+    out[count++] = *record;
+  }
+  return count;
+}
+
+// Packs up to four characters into an argument, for %k.
+int32_t trace_tag(const char *text) {
+  uint32_t tag = 0;
+  for (int i = 0; i < 4 && text[i] != '\0'; i++) {
+    tag |= (uint32_t)(uint8_t)text[i] << (8 * i);
+  }
+  return (int32_t)tag;
+}
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static char *putHex(char *out, uint32_t value, int digits) {
+  for (int i = digits - 1; i >= 0; i--) {
+    *out++ = hexDigits[(value >> (4 * i)) & 0xf];
+  }
+  return out;
+}
+
+static bool getHex(const char **in, int digits, uint32_t *value) {
+  uint32_t result = 0;
+  for (int i = 0; i < digits; i++) {
+    char ch = (*in)[i];
+    int nibble;
+    if (ch >= '0' && ch <= '9') nibble = ch - '0';
+    else if (ch >= 'a' && ch <= 'f') nibble = ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'F') nibble = ch - 'A' + 10;
+    else return false;
+    result = result << 4 | nibble;
+  }
+  *in += digits;
+  *value = result;
+  return true;
+}
+
+// Writes the record as TRACE_HEX_LEN hex digits, fields in order, most
+// significant digit first. Returns the length, or -1 if it doesn't fit in buf.
+int trace_encode_hex(const struct TraceRecord_t *record, char *buf, size_t len) {
+  if (len < TRACE_HEX_LEN + 1) return -1;
+  char *out = buf;
+  out = putHex(out, record->seq, 8);
+  out = putHex(out, record->timeUs, 8);
+  out = putHex(out, record->event, 4);
+  out = putHex(out, record->boot, 4);
+  for (int i = 0; i < TRACE_ARGS; i++) {
+    out = putHex(out, (uint32_t)record->args[i], 8);
+  }
+  *out = '\0';
+  return TRACE_HEX_LEN;
+}
+
+bool trace_decode_hex(const char *hex, struct TraceRecord_t *record) {
+  uint32_t seq, timeUs, event, boot, args[TRACE_ARGS];
+  if (!getHex(&hex, 8, &seq) || !getHex(&hex, 8, &timeUs) || !getHex(&hex, 4, &event) || !getHex(&hex, 4, &boot)) {
+    return false;
+  }
+  for (int i = 0; i < TRACE_ARGS; i++) {
+    if (!getHex(&hex, 8, &args[i])) return false;
+  }
+  record->seq = seq;
+  record->timeUs = timeUs;
+  record->event = event;
+  record->boot = boot;
+  for (int i = 0; i < TRACE_ARGS; i++) {
+    record->args[i] = (int32_t)args[i];
+  }
+  return true;
+}
+
+#define TRACE_EVENT_FORMAT(name, id, format) case id: return format;
+
+// NULL for an event this build doesn't know.
+const char *trace_event_format(uint16_t event) {
+  switch (event) {
+    TRACE_EVENTS(TRACE_EVENT_FORMAT)
+  }
+  return NULL;
+}
@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A ring of small binary records for tracing hot paths. Plain C with no ESP-IDF
+// dependencies so it can be built and exercised on a host machine.
+//
+// Writing a record is a few stores, with no formatting and no lock, so it can
+// be done from any task, timer callback or core. Records hold an event id, a
+// time and three integers. The text for each event lives in TRACE_EVENTS and
+// is only used by the decoder (firmware/host/trace_decode.c).
+//
+// Writers claim a slot with an atomic increment. A record's seq is set last,
+// so a record cut short by a crash doesn't match its slot and is skipped.
+
+#define TRACE_CAPACITY 128  // a power of two
+#define TRACE_MAGIC 0x31435254  // "TRC1"
+#define TRACE_ARGS 3
+#define TRACE_HEX_LEN 48  // hex digits for one record
+
+enum TraceModule_t {
+  TRACE_MODULE_SYSTEM = 0,
+  TRACE_MODULE_WEBSOCKET,
+  TRACE_MODULE_LED,
+  TRACE_MODULE_SPEAKER,
+  TRACE_MODULE_BUTTON,
+  TRACE_MODULE_COUNT,
+};
+
+#define TRACE_ALL_MODULES ((1 << TRACE_MODULE_COUNT) - 1)
+
+// X(name, id, format). The high byte of the id is the module. Ids are sent to
+// the decoder, so don't renumber them. Formats take %d, %u, %x and %k, a four
+// character tag packed by trace_tag.
+#define TRACE_EVENTS(X) \
+  X(TRACE_BOOT, 0x0001, "boot, reset reason %d") \
+  X(TRACE_WS_EVENT, 0x0101, "websocket event %d opcode %d, %d bytes") \
+  X(TRACE_WS_MESSAGE, 0x0102, "message %k, %u bytes") \
+  X(TRACE_WS_FRAME, 0x0103, "binary frame, %u bytes, result %d") \
+  X(TRACE_LED_SHOW, 0x0201, "show compiled, result %d, %u steps, %d replays") \
+  X(TRACE_LED_STEP, 0x0202, "step %u for %u ms, red duty %u") \
+  X(TRACE_LED_LAYER, 0x0203, "layer %d paused, layer %d playing") \
+  X(TRACE_SPEAKER_COMMAND, 0x0301, "speaker command %d, %u notes, layer %d") \
+  X(TRACE_SPEAKER_TONE, 0x0302, "tone %u Hz, %d ms late") \
+  X(TRACE_SPEAKER_LAYER, 0x0303, "layer %d paused, layer %d playing") \
+  X(TRACE_BUTTON_EDGE, 0x0401, "button %u %u (1 is down)") \
+  X(TRACE_BUTTON_GESTURE, 0x0402, "gesture %d, arg %u")
+
+#define TRACE_EVENT_ENUM(name, id, format) name = id,
+enum TraceEvent_t {
+  TRACE_EVENTS(TRACE_EVENT_ENUM)
+};
+#undef TRACE_EVENT_ENUM
+
+struct TraceRecord_t {
+  uint32_t seq;
+  uint32_t timeUs;  // since boot, wrapping every 71 minutes
+  uint16_t event;
+  uint16_t boot;
+  int32_t args[TRACE_ARGS];
+};
+
+struct TraceRing_t {
+  uint32_t magic;
+  uint32_t mask;  // bit per TraceModule_t
+  uint32_t head;  // seq of the next record
+  uint16_t boot;
+  struct TraceRecord_t records[TRACE_CAPACITY];
+};
+
+void trace_init(struct TraceRing_t *ring, uint32_t mask);
+bool trace_resume(struct TraceRing_t *ring);
+void trace_write(struct TraceRing_t *ring, uint16_t event, uint32_t timeUs, int32_t a, int32_t b, int32_t c);
+uint32_t trace_copy(const struct TraceRing_t *ring, uint16_t boot, struct TraceRecord_t *out, uint32_t max);
+int32_t trace_tag(const char *text);
+int trace_encode_hex(const struct TraceRecord_t *record, char *buf, size_t len);
+bool trace_decode_hex(const char *hex, struct TraceRecord_t *record);
+const char *trace_event_format(uint16_t event);
+
+static inline bool trace_enabled(const struct TraceRing_t *ring, uint16_t event) {
+  return (ring->mask & (1u << (event >> 8))) != 0;
+}
+
+#endif
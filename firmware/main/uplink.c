@@ -0,0 +1,148 @@
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "journal.h"
+#include "uplink.h"
+#include "websocket.h"
+
+// Events go to the server as
+//
+//   EVENTS <journal id> <boot> <ms since boot> <seq>:<type>:<arg>:<boot>:<ms> ...
+//
+// and it answers ACK <seq> once it has everything up to seq. Anything not
+// acknowledged in time is sent again, and the server ignores repeats.
+//
+// A message holds a whole batch with every field at its widest, the longest
+// type name being BUTTON_DOUBLE.
+#define UPLINK_BATCH 16
+#define UPLINK_HEADER_MAX_LEN (sizeof("EVENTS ffffffff 65535 4294967295") - 1)
+#define UPLINK_EVENT_MAX_LEN (sizeof(" 4294967295:BUTTON_DOUBLE:255:65535:4294967295") - 1)
+#define UPLINK_MESSAGE_LEN (UPLINK_HEADER_MAX_LEN + UPLINK_BATCH * UPLINK_EVENT_MAX_LEN + 1)
+#define UPLINK_ACK_TIMEOUT_MS 5000
+
+#define NOTIFY_RECORDED (1 << 0)
+#define NOTIFY_ACKED (1 << 1)
+#define NOTIFY_LINK_UP (1 << 2)
+
+static const char *TAG = "UPLINK";
+
+// Kept through a software restart, so an OTA result or a press just before a
+// crash still reaches the server.
+static RTC_NOINIT_ATTR struct Journal_t journal;
+
+// The journal takes one producer. Events come from several tasks, so they
+// queue for the producer side here. The uplink task never takes this lock.
+static portMUX_TYPE recordLock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t uplinkTask = NULL;
+static volatile uint32_t lastAck;
+
+static uint32_t nowMs() {
+  return esp_timer_get_time() / 1000;
+}
+
+void uplink_setup() {
+  if (esp_reset_reason() == ESP_RST_POWERON || !journal_resume(&journal)) {
+    journal_init(&journal, esp_random());
+  }
+  ESP_LOGI(TAG, "Journal %08lx boot %u has %lu events to send", (unsigned long)journal.id, journal.boot,
+           (unsigned long)journal_unacked(&journal));
+}
+
+// Safe from any task. Never blocks.
+void uplink_record(enum JournalEventType_t type, uint8_t arg) {
+  portENTER_CRITICAL(&recordLock);
+  bool recorded = journal_record(&journal, type, arg, nowMs());
+  portEXIT_CRITICAL(&recordLock);
+
+  if (!recorded) ESP_LOGW(TAG, "Journal is full, dropped a %s event", journal_type_name(type));
+  if (uplinkTask != NULL) xTaskNotify(uplinkTask, NOTIFY_RECORDED, eSetBits);
+}
+
+// Called from the websocket task when the server sends ACK.
+void uplink_acked(uint32_t seq) {
+  lastAck = seq;
+  if (uplinkTask != NULL) xTaskNotify(uplinkTask, NOTIFY_ACKED, eSetBits);
+}
+
+// Called from the websocket task once the server has welcomed us.
+void uplink_link_up() {
+  if (uplinkTask != NULL) xTaskNotify(uplinkTask, NOTIFY_LINK_UP, eSetBits);
+}
+
+// Encodes as many of the events as fit and returns the message length. The
+// number encoded is left in *encoded.
+static int encodeBatch(char *out, size_t size, const struct JournalEvent_t *events, uint32_t count,
+                       uint32_t *encoded) {
+  int len = snprintf(out, size, "EVENTS %08lx %u %lu", (unsigned long)journal.id, journal.boot, (unsigned long)nowMs());
+  uint32_t i = 0;
+  for (; i < count; i++) {
+    int eventLen = snprintf(out + len, size - len, " %lu:%s:%u:%u:%lu", (unsigned long)events[i].seq,
+                            journal_type_name(events[i].type), events[i].arg, events[i].boot,
+                            (unsigned long)events[i].timeMs);
+    if (eventLen < 0 || (size_t)eventLen >= size - len) {
+      out[len] = '\0';
+      break;
+    }
+    len += eventLen;
+  }
+  *encoded = i;
+  return len;
+}
+
+// Sends everything not yet sent. Returns false if the link dropped. Events that
+// didn't fit in a message go back to the journal for the next one.
+static bool sendPending() {
+  static char message[UPLINK_MESSAGE_LEN];
+  struct JournalEvent_t batch[UPLINK_BATCH];
+  uint32_t count;
+  while ((count = journal_next_batch(&journal, batch, UPLINK_BATCH)) > 0) {
+    uint32_t encoded;
+    int len = encodeBatch(message, sizeof(message), batch, count, &encoded);
+    if (encoded < count) journal_unsend(&journal, batch[encoded].seq);
+    if (encoded == 0) {
+      ESP_LOGE(TAG, "Event %lu doesn't fit in a message", (unsigned long)batch[0].seq);
+      return true;
+    }
+    if (!websocket_send_text(message, len)) return false;
+  }
+  return true;
+}
+
+void uplink_task(void *args) {
+  uplinkTask = xTaskGetCurrentTaskHandle();
+  uint32_t waitingSince = 0;
+
+  while (1) {
+    uint32_t notified = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &notified, UPLINK_ACK_TIMEOUT_MS / portTICK_PERIOD_MS);
+
+    uint32_t now = nowMs();
+    if (notified & NOTIFY_ACKED) {
+      journal_ack(&journal, lastAck);
+      waitingSince = now;
+    }
+    if (journal_unacked(&journal) == 0) {
+      waitingSince = 0;
+      continue;
+    }
+
+    bool timedOut = waitingSince != 0 && now - waitingSince >= UPLINK_ACK_TIMEOUT_MS;
+    if ((notified & NOTIFY_LINK_UP) || timedOut) {
+      journal_rewind(&journal);
+      waitingSince = 0;
+    }
+    if (!websocket_is_connected()) continue;
+
+    if (!sendPending()) {
+      journal_rewind(&journal);
+      continue;
+    }
+    if (waitingSince == 0) waitingSince = now;
+  }
+}
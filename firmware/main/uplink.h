@@ -0,0 +1,14 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdint.h>
+
+#include "journal.h"
+
+void uplink_setup();
+void uplink_record(enum JournalEventType_t type, uint8_t arg);
+void uplink_acked(uint32_t seq);
+void uplink_link_up();
+void uplink_task(void *args);
+
+#endif
@@ -1,11 +1,34 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_websocket_client.h"
 
+#include "arbiter.h"
+#include "backoff.h"
 #include "speaker.h"
 #include "websocket.h"
 #include "wifi.h"
 #include "led.h"
 #include "ota.h"
+#include "frame.h"
+#include "logging.h"
+#include "reassembly.h"
+#include "telemetry.h"
+#include "uplink.h"
+
+// Advertised in HELLO. BIN1 lets the server send LED and BEEP commands as
+// binary frames (see frame.h).
+#define PROTOCOL_CAPABILITIES "BIN1 PRIO1"
+
+// Reconnect delays. The websocket client's own reconnect uses a fixed delay,
+// which brings the whole fleet back at the same moment after a server restart.
+#define RECONNECT_BASE_MS 1000
+#define RECONNECT_CAP_MS 60000
+// How soon to try again when the last connection's task is still stopping.
+#define RECONNECT_RETRY_MS 500
 
 static const char *TAG = "WEBSOCKET";
 
@@ -15,62 +38,144 @@ static char* callsign = NULL;
 static esp_websocket_client_handle_t client = NULL;
 
 static volatile bool connected = false;
+static bool everConnected = false;
+static uint32_t reconnects = 0;
+
+// Messages are reassembled and parsed in place here. Only the websocket task
+// touches it.
+static struct Reassembler_t receiver;
+
+static struct Backoff_t backoff;
+static esp_timer_handle_t reconnectTimer = NULL;
 
 bool websocket_is_connected() {
   return connected;
 }
 
-void websocket_send_button(uint8_t buttonId) {
-  char outBuf[32];
-  int len = sprintf(outBuf, "BUTTON %u", buttonId);
-  esp_websocket_client_send_text(client, outBuf, len, portMAX_DELAY);
+// Only needs the socket to be open, so it also works before the server has
+// welcomed us, e.g. for OTA progress.
+bool websocket_send_text(const char *text, int len) {
+  if (client == NULL || !esp_websocket_client_is_connected(client)) return false;
+  return esp_websocket_client_send_text(client, text, len, 1000 / portTICK_PERIOD_MS) == len;
+}
+
+uint32_t websocket_reconnect_count() {
+  return reconnects;
 }
 
 static void handle_websocket_message(char *message) {
   char *marker;
-  const char *command = strtok_r(message, " ", &marker);
-  ESP_LOGI(TAG, "SOCKET MESSAGE %s (%s)", command, marker);
+  char *command = strtok_r(message, " ", &marker);
+  if (command == NULL) return;
+  // strtok_r leaves marker NULL when there is nothing after the command.
+  TRACE(TRACE_WS_MESSAGE, trace_tag(command), marker ? strlen(marker) : 0, 0);
+  enum ArbiterLayer_t layer = ARBITER_ALERT;
+  if (!arbiter_split_tag(command, &layer)) {
+    ESP_LOGW(TAG, "Dropping %s with a bad priority", command);
+    return;
+  }
   if (strcmp(command, "WELCOME") == 0) {
     ESP_LOGW(TAG, "Successfully connected to %s as %s", serverName, callsign);
     connected = true;
-    led_show("2 000000 0 000000 200 000088 0 000088 200");
+    telemetry_boot_phase(BOOT_PHASE_WELCOME);
+    backoff_reset(&backoff);
+    uplink_link_up();
+    logging_send_crash_trace();
+    led_show(ARBITER_STATUS, "2 000000 0 000000 200 000088 0 000088 200");
+  } else if (marker == NULL || marker[0] == '\0') {
+    // Everything else needs arguments.
+    ESP_LOGW(TAG, "Dropping %s without arguments", command);
+  } else if (strcmp(command, "ACK") == 0) {
+    uplink_acked(strtoul(marker, NULL, 10));
   } else if (strcmp(command, "OTA") == 0) {
     ESP_LOGW(TAG, "Server is asking us to install a new build %s", marker);
     ota_start_update();
   } else if (strcmp(command, "LED") == 0) {
-    ESP_LOGI(TAG, "An LED message %s", marker);
-    if (marker[0] == '1') {
-      led_show(marker + 2);
+    if (marker[0] == '1' && marker[1] == ' ') {
+      led_show(layer, marker + 2);
     }
   } else if (strcmp(command, "BEEP") == 0) {
-    ESP_LOGI(TAG, "A BEEP message %s", marker);
-    speaker_play(marker);
+    speaker_play(layer, marker);
+  } else if (strcmp(command, "TRACE") == 0) {
+    logging_set_trace_mask(strtoul(marker, NULL, 16));
   }
 }
 
+static void handle_websocket_frame(const uint8_t *data, int len) {
+  struct FrameReader_t reader;
+  enum FrameResult_t result = frame_open(&reader, data, len);
+  TRACE(TRACE_WS_FRAME, len, result, 0);
+  if (result != FRAME_OK) {
+    ESP_LOGW(TAG, "Dropping binary frame: %s", frame_result_name(result));
+    return;
+  }
+
+  struct FrameRecord_t record;
+  while (frame_next(&reader, &record) == FRAME_OK) {
+    enum ArbiterLayer_t layer = record.priority == FRAME_NO_PRIORITY ? ARBITER_ALERT : record.priority;
+    if (layer >= ARBITER_LAYER_COUNT) {
+      ESP_LOGW(TAG, "Dropping record with priority %d", record.priority);
+    } else if (record.type == FRAME_LED) {
+      if (record.target == 1) {
+        led_show_frame(layer, &record);
+      }
+    } else if (record.type == FRAME_BEEP) {
+      speaker_play_frame(layer, &record);
+    }
+  }
+}
+
+static void reconnect(void *args) {
+  ESP_LOGI(TAG, "Reconnecting");
+  if (esp_websocket_client_start(client) != ESP_OK) {
+    // The last connection's task hasn't finished yet. That isn't the server
+    // failing, so try again shortly without backing off further.
+    esp_timer_start_once(reconnectTimer, RECONNECT_RETRY_MS * 1000ULL);
+  }
+}
+
+static void scheduleReconnect() {
+  uint32_t delayMs = backoff_next_ms(&backoff);
+  ESP_LOGI(TAG, "Reconnecting in %lu ms", (unsigned long)delayMs);
+  esp_timer_start_once(reconnectTimer, delayMs * 1000ULL);
+}
+
 static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
   esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
-  char outBuf[32];
-  ESP_LOGI(TAG, "WEBSOCKET event event=%d opcode=%d len=%d", event_id, data ? data->op_code : -5, data->data_len);
+  char outBuf[128];
+  TRACE(TRACE_WS_EVENT, event_id, data ? data->op_code : -5, data ? data->data_len : 0);
   if (event_id == WEBSOCKET_EVENT_CONNECTED) {
   
     ESP_LOGI(TAG, "WEBSOCKET_EVENT_CONNECTED");
+    telemetry_boot_phase(BOOT_PHASE_CONNECTED);
+    if (everConnected) {
+      reconnects++;
+      uplink_record(JOURNAL_RECONNECT, 0);
+    }
+    everConnected = true;
     char otaBuf[OTA_HASH_STR_LEN];
-    int len = sprintf(outBuf, "HELLO %s %s", callsign, ota_get_partition_hash(otaBuf));
+    int len = snprintf(outBuf, sizeof(outBuf), "HELLO %s %s " PROTOCOL_CAPABILITIES, callsign, ota_get_partition_hash(otaBuf));
     esp_websocket_client_send_text(data->client, outBuf, len, portMAX_DELAY);
   
   } else if (event_id == WEBSOCKET_EVENT_DISCONNECTED) {
   
     ESP_LOGI(TAG, "WEBSOCKET_EVENT_DISCONNECTED");
     connected = false;
-    led_show("-1 000000 0 ff4400 500 000000 500");
+    reassembly_reset(&receiver);
+    led_show(ARBITER_STATUS, "-1 000000 0 ff4400 500 000000 500");
+    scheduleReconnect();
   
-  } else if (event_id == WEBSOCKET_EVENT_DATA && data->op_code == 1) {
+  } else if (event_id == WEBSOCKET_EVENT_DATA && (data->op_code == 1 || data->op_code == 2)) {
   
-    char buffer[data->data_len + 1];
-    strncpy(buffer, data->data_ptr, data->data_len);
-    buffer[data->data_len] = 0;
-    handle_websocket_message(buffer);
+    enum ReassemblyResult_t result = reassembly_feed(&receiver, data->op_code, data->payload_len, data->payload_offset,
+                                                     (const uint8_t *)data->data_ptr, data->data_len);
+    if (result == REASSEMBLY_COMPLETE && receiver.opcode == 1) {
+      handle_websocket_message((char *)receiver.buffer);
+    } else if (result == REASSEMBLY_COMPLETE) {
+      handle_websocket_frame(receiver.buffer, receiver.received);
+    } else if (result != REASSEMBLY_PARTIAL) {
+      ESP_LOGE(TAG, "Dropping %d byte message: %s", data->payload_len, reassembly_result_name(result));
+    }
   
   } else if (event_id == WEBSOCKET_EVENT_DATA) {
   
@@ -84,8 +189,9 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
   
   } else if (event_id == WEBSOCKET_EVENT_ERROR) {
   
+    // A DISCONNECTED event follows, which schedules the reconnect.
     ESP_LOGI(TAG, "WEBSOCKET_EVENT_ERROR");
-    connected = true;
+    connected = false;
   
   } else {
   
@@ -102,7 +208,7 @@ void websocket_start(char *server, char *configCallsign) {
     return;
   }
 
-  led_show("-1 000000 0 ff4400 500 000000 500");
+  led_show(ARBITER_STATUS, "-1 000000 0 ff4400 500 000000 500");
   serverName = server;
   callsign = configCallsign;
 
@@ -113,7 +219,15 @@ void websocket_start(char *server, char *configCallsign) {
 ESP_LOGI(TAG, "CONNECTING TO %s", uri);
   esp_websocket_client_config_t config = {
       .uri = uri,
+      .disable_auto_reconnect = true,
+  };
+
+  backoff_init(&backoff, RECONNECT_BASE_MS, RECONNECT_CAP_MS, esp_random());
+  esp_timer_create_args_t timerArgs = {
+      .callback = reconnect,
+      .name = "reconnect",
   };
+  esp_timer_create(&timerArgs, &reconnectTimer);
 
   client = esp_websocket_client_init(&config);
   esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)client);
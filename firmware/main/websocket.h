@@ -5,5 +5,6 @@
 
 void websocket_start(char *server, char *callsign);
 bool websocket_is_connected();
-void websocket_send_button(uint8_t buttonId);
+bool websocket_send_text(const char *text, int len);
+uint32_t websocket_reconnect_count();
 #endif
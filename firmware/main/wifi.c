@@ -1,15 +1,39 @@
 #include "esp_log.h"
+#include "esp_netif.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "lwip/ip4_addr.h"
+#include "nvs.h"
+#include <stdio.h>
 #include <string.h>
 
 #include "wifi.h"
 #include "led.h"
+#include "telemetry.h"
 
 #define EXAMPLE_ESP_MAXIMUM_RETRY 10
 
+// Sleep through this many beacon intervals (about 100ms each) between wakeups
+// when the link is idle. Incoming commands wait at most this long, and the
+// server pings often enough to keep the connection alive.
+#define LISTEN_INTERVAL 3
+
+#define CACHE_NAMESPACE "wifi_cache"
+#define CACHE_KEY_AP "ap"
+#define IP_STR_LEN 16
+
+// The access point we last got an address from. Joining it directly skips
+// scanning every channel, which is most of the time spent getting online.
+// The DHCP lease is kept by lwIP (CONFIG_LWIP_DHCP_RESTORE_LAST_IP), so it is
+// asked for again rather than discovered.
+struct ApCache_t {
+  char ssid[33];
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
@@ -25,13 +49,99 @@ static int s_retry_num = 0;
 static SemaphoreHandle_t s_semph_get_ip_addrs = NULL;
 static bool is_connected = false;
 
+static struct ApCache_t apCache;
+static bool usingCache = false;
+
+static bool loadApCache(const char *ssid) {
+  nvs_handle_t handle;
+  if (nvs_open(CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) return false;
+  size_t size = sizeof(apCache);
+  esp_err_t err = nvs_get_blob(handle, CACHE_KEY_AP, &apCache, &size);
+  nvs_close(handle);
+  return err == ESP_OK && size == sizeof(apCache) && strncmp(apCache.ssid, ssid, sizeof(apCache.ssid)) == 0;
+}
+
+// Called once connected. Writes only when the access point changed, to spare
+// the flash.
+static void saveApCache() {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) return;
+
+  struct ApCache_t current;
+  memset(&current, 0, sizeof(current));
+  strncpy(current.ssid, (const char *)ap.ssid, sizeof(current.ssid) - 1);
+  memcpy(current.bssid, ap.bssid, sizeof(current.bssid));
+  current.channel = ap.primary;
+  if (memcmp(&current, &apCache, sizeof(current)) == 0) return;
+
+  nvs_handle_t handle;
+  if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+  if (nvs_set_blob(handle, CACHE_KEY_AP, &current, sizeof(current)) == ESP_OK) {
+    nvs_commit(handle);
+    apCache = current;
+    ESP_LOGI(TAG, "Remembering access point on channel %d", current.channel);
+  }
+  nvs_close(handle);
+}
+
+// The remembered access point didn't answer. Forget it and scan as usual.
+static void forgetApCache() {
+  usingCache = false;
+  telemetry_boot_fast_connect(false);
+  memset(&apCache, 0, sizeof(apCache));
+
+  wifi_config_t config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+    config.sta.bssid_set = false;
+    config.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+  }
+
+  nvs_handle_t handle;
+  if (nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return;
+  nvs_erase_key(handle, CACHE_KEY_AP);
+  nvs_commit(handle);
+  nvs_close(handle);
+}
+
+// Parses "<ip> <netmask> <gateway> [<dns>]" and turns DHCP off.
+static bool useStaticIp(esp_netif_t *netif, const char *text) {
+  char ip[IP_STR_LEN], netmask[IP_STR_LEN], gateway[IP_STR_LEN], dns[IP_STR_LEN];
+  int fields = sscanf(text, "%15s %15s %15s %15s", ip, netmask, gateway, dns);
+  if (fields < 3) return false;
+
+  esp_netif_ip_info_t info = {
+      .ip.addr = esp_ip4addr_aton(ip),
+      .netmask.addr = esp_ip4addr_aton(netmask),
+      .gw.addr = esp_ip4addr_aton(gateway),
+  };
+  if (info.ip.addr == IPADDR_NONE || info.netmask.addr == IPADDR_NONE || info.gw.addr == IPADDR_NONE) return false;
+
+  esp_netif_dhcpc_stop(netif);
+  if (esp_netif_set_ip_info(netif, &info) != ESP_OK) return false;
+  if (fields == 4) {
+    esp_netif_dns_info_t dnsInfo = {
+        .ip.u_addr.ip4.addr = esp_ip4addr_aton(dns),
+        .ip.type = ESP_IPADDR_TYPE_V4,
+    };
+    esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dnsInfo);
+  }
+  return true;
+}
+
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data) {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     esp_wifi_connect();
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+    telemetry_boot_phase(BOOT_PHASE_ASSOCIATED);
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    if (usingCache) {
+      ESP_LOGW(TAG, "Remembered access point didn't answer. Scanning instead.");
+      forgetApCache();
+    }
     if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
-      led_show("-1 000000 0 ff4400 1000 000000 1000");
+      led_show(ARBITER_STATUS, "-1 000000 0 ff4400 1000 000000 1000");
       esp_wifi_connect();
       s_retry_num++;
       ESP_LOGI(TAG, "retry to connect to the AP");
@@ -43,12 +153,15 @@ static void event_handler(void *arg, esp_event_base_t event_base,
       }
     }
     ESP_LOGW(TAG, "Failed to connect to network.");
-    led_show("-1 FF0000 0 FF0000 200 000000 0 000000 200 FF0000 0 FF0000 200 000000 0 000000 1000");
+    led_show(ARBITER_STATUS, "-1 FF0000 0 FF0000 200 000000 0 000000 200 FF0000 0 FF0000 200 000000 0 000000 1000");
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGW(TAG, "Connected to network. IP:" IPSTR, IP2STR(&event->ip_info.ip));
+    telemetry_boot_phase(BOOT_PHASE_GOT_IP);
     s_retry_num = 0;
     is_connected = true;
+    usingCache = false;
+    saveApCache();
     if (s_semph_get_ip_addrs) {
       xSemaphoreGive(s_semph_get_ip_addrs);
     }
@@ -61,16 +174,19 @@ bool wait_for_ip() {
   return is_connected;
 }
 
-void wifi_init_sta(const char *ssid, const char *password) {
+void wifi_init_sta(const char *ssid, const char *password, const char *staticIp) {
   ESP_LOGW(TAG, "Connecting to wireless network (%s) ...", ssid);
-  led_show("-1 000000 0 ff4400 1000 000000 1000");
+  led_show(ARBITER_STATUS, "-1 000000 0 ff4400 1000 000000 1000");
   s_semph_get_ip_addrs = xSemaphoreCreateBinary();
   s_wifi_event_group = xEventGroupCreate();
 
   ESP_ERROR_CHECK(esp_netif_init());
 
   ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
+  esp_netif_t *netif = esp_netif_create_default_wifi_sta();
+  if (staticIp != NULL && !useStaticIp(netif, staticIp)) {
+    ESP_LOGE(TAG, "Ignoring bad static IP setting (%s)", staticIp);
+  }
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -96,13 +212,23 @@ void wifi_init_sta(const char *ssid, const char *password) {
           .threshold = {
               .authmode = WIFI_AUTH_WPA2_PSK,
           },
+          .listen_interval = LISTEN_INTERVAL,
       },
   };
   strcpy((char *)wifi_config.sta.ssid, ssid);
   strcpy((char *)wifi_config.sta.password, password);
+  usingCache = loadApCache(ssid);
+  if (usingCache) {
+    ESP_LOGI(TAG, "Joining remembered access point on channel %d", apCache.channel);
+    wifi_config.sta.channel = apCache.channel;
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, apCache.bssid, sizeof(apCache.bssid));
+  }
+  telemetry_boot_fast_connect(usingCache);
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
   ESP_ERROR_CHECK(esp_wifi_start());
+  ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
 
   ESP_LOGI(TAG, "wifi_init_sta finished.");
 }
\ No newline at end of file
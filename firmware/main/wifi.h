@@ -4,6 +4,6 @@
 #include <stdbool.h>
 
 bool wait_for_ip();
-void wifi_init_sta(const char* ssid, const char* password);
+void wifi_init_sta(const char* ssid, const char* password, const char* staticIp);
 
 #endif
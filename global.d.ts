@@ -1,7 +1,14 @@
 import { GmailService } from '@/lib/server/gmailService';
 import { MongoClient } from 'mongodb';
+import type { Server as HTTPServer } from 'http';
+import type { MessageBus } from '@/lib/server/messageBus';
+import type { LatchStore } from '@/lib/server/latchStore';
 
 declare global {
   var _mongoClientPromise: Promise<MongoClient>;
   var _devGmailService: GmailService|undefined;
+  var _notifyBus: MessageBus|undefined;
+  var _notifyLatches: LatchStore|undefined;
+  // Set by cluster.mjs, the server the device sockets attach to.
+  var _notifyHttpServer: HTTPServer|undefined;
 }
\ No newline at end of file
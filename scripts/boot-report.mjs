@@ -0,0 +1,45 @@
+// Summarizes how long devices took to get back online after starting, from
+// the BOOT messages they send once welcomed. Boots that joined the remembered
+// access point (fast) and ones that scanned are shown apart, as are restarts
+// after an OTA or other software restart.
+//
+//   MONGODB_URI=mongodb://localhost:27017/notify node scripts/boot-report.mjs [--days 7] [--callsign ABC]
+import { MongoClient } from 'mongodb';
+import { option, percentile } from './loadtest-common.mjs';
+
+// esp_reset_reason() for esp_restart(), which OTA uses.
+const RESET_SOFTWARE = 3;
+const PHASES = [ 'nvs', 'assoc', 'ip', 'tls', 'welcome' ];
+
+function summarize(label, boots) {
+  if (boots.length === 0) return;
+  const columns = PHASES.map(phase => {
+    const times = boots.map(b => b.phases[phase]).filter(t => t != null).sort((a, b) => a - b);
+    return `${phase} p50 ${percentile(times, 0.5)} p95 ${percentile(times, 0.95)}`;
+  });
+  console.log(`${label.padEnd(20)} ${String(boots.length).padStart(5)} boots  ${columns.join('  ')}`);
+}
+
+async function main() {
+  const days = Number(option('days', 7));
+  const callsign = option('callsign');
+  const client = new MongoClient(process.env.MONGODB_URI);
+  await client.connect();
+  const query = { time: { $gte: new Date(Date.now() - days * 24 * 60 * 60 * 1000) } };
+  if (callsign) query.callsign = callsign;
+  const boots = await client.db().collection('deviceboots').find(query).toArray();
+  await client.close();
+
+  console.log(`ms after starting, over the last ${days} days`);
+  for (const fast of [ true, false ]) {
+    for (const software of [ true, false ]) {
+      const group = boots.filter(b => b.fastConnect === fast && (b.resetReason === RESET_SOFTWARE) === software);
+      summarize(`${fast ? 'fast' : 'scanned'}, ${software ? 'restart' : 'power on'}`, group);
+    }
+  }
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,158 @@
+// A stand-in for the parts of the Gmail API the server uses: getProfile, watch
+// and history.list. It enforces a QPS limit like Google does, and can add mail
+// and send bursts of duplicate pushes to the server.
+//
+//   node scripts/fake-gmail.mjs [--port 4005] [--qps 50] [--page-size 5]
+//   GMAIL_API_ROOT=http://localhost:4005/ npm run dev
+//
+// Add 20 messages to a mailbox and tell the server about it 10 times at once:
+//
+//   curl -X POST 'http://localhost:4005/fake/mail?email=a@example.com&count=20&pushes=10'
+//
+// GET /fake/stats shows the requests the server made, how many were over the
+// QPS limit, and the most history.list calls in flight for one mailbox.
+import http from 'http';
+
+function option(name, fallback) {
+  const idx = process.argv.indexOf(`--${name}`);
+  return idx >= 0 ? process.argv[idx + 1] : fallback;
+}
+
+const PORT = Number(option('port', 4005));
+const QPS = Number(option('qps', 50));
+const PAGE_SIZE = Number(option('page-size', 5));
+const NOTIFY_URL = option('notify', 'http://localhost:3005/api/gmail-notify');
+// Older history than this is forgotten, and asking for it is a 404.
+const HISTORY_KEPT = 1000;
+const FIRST_HISTORY_ID = 1000;
+
+const mailboxes = new Map();
+const stats = { requests: {}, throttled: 0, maxConcurrentHistory: 0, pushes: 0 };
+let windowStart = 0;
+let windowCount = 0;
+
+function mailbox(email) {
+  if (!mailboxes.has(email)) {
+    mailboxes.set(email, { historyId: FIRST_HISTORY_ID, history: [], nextMessage: 1, listing: 0 });
+  }
+  return mailboxes.get(email);
+}
+
+function addMail(box, count) {
+  for (let i = 0; i < count; i++) {
+    box.historyId++;
+    const id = `m${box.nextMessage++}`;
+    box.history.push({ id: String(box.historyId), messages: [{ id }], messagesAdded: [{ message: { id, labelIds: ['INBOX'] } }] });
+  }
+  box.history.splice(0, Math.max(0, box.history.length - HISTORY_KEPT));
+}
+
+function overQuota() {
+  const now = Date.now();
+  if (now - windowStart >= 1000) {
+    windowStart = now;
+    windowCount = 0;
+  }
+  return ++windowCount > QPS;
+}
+
+function send(res, status, body) {
+  res.writeHead(status, { 'Content-Type': 'application/json' });
+  res.end(JSON.stringify(body));
+}
+
+function error(res, status, message) {
+  send(res, status, { error: { code: status, message, errors: [{ message }] } });
+}
+
+function listHistory(box, url, res) {
+  const start = Number(url.searchParams.get('startHistoryId'));
+  const oldest = box.history.length ? Number(box.history[0].id) - 1 : box.historyId;
+  if (!(start >= oldest)) return error(res, 404, 'Requested entity was not found.');
+
+  const offset = Number(url.searchParams.get('pageToken') ?? 0);
+  const after = box.history.filter(h => Number(h.id) > start);
+  const page = after.slice(offset, offset + PAGE_SIZE);
+  const body = { historyId: String(box.historyId) };
+  if (page.length) body.history = page;
+  if (offset + PAGE_SIZE < after.length) body.nextPageToken = String(offset + PAGE_SIZE);
+
+  // Answer a little later, so overlapping calls for one mailbox show up in the stats.
+  box.listing++;
+  stats.maxConcurrentHistory = Math.max(stats.maxConcurrentHistory, box.listing);
+  setTimeout(() => {
+    box.listing--;
+    send(res, 200, body);
+  }, 20);
+}
+
+async function push(email, historyId) {
+  stats.pushes++;
+  const data = Buffer.from(JSON.stringify({ emailAddress: email, historyId })).toString('base64');
+  await fetch(NOTIFY_URL, {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: JSON.stringify({ message: { data } }),
+  }).catch(err => console.log('Push failed', err.message));
+}
+
+function handleGmail(req, res, url, route) {
+  stats.requests[route] = (stats.requests[route] ?? 0) + 1;
+  if (overQuota()) {
+    stats.throttled++;
+    return error(res, 429, 'Too many concurrent requests for user.');
+  }
+
+  const email = req.headers['x-fake-gmail-user'];
+  if (!email) return error(res, 401, 'No x-fake-gmail-user header');
+  const box = mailbox(email);
+
+  switch (route) {
+    case 'profile':
+      return send(res, 200, { emailAddress: email, historyId: String(box.historyId), messagesTotal: box.nextMessage - 1 });
+    case 'watch':
+      return send(res, 200, { historyId: String(box.historyId), expiration: String(Date.now() + 7 * 24 * 60 * 60 * 1000) });
+    case 'history':
+      return listHistory(box, url, res);
+  }
+}
+
+function handleFake(req, res, url) {
+  if (url.pathname === '/fake/stats') return send(res, 200, stats);
+  if (url.pathname === '/fake/reset') {
+    mailboxes.clear();
+    Object.assign(stats, { requests: {}, throttled: 0, maxConcurrentHistory: 0, pushes: 0 });
+    return send(res, 200, {});
+  }
+  if (url.pathname === '/fake/mail' && req.method === 'POST') {
+    const email = url.searchParams.get('email');
+    if (!email) return error(res, 400, 'email is required');
+    const box = mailbox(email);
+    addMail(box, Number(url.searchParams.get('count') ?? 1));
+    // Gmail often sends several pushes for one change, and they can arrive in any order.
+    const pushes = Number(url.searchParams.get('pushes') ?? 1);
+    for (let i = 0; i < pushes; i++) {
+      push(email, box.historyId - Math.floor(Math.random() * 3));
+    }
+    return send(res, 200, { historyId: String(box.historyId) });
+  }
+  error(res, 404, 'Unknown fake endpoint');
+}
+
+const GMAIL_ROUTES = [
+  [ /^\/gmail\/v1\/users\/me\/profile$/, 'profile' ],
+  [ /^\/gmail\/v1\/users\/me\/watch$/, 'watch' ],
+  [ /^\/gmail\/v1\/users\/me\/history$/, 'history' ],
+];
+
+http.createServer((req, res) => {
+  const url = new URL(req.url, `http://localhost:${PORT}`);
+  // The request body (watch) isn't needed, but has to be read.
+  req.resume();
+  req.on('end', () => {
+    if (url.pathname.startsWith('/fake/')) return handleFake(req, res, url);
+    const route = GMAIL_ROUTES.find(([ pattern ]) => pattern.test(url.pathname));
+    if (!route) return error(res, 404, 'Not found');
+    handleGmail(req, res, url, route[1]);
+  });
+}).listen(PORT, () => console.log(`Fake Gmail API on http://localhost:${PORT}/ allowing ${QPS} requests a second`));
@@ -0,0 +1,87 @@
+// Measures how long one new email takes to reach every subscribed device, with
+// many devices connected to one server.
+//
+// Start the server as for handshake-loadtest.mjs, then:
+//
+//   ulimit -n 65536
+//   MONGODB_URI=mongodb://localhost:27017/notify-loadtest node scripts/fanout-loadtest.mjs \
+//     [--server http://localhost:3005] [--devices 10000] [--channels 1] [--rounds 5]
+//
+// With the Gmail stub every /api/gmail-notify push counts as new mail. Device i
+// listens to channel i, so channel 0 reaches every device when --channels is 1.
+import { channelEmail, handshake, option, percentile, seed, startSocketServer } from './loadtest-common.mjs';
+
+const CONNECT_BATCH = 500;
+const ROUND_TIMEOUT_MS = 60000;
+
+async function connectAll(url, devices) {
+  const sockets = [];
+  for (let i = 0; i < devices; i += CONNECT_BATCH) {
+    const batch = Array.from({ length: Math.min(CONNECT_BATCH, devices - i) }, (_, n) => handshake(url, i + n));
+    (await Promise.all(batch)).forEach((result, n) => {
+      if (result.ok) sockets.push({ idx: i + n, ws: result.ws });
+    });
+  }
+  return sockets;
+}
+
+async function notify(server, email) {
+  const data = Buffer.from(JSON.stringify({ emailAddress: email, historyId: 1 })).toString('base64');
+  await fetch(`${server}/api/gmail-notify`, {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: JSON.stringify({ message: { data } }),
+  });
+}
+
+// Sends one notification and waits for the first message on every socket.
+function round(server, sockets, email) {
+  return new Promise(resolve => {
+    const start = performance.now();
+    const arrivals = [];
+    const timer = setTimeout(() => finish(), ROUND_TIMEOUT_MS);
+    const listeners = sockets.map(ws => {
+      const listener = () => {
+        ws.off('message', listener);
+        arrivals.push(performance.now() - start);
+        if (arrivals.length === sockets.length) finish();
+      };
+      ws.on('message', listener);
+      return listener;
+    });
+    function finish() {
+      clearTimeout(timer);
+      sockets.forEach((ws, i) => ws.off('message', listeners[i]));
+      resolve(arrivals.sort((a, b) => a - b));
+    }
+    notify(server, email);
+  });
+}
+
+async function main() {
+  const server = option('server', 'http://localhost:3005');
+  const devices = Number(option('devices', 10000));
+  const channels = Number(option('channels', 1));
+  const rounds = Number(option('rounds', 5));
+
+  await seed(devices, channels);
+  const url = await startSocketServer(server);
+  const sockets = await connectAll(url, devices);
+  console.log(`${sockets.length} of ${devices} devices connected`);
+
+  // Sockets whose device listens to channel 0.
+  const perDevice = Math.min(3, channels);
+  const listening = sockets.filter(s => Array.from({ length: perDevice }, (_, n) => (s.idx + n) % channels).includes(0)).map(s => s.ws);
+  for (let r = 0; r < rounds; r++) {
+    const arrivals = await round(server, listening, channelEmail(0));
+    console.log(`round ${r + 1}: ${arrivals.length} of ${listening.length} delivered, ` +
+      `p50 ${percentile(arrivals, 0.5).toFixed(0)} ms, p95 ${percentile(arrivals, 0.95).toFixed(0)} ms, ` +
+      `last ${percentile(arrivals, 1).toFixed(0)} ms`);
+  }
+  sockets.forEach(s => s.ws.terminate());
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,46 @@
+// Writes the binary frame corpus checked by the host tests
+// (firmware/host/tests/test_frame.c). Each command is encoded with
+// src/lib/server/commandFrame.ts, so the firmware's decoder is tested against
+// what the server actually sends:
+//
+//   node scripts/frame-corpus.mjs > firmware/host/corpus/frames.txt
+//
+// Lines are "<priority or -> <hex frame> <command>".
+import { readFile } from 'fs/promises';
+import ts from 'typescript';
+
+const COMMANDS = [
+  [ undefined, 'LED 1 10 FF0000 1000 00FF00 1000 0000FF 1000' ],
+  [ undefined, 'LED 1 2 000000 0 000000 200 000088 0 000088 200' ],
+  [ undefined, 'LED 1 -1 000000 0 ff4400 500 000000 500' ],
+  [ undefined, 'LED 0 1 123456 65535' ],
+  [ undefined, 'BEEP 0 3 1000 500 0 100 1000 500 0 100 1000 750 0 500' ],
+  [ undefined, 'BEEP 1 3 262 200 294 200 330 200 349 200 392 200 440 200 494 200 523 400 0 400' ],
+  [ undefined, 'BEEP 0 -32768 65535 1' ],
+  [ 'status', 'LED 1 -1 000000 0 ff4400 1000 000000 1000' ],
+  [ 'feedback', 'LED 1 1 000088 0 000000 200' ],
+  [ 'alert', 'BEEP 0 32767 1000 500 0 100' ],
+  // More steps than a show holds. It decodes, but the LED task must refuse it.
+  [ 'alert', 'LED 1 1 ' + Array.from({ length: 70 }, (_, i) => `${(i * 3).toString(16).padStart(2, '0')}0000 10`).join(' ') ],
+];
+
+async function loadCommandFrame() {
+  const source = await readFile(new URL('../src/lib/server/commandFrame.ts', import.meta.url), 'utf8');
+  const { outputText } = ts.transpileModule(source, { compilerOptions: { module: ts.ModuleKind.ES2020, target: ts.ScriptTarget.ES2020 } });
+  return import('data:text/javascript,' + encodeURIComponent(outputText));
+}
+
+async function main() {
+  const { encodeCommand } = await loadCommandFrame();
+  console.log('# Generated by scripts/frame-corpus.mjs from src/lib/server/commandFrame.ts.');
+  for (const [ priority, command ] of COMMANDS) {
+    const frame = encodeCommand(command, priority);
+    if (!frame) throw new Error(`No frame for ${command}`);
+    console.log(`${priority ?? '-'} ${frame.toString('hex')} ${command}`);
+  }
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
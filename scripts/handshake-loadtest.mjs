@@ -0,0 +1,38 @@
+// Measures how many device handshakes (HELLO to WELCOME) the server completes
+// per second, the way the fleet hits it after a restart.
+//
+// Start the server against a throwaway local Mongo, with the Gmail stub and the
+// admission limit out of the way:
+//
+//   MONGODB_URI=mongodb://localhost:27017/notify-loadtest GMAIL_STUB=1 \
+//     WS_ADMISSION_RATE=1000000 WS_ADMISSION_BURST=1000000 yarn dev
+//
+// then seed it and run the test with the same MONGODB_URI:
+//
+//   MONGODB_URI=mongodb://localhost:27017/notify-loadtest node scripts/handshake-loadtest.mjs \
+//     [--server http://localhost:3005] [--devices 500] [--channels 20]
+import { handshake, option, percentile, seed, startSocketServer } from './loadtest-common.mjs';
+
+async function main() {
+  const server = option('server', 'http://localhost:3005');
+  const devices = Number(option('devices', 500));
+  const channels = Number(option('channels', 20));
+
+  await seed(devices, channels);
+  const url = await startSocketServer(server);
+
+  const start = performance.now();
+  const results = await Promise.all(Array.from({ length: devices }, (_, i) => handshake(url, i)));
+  const seconds = (performance.now() - start) / 1000;
+  results.forEach(r => r.ws.terminate());
+
+  const ok = results.filter(r => r.ok);
+  const times = ok.map(r => r.ms).sort((a, b) => a - b);
+  console.log(`${ok.length} of ${devices} handshakes in ${seconds.toFixed(2)} s, ${(ok.length / seconds).toFixed(1)}/s`);
+  console.log(`latency p50 ${percentile(times, 0.5).toFixed(0)} ms, p95 ${percentile(times, 0.95).toFixed(0)} ms, max ${percentile(times, 1).toFixed(0)} ms`);
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,86 @@
+// Shared by the load test scripts: seeds test devices and channels, and opens
+// device connections.
+import { MongoClient } from 'mongodb';
+import { WebSocket } from 'ws';
+
+export const CALLSIGN_PREFIX = 'LOADTEST';
+const HANDSHAKE_TIMEOUT_MS = 60000;
+
+export function option(name, fallback) {
+  const idx = process.argv.indexOf(`--${name}`);
+  return idx >= 0 ? process.argv[idx + 1] : fallback;
+}
+
+export function channelEmail(idx) {
+  return `loadtest${idx}@example.com`;
+}
+
+/**
+ * Replaces the load test devices and channels in MONGODB_URI. Device i listens to up to three channels starting at
+ * channel i, so neighbours share channels.
+ */
+export async function seed(devices, channels) {
+  const client = new MongoClient(process.env.MONGODB_URI);
+  await client.connect();
+  const db = client.db();
+
+  const channelDocs = [];
+  for (let i = 0; i < channels; i++) {
+    channelDocs.push({ name: `${CALLSIGN_PREFIX}-${i}`, type: 'gmail', email: channelEmail(i), commands: [ 'LED 1 1 FF0000 100' ] });
+  }
+  await db.collection('channels').deleteMany({ name: { $regex: `^${CALLSIGN_PREFIX}-` } });
+  await db.collection('channels').insertMany(channelDocs);
+
+  const deviceDocs = [];
+  const perDevice = Math.min(3, channels);
+  for (let i = 0; i < devices; i++) {
+    deviceDocs.push({
+      callsign: `${CALLSIGN_PREFIX}${i}`,
+      name: `Load test ${i}`,
+      email: 'loadtest@example.com',
+      channels: Array.from({ length: perDevice }, (_, n) => ({ id: channelDocs[(i + n) % channels].name })),
+      expectedVersion: 'ignore',
+    });
+  }
+  await db.collection('devices').deleteMany({ callsign: { $regex: `^${CALLSIGN_PREFIX}` } });
+  await db.collection('devices').insertMany(deviceDocs);
+  await client.close();
+}
+
+/**
+ * Connects as device idx and says HELLO.
+ * @returns whether the server sent WELCOME, how long it took, and the open socket
+ */
+export function handshake(url, idx) {
+  return new Promise(resolve => {
+    const start = performance.now();
+    const ws = new WebSocket(url);
+    const timer = setTimeout(() => finish(false), HANDSHAKE_TIMEOUT_MS);
+    let done = false;
+    function finish(ok) {
+      if (done) return;
+      done = true;
+      clearTimeout(timer);
+      if (!ok) ws.terminate();
+      resolve({ ok, ms: performance.now() - start, ws });
+    }
+    ws.on('open', () => ws.send(`HELLO ${CALLSIGN_PREFIX}${idx} loadtest BIN1`));
+    ws.on('message', data => {
+      const text = String(data);
+      if (text.startsWith('WELCOME')) finish(true);
+      else if (text.startsWith('ERROR') || text.startsWith('OTA')) finish(false);
+    });
+    ws.on('close', () => finish(false));
+    ws.on('error', () => finish(false));
+  });
+}
+
+export function percentile(sorted, p) {
+  return sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] : 0;
+}
+
+export async function startSocketServer(server) {
+  // The websocket server starts with the first API call.
+  await fetch(`${server}/api/keepalive`);
+  return server.replace(/^http/, 'ws') + '/ws';
+}
@@ -0,0 +1,31 @@
+// Prints the trace records devices sent after crashing, as TRACE lines for
+// notify_trace_decode (firmware/host/trace_decode.c):
+//
+//   MONGODB_URI=mongodb://localhost:27017/notify node scripts/trace-dump.mjs --callsign ABC [--days 7] \
+//     | build-host/notify_trace_decode
+import { MongoClient } from 'mongodb';
+import { option } from './loadtest-common.mjs';
+
+async function main() {
+  const days = Number(option('days', 7));
+  const callsign = option('callsign');
+  if (!callsign) throw new Error('--callsign is required');
+
+  const client = new MongoClient(process.env.MONGODB_URI);
+  await client.connect();
+  const traces = await client.db().collection('devicetraces')
+    .find({ callsign, time: { $gte: new Date(Date.now() - days * 24 * 60 * 60 * 1000) } })
+    .sort({ time: 1 })
+    .toArray();
+  await client.close();
+
+  for (const trace of traces) {
+    console.log(`# ${trace.time.toISOString()} reset reason ${trace.resetReason}`);
+    console.log(`TRACE ${trace.resetReason} ${trace.records.join(' ')}`);
+  }
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
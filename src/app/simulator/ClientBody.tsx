@@ -4,16 +4,28 @@ import { useEffect, useMemo, useState } from "react";
 import { v4 as uuid } from 'uuid';
 
 import styles from './simulator.module.css';
+import { WasmTimeline } from './timeline';
+
+// How often the LED and buzzer follow the timeline.
+const SAMPLE_MS = 10;
+
+// Duty is gamma corrected on the device, so undo that for the screen.
+function ledColor(rgb: [number, number, number]) {
+  if (rgb.every(c => c === 0)) return '#400';
+  return `rgb(${rgb.map(c => Math.round(c ** (1 / 2.2) * 255)).join(',')})`;
+}
 
 export default function ClientBody() {
   const [ id, setId ] = useState<string>('');
   const [ led, setLed ] = useState<boolean>(false);
+  const [ color, setColor ] = useState<string>();
   const [ silent, setSilent ] = useState<boolean>(true);
   const [ toning, setToning ] = useState<number>(0);
   const [ connected, setConnected ] = useState<boolean>(false);
 
   const client = useMemo(() => new SocketClient({
     doLed: setLed,
+    doColor: setColor,
     doTone: setToning,
     doConnected: setConnected
   }), []);
@@ -36,6 +48,7 @@ export default function ClientBody() {
 
   function handleClick() {
     setLed(false);
+    setColor(undefined);
     client.click();
   }
 
@@ -56,7 +69,7 @@ export default function ClientBody() {
       </div>
       <div style={{marginTop:'2rem'}}>{connected ? 'Connected' : 'Disconnected'}</div>
       <div style={{ display: 'flex', alignItems: 'center' }}>
-        <div className={styles.dot} style={{backgroundColor: led ? '#f00' : '#400'}} />
+        <div className={styles.dot} style={{backgroundColor: color ?? (led ? '#f00' : '#400')}} />
         <button onClick={() => handleClick()}>Silence</button>
         <div className={styles.dot} style={{backgroundColor: toning ? '#00f' : '#004'}}>{toning > 0 ? toning : ''}</div>
       </div>
@@ -66,6 +79,8 @@ export default function ClientBody() {
 
 interface SocketClientOptions {
   doLed?: (led: boolean) => void;
+  // Set instead of doLed when the firmware timeline is playing.
+  doColor?: (color: string) => void;
   doTone?: (frequency: number) => void;
   doConnected?: (connected: boolean) => void;
 }
@@ -83,11 +98,15 @@ class SocketClient {
   private muted: boolean = true;
   private readonly audio?: AudioContext;
   private oscillator?: any = undefined;
+  private timeline?: WasmTimeline;
+  private timelineTimer?: ReturnType<typeof setInterval>;
+  private timelineTone: number = 0;
 
   constructor(options: SocketClientOptions) {
     this.options = options;
     const AudioCtor = (window.AudioContext || (window as any).webkitAudioContext);
     this.audio = AudioCtor ? new AudioCtor() : undefined;
+    WasmTimeline.load().then(timeline => this.timeline = timeline);
   }
 
   start(id: string) {
@@ -143,7 +162,14 @@ class SocketClient {
         break;
 
       case 'LED':
-        if (parts[1] === '1') {
+      case 'BEEP':
+        if (this.timeline) {
+          this.playTimeline(message);
+          break;
+        }
+        if (parts[0] === 'BEEP') {
+          this.playBeep(parts);
+        } else if (parts[1] === '1') {
           this.options.doLed?.(parts[2] === 'ON');
           this.ledTimerNonce = undefined;
 
@@ -159,22 +185,52 @@ class SocketClient {
           }
         }
         break;
+    }
+  }
 
-      case 'BEEP':
-        if (parts[1] === '1') {
-          this.speakerCursor = 0;
-          this.speakerRepeat = Number(parts[2]);
-          this.speakerSong = parts.slice(3).map(f => Number(f));
-          this.playSong();
-        }
-        break;
+  private playBeep(parts: string[]) {
+    if (parts[1] === '1') {
+      this.speakerCursor = 0;
+      this.speakerRepeat = Number(parts[2]);
+      this.speakerSong = parts.slice(3).map(f => Number(f));
+      this.playSong();
+    }
+  }
+
+  private playTimeline(message: string) {
+    if (!this.timeline!.play(message)) {
+      console.log('timeline rejected', message);
+    }
+    this.followTimeline();
+    if (!this.timelineTimer) {
+      this.timelineTimer = setInterval(() => this.followTimeline(), SAMPLE_MS);
+    }
+  }
+
+  private followTimeline() {
+    const sample = this.timeline!.sample();
+    this.options.doColor?.(ledColor(sample.rgb));
+    if (sample.frequency !== this.timelineTone) {
+      this.timelineTone = sample.frequency;
+      this.startNote(sample.frequency);
+    }
+    if (!sample.busy) this.stopTimeline();
+  }
+
+  private stopTimeline() {
+    if (this.timelineTimer) {
+      clearInterval(this.timelineTimer);
+      this.timelineTimer = undefined;
     }
+    this.timelineTone = 0;
   }
 
   click() {
     console.log('button clicked');
     this.options.doLed?.(false);
     this.resetSpeaker();
+    this.stopTimeline();
+    this.timeline?.reset();
     this.s?.send('BUTTON 1');
   }
 
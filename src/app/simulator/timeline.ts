@@ -0,0 +1,93 @@
+// The firmware's own show, song and player code, built to WASM from
+// firmware/host/timeline_wasm.c, so the simulator plays LED and BEEP commands
+// exactly as a device would.
+
+export interface TimelineSample {
+  // 0-1 for red, green and blue.
+  rgb: [number, number, number];
+  // 0 is silent.
+  frequency: number;
+  busy: boolean;
+}
+
+interface TimelineExports {
+  memory: WebAssembly.Memory;
+  _initialize?: () => void;
+  timeline_command_buffer: () => number;
+  timeline_command_buffer_len: () => number;
+  timeline_reset: (tickMs: number) => void;
+  timeline_play: (ms: number) => number;
+  timeline_seek: (ms: number) => number;
+  timeline_output: (which: number) => number;
+  timeline_duty_max: () => number;
+}
+
+// The device's scheduler tick, so timing matches too.
+const TICK_MS = 10;
+
+export class WasmTimeline {
+  private readonly exports: TimelineExports;
+  private readonly encoder = new TextEncoder();
+  private origin = performance.now();
+
+  private constructor(exports: TimelineExports) {
+    this.exports = exports;
+    exports._initialize?.();
+    this.reset();
+  }
+
+  /**
+   * Loads the timeline, if it has been built.
+   * @param url 
+   * @returns undefined when there is no timeline.wasm
+   */
+  static async load(url = '/timeline.wasm'): Promise<WasmTimeline|undefined> {
+    try {
+      const res = await fetch(url);
+      if (!res.ok) return undefined;
+      const module = await WebAssembly.compile(await res.arrayBuffer());
+      // A standalone build may still import a few WASI calls. None of them are reached.
+      const imports: Record<string, Record<string, () => number>> = {};
+      for (const { module: name, name: field } of WebAssembly.Module.imports(module)) {
+        imports[name] = imports[name] ?? {};
+        imports[name][field] = () => 0;
+      }
+      const instance = await WebAssembly.instantiate(module, imports);
+      return new WasmTimeline(instance.exports as unknown as TimelineExports);
+    } catch (err: unknown) {
+      console.log('No timeline, using the built-in player', err);
+      return undefined;
+    }
+  }
+
+  private now() {
+    return Math.floor(performance.now() - this.origin) >>> 0;
+  }
+
+  reset() {
+    this.origin = performance.now();
+    this.exports.timeline_reset(TICK_MS);
+  }
+
+  /**
+   * Plays an LED or BEEP command now.
+   * @param command 
+   * @returns whether the command was understood
+   */
+  play(command: string): boolean {
+    const bytes = this.encoder.encode(command);
+    const len = this.exports.timeline_command_buffer_len();
+    if (bytes.length >= len) return false;
+    const buffer = new Uint8Array(this.exports.memory.buffer, this.exports.timeline_command_buffer(), len);
+    buffer.set(bytes);
+    buffer[bytes.length] = 0;
+    return this.exports.timeline_play(this.now()) === 0;
+  }
+
+  sample(): TimelineSample {
+    const busy = this.exports.timeline_seek(this.now()) !== 0;
+    const max = this.exports.timeline_duty_max();
+    const duty = (channel: number) => this.exports.timeline_output(channel) / max;
+    return { rgb: [duty(0), duty(1), duty(2)], frequency: this.exports.timeline_output(3), busy };
+  }
+}
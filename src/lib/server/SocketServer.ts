@@ -4,6 +4,12 @@ import { WebSocketServer } from 'ws';
 import { NextApiResponse } from 'next';
 import { SocketConnection } from './socketConnection';
 import { getServices } from './services';
+import { TokenBucket } from './tokenBucket';
+import { ChannelDoc } from './data/channelDoc';
+import { PreparedCommand, prepareCommand } from './commandFrame';
+import { LEADER_TOPIC, NOTIFY_TOPIC, TEST_TOPIC, getMessageBus } from './messageBus';
+import { LatchedAlertsMongo } from './mongodb';
+import { getLatchStore, latchKey } from './latchStore';
 
 export type SocketHTTPServer = HTTPServer & { ss?: SocketServer };
 
@@ -17,23 +23,47 @@ function hasHttpServer(object: NextApiResponse): object is NextSocketApiResponse
   return 'socket' in object;
 }
 
+// New connections admitted per second, and how many can arrive together. When
+// the server restarts every device reconnects at once, and each one costs a TLS
+// handshake and a deviceCheckin, so connections over the rate are turned away
+// and the devices back off and retry. Load tests raise these to measure the
+// handshake itself.
+const ADMISSION_RATE = Number(process.env.WS_ADMISSION_RATE ?? 20);
+const ADMISSION_BURST = Number(process.env.WS_ADMISSION_BURST ?? 40);
+// Connections sent to before yielding to the event loop during a fan-out.
+const DELIVERY_BATCH = 500;
+// "Try Again Later". Devices back off with jitter when they see it.
+const CLOSE_TRY_AGAIN_LATER = 1013;
+
 function fromMultiValue(str: string|string[]|undefined): string|undefined {
   if (str == null || typeof str === 'string') return str;
   return str[0];
 }
 
+interface ChannelSubscribers {
+  channel: ChannelDoc;
+  connections: Set<SocketConnection>;
+}
 
 export class SocketServer {
   private readonly wss: WebSocketServer;
-  
+  private readonly admission = new TokenBucket(ADMISSION_RATE, ADMISSION_BURST);
 
   connections: Record<string, SocketConnection> = {};
+  // email -> channel name -> connections subscribed to it, and callsign -> connections. Filled in when a handshake
+  // completes so a new email doesn't need to look at every connection.
+  private byEmail = new Map<string, Map<string, ChannelSubscribers>>();
+  private byCallsign = new Map<string, Set<SocketConnection>>();
 
   constructor(server: SocketHTTPServer) {
     this.wss = new WebSocketServer({ server, path: '/ws' });
     this.wss.on('connection', (ws, req) => {
+      if (!this.admission.tryTake()) {
+        ws.close(CLOSE_TRY_AGAIN_LATER, 'Try again later');
+        return;
+      }
       const remoteAddr = (fromMultiValue(req.headers['x-forwarded-for']) ?? req.socket.remoteAddress)?.split(':').pop();
-      const conn = new SocketConnection(ws, remoteAddr, closeId => this.handleClose(closeId));
+      const conn = new SocketConnection(ws, remoteAddr, closeId => this.handleClose(closeId), ready => this.handleReady(ready));
       this.connections[conn.id] = conn;
       console.log(conn.id, 'new connection');
       conn.run();
@@ -42,11 +72,59 @@ export class SocketServer {
     this.wss.on('close', () => console.log('outer close'));
 
     setInterval(() => Object.values(this.connections).forEach(c => c.ping()), 20000);
+
+    // Other shards may own the devices, so notices and tests go out on the bus.
+    const bus = getMessageBus();
+    bus.subscribe(NOTIFY_TOPIC, ({ email, skip }) => this.deliverNotice(email, skip ?? []));
+    bus.subscribe(TEST_TOPIC, ({ callsign }) => this.byCallsign.get(callsign)?.forEach(c => c.sendTest()));
+    bus.subscribe(LEADER_TOPIC, () => this.renewInterests());
     getServices().then(services => services.gmailService.newMailStream.subscribe(email => this.notifyDevices(email)));
   }
 
+  // A new leader knows nothing about the mailboxes our devices are listening to.
+  private async renewInterests() {
+    const gmail = (await getServices()).gmailService;
+    for (const email of this.byEmail.keys()) {
+      gmail.refreshInterest(email).catch(err => console.log(`Could not watch ${email}`, err));
+    }
+  }
+
+  private handleReady(conn: SocketConnection) {
+    if (!this.connections[conn.id]) return;
+
+    const sameCallsign = this.byCallsign.get(conn.callsign) ?? new Set<SocketConnection>();
+    sameCallsign.add(conn);
+    this.byCallsign.set(conn.callsign, sameCallsign);
+
+    for (const channel of conn.channels) {
+      const channels = this.byEmail.get(channel.email) ?? new Map<string, ChannelSubscribers>();
+      this.byEmail.set(channel.email, channels);
+      const subscribers = channels.get(channel.name) ?? { channel, connections: new Set<SocketConnection>() };
+      // The newest connection has the newest copy of the channel.
+      subscribers.channel = channel;
+      subscribers.connections.add(conn);
+      channels.set(channel.name, subscribers);
+    }
+  }
+
+  private unindex(conn: SocketConnection) {
+    const sameCallsign = this.byCallsign.get(conn.callsign);
+    sameCallsign?.delete(conn);
+    if (sameCallsign?.size === 0) this.byCallsign.delete(conn.callsign);
+
+    for (const channel of conn.channels) {
+      const channels = this.byEmail.get(channel.email);
+      const subscribers = channels?.get(channel.name);
+      subscribers?.connections.delete(conn);
+      if (subscribers?.connections.size === 0) channels!.delete(channel.name);
+      if (channels?.size === 0) this.byEmail.delete(channel.email);
+    }
+  }
+
   private handleClose(closeId: string) {
     console.log(closeId, 'lost connection');
+    const conn = this.connections[closeId];
+    if (conn) this.unindex(conn);
     delete this.connections[closeId];
   }
 
@@ -55,25 +133,59 @@ export class SocketServer {
       conn.close();
     }
     this.connections = {};
+    this.byEmail = new Map();
+    this.byCallsign = new Map();
   }
 
   testDevice(callsign: string) {
-    Object.values(this.connections).filter(c => c.callsign === callsign).forEach(c => c.sendTest());
+    getMessageBus().publish(TEST_TOPIC, { callsign });
   }
 
-  notifyDevices(email: string) {
-    for (const conn of Object.values(this.connections)) {
-      const channels = conn.channels.filter(c => c.email === email).forEach(channel => {
-        console.log(`SEND NOTICE TO ${conn.callsign} about ${channel.email}!!`);
-        channel.commands.forEach(cmd => conn.sendCommand(cmd));
-      });
+  /**
+   * Alerts every device subscribed to a channel for the mailbox. Latched subscriptions are latched first, so a device
+   * that is reconnecting gets the alert in its handshake.
+   * @param email mailbox that has new mail
+   */
+  async notifyDevices(email: string) {
+    let skip: string[] = [];
+    try {
+      const latches = getLatchStore();
+      await latches.ready;
+      const targets = await LatchedAlertsMongo.getLatchSubscriptions(email);
+      const due = new Set(latches.latch(targets).map(latchKey));
+      // Devices still showing the last alert for this channel don't need another.
+      skip = targets.map(latchKey).filter(key => !due.has(key));
+    } catch (err) {
+      console.log(`Could not latch alerts for ${email}`, err);
+    }
+    getMessageBus().publish(NOTIFY_TOPIC, { email, skip });
+  }
+
+  private deliverNotice(email: string, skip: string[]) {
+    const skipped = new Set(skip);
+    for (const { channel, connections } of this.byEmail.get(email)?.values() ?? []) {
+      const targets = [...connections].filter(conn => !skipped.has(latchKey({ callsign: conn.callsign, channel: channel.name })));
+      console.log(`SEND NOTICE TO ${targets.length} devices on ${channel.name} about ${channel.email}!!`);
+      const commands = channel.commands.map(cmd => prepareCommand(cmd, channel.priority));
+      this.deliver(targets, commands, 0);
+    }
+  }
+
+  private deliver(connections: SocketConnection[], commands: PreparedCommand[], start: number) {
+    const end = Math.min(start + DELIVERY_BATCH, connections.length);
+    for (let i = start; i < end; i++) {
+      commands.forEach(command => connections[i].sendPrepared(command));
+    }
+    if (end < connections.length) {
+      setImmediate(() => this.deliver(connections, commands, end));
     }
   }
 
   static fromResponse(res: NextApiResponse): SocketServer {
     if (!hasHttpServer(res)) throw new Error('Not a socket server');
 
-    const server = res.socket.server;
+    // Under cluster.mjs the sockets attach to the worker's own server.
+    const server: SocketHTTPServer = global._notifyHttpServer ?? res.socket.server;
     if (!server.ss) {
       console.log('Initializing websocket server');
       server.ss = new SocketServer(server);
@@ -0,0 +1,137 @@
+// Binary form of the LED and BEEP commands, for devices that advertise BIN1 in
+// their HELLO. The layout is documented in firmware/main/frame.h.
+const FRAME_VERSION = 1;
+const FRAME_LED = 1;
+const FRAME_BEEP = 2;
+const FRAME_PRIORITY = 3;
+
+const COMMAND_HEADER_LEN = 3;
+const LED_STEP_LEN = 5;
+const BEEP_NOTE_LEN = 4;
+
+function parseInteger(text: string|undefined, min: number, max: number): number|undefined {
+  if (text == null || !/^-?\d+$/.test(text)) return undefined;
+  const value = Number(text);
+  return (value < min || value > max) ? undefined : value;
+}
+
+// Output layers on the device, lowest first. A higher layer interrupts a lower
+// one, which picks up again once it is done. See firmware/main/arbiter.h.
+export type OutputPriority = 'status' | 'feedback' | 'alert';
+const PRIORITY_LAYERS: Record<OutputPriority, number> = {
+  'status': 0,
+  'feedback': 1,
+  'alert': 2,
+};
+
+function writeRecord(type: number, value: Buffer): Buffer {
+  const header = Buffer.alloc(3);
+  header.writeUInt8(type, 0);
+  header.writeUInt16LE(value.length, 1);
+  return Buffer.concat([header, value]);
+}
+
+function writeCommandRecord(type: number, target: number, replays: number, items: Buffer): Buffer {
+  const value = Buffer.alloc(COMMAND_HEADER_LEN + items.length);
+  value.writeUInt8(target, 0);
+  value.writeInt16LE(replays, 1);
+  items.copy(value, COMMAND_HEADER_LEN);
+  return writeRecord(type, value);
+}
+
+function encodeLed(args: string[]): Buffer|undefined {
+  const target = parseInteger(args[0], 0, 255);
+  const replays = parseInteger(args[1], -32768, 32767);
+  const steps = args.slice(2);
+  if (target == null || replays == null || steps.length === 0 || steps.length % 2 !== 0) return undefined;
+
+  const items = Buffer.alloc(steps.length / 2 * LED_STEP_LEN);
+  for (let i = 0; i < steps.length; i += 2) {
+    const color = steps[i];
+    const ms = parseInteger(steps[i + 1], 0, 65535);
+    if (!/^[0-9a-fA-F]{6}$/.test(color) || ms == null) return undefined;
+
+    const offset = i / 2 * LED_STEP_LEN;
+    Buffer.from(color, 'hex').copy(items, offset);
+    items.writeUInt16LE(ms, offset + 3);
+  }
+  return writeCommandRecord(FRAME_LED, target, replays, items);
+}
+
+function encodeBeep(args: string[]): Buffer|undefined {
+  const speaker = parseInteger(args[0], 0, 255);
+  const replays = parseInteger(args[1], -32768, 32767);
+  const notes = args.slice(2);
+  if (speaker == null || replays == null || notes.length === 0 || notes.length % 2 !== 0) return undefined;
+
+  const items = Buffer.alloc(notes.length / 2 * BEEP_NOTE_LEN);
+  for (let i = 0; i < notes.length; i += 2) {
+    const freq = parseInteger(notes[i], 0, 65535);
+    const ms = parseInteger(notes[i + 1], 0, 65535);
+    if (freq == null || ms == null) return undefined;
+
+    const offset = i / 2 * BEEP_NOTE_LEN;
+    items.writeUInt16LE(freq, offset);
+    items.writeUInt16LE(ms, offset + 2);
+  }
+  return writeCommandRecord(FRAME_BEEP, speaker, replays, items);
+}
+
+export interface PreparedCommand {
+  text: Buffer;
+  // The text with its priority tag, for devices that advertise PRIO1.
+  taggedText?: Buffer;
+  frame?: Buffer;
+}
+
+/**
+ * Adds a priority tag to an LED or BEEP command, as "LED@2 1 ...".
+ * @param cmd text command
+ * @param priority output layer to play it on
+ * @returns the tagged command, or undefined if the command can't be tagged
+ */
+export function tagCommand(cmd: string, priority: OutputPriority): string|undefined {
+  const match = /^(LED|BEEP) /.exec(cmd.trim());
+  if (!match) return undefined;
+  return `${match[1]}@${PRIORITY_LAYERS[priority]}${cmd.trim().substring(match[1].length)}`;
+}
+
+/**
+ * Serializes a command once so it can be sent to any number of devices.
+ * @param cmd text command
+ * @param priority output layer to play it on. Devices treat untagged commands as alerts.
+ * @returns the UTF-8 text, and the tagged text and binary frame if the command has them
+ */
+export function prepareCommand(cmd: string, priority?: OutputPriority): PreparedCommand {
+  const tagged = priority ? tagCommand(cmd, priority) : undefined;
+  return {
+    text: Buffer.from(cmd),
+    taggedText: tagged ? Buffer.from(tagged) : undefined,
+    frame: encodeCommand(cmd, priority),
+  };
+}
+
+/**
+ * Encodes a text command as a binary frame.
+ * @param cmd text command, like "LED 1 10 FF0000 1000 00FF00 1000"
+ * @param priority output layer to play it on. Firmware without layers skips the priority record.
+ * @returns the frame, or undefined if the command has no binary form and should be sent as text.
+ */
+export function encodeCommand(cmd: string, priority?: OutputPriority): Buffer|undefined {
+  const [ command, ...args ] = cmd.trim().split(/\s+/);
+  let record: Buffer|undefined;
+  if (command === 'LED') {
+    record = encodeLed(args);
+  } else if (command === 'BEEP') {
+    record = encodeBeep(args);
+  }
+  // Record values carry a 16 bit length.
+  if (!record || record.length - 3 > 0xffff) return undefined;
+
+  const parts = [ Buffer.from([ FRAME_VERSION ]) ];
+  if (priority) {
+    parts.push(writeRecord(FRAME_PRIORITY, Buffer.from([ PRIORITY_LAYERS[priority] ])));
+  }
+  parts.push(record);
+  return Buffer.concat(parts);
+}
@@ -1,3 +1,5 @@
+import type { OutputPriority } from "../commandFrame";
+
 export const CHANNEL_COLLECTION = "channels";
 
 export interface ChannelDoc {
@@ -5,4 +7,6 @@ export interface ChannelDoc {
   type: 'gmail';
   email: string;
   commands: string[];
+  // Layer the commands play on. Devices treat commands without one as alerts.
+  priority?: OutputPriority;
 }
\ No newline at end of file
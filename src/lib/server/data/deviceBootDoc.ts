@@ -0,0 +1,19 @@
+export const DEVICE_BOOTS_COLLECTION = "deviceboots";
+
+// How long after starting a device reached each step of getting online, in ms.
+export interface BootPhases {
+  main?: number;
+  nvs?: number;
+  assoc?: number;    // joined the access point
+  ip?: number;
+  tls?: number;      // websocket open
+  welcome?: number;
+}
+
+export interface DeviceBootDoc {
+  callsign: string;
+  time: Date;
+  resetReason: number;   // esp_reset_reason(). 3 is a software restart, such as after an OTA.
+  fastConnect: boolean;  // joined the remembered access point without scanning
+  phases: BootPhases;
+}
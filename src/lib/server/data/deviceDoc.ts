@@ -14,4 +14,6 @@ export interface DeviceDoc {
   reportedVersion?: string;
   lastConnected?: number;
   lastInteraction?: number;
+  lastGesture?: string;
+  traceMask?: number;  // trace modules to record, a bit per TraceModule_t in firmware/main/trace.h
 }
\ No newline at end of file
@@ -0,0 +1,14 @@
+export const DEVICE_STATS_COLLECTION = "devicestats";
+
+export interface DeviceStatsDoc {
+  callsign: string;
+  time: Date;
+  uptime: number;
+  freeHeap: number;
+  minFreeHeap: number;
+  largestFreeBlock: number;
+  reconnects: number;
+  wakes: number;     // times the device was held out of light sleep
+  awakeMs: number;   // total time held out of light sleep
+  stackFree: Record<string, number>;
+}
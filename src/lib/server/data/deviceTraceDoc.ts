@@ -0,0 +1,10 @@
+export const DEVICE_TRACES_COLLECTION = "devicetraces";
+
+// Trace records a device kept through a crash and sent once it was back. Decode
+// them with firmware/host/trace_decode.c (see scripts/trace-dump.mjs).
+export interface DeviceTraceDoc {
+  callsign: string;
+  time: Date;
+  resetReason: number;  // esp_reset_reason() of the crash
+  records: string[];    // hex, one per record
+}
@@ -1,10 +1,14 @@
 export const FIRMWARE_COLLECTION = "firmwares";
+// GridFS bucket holding firmware images, named by version, and the deltas
+// between them.
+export const FIRMWARE_BUCKET = "firmware";
 
 export interface FirmwareDoc {
   description: string;
   version: string;
   uploaded: number;
   creator: string;
-  file: Buffer;
+  length?: number;
+  file?: Buffer;      // images uploaded before GridFS storage
   archived?: boolean;
-}
\ No newline at end of file
+}
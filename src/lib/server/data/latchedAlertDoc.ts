@@ -0,0 +1,11 @@
+export const LATCHED_ALERTS_COLLECTION = "latchedalerts";
+
+// An alert on a latched subscription (DeviceChannelSubscription.latch). It is
+// sent again each time the device connects until one of its buttons is pressed.
+export interface LatchedAlertDoc {
+  callsign: string;
+  channel: string;   // ChannelDoc.name
+  since: number;     // first alert
+  lastSent: number;  // last time it went out for new mail, for dropping re-alerts
+  count: number;     // notices folded into it
+}
@@ -0,0 +1,109 @@
+// Encodes firmware deltas for devices to apply against their running image.
+// The format and the device side decoder are in firmware/main/delta.h.
+const DELTA_MAGIC = 'NDL1';
+const DELTA_OP_COPY = 1;
+const DELTA_OP_DATA = 2;
+
+// Source blocks are indexed at this granularity. Matches shorter than a block
+// are sent as data.
+const BLOCK_LEN = 32;
+const HASH_MOD = 0x10000;
+
+function weakHash(data: Buffer, start: number): { a: number, b: number } {
+  let a = 0;
+  let b = 0;
+  for (let i = 0; i < BLOCK_LEN; i++) {
+    a = (a + data[start + i]) % HASH_MOD;
+    b = (b + (BLOCK_LEN - i) * data[start + i]) % HASH_MOD;
+  }
+  return { a, b };
+}
+
+class DeltaWriter {
+  private parts: Buffer[] = [];
+  private literalStart = 0;
+
+  constructor(private target: Buffer) {
+    const header = Buffer.alloc(8);
+    header.write(DELTA_MAGIC, 0, 'latin1');
+    header.writeUInt32LE(target.length, 4);
+    this.parts.push(header);
+  }
+
+  private flushLiteral(end: number) {
+    if (end <= this.literalStart) return;
+    const op = Buffer.alloc(5);
+    op.writeUInt8(DELTA_OP_DATA, 0);
+    op.writeUInt32LE(end - this.literalStart, 1);
+    this.parts.push(op, this.target.subarray(this.literalStart, end));
+  }
+
+  copy(targetOffset: number, sourceOffset: number, length: number) {
+    this.flushLiteral(targetOffset);
+    const op = Buffer.alloc(9);
+    op.writeUInt8(DELTA_OP_COPY, 0);
+    op.writeUInt32LE(sourceOffset, 1);
+    op.writeUInt32LE(length, 5);
+    this.parts.push(op);
+    this.literalStart = targetOffset + length;
+  }
+
+  finish(): Buffer {
+    this.flushLiteral(this.target.length);
+    return Buffer.concat(this.parts);
+  }
+}
+
+/**
+ * Builds a delta that turns source into target, using rsync style block
+ * matching with a rolling checksum so code that has moved is still found.
+ * @param source image the device is running
+ * @param target image the device should end up with
+ * @returns the delta
+ */
+export function encodeDelta(source: Buffer, target: Buffer): Buffer {
+  const blocks = new Map<number, number>();
+  for (let offset = 0; offset + BLOCK_LEN <= source.length; offset += BLOCK_LEN) {
+    const { a, b } = weakHash(source, offset);
+    const key = b * HASH_MOD + a;
+    if (!blocks.has(key)) blocks.set(key, offset);
+  }
+
+  const writer = new DeltaWriter(target);
+  let pos = 0;
+  let copiedTo = 0;
+  let { a, b } = target.length >= BLOCK_LEN ? weakHash(target, 0) : { a: 0, b: 0 };
+  while (pos + BLOCK_LEN <= target.length) {
+    const candidate = blocks.get(b * HASH_MOD + a);
+    if (candidate != null && source.compare(target, pos, pos + BLOCK_LEN, candidate, candidate + BLOCK_LEN) === 0) {
+      // Grow the match both ways, but not back into bytes already copied.
+      let start = pos;
+      let sourceStart = candidate;
+      while (start > copiedTo && sourceStart > 0 && target[start - 1] === source[sourceStart - 1]) {
+        start--;
+        sourceStart--;
+      }
+      let end = pos + BLOCK_LEN;
+      let sourceEnd = candidate + BLOCK_LEN;
+      while (end < target.length && sourceEnd < source.length && target[end] === source[sourceEnd]) {
+        end++;
+        sourceEnd++;
+      }
+
+      writer.copy(start, sourceStart, end - start);
+      copiedTo = end;
+      pos = end;
+      if (pos + BLOCK_LEN <= target.length) ({ a, b } = weakHash(target, pos));
+      continue;
+    }
+
+    if (pos + BLOCK_LEN < target.length) {
+      const out = target[pos];
+      const into = target[pos + BLOCK_LEN];
+      a = (a - out + into + HASH_MOD) % HASH_MOD;
+      b = (b - BLOCK_LEN * out + a + BLOCK_LEN * HASH_MOD) % HASH_MOD;
+    }
+    pos++;
+  }
+  return writer.finish();
+}
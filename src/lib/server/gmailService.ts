@@ -2,6 +2,8 @@ import path from 'path';
 import process from 'process';
 import { Observable, Subject } from 'rxjs';
 import { google } from 'googleapis';
+import { GMAIL_INTEREST_TOPIC, GMAIL_PUSH_TOPIC, getMessageBus } from './messageBus';
+import { TokenBucket } from './tokenBucket';
 
 const JWT = google.auth.JWT;
 
@@ -13,66 +15,191 @@ const SCOPES = ['https://www.googleapis.com/auth/gmail.metadata'];
 const TOKEN_PATH = path.join(process.cwd(), 'google-token.json');
 const CREDENTIALS_PATH = path.join(process.cwd(), 'google-credentials.json');
 
+// A watch lasts 7 days. A scheduled check renews any that are over a day old.
+const WATCH_REFRESH_MS = 24 * 60 * 60 * 1000;
+const WATCH_CHECK_MS = 60 * 60 * 1000;
+// After failing to set up a mailbox, wait this long before trying again.
+const INTEREST_RETRY_MS = 60 * 1000;
+
+// All Gmail API calls share this budget, well under the per-project quota.
+const GMAIL_QPS = Number(process.env.GMAIL_QPS ?? 10);
+const GMAIL_BURST = 20;
+
+// For testing against a fake Gmail API (scripts/fake-gmail.mjs) instead of Google.
+const GMAIL_API_ROOT = process.env.GMAIL_API_ROOT;
+
 interface MailboxInfo {
   email: string,
-  history: string,
+  history: bigint,
+  // Highest history id a push has told us about.
+  pushedHistory: bigint,
+  syncing: boolean,
   watchTime: number,
   gmail: ReturnType<typeof google.gmail>
 };
 
+function maxHistory(a: bigint, b: bigint) {
+  return a > b ? a : b;
+}
+
 export class GmailService {
   private readonly mailboxes: Record<string, MailboxInfo> = {};
-  private readonly newMailSubject = new Subject<string>();
+  protected readonly newMailSubject = new Subject<string>();
+  private readonly pendingInterest: Record<string, Promise<void>> = {};
+  private readonly lastAttempt: Record<string, number> = {};
+  private readonly quota = new TokenBucket(GMAIL_QPS, GMAIL_BURST);
+
+  // Only the leader talks to Gmail, so there is one watch and one history
+  // cursor per mailbox however many shards there are. Other shards forward
+  // their work to it.
+  constructor() {
+    const bus = getMessageBus();
+    bus.subscribe(GMAIL_INTEREST_TOPIC, ({ email }) => {
+      if (!bus.isLeader()) return;
+      this.refreshInterest(email).catch(err => console.log(`Could not watch ${email}`, err));
+    });
+    bus.subscribe(GMAIL_PUSH_TOPIC, notification => {
+      if (!bus.isLeader()) return;
+      this.notify(notification).catch(err => console.log(`Could not handle push for ${notification.emailAddress}`, err));
+    });
+    setInterval(() => this.renewWatches(), WATCH_CHECK_MS);
+  }
 
   get newMailStream(): Observable<string> {
     return this.newMailSubject;
   }
 
   /**
-   * 
+   * Starts watching a mailbox if we aren't already. Calls for the same mailbox share one request. Renewing the watch
+   * is left to renewWatches.
    * @param email 
    */
   async refreshInterest(email: string) {
-    if (!this.mailboxes[email]) {
-      const auth = new JWT({
-        keyFile: CREDENTIALS_PATH,
-        scopes: SCOPES,
-        subject: email,
-      });
-  
-      await auth.authorize();
-      const gmail = google.gmail({ version: 'v1', auth });
-
-      const profile = await gmail.users.getProfile({ userId: 'me' });
-      this.mailboxes[email] = {
-        email,
-        gmail,
-        history: profile.data.historyId!,
-        watchTime: 0,
-      }
+    const bus = getMessageBus();
+    if (!bus.isLeader()) {
+      bus.publish(GMAIL_INTEREST_TOPIC, { email });
+      return;
+    }
+
+    const pending = this.pendingInterest[email];
+    if (pending) return pending;
+
+    const now = new Date().getTime();
+    if (this.mailboxes[email] || now - (this.lastAttempt[email] ?? 0) < INTEREST_RETRY_MS) return;
+
+    this.lastAttempt[email] = now;
+    const request = this.startInterest(email).finally(() => delete this.pendingInterest[email]);
+    this.pendingInterest[email] = request;
+    return request;
+  }
 
-      console.log('Now listening for emails to ' + email);
+  private async connectGmail(email: string) {
+    if (GMAIL_API_ROOT) {
+      // The fake has no auth, so tell it which mailbox we mean.
+      return google.gmail({ version: 'v1', rootUrl: GMAIL_API_ROOT, headers: { 'x-fake-gmail-user': email } });
+    }
+
+    const auth = new JWT({
+      keyFile: CREDENTIALS_PATH,
+      scopes: SCOPES,
+      subject: email,
+    });
+    await auth.authorize();
+    return google.gmail({ version: 'v1', auth });
+  }
+
+  private async startInterest(email: string) {
+    const gmail = await this.connectGmail(email);
+    await this.quota.take();
+    const profile = await gmail.users.getProfile({ userId: 'me' });
+    const history = BigInt(profile.data.historyId!);
+    const mailbox: MailboxInfo = {
+      email,
+      gmail,
+      history,
+      pushedHistory: history,
+      syncing: false,
+      watchTime: 0,
+    };
+    await this.refreshWatch(mailbox);
+    this.mailboxes[email] = mailbox;
+    console.log('Now listening for emails to ' + email);
+  }
+
+  private async renewWatches() {
+    const now = new Date().getTime();
+    for (const mailbox of Object.values(this.mailboxes)) {
+      if (now - mailbox.watchTime < WATCH_REFRESH_MS) continue;
+      await this.refreshWatch(mailbox).catch(err => console.log('Could not renew watch for ' + mailbox.email, err));
     }
-    this.refreshWatch(this.mailboxes[email]);
   }
 
   /**
-   * 
+   * Handles a Gmail push. Pushes only raise the mark the mailbox needs to catch up to. One sync per mailbox runs at
+   * a time and takes in every push that arrives while it runs.
    * @param notification 
    * @returns 
    */
   async notify(notification: { emailAddress: string, historyId: string|number }) {
+    const bus = getMessageBus();
+    if (!bus.isLeader()) {
+      bus.publish(GMAIL_PUSH_TOPIC, notification);
+      return;
+    }
+
     const mailbox = this.mailboxes[notification.emailAddress];
     if (!mailbox) {
       console.log('Not listening for ' + notification.emailAddress);
       return;
     }
 
-    const response = (await mailbox.gmail.users.history.list({ userId: 'me', startHistoryId: mailbox.history })).data;
-    if ((response.history ?? []).flatMap(h => h.messagesAdded ?? []).length > 0) {
-      this.newMailSubject.next(notification.emailAddress);
+    mailbox.pushedHistory = maxHistory(mailbox.pushedHistory, BigInt(notification.historyId));
+    if (mailbox.syncing) return;
+
+    mailbox.syncing = true;
+    try {
+      while (mailbox.pushedHistory > mailbox.history) {
+        if (await this.syncHistory(mailbox)) {
+          this.newMailSubject.next(mailbox.email);
+        }
+      }
+    } finally {
+      mailbox.syncing = false;
     }
-    mailbox.history = response.historyId + '';
+  }
+
+  /**
+   * Reads every page of history since the cursor, then moves the cursor forward.
+   * @param mailbox 
+   * @returns whether any messages were added
+   */
+  private async syncHistory(mailbox: MailboxInfo): Promise<boolean> {
+    let added = 0;
+    let latest = mailbox.history;
+    let pageToken: string|undefined;
+    do {
+      await this.quota.take();
+      const response = await mailbox.gmail.users.history.list({
+        userId: 'me',
+        startHistoryId: mailbox.history.toString(),
+        historyTypes: ['messageAdded'],
+        pageToken,
+      }).then(res => res.data, async err => {
+        // The cursor is too old for Gmail to have history from it. Start again from now and count it as new mail.
+        if (err?.code !== 404) throw err;
+        await this.quota.take();
+        const profile = await mailbox.gmail.users.getProfile({ userId: 'me' });
+        added++;
+        return { historyId: profile.data.historyId, history: undefined, nextPageToken: undefined };
+      });
+      added += (response.history ?? []).flatMap(h => h.messagesAdded ?? []).length;
+      if (response.historyId) latest = maxHistory(latest, BigInt(response.historyId));
+      pageToken = response.nextPageToken ?? undefined;
+    } while (pageToken);
+
+    // The push may be ahead of what history reports. Don't ask again for it.
+    mailbox.history = maxHistory(latest, mailbox.pushedHistory);
+    return added > 0;
   }
 
   /**
@@ -80,6 +207,7 @@ export class GmailService {
    * @param mailbox 
    */
   private async refreshWatch(mailbox: MailboxInfo) {
+    await this.quota.take();
     const res = await mailbox.gmail.users.watch({
       userId: 'me',
       requestBody: {
@@ -94,6 +222,10 @@ export class GmailService {
   }
 
   static create() {
+    if (process.env.GMAIL_STUB) {
+      // For load tests, which have no Google credentials.
+      return new GmailStubService();
+    }
     if (process.env.NODE_ENV === 'development') {
       // In development mode, use a global variable so that the value
       // is preserved across module reloads caused by HMR (Hot Module Replacement).
@@ -106,4 +238,14 @@ export class GmailService {
       return new GmailService();
     }
   }
+}
+
+class GmailStubService extends GmailService {
+  async refreshInterest() {
+  }
+
+  // Every notification counts as new mail.
+  async notify(notification: { emailAddress: string, historyId: string|number }) {
+    this.newMailSubject.next(notification.emailAddress);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+import { LatchedAlertDoc } from './data/latchedAlertDoc';
+import { LatchedAlertsMongo } from './mongodb';
+import { LATCH_TOPIC, getMessageBus } from './messageBus';
+
+// Changes are written to Mongo in batches this far apart.
+const WRITE_BEHIND_MS = 1000;
+// New mail for an alert that is still latched is only sent again after this long.
+const REALERT_MIN_MS = 5 * 60 * 1000;
+
+export interface LatchTarget {
+  callsign: string;
+  channel: string;
+}
+
+// What goes out on the bus. Every shard applies it, including the one that sent it.
+interface LatchMessage {
+  set?: LatchedAlertDoc[];
+  clear?: LatchTarget[];
+}
+
+interface PendingWrite extends LatchTarget {
+  alert?: LatchedAlertDoc;  // undefined deletes
+}
+
+export function latchKey(target: LatchTarget) {
+  return `${target.callsign}/${target.channel}`;
+}
+
+/**
+ * Latched alerts for every device. Each shard keeps all of them in memory, loaded once when it starts and kept up to
+ * date over the bus, so a handshake only looks at its own device's alerts however many devices reconnect together.
+ * The shard that makes a change writes it to Mongo shortly after.
+ */
+export class LatchStore {
+  private readonly byCallsign = new Map<string, Map<string, LatchedAlertDoc>>();
+  private pendingWrites = new Map<string, PendingWrite>();
+  private flushTimer?: NodeJS.Timeout;
+  readonly ready: Promise<void>;
+
+  constructor() {
+    getMessageBus().subscribe(LATCH_TOPIC, (message: LatchMessage) => this.apply(message));
+    this.ready = LatchedAlertsMongo.getLatchedAlerts()
+      .then(alerts => alerts.forEach(alert => {
+        // Anything that arrived over the bus while loading is newer.
+        if (!this.byCallsign.get(alert.callsign)?.has(alert.channel)) this.put(alert);
+      }))
+      .catch(err => console.log('Could not load latched alerts', err));
+  }
+
+  /**
+   * Latches an alert for each device and channel. Call it on one shard per notice.
+   * @param targets latched subscriptions to the channels the notice is for
+   * @param now when the notice arrived
+   * @returns the alerts to send now. Ones still latched from mail less than REALERT_MIN_MS ago are left out.
+   */
+  latch(targets: LatchTarget[], now: number = Date.now()): LatchedAlertDoc[] {
+    const changed: LatchedAlertDoc[] = [];
+    const due: LatchedAlertDoc[] = [];
+    for (const { callsign, channel } of targets) {
+      const existing = this.byCallsign.get(callsign)?.get(channel);
+      const send = !existing || now - existing.lastSent >= REALERT_MIN_MS;
+      const alert: LatchedAlertDoc = {
+        callsign,
+        channel,
+        since: existing?.since ?? now,
+        lastSent: send ? now : existing!.lastSent,
+        count: (existing?.count ?? 0) + 1,
+      };
+      this.put(alert);
+      this.write({ callsign, channel, alert });
+      changed.push(alert);
+      if (send) due.push(alert);
+    }
+    if (changed.length > 0) getMessageBus().publish(LATCH_TOPIC, { set: changed });
+    return due;
+  }
+
+  /**
+   * Lists the alerts a device hasn't acknowledged, to send again on its handshake.
+   * @param callsign device
+   * @returns the device's latched alerts
+   */
+  alertsFor(callsign: string): LatchedAlertDoc[] {
+    return [...(this.byCallsign.get(callsign)?.values() ?? [])];
+  }
+
+  /**
+   * Clears a device's alerts, after someone pressed its button.
+   * @param callsign device
+   * @param time when the button was pressed. Presses replayed from the device's journal don't clear later alerts.
+   * @returns how many were cleared
+   */
+  clear(callsign: string, time: number = Date.now()): number {
+    const cleared = this.alertsFor(callsign).filter(alert => alert.since <= time);
+    if (cleared.length === 0) return 0;
+
+    const targets = cleared.map(alert => ({ callsign, channel: alert.channel }));
+    targets.forEach(target => {
+      this.remove(target);
+      this.write(target);
+    });
+    getMessageBus().publish(LATCH_TOPIC, { clear: targets });
+    return cleared.length;
+  }
+
+  private apply(message: LatchMessage) {
+    message.set?.forEach(alert => this.put(alert));
+    message.clear?.forEach(target => this.remove(target));
+  }
+
+  private remove(target: LatchTarget) {
+    const alerts = this.byCallsign.get(target.callsign);
+    alerts?.delete(target.channel);
+    if (alerts?.size === 0) this.byCallsign.delete(target.callsign);
+  }
+
+  private put(alert: LatchedAlertDoc) {
+    const alerts = this.byCallsign.get(alert.callsign) ?? new Map<string, LatchedAlertDoc>();
+    alerts.set(alert.channel, alert);
+    this.byCallsign.set(alert.callsign, alerts);
+  }
+
+  // Only the latest change to each alert is written.
+  private write(change: PendingWrite) {
+    this.pendingWrites.set(latchKey(change), change);
+    if (!this.flushTimer) {
+      this.flushTimer = setTimeout(() => this.flush(), WRITE_BEHIND_MS);
+    }
+  }
+
+  private async flush() {
+    this.flushTimer = undefined;
+    const writes = this.pendingWrites;
+    this.pendingWrites = new Map();
+    try {
+      await LatchedAlertsMongo.writeLatchedAlerts([...writes.values()]);
+    } catch (err) {
+      console.log(`Could not save ${writes.size} latched alert changes, retrying`, err);
+      // Put back whatever hasn't been changed again since.
+      for (const [ key, change ] of writes) {
+        if (!this.pendingWrites.has(key)) this.write(change);
+      }
+    }
+  }
+}
+
+/**
+ * Gets the latched alert store shared by everything in this process, creating it on first use.
+ * @returns this process's store
+ */
+export function getLatchStore(): LatchStore {
+  if (!global._notifyLatches) {
+    // Kept across module reloads in development.
+    global._notifyLatches = new LatchStore();
+  }
+  return global._notifyLatches;
+}
@@ -0,0 +1,123 @@
+import cluster from 'cluster';
+
+// Topics every shard listens to.
+export const NOTIFY_TOPIC = 'notify';
+export const TEST_TOPIC = 'test';
+export const GMAIL_PUSH_TOPIC = 'gmail-push';
+export const GMAIL_INTEREST_TOPIC = 'gmail-interest';
+export const LATCH_TOPIC = 'latch';
+// Published by the bus itself when the leader changes.
+export const LEADER_TOPIC = 'leader';
+
+export type BusHandler = (message: any) => void;
+
+/**
+ * Carries messages between the processes that each own a shard of the device sockets. Every message goes to every
+ * shard, including the one that published it, and each shard acts on the devices it has.
+ */
+export interface MessageBus {
+  publish(topic: string, message: unknown): void;
+  subscribe(topic: string, handler: BusHandler): void;
+  /**
+   * 
+   * @returns whether this process does the work only one shard should do, like handling Gmail pushes
+   */
+  isLeader(): boolean;
+}
+
+class Subscriptions {
+  private readonly handlers = new Map<string, BusHandler[]>();
+
+  add(topic: string, handler: BusHandler) {
+    this.handlers.set(topic, [ ...(this.handlers.get(topic) ?? []), handler ]);
+  }
+
+  dispatch(topic: string, message: unknown) {
+    for (const handler of this.handlers.get(topic) ?? []) {
+      try {
+        handler(message);
+      } catch (err) {
+        console.log(`Bus handler for ${topic} failed`, err);
+      }
+    }
+  }
+}
+
+/**
+ * A single process is the only shard and always the leader. Messages are delivered asynchronously, as they would be
+ * between processes.
+ */
+export class InProcessBus implements MessageBus {
+  private readonly subscriptions = new Subscriptions();
+
+  publish(topic: string, message: unknown) {
+    setImmediate(() => this.subscriptions.dispatch(topic, message));
+  }
+
+  subscribe(topic: string, handler: BusHandler) {
+    this.subscriptions.add(topic, handler);
+  }
+
+  isLeader() {
+    return true;
+  }
+}
+
+interface ClusterBusMessage {
+  bus: true;
+  topic: string;
+  message: unknown;
+}
+
+function isBusMessage(value: any): value is ClusterBusMessage {
+  return value != null && value.bus === true && typeof value.topic === 'string';
+}
+
+/**
+ * A node:cluster worker. Messages go to the primary (see cluster.mjs), which sends them on to every worker and tells
+ * the workers which of them is the leader.
+ */
+export class ClusterWorkerBus implements MessageBus {
+  private readonly subscriptions = new Subscriptions();
+  private leaderId?: number;
+
+  constructor() {
+    process.on('message', (value: any) => {
+      if (!isBusMessage(value)) return;
+      if (value.topic === LEADER_TOPIC) {
+        this.leaderId = (value.message as { workerId: number }).workerId;
+      }
+      this.subscriptions.dispatch(value.topic, value.message);
+    });
+    // Ask who the leader is.
+    process.send?.({ bus: true, topic: LEADER_TOPIC, message: {} });
+  }
+
+  publish(topic: string, message: unknown) {
+    const value: ClusterBusMessage = { bus: true, topic, message };
+    process.send?.(value);
+  }
+
+  subscribe(topic: string, handler: BusHandler) {
+    this.subscriptions.add(topic, handler);
+  }
+
+  isLeader() {
+    return this.leaderId === cluster.worker?.id;
+  }
+}
+
+let instance: MessageBus|undefined;
+
+export function getMessageBus(): MessageBus {
+  if (!instance) {
+    if (global._notifyBus) {
+      // Preserved across module reloads in development.
+      instance = global._notifyBus;
+    } else {
+      instance = (cluster.isWorker && process.env.NOTIFY_CLUSTER) ? new ClusterWorkerBus() : new InProcessBus();
+      global._notifyBus = instance;
+    }
+  }
+  return instance;
+}
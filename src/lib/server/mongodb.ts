@@ -1,9 +1,17 @@
 // SEE https://github.com/vercel/next.js/tree/canary/examples/with-mongodb
-import { MongoClient } from 'mongodb';
+import { AnyBulkWriteOperation, GridFSBucket, MongoClient, MongoServerError } from 'mongodb';
+import { createHash } from 'crypto';
+import { Readable, Transform } from 'stream';
+import { pipeline } from 'stream/promises';
 import { DEVICE_COLLECTION, DeviceDoc } from './data/deviceDoc';
 import { SETTINGS_COLLECTION, SettingsDoc } from './data/settingsDoc';
-import { FIRMWARE_COLLECTION, FirmwareDoc } from './data/firmwareDoc';
+import { FIRMWARE_BUCKET, FIRMWARE_COLLECTION, FirmwareDoc } from './data/firmwareDoc';
 import { CHANNEL_COLLECTION, ChannelDoc } from './data/channelDoc';
+import { DEVICE_STATS_COLLECTION, DeviceStatsDoc } from './data/deviceStatsDoc';
+import { DEVICE_BOOTS_COLLECTION, DeviceBootDoc } from './data/deviceBootDoc';
+import { DEVICE_TRACES_COLLECTION, DeviceTraceDoc } from './data/deviceTraceDoc';
+import { LATCHED_ALERTS_COLLECTION, LatchedAlertDoc } from './data/latchedAlertDoc';
+import { encodeDelta } from './firmwareDelta';
 
 if (!process.env.MONGODB_URI) {
   throw new Error('Invalid/Missing environment variable: "MONGODB_URI"');
@@ -76,14 +84,22 @@ export async function getDevice(callsign: string, opts?: StandardOptions) {
 export async function deviceCheckin(callsign: string, version: string, time: number): Promise<DeviceDoc|null> {
   const client = await clientPromise;
   const update = { $set: { reportedVersion: version, lastConnected: time }};
-  await client.db().collection<DeviceDoc>(DEVICE_COLLECTION).updateOne({callsign}, update);
-  return await getDevice(callsign);
+  const result = await client.db().collection<DeviceDoc>(DEVICE_COLLECTION).findOneAndUpdate({callsign}, update, { returnDocument: 'after' });
+  return result.value;
 }
 
-export async function deviceInteraction(callsign: string, time: number) {
+/**
+ * 
+ * @param callsign 
+ * @param time when the button was pressed
+ * @param gesture which button and how, e.g. "1 LONG"
+ */
+export async function deviceInteraction(callsign: string, time: number, gesture?: string) {
   const client = await clientPromise;
-  const update = { $set: { lastInteraction: time }};
-  await client.db().collection<DeviceDoc>(DEVICE_COLLECTION).updateOne({callsign}, update);
+  // Presses can arrive late and out of order from a device's journal, so only a newer one is kept.
+  const filter = { callsign, $or: [ { lastInteraction: { $lt: time } }, { lastInteraction: { $exists: false } } ] };
+  const update = { $set: { lastInteraction: time, ...(gesture ? { lastGesture: gesture } : {}) }};
+  await client.db().collection<DeviceDoc>(DEVICE_COLLECTION).updateOne(filter, update);
 }
 
 export const DeviceMongo = {
@@ -93,35 +109,357 @@ export const DeviceMongo = {
   deviceInteraction,
 }
 
+// Stats, boot reports and traces are kept for 30 days.
+const DEVICE_STATS_TTL_SECONDS = 30 * 24 * 60 * 60;
+const timeseriesReady: Record<string, Promise<void>|undefined> = {};
+
+async function ensureTimeseriesCollection(name: string) {
+  let ready = timeseriesReady[name];
+  if (!ready) {
+    ready = (async () => {
+      const db = (await clientPromise).db();
+      const existing = await db.listCollections({ name }).toArray();
+      if (existing.length === 0) {
+        await db.createCollection(name, {
+          timeseries: { timeField: 'time', metaField: 'callsign', granularity: 'minutes' },
+          expireAfterSeconds: DEVICE_STATS_TTL_SECONDS,
+        });
+      }
+    })();
+    ready.catch(() => delete timeseriesReady[name]);
+    timeseriesReady[name] = ready;
+  }
+  return ready;
+}
+
+function ensureStatsCollection() {
+  return ensureTimeseriesCollection(DEVICE_STATS_COLLECTION);
+}
+
+export async function addDeviceStats(stats: DeviceStatsDoc) {
+  await ensureStatsCollection();
+  const client = await clientPromise;
+  await client.db().collection<DeviceStatsDoc>(DEVICE_STATS_COLLECTION).insertOne(stats);
+}
+
+export async function getDeviceStats(callsign: string, since: number, opts?: StandardOptions) {
+  await ensureStatsCollection();
+  const client = await clientPromise;
+  const stats = await client.db().collection<DeviceStatsDoc>(DEVICE_STATS_COLLECTION)
+    .find({ callsign, time: { $gte: new Date(since) } })
+    .sort({ time: 1 })
+    .toArray();
+  if (opts?.stripIds ?? false) {
+    stats.forEach(s => delete (s as MongoDoc)._id);
+  }
+  return stats;
+}
+
+export async function addDeviceBoot(boot: DeviceBootDoc) {
+  await ensureTimeseriesCollection(DEVICE_BOOTS_COLLECTION);
+  const client = await clientPromise;
+  await client.db().collection<DeviceBootDoc>(DEVICE_BOOTS_COLLECTION).insertOne(boot);
+}
+
+export async function getDeviceBoots(callsign: string, since: number, opts?: StandardOptions) {
+  await ensureTimeseriesCollection(DEVICE_BOOTS_COLLECTION);
+  const client = await clientPromise;
+  const boots = await client.db().collection<DeviceBootDoc>(DEVICE_BOOTS_COLLECTION)
+    .find({ callsign, time: { $gte: new Date(since) } })
+    .sort({ time: 1 })
+    .toArray();
+  if (opts?.stripIds ?? false) {
+    boots.forEach(b => delete (b as MongoDoc)._id);
+  }
+  return boots;
+}
+
+export async function addDeviceTrace(trace: DeviceTraceDoc) {
+  await ensureTimeseriesCollection(DEVICE_TRACES_COLLECTION);
+  const client = await clientPromise;
+  await client.db().collection<DeviceTraceDoc>(DEVICE_TRACES_COLLECTION).insertOne(trace);
+}
+
+export const DeviceStatsMongo = {
+  addDeviceStats,
+  getDeviceStats,
+  addDeviceBoot,
+  getDeviceBoots,
+  addDeviceTrace,
+}
+
+// Every handshake reads its device's channels, and channels rarely change, so
+// they are cached. A change stream empties the cache whenever the collection
+// changes. Change streams need a replica set; without one nothing is cached.
+const channelCache = new Map<string, ChannelDoc>();
+let channelCacheGeneration = 0;
+let channelWatch: Promise<boolean>|undefined;
+
+function watchChannels(client: MongoClient): Promise<boolean> {
+  if (!channelWatch) {
+    channelWatch = new Promise<boolean>(resolve => {
+      const stream = client.db().collection<ChannelDoc>(CHANNEL_COLLECTION).watch();
+      stream.on('init', () => resolve(true));
+      stream.on('change', () => {
+        channelCacheGeneration++;
+        channelCache.clear();
+      });
+      stream.on('error', err => {
+        console.log('Channel change stream stopped, not caching channels:', err.message);
+        channelCacheGeneration++;
+        channelCache.clear();
+        stream.close().catch(() => undefined);
+        resolve(false);
+      });
+    });
+  }
+  return channelWatch;
+}
+
 export async function getChannel(channelId: string): Promise<ChannelDoc|undefined> {
+  return (await getChannels([channelId]))[0];
+}
+
+/**
+ * 
+ * @param channelIds names of the channels
+ * @returns the channels that exist, in the order asked for. Don't modify them, they may be shared through the cache.
+ */
+export async function getChannels(channelIds: string[]): Promise<ChannelDoc[]> {
   const client = await clientPromise;
-  const channel = await client.db().collection<ChannelDoc>(CHANNEL_COLLECTION).findOne({ name: channelId });
-  return channel ? channel : undefined;
+  const cached = await watchChannels(client);
+  const generation = channelCacheGeneration;
+  const found = new Map<string, ChannelDoc>();
+  const missing: string[] = [];
+  for (const id of channelIds) {
+    const channel = cached ? channelCache.get(id) : undefined;
+    if (channel) {
+      found.set(id, channel);
+    } else {
+      missing.push(id);
+    }
+  }
+
+  if (missing.length > 0) {
+    const channels = await client.db().collection<ChannelDoc>(CHANNEL_COLLECTION).find({ name: { $in: missing } }).toArray();
+    for (const channel of channels) {
+      found.set(channel.name, channel);
+      // Skip the cache if a change arrived while we were reading.
+      if (cached && generation === channelCacheGeneration) channelCache.set(channel.name, channel);
+    }
+  }
+  return channelIds.flatMap(id => found.get(id) ?? []);
 }
 
 export const ChannelsMongo = {
   getChannel,
+  getChannels,
+}
+
+let latchIndexes: Promise<unknown>|undefined;
+
+async function latchedAlertsCollection(client: MongoClient) {
+  const collection = client.db().collection<LatchedAlertDoc>(LATCHED_ALERTS_COLLECTION);
+  latchIndexes ??= collection.createIndex({ callsign: 1, channel: 1 }, { unique: true });
+  await latchIndexes;
+  return collection;
+}
+
+/**
+ * 
+ * @returns every latched alert, read once when a shard starts
+ */
+export async function getLatchedAlerts(): Promise<LatchedAlertDoc[]> {
+  const client = await clientPromise;
+  const alerts = await (await latchedAlertsCollection(client)).find().toArray();
+  alerts.forEach(a => delete (a as MongoDoc)._id);
+  return alerts;
+}
+
+/**
+ * Saves a batch of changes in one round trip.
+ * @param changes the alert to store for each device and channel, or none to delete it
+ */
+export async function writeLatchedAlerts(changes: { callsign: string, channel: string, alert?: LatchedAlertDoc }[]) {
+  if (changes.length === 0) return;
+  const client = await clientPromise;
+  const operations: AnyBulkWriteOperation<LatchedAlertDoc>[] = changes.map(({ callsign, channel, alert }) => alert
+    ? { replaceOne: { filter: { callsign, channel }, replacement: alert, upsert: true } }
+    : { deleteOne: { filter: { callsign, channel } } });
+  await (await latchedAlertsCollection(client)).bulkWrite(operations, { ordered: false });
+}
+
+/**
+ * 
+ * @param email mailbox that has new mail
+ * @returns each device and channel with a latched subscription to a channel for the mailbox
+ */
+export async function getLatchSubscriptions(email: string): Promise<{ callsign: string, channel: string }[]> {
+  const client = await clientPromise;
+  const channels = await client.db().collection<ChannelDoc>(CHANNEL_COLLECTION).find({ email }).toArray();
+  const names = channels.map(c => c.name);
+  if (names.length === 0) return [];
+
+  const devices = await client.db().collection<DeviceDoc>(DEVICE_COLLECTION)
+    .find({ channels: { $elemMatch: { id: { $in: names }, latch: true } } })
+    .toArray();
+  return devices.flatMap(device => device.channels
+    .filter(c => c.latch && names.includes(c.id))
+    .map(c => ({ callsign: device.callsign, channel: c.id })));
+}
+
+export const LatchedAlertsMongo = {
+  getLatchedAlerts,
+  writeLatchedAlerts,
+  getLatchSubscriptions,
+}
+
+const DUPLICATE_KEY = 11000;
+
+let firmwareIndexes: Promise<unknown>|undefined;
+
+async function firmwareCollection(client: MongoClient) {
+  const collection = client.db().collection<FirmwareDoc>(FIRMWARE_COLLECTION);
+  firmwareIndexes ??= collection.createIndex({ version: 1 }, { unique: true });
+  await firmwareIndexes;
+  return collection;
+}
+
+export interface FirmwareImage {
+  length: number;
+  /** Strong validator for the content, for ETag and If-Range. */
+  etag: string;
+  /** Streams bytes start (inclusive) to end (exclusive) of the image. */
+  open(start: number, end: number): Readable;
 }
 
-export async function getFirmwareVersions(): Promise<string[]> {
+function firmwareBucket(client: MongoClient) {
+  return new GridFSBucket(client.db(), { bucketName: FIRMWARE_BUCKET });
+}
+
+async function findStoredImage(client: MongoClient, filename: string): Promise<FirmwareImage|undefined> {
+  const bucket = firmwareBucket(client);
+  const file = await bucket.find({ filename }).sort({ uploadDate: -1 }).limit(1).next();
+  if (!file) return undefined;
+  return {
+    length: file.length,
+    // Images are named by their own hash, and deltas by the two images', so the name will do for older files.
+    etag: `"${file.metadata?.sha256 ?? filename}"`,
+    open: (start, end) => bucket.openDownloadStream(file._id, { start, end }),
+  };
+}
+
+/**
+ * Streams data into the bucket, hashing it on the way.
+ * @returns the stored file's id and the SHA-256 of its content
+ */
+async function storeImage(client: MongoClient, filename: string, data: Readable|Buffer) {
+  const hash = createHash('sha256');
+  const hashing = new Transform({
+    transform(chunk, encoding, callback) {
+      hash.update(chunk);
+      callback(null, chunk);
+    },
+  });
+  const bucket = firmwareBucket(client);
+  const upload = bucket.openUploadStream(filename);
+  try {
+    await pipeline(Buffer.isBuffer(data) ? Readable.from([data]) : data, hashing, upload);
+  } catch (err) {
+    // Don't leave the chunks written so far behind.
+    await bucket.delete(upload.id).catch(() => undefined);
+    throw err;
+  }
+
+  const sha256 = hash.digest('hex');
+  await client.db().collection(`${FIRMWARE_BUCKET}.files`).updateOne({ _id: upload.id }, { $set: { metadata: { sha256 } } });
+  return { id: upload.id, sha256 };
+}
+
+async function readImage(image: FirmwareImage): Promise<Buffer> {
+  const chunks: Buffer[] = [];
+  for await (const chunk of image.open(0, image.length)) {
+    chunks.push(chunk);
+  }
+  return Buffer.concat(chunks);
+}
+
+/**
+ * Stores a new firmware image. The image is written first, so a version is only listed once it can be downloaded.
+ * @param firmware the version's details
+ * @param data the image
+ * @param length the image's length in bytes
+ * @returns false if the version has already been uploaded
+ */
+export async function putFirmware(firmware: FirmwareDoc, data: Readable, length: number): Promise<boolean> {
   const client = await clientPromise;
-  const versions = await client.db().collection<FirmwareDoc>(FIRMWARE_COLLECTION).find().project<{version: string}>({ version: 1 }).toArray();
-  return versions.map(v => v.version);
+  const collection = await firmwareCollection(client);
+  const stored = await storeImage(client, firmware.version, data);
+  try {
+    await collection.insertOne({ ...firmware, length });
+    return true;
+  } catch (err) {
+    await firmwareBucket(client).delete(stored.id);
+    if (err instanceof MongoServerError && err.code === DUPLICATE_KEY) return false;
+    throw err;
+  }
 }
 
-export async function putFirmware(firmware: FirmwareDoc) {
+/**
+ * 
+ * @param version firmware version
+ * @returns the image, streamed in chunks from storage
+ */
+export async function getFirmwareImage(version: string): Promise<FirmwareImage|undefined> {
   const client = await clientPromise;
-  await client.db().collection<FirmwareDoc>(FIRMWARE_COLLECTION).replaceOne({ version: firmware.version }, firmware, { upsert: true });
+  const stored = await findStoredImage(client, version);
+  if (stored) return stored;
+
+  // Move images from before GridFS storage out of their documents the first time they are asked for.
+  const collection = await firmwareCollection(client);
+  const document = await collection.findOne({ version });
+  if (!document?.file) return undefined;
+  const data = Buffer.from(document.file.buffer);
+  await storeImage(client, version, data);
+  await collection.updateOne({ version }, { $set: { length: data.length }, $unset: { file: '' } });
+  return findStoredImage(client, version);
 }
 
-export async function getFirmwareBinary(version: string): Promise<Buffer|undefined> {
+// Deltas being built, so devices updating together share one.
+const pendingDeltas = new Map<string, Promise<FirmwareImage|undefined>>();
+
+async function buildDelta(client: MongoClient, from: string, to: string, filename: string): Promise<FirmwareImage|undefined> {
+  const source = await getFirmwareImage(from);
+  const target = await getFirmwareImage(to);
+  if (!source || !target) return undefined;
+
+  const delta = encodeDelta(await readImage(source), await readImage(target));
+  await storeImage(client, filename, delta);
+  return findStoredImage(client, filename);
+}
+
+/**
+ * 
+ * @param from version the device is running
+ * @param to version the device should be updated to
+ * @returns a delta from one to the other, built and stored the first time it is asked for, or undefined if either version is unknown
+ */
+export async function getFirmwareDelta(from: string, to: string): Promise<FirmwareImage|undefined> {
   const client = await clientPromise;
-  const document = await client.db().collection<FirmwareDoc>(FIRMWARE_COLLECTION).findOne({version});
-  return document ? document.file : undefined;
+  const filename = `delta-${from}-${to}`;
+  const stored = await findStoredImage(client, filename);
+  if (stored) return stored;
+
+  let pending = pendingDeltas.get(filename);
+  if (!pending) {
+    pending = buildDelta(client, from, to, filename).finally(() => pendingDeltas.delete(filename));
+    pendingDeltas.set(filename, pending);
+  }
+  return pending;
 }
 
 export const FirmwareMongo = {
-  getFirmwareVersions,
   putFirmware,
-  getFirmwareBinary,
+  getFirmwareImage,
+  getFirmwareDelta,
 }
\ No newline at end of file
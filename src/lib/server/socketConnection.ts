@@ -1,8 +1,52 @@
 import { WebSocket } from 'ws';
 import { v4 as uuid } from 'uuid';
-import { DeviceMongo, ChannelsMongo } from './mongodb';
+import { DeviceMongo, ChannelsMongo, DeviceStatsMongo } from './mongodb';
 import { getServices } from './services';
 import { ChannelDoc } from './data/channelDoc';
+import { DeviceStatsDoc } from './data/deviceStatsDoc';
+import { BootPhases, DeviceBootDoc } from './data/deviceBootDoc';
+import { OutputPriority, PreparedCommand, prepareCommand } from './commandFrame';
+import { getLatchStore } from './latchStore';
+
+// Messages are queued per connection and written while the socket has less than
+// this waiting to go out, so a slow device can't hold everyone else up.
+const SEND_HIGH_WATER_BYTES = 64 * 1024;
+// Oldest messages are dropped past this.
+const MAX_QUEUED_MESSAGES = 64;
+const SEND_RETRY_MS = 50;
+
+// The last event handled from each device's journal, so events sent again after a lost ACK are only handled once.
+// An entry belongs to the connection that wrote it and goes when that connection closes or the journal changes.
+const journalPositions = new Map<string, { journal: string, seq: number, connection: string }>();
+
+// Journal events for button gestures, and what they are called in BUTTON messages.
+const GESTURE_EVENTS: Record<string, string> = {
+  'BUTTON': 'PRESS',
+  'BUTTON_LONG': 'LONG',
+  'BUTTON_DOUBLE': 'DOUBLE',
+  'BUTTON_CHORD': 'CHORD',
+};
+
+interface DeviceEvent {
+  seq: number;
+  type: string;
+  arg: number;
+  time: number;
+}
+
+interface OutgoingMessage {
+  data: Buffer|string;
+  binary: boolean;
+}
+
+// "1+2" for a chord of buttons 1 and 2.
+function chordButtons(mask: number) {
+  const buttons: number[] = [];
+  for (let i = 0; i < 8; i++) {
+    if (mask & (1 << i)) buttons.push(i + 1);
+  }
+  return buttons.join('+');
+}
 
 export class SocketConnection {
   private ws: WebSocket;
@@ -11,17 +55,42 @@ export class SocketConnection {
   readonly since: number = new Date().getTime();
   readonly addr?: string;
   private isAlive: boolean = true;
+  private binaryFrames: boolean = false;
+  private priorityTags: boolean = false;
+  // Sent OTA instead of WELCOME, so the connection is only there for the update.
+  private otaOffered: boolean = false;
+  private outbox: OutgoingMessage[] = [];
+  private flushTimer?: NodeJS.Timeout;
+  // EVENTS batches are handled one at a time, in the order they arrived.
+  private eventBatches: Promise<void> = Promise.resolve();
 
   channels: ChannelDoc[] = [];
   
   handshakeTimeout?: NodeJS.Timeout;
 
-  constructor(ws: WebSocket, remoteAddr?: string, onClose?: (id: string) => void) {
+  private onReady?: (conn: SocketConnection) => void;
+
+  /**
+   * 
+   * @param ws the device's socket
+   * @param remoteAddr where the device connected from
+   * @param onClose called when the socket closes
+   * @param onReady called once the handshake is complete and channels are known
+   */
+  constructor(ws: WebSocket, remoteAddr?: string, onClose?: (id: string) => void, onReady?: (conn: SocketConnection) => void) {
     this.ws = ws;
     this.addr = remoteAddr;
+    this.onReady = onReady;
     ws.on('error', err => console.log('error:', err));
     ws.on('message', (data) => this.handleMessage(String(data)));
-    ws.on('close', () => onClose?.(this.id));
+    ws.on('close', () => {
+      this.outbox = [];
+      clearTimeout(this.flushTimer);
+      if (journalPositions.get(this.callsign)?.connection === this.id) {
+        journalPositions.delete(this.callsign);
+      }
+      onClose?.(this.id);
+    });
     ws.on('pong', () => this.isAlive = true);
   }
 
@@ -30,12 +99,67 @@ export class SocketConnection {
     switch (parts[0]) {
       case 'HELLO':
         this.callsign = parts[1];
+        this.binaryFrames = parts.slice(3).includes('BIN1');
+        this.priorityTags = parts.slice(3).includes('PRIO1');
         await this.onHello(parts[2]);
         break;
 
       case 'BUTTON':
-        await DeviceMongo.deviceInteraction(this.callsign, new Date().getTime());
-        console.log(this.id, 'clicked button');
+        // BUTTON <button> [PRESS|LONG|DOUBLE|CHORD], from firmware that doesn't journal its events.
+        if (this.callsign) {
+          await this.onButton(parts[1] ?? '1', parts[2] ?? 'PRESS', new Date().getTime());
+        }
+        break;
+
+      case 'EVENTS':
+        if (this.callsign) {
+          this.eventBatches = this.eventBatches.then(() => this.onEvents(parts.slice(1))).catch(err => {
+            console.log(this.id, `${this.callsign} events failed:`, err);
+          });
+          await this.eventBatches;
+        }
+        break;
+
+      case 'OTA_PROGRESS':
+        // OTA_PROGRESS <received> <total>, or OTA_PROGRESS FAILED <reason> once the device has given up.
+        if (this.callsign && parts[1] === 'FAILED') {
+          console.log(this.id, `${this.callsign} OTA failed (${parts[2] ?? '?'})`);
+          // A device that was never welcomed reconnects and is offered the update again after its backoff.
+          if (this.otaOffered) this.ws.close();
+        } else if (this.callsign) {
+          const [ received, total ] = parts.slice(1).map(Number);
+          const percent = total > 0 ? Math.floor(received * 100 / total) : 0;
+          console.log(this.id, `${this.callsign} OTA at ${received} of ${total} bytes (${percent}%)`);
+        }
+        break;
+
+      case 'STATS':
+        if (this.callsign) {
+          await DeviceStatsMongo.addDeviceStats(this.parseStats(parts.slice(1)));
+        }
+        break;
+
+      case 'BOOT':
+        if (this.callsign) {
+          const boot = this.parseBoot(parts.slice(1));
+          console.log(this.id, `${this.callsign} online ${boot.phases.welcome ?? '?'} ms after starting` +
+            (boot.fastConnect ? ' (fast connect)' : ''));
+          await DeviceStatsMongo.addDeviceBoot(boot);
+        }
+        break;
+
+      case 'TRACE':
+        // TRACE <reset reason> <hex record> ..., sent after a crash.
+        if (this.callsign) {
+          const records = parts.slice(2).filter(record => /^[0-9a-f]{48}$/.test(record));
+          console.log(this.id, `${this.callsign} sent ${records.length} trace records from before a crash`);
+          await DeviceStatsMongo.addDeviceTrace({
+            callsign: this.callsign,
+            time: new Date(),
+            resetReason: Number(parts[1]) || 0,
+            records,
+          });
+        }
         break;
     }
   }
@@ -55,24 +179,177 @@ export class SocketConnection {
 
     if (device.expectedVersion && (device.expectedVersion !== 'ignore') && (device.expectedVersion !== firmware)) {
       console.log(this.id, `${this.callsign} on firmware ${firmware} should be on ${device.expectedVersion}`);
+      // Leave the socket open so the device can report OTA_PROGRESS. It restarts when it is done, or reports failure.
       this.ws.send(`OTA ${device.expectedVersion}`);
-      this.ws.close();
+      this.otaOffered = true;
       return;
     }
 
+    const channelIds = device.channels.map(c => c.id);
+    this.channels = await ChannelsMongo.getChannels(channelIds);
+    for (const id of channelIds.filter(id => !this.channels.some(c => c.name === id))) {
+      console.log(`Could not find channel ${id} for device ${this.callsign}`);
+    }
+
     const gmail = (await getServices()).gmailService;
-    for (const deviceChannel of device.channels) {
-      const channel = await ChannelsMongo.getChannel(deviceChannel.id);
-      if (channel) {
-        this.channels.push(channel);
-        await gmail.refreshInterest(channel.email);
+    const emails = new Set(this.channels.map(c => c.email));
+    await Promise.all([...emails].map(email => gmail.refreshInterest(email).catch(err => {
+      console.log(this.id, `Could not watch ${email} for ${this.callsign}`, err);
+    })));
+
+    console.log(this.id, `Handshake complete for ${this.callsign}`);
+    if (device.traceMask != null) {
+      this.ws.send(`TRACE ${device.traceMask.toString(16)}`);
+    }
+    this.ws.send('WELCOME ' + this.id);
+    await this.redeliverAlerts();
+    this.onReady?.(this);
+  }
+
+  // Alerts the device missed or hasn't acknowledged go out again with every handshake.
+  private async redeliverAlerts() {
+    const latches = getLatchStore();
+    await latches.ready;
+    for (const alert of latches.alertsFor(this.callsign)) {
+      const channel = this.channels.find(c => c.name === alert.channel);
+      if (!channel) continue;
+      console.log(this.id, `Redelivering ${alert.channel} alert to ${this.callsign}, latched since ${new Date(alert.since).toISOString()}`);
+      channel.commands.forEach(cmd => this.sendCommand(cmd, channel.priority));
+    }
+  }
+
+  /**
+   * Handles a batch from the device's event journal and acknowledges it.
+   * @param fields journal id, boot, the device's ms since boot, then one seq:type:arg:boot:ms per event
+   */
+  private async onEvents(fields: string[]) {
+    const [ journal, boot, deviceNow ] = fields;
+    const received = new Date().getTime();
+    const events: DeviceEvent[] = fields.slice(3).map(field => {
+      const [ seq, type, arg, eventBoot, ms ] = field.split(':');
+      // Times from an earlier boot can't be placed, so they count as now.
+      const age = eventBoot === boot ? Math.max(0, Number(deviceNow) - Number(ms)) : 0;
+      return { seq: Number(seq), type, arg: Number(arg), time: received - age };
+    }).filter(event => !isNaN(event.seq) && !isNaN(event.time));
+    if (events.length === 0) return;
+
+    // A new journal starts its sequence again, so the old position means nothing.
+    if (journalPositions.get(this.callsign)?.journal !== journal) {
+      journalPositions.delete(this.callsign);
+    }
+    let last = journalPositions.get(this.callsign)?.seq ?? -1;
+    for (const event of events) {
+      if (event.seq <= last) continue;
+      await this.onEvent(event);
+      last = this.advanceJournal(journal, event.seq);
+    }
+    this.send(`ACK ${last}`, false);
+  }
+
+  /**
+   * Records that the device's events up to seq have been handled. The position only moves forward.
+   * @param journal the device's journal id
+   * @param seq the last event handled
+   * @returns the position after the update
+   */
+  private advanceJournal(journal: string, seq: number) {
+    const position = journalPositions.get(this.callsign);
+    if (position?.journal === journal && position.seq >= seq) return position.seq;
+    journalPositions.set(this.callsign, { journal, seq, connection: this.id });
+    return seq;
+  }
+
+  private async onEvent(event: DeviceEvent) {
+    const gesture = GESTURE_EVENTS[event.type];
+    if (gesture) {
+      await this.onButton(gesture === 'CHORD' ? chordButtons(event.arg) : String(event.arg), gesture, event.time);
+      return;
+    }
+
+    switch (event.type) {
+      case 'RECONNECT':
+        console.log(this.id, `${this.callsign} reconnected at ${new Date(event.time).toISOString()}`);
+        break;
+
+      case 'OTA':
+        console.log(this.id, `${this.callsign} OTA ${event.arg === 0 ? 'succeeded' : 'failed with ' + event.arg}`);
+        break;
+    }
+  }
+
+  /**
+   * 
+   * @param button which button, or buttons joined with + for a chord
+   * @param gesture PRESS, LONG, DOUBLE or CHORD
+   * @param time when it happened
+   */
+  private async onButton(button: string, gesture: string, time: number) {
+    await DeviceMongo.deviceInteraction(this.callsign, time, `${button} ${gesture}`);
+    console.log(this.id, `${this.callsign} button ${button} ${gesture} at ${new Date(time).toISOString()}`);
+    // Any press acknowledges the device's latched alerts.
+    const cleared = getLatchStore().clear(this.callsign, time);
+    if (cleared > 0) {
+      console.log(this.id, `${this.callsign} cleared ${cleared} latched alerts`);
+    }
+  }
+
+  /**
+   * 
+   * @param fields key=value pairs from a STATS message
+   * @returns the sample to store
+   */
+  private parseStats(fields: string[]): DeviceStatsDoc {
+    const values: Record<string, number> = {};
+    const stackFree: Record<string, number> = {};
+    for (const field of fields) {
+      const [ key, value ] = field.split('=');
+      const num = Number(value);
+      if (!key || value == null || isNaN(num)) continue;
+
+      if (key.startsWith('s.')) {
+        stackFree[key.substring(2)] = num;
       } else {
-        console.log(`Could not find channel ${deviceChannel.id} for device ${this.callsign}`);
+        values[key] = num;
       }
     }
 
-    console.log(this.id, `Handshake complete for ${this.callsign}`);
-    this.ws.send('WELCOME ' + this.id);
+    return {
+      callsign: this.callsign,
+      time: new Date(),
+      uptime: values['up'] ?? 0,
+      freeHeap: values['heap'] ?? 0,
+      minFreeHeap: values['minheap'] ?? 0,
+      largestFreeBlock: values['block'] ?? 0,
+      reconnects: values['rc'] ?? 0,
+      wakes: values['pm'] ?? 0,
+      awakeMs: values['pmms'] ?? 0,
+      stackFree,
+    };
+  }
+
+  /**
+   * 
+   * @param fields key=value pairs from a BOOT message
+   * @returns the report to store
+   */
+  private parseBoot(fields: string[]): DeviceBootDoc {
+    const phases: BootPhases = {};
+    let resetReason = 0;
+    let fastConnect = false;
+    for (const field of fields) {
+      const [ key, value ] = field.split('=');
+      const num = Number(value);
+      if (!key || value == null || isNaN(num)) continue;
+
+      if (key === 'rst') {
+        resetReason = num;
+      } else if (key === 'fast') {
+        fastConnect = num === 1;
+      } else if ([ 'main', 'nvs', 'assoc', 'ip', 'tls', 'welcome' ].includes(key)) {
+        phases[key as keyof BootPhases] = num;
+      }
+    }
+    return { callsign: this.callsign, time: new Date(), resetReason, fastConnect, phases };
   }
 
   run() {
@@ -107,8 +384,45 @@ export class SocketConnection {
     this.ws.send(`LED ${idx} ${on ? 'ON' : 'OFF'}${timeMs ?? 0 > 0 ? ' ' + timeMs : ''}`);
   }
 
-  sendCommand(cmd: string) {
-    this.ws.send(cmd);
+  private flush() {
+    this.flushTimer = undefined;
+    while (this.outbox.length > 0 && this.ws.bufferedAmount < SEND_HIGH_WATER_BYTES) {
+      const message = this.outbox.shift()!;
+      this.ws.send(message.data, { binary: message.binary });
+    }
+    if (this.outbox.length > 0 && this.ws.readyState === WebSocket.OPEN) {
+      this.flushTimer = setTimeout(() => this.flush(), SEND_RETRY_MS);
+    }
+  }
+
+  private send(data: Buffer|string, binary: boolean) {
+    if (this.outbox.length === 0 && this.ws.bufferedAmount < SEND_HIGH_WATER_BYTES) {
+      this.ws.send(data, { binary });
+      return;
+    }
+
+    if (this.outbox.length >= MAX_QUEUED_MESSAGES) {
+      this.outbox.shift();
+      console.log(this.id, `${this.callsign} is not keeping up, dropped a message`);
+    }
+    this.outbox.push({ data, binary });
+    if (!this.flushTimer) {
+      this.flushTimer = setTimeout(() => this.flush(), SEND_RETRY_MS);
+    }
+  }
+
+  sendPrepared(command: PreparedCommand) {
+    if (this.binaryFrames && command.frame) {
+      this.send(command.frame, true);
+    } else if (this.priorityTags && command.taggedText) {
+      this.send(command.taggedText, false);
+    } else {
+      this.send(command.text, false);
+    }
+  }
+
+  sendCommand(cmd: string, priority?: OutputPriority) {
+    this.sendPrepared(prepareCommand(cmd, priority));
   }
 
   sendTest() {
@@ -0,0 +1,55 @@
+/**
+ * Token bucket rate limiter. Tokens refill continuously up to the burst size.
+ */
+export class TokenBucket {
+  private tokens: number;
+  private lastRefill: number;
+  // Waiters in take(), so they are served in order.
+  private queue: Promise<void> = Promise.resolve();
+
+  /**
+   * 
+   * @param ratePerSecond tokens added per second
+   * @param burst most tokens that can be saved up
+   */
+  constructor(private readonly ratePerSecond: number, private readonly burst: number) {
+    this.tokens = burst;
+    this.lastRefill = Date.now();
+  }
+
+  private refill(now: number) {
+    const elapsed = Math.max(0, now - this.lastRefill) / 1000;
+    this.tokens = Math.min(this.burst, this.tokens + elapsed * this.ratePerSecond);
+    this.lastRefill = now;
+  }
+
+  /**
+   * 
+   * @returns true if a token was taken, false if there are none right now
+   */
+  tryTake(now: number = Date.now()): boolean {
+    this.refill(now);
+    if (this.tokens < 1) return false;
+
+    this.tokens--;
+    return true;
+  }
+
+  /**
+   * Waits for a token. Callers are served in the order they asked.
+   */
+  async take(): Promise<void> {
+    const previous = this.queue;
+    let release: () => void = () => undefined;
+    this.queue = new Promise<void>(resolve => release = resolve);
+    await previous;
+    try {
+      while (!this.tryTake()) {
+        const waitMs = Math.ceil((1 - this.tokens) * 1000 / this.ratePerSecond);
+        await new Promise(resolve => setTimeout(resolve, waitMs));
+      }
+    } finally {
+      release();
+    }
+  }
+}
@@ -1,9 +1,41 @@
 import type { NextApiRequest, NextApiResponse } from 'next';
-import { FirmwareMongo, getDevice } from '@/lib/server/mongodb';
+import { FirmwareImage, FirmwareMongo, getDevice } from '@/lib/server/mongodb';
 import Utils from '@/lib/server/utils';
 
+// A delta is only worth applying if it saves a good part of the download.
+const MAX_DELTA_RATIO = 0.7;
+
+export const config = {
+  api: {
+    responseLimit: false,
+  }
+}
+
+/**
+ * Parses a single "bytes=start-end" range. Devices only ever ask for "bytes=start-" to resume.
+ * @returns the inclusive range, undefined to send everything, or null if it can't be satisfied
+ */
+function parseRange(header: string|undefined, length: number): { start: number, end: number }|undefined|null {
+  if (!header) return undefined;
+  const match = /^bytes=(\d*)-(\d*)$/.exec(header.trim());
+  if (!match || (match[1] === '' && match[2] === '')) return undefined;
+
+  let start: number;
+  let end: number;
+  if (match[1] === '') {
+    // Suffix range, the last n bytes.
+    start = Math.max(0, length - Number(match[2]));
+    end = length - 1;
+  } else {
+    start = Number(match[1]);
+    end = match[2] === '' ? length - 1 : Math.min(Number(match[2]), length - 1);
+  }
+  return (start > end || start >= length) ? null : { start, end };
+}
+
 export default async function DeviceFirmwareDownload(req: NextApiRequest, res: NextApiResponse) {
   const callsign = Utils.fromMultiValue(req.query.callsign)!;
+  const from = Utils.fromMultiValue(req.query.from);
   const device = await getDevice(callsign);
 
   if (device == null || device.expectedVersion == null) {
@@ -11,14 +43,52 @@ export default async function DeviceFirmwareDownload(req: NextApiRequest, res: N
     return;
   }
 
-  const firmware = await FirmwareMongo.getFirmwareBinary(device.expectedVersion);
-  if (!firmware) {
+  let image: FirmwareImage|undefined = await FirmwareMongo.getFirmwareImage(device.expectedVersion);
+  if (!image) {
     console.log(`Could not get firmware ${device.expectedVersion} from storage`);
     res.status(500).json({message: 'Expected version not found on server'});
     return;
   }
+  let filename = `notify-firmware.${device.expectedVersion}.bin`;
+
+  if (from && from !== device.expectedVersion) {
+    const delta = await FirmwareMongo.getFirmwareDelta(from, device.expectedVersion);
+    if (delta && delta.length < image.length * MAX_DELTA_RATIO) {
+      image = delta;
+      filename = `notify-firmware.${from}-${device.expectedVersion}.delta`;
+    }
+  }
+
+  res.setHeader('ETag', image.etag);
+  if (req.headers['if-none-match'] === image.etag) {
+    res.status(304).end();
+    return;
+  }
+
+  // A resume only continues the same content. If it has changed, send the whole thing.
+  const ifRange = req.headers['if-range'];
+  const range = (ifRange && ifRange !== image.etag) ? undefined : parseRange(req.headers.range, image.length);
+  if (range === null) {
+    res.setHeader('Content-Range', `bytes */${image.length}`);
+    res.status(416).end();
+    return;
+  }
 
+  const start = range?.start ?? 0;
+  const end = range?.end ?? image.length - 1;
   res.setHeader('Content-Type', 'application/octet-stream');
-  res.setHeader('Content-Disposition', `attachment; filename=notify-firmware.${device.expectedVersion}.bin`);
-  res.send(firmware.buffer);
-}
\ No newline at end of file
+  res.setHeader('Content-Disposition', `attachment; filename=${filename}`);
+  res.setHeader('Accept-Ranges', 'bytes');
+  res.setHeader('Content-Length', end - start + 1);
+  if (range) {
+    res.setHeader('Content-Range', `bytes ${start}-${end}/${image.length}`);
+    res.status(206);
+  }
+
+  const stream = image.open(start, end + 1);
+  stream.on('error', err => {
+    console.log(`Could not stream firmware ${device.expectedVersion}`, err);
+    res.destroy(err);
+  });
+  stream.pipe(res);
+}
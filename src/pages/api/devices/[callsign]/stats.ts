@@ -0,0 +1,39 @@
+import type { NextApiRequest, NextApiResponse } from 'next';
+import { getAuthFromApiCookies } from '@/lib/server/auth';
+import { DeviceStatsMongo, getDevice } from '@/lib/server/mongodb';
+import Utils from '@/lib/server/utils';
+
+const DEFAULT_WINDOW_MS = 24 * 60 * 60 * 1000;
+
+export default async function DeviceStats(req: NextApiRequest, res: NextApiResponse) {
+  const callsign = Utils.fromMultiValue(req.query.callsign)!;
+
+  const user = await getAuthFromApiCookies(req.cookies);
+  if (!user) {
+    res.status(401).json({message: 'Must authenticate'});
+    return;
+  }
+
+  const device = await getDevice(callsign);
+  if (device == null) {
+    res.status(404).json({message: 'Not found'});
+    return;
+  }
+  if (device.email !== user.email && !user.isAdmin) {
+    res.status(403).json({message: 'Permission denied'});
+    return;
+  }
+
+  const since = Number(Utils.fromMultiValue(req.query.since) ?? (new Date().getTime() - DEFAULT_WINDOW_MS));
+  if (isNaN(since)) {
+    res.status(400).json({message: 'Invalid since'});
+    return;
+  }
+
+  const stats = await DeviceStatsMongo.getDeviceStats(callsign, since, { stripIds: true });
+  const boots = await DeviceStatsMongo.getDeviceBoots(callsign, since, { stripIds: true });
+  res.json({
+    stats,
+    boots,
+  });
+};
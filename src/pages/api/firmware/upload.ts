@@ -1,6 +1,8 @@
 import { getAuthFromApiCookies } from '@/lib/server/auth';
 import { IncomingForm, Fields, Files } from 'formidable';
-import { promises as fs } from 'fs';
+import { createReadStream, promises as fs } from 'fs';
+import { createHash } from 'crypto';
+import { Transform } from 'stream';
 import { NextApiRequest, NextApiResponse } from 'next';
 import { FirmwareMongo } from '@/lib/server/mongodb';
 import Utils from '@/lib/server/utils';
@@ -10,17 +12,55 @@ export const config = {
   }
 }
 
-function findVersion(data: Buffer) {
-  // https://docs.espressif.com/projects/esptool/en/latest/esp32/advanced-topics/firmware-image-format.html
-  // Extended File Header is 16 bytes starting after the 8 byte File Header. Byte 15 of the Extended File Header
-  // (8 + 15) is the "Hash appended" flag.
-  if (data[0x17] !== 0x01) {
-    return undefined;
+const HASH_LEN = 32;
+
+/**
+ * Reads the version from the image's header and tail, without reading the rest of it.
+ * @param filepath the uploaded image
+ * @param length its size in bytes
+ */
+async function findVersion(filepath: string, length: number) {
+  if (length < 0x18 + HASH_LEN) return undefined;
+
+  const file = await fs.open(filepath, 'r');
+  try {
+    // https://docs.espressif.com/projects/esptool/en/latest/esp32/advanced-topics/firmware-image-format.html
+    // Extended File Header is 16 bytes starting after the 8 byte File Header. Byte 15 of the Extended File Header
+    // (8 + 15) is the "Hash appended" flag.
+    const flag = Buffer.alloc(1);
+    await file.read(flag, 0, 1, 0x17);
+    if (flag[0] !== 0x01) {
+      return undefined;
+    }
+
+    // There is a system call on the ESP32 to get the hash of the currently running partition that matches the last
+    // 32 bytes of the .bin file.
+    const hash = Buffer.alloc(HASH_LEN);
+    await file.read(hash, 0, HASH_LEN, length - HASH_LEN);
+    return hash.toString('hex');
+  } finally {
+    await file.close();
   }
+}
 
-  // There is a system call on the ESP32 to get the hash of the currently running partition that matches the last
-  // 32 bytes of the .bin file.
-  return data.subarray(-32).toString('hex');
+/**
+ * Passes the image through, and fails at the end if the appended hash isn't the SHA-256 of everything before it,
+ * so a truncated or corrupted upload is never stored.
+ */
+function verifyAppendedHash(version: string, length: number) {
+  const hash = createHash('sha256');
+  let seen = 0;
+  return new Transform({
+    transform(chunk: Buffer, encoding, callback) {
+      const body = Math.max(0, Math.min(chunk.length, length - HASH_LEN - seen));
+      hash.update(chunk.subarray(0, body));
+      seen += chunk.length;
+      callback(null, chunk);
+    },
+    flush(callback) {
+      callback(hash.digest('hex') === version ? null : new Error('Image does not match its appended hash'));
+    },
+  });
 }
 
 export default async function FirmwareUploadHandler(req: NextApiRequest, res: NextApiResponse) {
@@ -44,26 +84,29 @@ export default async function FirmwareUploadHandler(req: NextApiRequest, res: Ne
 
   const fileInfo = Array.isArray(formData.files['file']) ? formData.files['file'][0] : formData.files['file'];
 
-  const data = await fs.readFile(fileInfo.filepath);
-  const version = findVersion(data);
-
-  if (!version) {
-    res.status(400).json({message: 'Cant find version in file'});
-    return;
-  }
-  const existing = (await FirmwareMongo.getFirmwareVersions()).includes(version);
-  if (existing) {
-    res.status(400).json({message: 'Version has already been uploaded'});
-    return;
-  }
+  try {
+    const version = await findVersion(fileInfo.filepath, fileInfo.size);
+    if (!version) {
+      res.status(400).json({message: 'Cant find version in file'});
+      return;
+    }
 
-  await FirmwareMongo.putFirmware({
-    description: Utils.fromMultiValue(formData.fields['description']) ?? '',
-    version,
-    file: data,
-    uploaded: new Date().getTime(),
-    creator: user.email,
-  });
+    const file = createReadStream(fileInfo.filepath);
+    const data = file.pipe(verifyAppendedHash(version, fileInfo.size));
+    file.on('error', err => data.destroy(err));
+    const added = await FirmwareMongo.putFirmware({
+      description: Utils.fromMultiValue(formData.fields['description']) ?? '',
+      version,
+      uploaded: new Date().getTime(),
+      creator: user.email,
+    }, data, fileInfo.size);
+    if (!added) {
+      res.status(400).json({message: 'Version has already been uploaded'});
+      return;
+    }
 
-  res.json({ ok: true });
+    res.json({ ok: true });
+  } finally {
+    await fs.unlink(fileInfo.filepath).catch(() => undefined);
+  }
 }
\ No newline at end of file
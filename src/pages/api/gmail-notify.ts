@@ -6,6 +6,6 @@ export default async function GMailNotify(req: NextApiRequest, res: NextApiRespo
   const notification = JSON.parse(Buffer.from(req.body.message.data, 'base64').toString());
 
   // fire and forget
-  gmail.notify(notification);
+  gmail.notify(notification).catch(err => console.log(`Could not handle push for ${notification.emailAddress}`, err));
   res.json({ status: 'ok' });
 }